@@ -22,6 +22,7 @@
 #include <iomanip>
 #include <fstream>
 #include <cmath>
+#include <climits>
 #include <string>
 #include <vector>
 #include <set>
@@ -39,7 +40,6 @@
 #include <gsl/gsl_heapsort.h>
 #include <gsl/gsl_errno.h>
 #include <gsl/gsl_math.h>
-#include <gsl/gsl_roots.h>
 
 
 ///\name Include for NBodyFramework library.
@@ -231,6 +231,25 @@ using namespace NBody;
 #define CALCQUANTITYAPERTUREAVERAGE -2
 typedef double (*ExtraPropFunc)(double, double, double&);
 
+/*! \struct ExtraPropPlan
+    \brief Extra property calculations of a particle type resolved once from the configuration name lists into slots.
+
+    Slots are ordered as internal properties, chemistry and then chemistry production so running values
+    can be held in flat vectors indexed by slot rather than in maps keyed by field name.
+*/
+struct ExtraPropPlan {
+    ///number of internal property and chemistry slots, remaining slots are chemistry production
+    int ninternal=0, nchem=0;
+    ///input field name, output field name and calculation type of each slot
+    vector<string> fields, outnames;
+    vector<int> functions;
+    ///slot a multistage calculation is paired with, itself if not paired
+    vector<int> paired;
+    ///accumulation function of each slot, not set for aperture calculations
+    vector<ExtraPropFunc> funcs;
+    int size() const {return fields.size();}
+};
+
 //@}
 
 /// \name For Unbinding
@@ -260,6 +279,21 @@ typedef double (*ExtraPropFunc)(double, double, double&);
 ///use minimum potential particle to calculat properties
 #define PROPREFMINPOT 2
 
+///\name bulk property calculations that can be skipped if none of the fields they produce are output
+//@{
+///spherical overdensity masses and radii of subhaloes and exclusive masses of field haloes
+#define PROPKERNELSO 1
+///rotational support (kappa) about the angular momentum axis
+#define PROPKERNELROTATION 2
+///quantities within the radius of maximum circular velocity
+#define PROPKERNELRVMAX 4
+///shapes from the inertia tensor
+#define PROPKERNELMORPHOLOGY 8
+///NFW concentrations
+#define PROPKERNELCONCENTRATION 16
+#define PROPKERNELALL 31
+//@}
+
 //@}
 
 /// \name For Tree potential calculation
@@ -289,6 +323,21 @@ typedef double (*ExtraPropFunc)(double, double, double&);
 #define NFWMAXRHALFRATIO 0.60668
 #define NFWMINRHALFRATIO 0.05
 #define NFWMINVMAXVVIRRATIO 36.0
+/// number of log spaced concentrations at which NFW relations are tabulated, and range of concentrations tabulated
+/// for the Vmax/Vvir relation, starting where it is minimal, and the half mass radius relation
+#define NFWTABLENUM 512
+#define NFWVMAXCMIN 2.1626
+#define NFWVMAXCMAX 5000.0
+#define NFWRHALFCMIN 0.6
+#define NFWRHALFCMAX 10000.0
+/// number of Newton iterations refining concentrations interpolated from the tables
+#define NFWNEWTONITER 3
+/// average number of particles per radial shell used to bin spherical overdensity search candidates
+#define SOSHELLPARTNUM 32
+/// maximum number of radial shells used to bin spherical overdensity search candidates
+#define SOSHELLMAXNUM 4096
+/// number of spatially adjacent haloes handed to a thread at once in the spherical overdensity search
+#define SOHALOBATCHNUM 4
 //@}
 
 
@@ -299,6 +348,12 @@ typedef double (*ExtraPropFunc)(double, double, double&);
 #define HALOIDSNVAL 1000000
 #endif
 
+/// \defgroup MPIMESHCURVETYPES Space filling curve used to order top-level cells in the mpi mesh decomposition
+//@{
+#define MPIMESHCURVEZ 0
+#define MPIMESHCURVEHILBERT 1
+//@}
+
 ///\defgroup radial profile parameters
 //@{
 #define PROFILERNORMPHYS 0
@@ -389,13 +444,25 @@ struct PropInfo
 {
     //interate till this much mass in contained in a spherical region to calculate cm quantities
     Double_t cmfrac,cmadjustfac;
+    ///fraction of the current radius the centre can move before particles are re-sorted by distance when iterating the cm
+    Double_t cmresorttol;
 
     PropInfo(){
         cmfrac=0.1;
         cmadjustfac=0.7;
+        cmresorttol=0.1;
     }
 };
 
+/// Packed key used to order the particles of a group radially, see \ref SortParticlesByRadius
+struct RadialKey
+{
+    ///bits of the radius squared, which order as the radius does
+    unsigned long long key;
+    ///index of the particle
+    Int_t index;
+};
+
 /* Structure to hold the location of a top-level cell. */
 struct cell_loc {
 
@@ -425,6 +492,10 @@ struct Options
     int nsnapread;
     ///for output, specify the formats, ie. many separate files
     int iseparatefiles;
+    ///write group output with a separate thread while later groups are processed
+    int iasyncoutput;
+    ///maximum number of group outputs waiting to be written
+    int asyncoutputmaxqueued;
     ///for output specify the format HDF, binary or ascii \ref OUTHDF, \ref OUTBINARY, \ref OUTASCII
     int ibinaryout;
     ///for extended output allowing extraction of particles
@@ -439,6 +510,10 @@ struct Options
     int iextrabhoutput;
     /// calculate and output extra interloper fields
     int iextrainterloperoutput;
+    ///names of the property fields to output, if empty all fields are calculated
+    vector<string> output_field_names;
+    ///bulk property calculations needed for the requested fields, see \ref PROPKERNELALL
+    unsigned int propertykernels;
     /// calculate subind like properties
     int isubfindproperties;
     ///for output, produce subfind like format
@@ -455,6 +530,20 @@ struct Options
     int icosmologicalin;
     /// input buffer size when reading data
     long long inputbufsize;
+    ///if set, star formation rates, metallicities and extra chemistry/internal property fields of hydro inputs
+    ///are only loaded for particles in groups once the search is finished
+    int ilazyextrafields;
+    ///if set, SWIFT HDF input is read using the top-level cell meta data so that each mpi task only reads
+    ///the cells overlapping its domain (and \ref inputregion if given)
+    int iswiftcellread;
+    ///fraction of a SWIFT top-level cell by which cells are expanded when checking overlaps, as particles drift out of
+    ///their cell between rebuilds
+    Double_t swiftcellbuffer;
+    ///region of interest in input units (xmin,ymin,zmin,xmax,ymax,zmax), only SWIFT cells overlapping it are read
+    vector<Double_t> inputregion;
+    ///if set, the number of particles of each type in each mesh cell is stored in an index file next to the snapshot
+    ///and reused by later runs on the same snapshot instead of reading all positions to decompose the domain
+    int isnapshotindex;
     /// mpi paritcle buffer size when sending input particle information
     long long mpiparticletotbufsize,mpiparticlebufsize;
     /// mpi factor by which to multiple the memory allocated, ie: buffer region
@@ -697,6 +786,12 @@ struct Options
     /// minimum number of top-level cells
     int minnumcellperdim;
 
+    /// user requested number of top-level cells per dimension, if <=0 then determined from number of particles and mpi tasks
+    int mpimeshnumcellsperdim;
+
+    /// space filling curve used to order top-level cells, \ref MPIMESHCURVEZ or \ref MPIMESHCURVEHILBERT
+    int mpimeshcurvetype;
+
     /* Locations of top-level cells. */
     cell_loc *cellloc;
 
@@ -715,6 +810,21 @@ struct Options
     /// holds the number of particles in a given top-level cell
     vector<unsigned long long> cellnodenumparts;
 
+    /// groups with at least this many particles are assigned to mpi tasks largest first to balance the load
+    /// prior to being localized to a single task, ignored if <=0. Each group is still hosted whole by one task
+    Int_t mpilargegroupsize;
+    /// if set, the first level of substructure of these groups is searched across the mpi tasks holding their particles
+    int impilargegroupsearch;
+
+    /// if set, the counting pass before reading samples positions and particles are read in a single pass
+    /// into local arrays that grow as needed
+    int impisinglepassread;
+    /// fraction of positions read (1/stride) when sampling the number of particles in each mpi domain
+    int mpisinglepasssamplestride;
+    /// maximum number of mpi tasks reading a single file with parallel hdf5, typically the file system stripe count.
+    /// ignored if <=0
+    int mpinumreadtasksperfile;
+
     /// allowed mesh based mpi decomposition load imbalance
     float mpimeshimbalancelimit;
 
@@ -738,6 +848,10 @@ struct Options
     string profileradnormstring;
     vector<Double_t> profile_bin_edges;
     Int_t profileminsize, profileminFOFsize;
+    ///if log bin edges are evenly spaced, the first edge and inverse spacing in log10
+    ///so radial bins can be calculated directly rather than searched
+    int iprofilelogbinuniform;
+    Double_t profilelogedgemin, profileilogbinwidth;
     //@}
 
     /// \name options related to calculation of arbitrary overdensities masses, radii, angular momentum
@@ -916,6 +1030,10 @@ struct Options
     vector<string> bh_chemproduction_output_names_aperture;
     vector<string> extra_dm_internalprop_output_names_aperture;
 
+    ///extra property calculations resolved into slots, set in \ref SetExtraPropPlans
+    ExtraPropPlan gas_extraprop_plan, star_extraprop_plan, bh_extraprop_plan, extra_dm_extraprop_plan;
+    ExtraPropPlan gas_extraprop_aperture_plan, star_extraprop_aperture_plan, bh_extraprop_aperture_plan, extra_dm_extraprop_aperture_plan;
+
     //to store the unique names that are going to be loaded from the input
     vector<string> gas_internalprop_unique_input_names;
     vector<string> gas_chem_unique_input_names;
@@ -1068,6 +1186,8 @@ struct Options
         iverbose=0;
         iwritefof=0;
         iseparatefiles=0;
+        iasyncoutput=0;
+        asyncoutputmaxqueued=2;
         ibinaryout=0;
         iextendedoutput=0;
         isubfindoutput=0;
@@ -1079,6 +1199,7 @@ struct Options
         iextragasoutput=0;
         iextrastaroutput=0;
         iextrainterloperoutput=0;
+        propertykernels=PROPKERNELALL;
         isubfindproperties=0;
 
         iusedmparticles=1;
@@ -1102,6 +1223,10 @@ struct Options
         iScaleLengths=0;
 
         inputbufsize=1000000;
+        ilazyextrafields=0;
+        iswiftcellread=0;
+        swiftcellbuffer=0.2;
+        isnapshotindex=0;
 
         mpiparticletotbufsize=-1;
         mpiparticlebufsize=-1;
@@ -1113,6 +1238,13 @@ struct Options
         mpimeshimbalancelimit = 0.1;
         minnumcellperdim = 8;
 #endif
+        mpimeshnumcellsperdim = -1;
+        mpimeshcurvetype = MPIMESHCURVEZ;
+        mpilargegroupsize = -1;
+        impilargegroupsearch = 0;
+        impisinglepassread = 0;
+        mpisinglepasssamplestride = 100;
+        mpinumreadtasksperfile = 0;
         cellnodeids = NULL;
 
         lengthtokpc=-1.0;
@@ -1148,6 +1280,8 @@ struct Options
         iprofilecumulative=0;
         profilenbins=0;
         profileminsize = profileminFOFsize = 0;
+        iprofilelogbinuniform=0;
+        profilelogedgemin=profileilogbinwidth=0;
 #ifdef USEOPENMP
         iopenmpfof = 1;
         openmpfofsize = ompfofsearchnum;
@@ -1,4 +1,6 @@
 ///Math code
+#include <cstdint>
+#include <cstddef>
 #include <NBodyMath.h>
 using namespace Math;
 
@@ -291,6 +293,52 @@ inline void InitEndian( void )
   }
 }
 
+//The single value routines above are fine for headers but are called through a function pointer for every value.
+//For large blocks of data, such as particle records, swap the bytes of the whole block in place with simple shifts,
+//which the compiler can vectorise, and split the block between threads if it is large.
+
+///number of values above which byte swapping of a block is split between threads
+#define ENDIANOMPNUM 100000
+
+///reverse the bytes of n 4 byte values in place
+inline void ByteSwap4Array(void *data, size_t n)
+{
+  uint32_t *d = (uint32_t *)data;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (n>ENDIANOMPNUM)
+#endif
+  for (size_t i = 0; i < n; i++)
+  {
+     uint32_t x = d[i];
+     d[i] = (x >> 24) | ((x >> 8) & 0x0000FF00u) | ((x << 8) & 0x00FF0000u) | (x << 24);
+  }
+}
+
+///reverse the bytes of n 8 byte values in place
+inline void ByteSwap8Array(void *data, size_t n)
+{
+  uint64_t *d = (uint64_t *)data;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (n>ENDIANOMPNUM)
+#endif
+  for (size_t i = 0; i < n; i++)
+  {
+     uint64_t x = d[i];
+     x = ((x >> 8) & 0x00FF00FF00FF00FFull) | ((x & 0x00FF00FF00FF00FFull) << 8);
+     x = ((x >> 16) & 0x0000FFFF0000FFFFull) | ((x & 0x0000FFFF0000FFFFull) << 16);
+     d[i] = (x >> 32) | (x << 32);
+  }
+}
+
+///convert a block of n 4 byte big endian values (ints, floats) to the endian of the system
+inline void BigEndian4Array(void *data, size_t n){if (!BigEndianSystem) ByteSwap4Array(data, n);}
+///convert a block of n 8 byte big endian values (long ints, doubles) to the endian of the system
+inline void BigEndian8Array(void *data, size_t n){if (!BigEndianSystem) ByteSwap8Array(data, n);}
+///convert a block of n 4 byte little endian values to the endian of the system
+inline void LittleEndian4Array(void *data, size_t n){if (BigEndianSystem) ByteSwap4Array(data, n);}
+///convert a block of n 8 byte little endian values to the endian of the system
+inline void LittleEndian8Array(void *data, size_t n){if (BigEndianSystem) ByteSwap8Array(data, n);}
+
 //now with this code, I can alter how structures are read and make it endian independent.
 
 #endif
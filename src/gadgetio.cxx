@@ -9,6 +9,144 @@
 #include "gadgetitems.h"
 #include "endianutils.h"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+///map a gadget file into memory, leaving gmap.data NULL if this is not possible
+inline void GadgetMapFile(const char *fname, gadget_mapped_file &gmap)
+{
+    struct stat sb;
+    gmap.fd=open(fname,O_RDONLY);
+    if (gmap.fd<0) return;
+    if (fstat(gmap.fd,&sb)!=0 || sb.st_size==0) {close(gmap.fd);gmap.fd=-1;return;}
+    gmap.size=sb.st_size;
+    void *addr=mmap(NULL,gmap.size,PROT_READ,MAP_PRIVATE,gmap.fd,0);
+    if (addr==MAP_FAILED) {close(gmap.fd);gmap.fd=-1;gmap.size=0;return;}
+    madvise(addr,gmap.size,MADV_SEQUENTIAL);
+    gmap.data=(char*)addr;
+}
+
+inline void GadgetUnmapFile(gadget_mapped_file &gmap)
+{
+    if (gmap.data!=NULL) munmap(gmap.data,gmap.size);
+    if (gmap.fd>=0) close(gmap.fd);
+    gmap=gadget_mapped_file();
+}
+
+///returns a pointer to the next nbytes of the file, from the memory map if present, otherwise read in one call into blockbuf.
+///the stream is left positioned after the block.
+inline const char *GadgetGetBlock(gadget_mapped_file &gmap, fstream &F, size_t nbytes, vector<char> &blockbuf)
+{
+    const char *block;
+    if (gmap.data!=NULL && (size_t)F.tellg()+nbytes<=gmap.size) {
+        block=gmap.data+(size_t)F.tellg();
+        F.seekg(nbytes,ios::cur);
+    }
+    else {
+        blockbuf.resize(nbytes);
+        F.read(blockbuf.data(),nbytes);
+        block=blockbuf.data();
+    }
+    return block;
+}
+
+///where particles of gadget type k are stored given the search type: 0 not stored, 1 Part, 2 Pbaryons.
+///includebh sets whether black holes are stored with the baryons when searching dark matter only.
+inline int GadgetTypeDestination(Options &opt, int k, bool includebh)
+{
+    if (opt.partsearchtype==PSTALL) return 1;
+    else if (opt.partsearchtype==PSTDARK) {
+        if (!(k==GGASTYPE||k==GSTARTYPE||k==GBHTYPE)) return 1;
+        if (opt.iBaryonSearch==1 && (k==GGASTYPE||k==GSTARTYPE||(includebh&&k==GBHTYPE))) return 2;
+        return 0;
+    }
+    else if (opt.partsearchtype==PSTSTAR) return (k==GSTARTYPE);
+    else if (opt.partsearchtype==PSTGAS) return (k==GGASTYPE);
+    return 0;
+}
+
+///decode a position (ivel=0) or velocity (ivel=1) block of a file, storing values in Part or Pbaryons and updating the counts
+inline void GadgetDecodeVectorBlock(Options &opt, const char *block, gadget_header &header,
+    vector<Particle> &Part, Particle *Pbaryons, Int_t &count, Int_t &bcount, int ivel)
+{
+    Int_t offset=0;
+    for (int k=0;k<NGTYPE;k++) {
+        Int_t np=header.npart[k];
+        int idest=GadgetTypeDestination(opt,k,false);
+        if (idest>0 && np>0) {
+            Particle *P=(idest==1)?&Part[count]:&Pbaryons[bcount];
+            const char *src=block+offset*3*sizeof(FLOAT);
+#ifdef USEOPENMP
+            #pragma omp parallel for default(shared) schedule(static) if (np>ompreadnum)
+#endif
+            for (Int_t n=0;n<np;n++) {
+                FLOAT x[3];
+                memcpy(x,src+n*3*sizeof(FLOAT),3*sizeof(FLOAT));
+                if (BigEndianSystem) for (int m=0;m<3;m++) x[m]=LittleFLOAT(x[m]);
+                if (ivel) P[n].SetVelocity(x[0],x[1],x[2]);
+                else P[n].SetPosition(x[0],x[1],x[2]);
+            }
+            if (idest==1) count+=np;
+            else bcount+=np;
+        }
+        offset+=np;
+    }
+}
+
+///decode an id block of a file, setting the pid, index and type of the stored particles and updating the counts
+inline void GadgetDecodeIDBlock(Options &opt, const char *block, gadget_header &header,
+    vector<Particle> &Part, Particle *Pbaryons, Int_t &count, Int_t &bcount, const Int_t nbodies, const int ifile)
+{
+    Int_t offset=0;
+    for (int k=0;k<NGTYPE;k++) {
+        Int_t np=header.npart[k];
+        int idest=GadgetTypeDestination(opt,k,true);
+        if (idest>0 && np>0) {
+            Particle *P=(idest==1)?&Part[count]:&Pbaryons[bcount];
+            Int_t idoffset=(idest==1)?count:bcount+nbodies;
+            int itype;
+            if (idest==2) itype=STARTYPE*(k==GSTARTYPE)+GASTYPE*(k==GGASTYPE)+BHTYPE*(k==GBHTYPE);
+            else if (opt.partsearchtype==PSTALL) {
+                itype=k;
+#ifdef HIGHRES
+                if (!(k==GGASTYPE || k==GSTARTYPE || k==GBHTYPE)) itype=DARKTYPE;
+#endif
+            }
+            else if (opt.partsearchtype==PSTDARK) itype=DARKTYPE;
+            else if (opt.partsearchtype==PSTSTAR) itype=STARTYPE;
+            else itype=GASTYPE;
+            const char *src=block+offset*sizeof(GADGETIDTYPE);
+#ifdef USEOPENMP
+            #pragma omp parallel for default(shared) schedule(static) if (np>ompreadnum)
+#endif
+            for (Int_t n=0;n<np;n++) {
+                GADGETIDTYPE idval;
+                memcpy(&idval,src+n*sizeof(GADGETIDTYPE),sizeof(GADGETIDTYPE));
+#ifdef GADGETLONGID
+                if (BigEndianSystem) idval=LittleLongInt(idval);
+#else
+                if (BigEndianSystem) idval=LittleInt(idval);
+#endif
+                P[n].SetPID(idval);
+                P[n].SetID(idoffset+n);
+                P[n].SetType(itype);
+#ifdef EXTRAINPUTINFO
+                if (opt.iextendedoutput)
+                {
+                    P[n].SetInputFileID(ifile);
+                    P[n].SetInputIndexInFile(n);
+                }
+#endif
+            }
+            if (idest==1) count+=np;
+            else bcount+=np;
+        }
+        offset+=np;
+    }
+}
+
 ///reads a gadget file. If cosmological simulation uses cosmology (generally assuming LCDM or small deviations from this) to estimate the mean interparticle spacing
 ///and scales physical linking length passed by this distance. Also reads header and over rides passed cosmological parameters with ones stored in header.
 void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle *&Pbaryons, Int_t nbaryons)
@@ -28,6 +166,11 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
 
     fstream *Fgad;
     struct gadget_header *header;
+#ifndef USEMPI
+    gadget_mapped_file gmap;
+    vector<char> blockbuf;
+    const char *block;
+#endif
     Double_t mscale,lscale,lvscale;
     Double_t MP_DM=MAXVALUE,LN,N_DM,MP_B=MAXVALUE;
     int ifirstfile=0,*ireadfile,*ireadtask,*readtaskID;
@@ -237,6 +380,10 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
     //now read and store data appropriately
     for(i=0,count=0,bcount=0,pc=0;i<opt.num_files; i++,pc=pc_new,count=count2,bcount=bcount2)
     {
+        //positions, velocities and ids are decoded directly from the mapped file
+        if(opt.num_files>1) sprintf(buf,"%s.%lld",opt.fname,i);
+        else sprintf(buf,"%s",opt.fname);
+        GadgetMapFile(buf,gmap);
 #ifdef GADGET2FORMAT
         SKIP2;
         Fgad[i].read((char*)&DATA[0],sizeof(char)*4);DATA[4] = '\0';
@@ -252,42 +399,9 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
         //and read positions, velocities, ids, masses, etc
         SKIP2;
         if (dummy/Ntotfile/3!=sizeof(FLOAT)) {cout<<" mismatch in position type size, file has "<<dummy/Ntotfile/3<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
-        for(k=0,count2=count,bcount2=bcount,pc_new=pc;k<NGTYPE;k++)
-        {
-            for(n=0;n<header[i].npart[k];n++)
-            {
-                Fgad[i].read((char*)&ctemp[0], sizeof(FLOAT)*3);
-                if (opt.partsearchtype==PSTALL) {
-                    for (Int_t m=0;m<3;m++) Part[count2].SetPosition(m,LittleFLOAT(ctemp[m]));
-                    count2++;
-                }
-                else if (opt.partsearchtype==PSTDARK) {
-                    if (!(k==GGASTYPE||k==GSTARTYPE||k==GBHTYPE)) {
-                        for (Int_t m=0;m<3;m++) Part[count2].SetPosition(m,LittleFLOAT(ctemp[m]));
-                        count2++;
-                    }
-                    else {
-                        if (opt.iBaryonSearch==1 && (k==GGASTYPE || k==GSTARTYPE)) {
-                            for (Int_t m=0;m<3;m++) Pbaryons[bcount2].SetPosition(m,LittleFLOAT(ctemp[m]));
-                            bcount2++;
-                        }
-                    }
-                }
-                else if (opt.partsearchtype==PSTSTAR) {
-                    if (k==GSTARTYPE) {
-                        for (Int_t m=0;m<3;m++) Part[count2].SetPosition(m,LittleFLOAT(ctemp[m]));
-                        count2++;
-                    }
-                }
-                else if (opt.partsearchtype==PSTGAS) {
-                    if (k==GGASTYPE) {
-                        for (Int_t m=0;m<3;m++) Part[count2].SetPosition(m,LittleFLOAT(ctemp[m]));
-                        count2++;
-                    }
-                }
-                pc_new++;
-            }
-        }
+        block=GadgetGetBlock(gmap,Fgad[i],dummy,blockbuf);
+        count2=count;bcount2=bcount;pc_new=pc+Ntotfile;
+        GadgetDecodeVectorBlock(opt,block,header[i],Part,Pbaryons,count2,bcount2,0);
         SKIP2;
 #ifdef GADGET2FORMAT
         SKIP2;
@@ -298,42 +412,9 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
 #endif
         SKIP2;
         if (dummy/Ntotfile/3!=sizeof(FLOAT)) {cout<<" mismatch in velocity type size, file has "<<dummy/Ntotfile/3<<" but using "<<sizeof(FLOAT)<<endl;exit(9);}
-        for(k=0,count2=count,bcount2=bcount,pc_new=pc;k<NGTYPE;k++)
-        {
-            for(n=0;n<header[i].npart[k];n++)
-            {
-                Fgad[i].read((char*)&ctemp[0], sizeof(FLOAT)*3);
-                if (opt.partsearchtype==PSTALL) {
-                    for (Int_t m=0;m<3;m++) Part[count2].SetVelocity(m,LittleFLOAT(ctemp[m]));
-                    count2++;
-                }
-                else if (opt.partsearchtype==PSTDARK) {
-                    if (!(k==GGASTYPE||k==GSTARTYPE||k==GBHTYPE)) {
-                        for (Int_t m=0;m<3;m++) Part[count2].SetVelocity(m,LittleFLOAT(ctemp[m]));
-                        count2++;
-                    }
-                    else {
-                        if (opt.iBaryonSearch==1 && (k==GGASTYPE || k==GSTARTYPE)) {
-                            for (Int_t m=0;m<3;m++) Pbaryons[bcount2].SetVelocity(m,LittleFLOAT(ctemp[m]));
-                            bcount2++;
-                        }
-                    }
-                }
-                else if (opt.partsearchtype==PSTSTAR) {
-                    if (k==GSTARTYPE) {
-                        for (Int_t m=0;m<3;m++) Part[count2].SetVelocity(m,LittleFLOAT(ctemp[m]));
-                        count2++;
-                    }
-                }
-                else if (opt.partsearchtype==PSTGAS) {
-                    if (k==GGASTYPE) {
-                        for (Int_t m=0;m<3;m++) Part[count2].SetVelocity(m,LittleFLOAT(ctemp[m]));
-                        count2++;
-                    }
-                }
-                pc_new++;
-            }
-        }
+        block=GadgetGetBlock(gmap,Fgad[i],dummy,blockbuf);
+        count2=count;bcount2=bcount;pc_new=pc+Ntotfile;
+        GadgetDecodeVectorBlock(opt,block,header[i],Part,Pbaryons,count2,bcount2,1);
         SKIP2;
 #ifdef GADGET2FORMAT
         SKIP2;
@@ -344,96 +425,9 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
 #endif
         SKIP2;
         if (dummy/Ntotfile!=sizeof(idval)) {cout<<" mismatch in ID type size, file has "<<dummy/Ntotfile<<" but using "<<sizeof(idval)<<endl;exit(9);}
-        for(k=0,count2=count,bcount2=bcount,pc_new=pc;k<NGTYPE;k++)
-        {
-            for(n=0;n<header[i].npart[k];n++) {
-                Fgad[i].read((char*)&idval, sizeof(idval));
-#ifdef GADGETLONGID
-                idval=LittleLongInt(idval);
-#else
-                idval=LittleInt(idval);
-#endif
-                if (opt.partsearchtype==PSTALL) {
-                    Part[count2].SetPID(idval);
-                    Part[count2].SetID(count2);
-#ifdef HIGHRES
-                    if (!(k==GGASTYPE || k==GSTARTYPE || k==GBHTYPE)) Part[count2].SetType(DARKTYPE);
-                    else Part[count2].SetType(k);
-#else
-                    Part[count2].SetType(k);
-#endif
-#ifdef EXTRAINPUTINFO
-                    if (opt.iextendedoutput)
-                    {
-                        Part[count2].SetInputFileID(i);
-                        Part[count2].SetInputIndexInFile(n);
-                    }
-#endif
-                    count2++;
-                }
-                else if (opt.partsearchtype==PSTDARK) {
-                    if (!(k==GGASTYPE||k==GSTARTYPE||k==GBHTYPE)) {
-                        Part[count2].SetPID(idval);
-                        Part[count2].SetID(count2);
-                        Part[count2].SetType(DARKTYPE);
-#ifdef EXTRAINPUTINFO
-                        if (opt.iextendedoutput)
-                        {
-                            Part[count2].SetInputFileID(i);
-                            Part[count2].SetInputIndexInFile(n);
-                        }
-#endif
-                        count2++;
-                    }
-                    else {
-                        if (opt.iBaryonSearch==1 && (k==GGASTYPE || k==GSTARTYPE || k==GBHTYPE)) {
-                            Pbaryons[bcount2].SetPID(idval);
-                            Pbaryons[bcount2].SetID(bcount2+nbodies);
-                            Pbaryons[bcount2].SetType(STARTYPE*(k==GSTARTYPE)+GASTYPE*(k==GGASTYPE)+BHTYPE*(k==GBHTYPE));
-#ifdef EXTRAINPUTINFO
-                            if (opt.iextendedoutput)
-                            {
-                                Pbaryons[bcount2].SetInputFileID(i);
-                                Pbaryons[bcount2].SetInputIndexInFile(n);
-                            }
-#endif
-                            bcount2++;
-                        }
-                    }
-                }
-                else if (opt.partsearchtype==PSTSTAR) {
-                    if (k==GSTARTYPE) {
-                        Part[count2].SetPID(idval);
-                        Part[count2].SetID(count2);
-                        Part[count2].SetType(STARTYPE);
-#ifdef EXTRAINPUTINFO
-                        if (opt.iextendedoutput)
-                        {
-                            Part[count2].SetInputFileID(i);
-                            Part[count2].SetInputIndexInFile(n);
-                        }
-#endif
-                        count2++;
-                    }
-                }
-                else if (opt.partsearchtype==PSTGAS) {
-                    if (k==GGASTYPE) {
-                        Part[count2].SetPID(idval);
-                        Part[count2].SetID(count2);
-                        Part[count2].SetType(GASTYPE);
-#ifdef EXTRAINPUTINFO
-                        if (opt.iextendedoutput)
-                        {
-                            Part[count2].SetInputFileID(i);
-                            Part[count2].SetInputIndexInFile(n);
-                        }
-#endif
-                        count2++;
-                    }
-                }
-                pc_new++;
-            }
-        }
+        block=GadgetGetBlock(gmap,Fgad[i],dummy,blockbuf);
+        count2=count;bcount2=bcount;pc_new=pc+Ntotfile;
+        GadgetDecodeIDBlock(opt,block,header[i],Part,Pbaryons,count2,bcount2,nbodies,i);
         SKIP2;
 #ifdef GADGET2FORMAT
         SKIP2;
@@ -764,8 +758,12 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
 #endif
 
         Fgad[i].close();
+        GadgetUnmapFile(gmap);
     }
     //finally adjust to appropriate units
+#ifdef USEOPENMP
+    #pragma omp parallel for default(shared) schedule(static) if (nbodies>ompreadnum)
+#endif
     for (i=0;i<nbodies;i++)
     {
         Part[i].SetMass(Part[i].GetMass()*mscale);
@@ -1327,6 +1325,8 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
             for(ibuf = 0; ibuf < opt.nsnapread; ibuf++) Nreadbuf[ibuf]=0;
         }
     }//end of loop over input files
+    //make sure any full buffers still in flight have been delivered before the final flush
+    MPIWaitParticleSendsFromReadThreads();
     //once finished reading the file if there are any particles left in the buffer broadcast them
     for(ibuf = 0; ibuf < NProcs; ibuf++) if (ireadtask[ibuf]<0)
     {
@@ -1344,6 +1344,7 @@ void ReadGadget(Options &opt, vector<Particle> &Part, const Int_t nbodies,Partic
     if (opt.nsnapread>1){
         MPI_Allgather(Nreadbuf, opt.nsnapread, MPI_Int_t, mpi_nsend_readthread, opt.nsnapread, MPI_Int_t, mpi_comm_read);
         MPISendParticlesBetweenReadThreads(opt, Preadbuf, Part.data(), ireadtask, readtaskID, Pbaryons, mpi_comm_read, mpi_nsend_readthread, mpi_nsend_readthread_baryon);
+        MPIWaitParticleExchangeBetweenReadThreads(Part.data(), Pbaryons);
     }
 #endif
 
@@ -96,6 +96,17 @@ struct gadget_header
     }
 };
 
+/*! Read-only memory map of a gadget snapshot file, used to decode particle blocks directly from the mapped pages.
+    If the map could not be made, data is NULL and blocks are read into a buffer instead.
+*/
+struct gadget_mapped_file
+{
+    int fd;
+    char *data;
+    size_t size;
+    gadget_mapped_file() {fd=-1;data=NULL;size=0;}
+};
+
 struct gadget_particle_data 
 {
   FLOAT  Pos[3];
@@ -806,6 +806,8 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     double *Zdoublebuff=new double[chunksize];
     float *SFRfloatbuff=new float[chunksize];
     double *SFRdoublebuff=new double[chunksize];
+    //if only read for particles in groups later, particles are passed zeros when read
+    if (opt.ilazyextrafields) for (i=0;i<chunksize;i++) Zdoublebuff[i]=SFRdoublebuff[i]=0;
 #endif
 #ifdef STARON
     float *Tagefloatbuff=new float[chunksize];
@@ -838,7 +840,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
         for (int j=0;j<opt.num_files;j++) inreadsend+=ireadfile[j];
         MPI_Allreduce(&inreadsend,&totreadsend,1,MPI_Int_t,MPI_MIN,mpi_comm_read);
 #ifdef USEPARALLELHDF
-        if (opt.nsnapread > opt.num_files) {
+        if (opt.nsnapread > opt.num_files && !opt.iswiftcellread) {
             int ntaskread = ceil(opt.nsnapread/opt.num_files);
             int ifile = floor(ireadtask[ThisTask]/ntaskread);
 	    int ThisReadTask, NProcsReadTask;
@@ -917,7 +919,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
         partsdataspaceall_extra.resize(opt.num_files*numextrafields);
         for (auto &x:partsdatasetall_extra) x=-1;
         for (auto &x:partsdataspaceall_extra) x=-1;
-        extrafieldbuff = new double[numextrafields*chunksize];
+        if (!opt.ilazyextrafields) extrafieldbuff = new double[numextrafields*chunksize];
     }
 #endif
     for(i=0; i<opt.num_files; i++) if(ireadfile[i]) {
@@ -1167,7 +1169,11 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                 if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
                 //setup hyperslab so that it is loaded into the buffer
                 HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 3, nchunk, n);
-                for (int nn=0;nn<nchunk;nn++) Part[count++].SetPosition(doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
+#ifdef USEOPENMP
+                #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
+                for (int nn=0;nn<nchunk;nn++) Part[count+nn].SetPosition(doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
+                count+=nchunk;
               }
             }
             if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
@@ -1215,7 +1221,11 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                 if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
                 //setup hyperslab so that it is loaded into the buffer
                 HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 3, nchunk, n);
-                for (int nn=0;nn<nchunk;nn++) Part[count++].SetVelocity(doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
+#ifdef USEOPENMP
+                #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
+                for (int nn=0;nn<nchunk;nn++) Part[count+nn].SetVelocity(doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
+                count+=nchunk;
               }
             }
             if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
@@ -1229,7 +1239,11 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
                   // //setup hyperslab so that it is loaded into the buffer
                   HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 3, nchunk, n);
-                  for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetVelocity(doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
+#ifdef USEOPENMP
+                  #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
+                  for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount+nn].SetVelocity(doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
+                  bcount+=nchunk;
                 }
               }
             }
@@ -1263,26 +1277,30 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                 //setup hyperslab so that it is loaded into the buffer
                 HDF5ReadHyperSlabInteger(longbuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
 
+#ifdef USEOPENMP
+                #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
                 for (int nn=0;nn<nchunk;nn++) {
-                    Part[count].SetPID(longbuff[nn]);
-                    Part[count].SetID(count);
-                    if (k==HDFGASTYPE) Part[count].SetType(GASTYPE);
-                    else if (k==HDFDMTYPE) Part[count].SetType(DARKTYPE);
+                    Int_t index=count+nn;
+                    Part[index].SetPID(longbuff[nn]);
+                    Part[index].SetID(index);
+                    if (k==HDFGASTYPE) Part[index].SetType(GASTYPE);
+                    else if (k==HDFDMTYPE) Part[index].SetType(DARKTYPE);
 #ifdef HIGHRES
-                    else if (k==HDFDM1TYPE) Part[count].SetType(DARK2TYPE);
-                    else if (k==HDFDM2TYPE) Part[count].SetType(DARK2TYPE);
+                    else if (k==HDFDM1TYPE) Part[index].SetType(DARK2TYPE);
+                    else if (k==HDFDM2TYPE) Part[index].SetType(DARK2TYPE);
 #endif
-                    else if (k==HDFSTARTYPE) Part[count].SetType(STARTYPE);
-                    else if (k==HDFBHTYPE) Part[count].SetType(BHTYPE);
+                    else if (k==HDFSTARTYPE) Part[index].SetType(STARTYPE);
+                    else if (k==HDFBHTYPE) Part[index].SetType(BHTYPE);
 #ifdef EXTRAINPUTINFO
-                    if (opt.iextendedoutput)
+                    if (opt.iextendedoutput || opt.ilazyextrafields)
                     {
-                        Part[count].SetInputFileID(i);
-                        Part[count].SetInputIndexInFile(nn+ninputoffset);
+                        Part[index].SetInputFileID(i);
+                        Part[index].SetInputIndexInFile(nn+ninputoffset);
                     }
 #endif
-                    count++;
                 }
+                count+=nchunk;
                 ninputoffset += nchunk;
               }
             }
@@ -1298,21 +1316,25 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
                   HDF5ReadHyperSlabInteger(longbuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
 
+#ifdef USEOPENMP
+                  #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
                   for (int nn=0;nn<nchunk;nn++) {
-                    Pbaryons[bcount].SetPID(longbuff[nn]);
-                    Pbaryons[bcount].SetID(bcount);
-                    if (k==HDFGASTYPE) Pbaryons[bcount].SetType(GASTYPE);
-                    else if (k==HDFSTARTYPE) Pbaryons[bcount].SetType(STARTYPE);
-                    else if (k==HDFBHTYPE) Pbaryons[bcount].SetType(BHTYPE);
+                    Int_t index=bcount+nn;
+                    Pbaryons[index].SetPID(longbuff[nn]);
+                    Pbaryons[index].SetID(index);
+                    if (k==HDFGASTYPE) Pbaryons[index].SetType(GASTYPE);
+                    else if (k==HDFSTARTYPE) Pbaryons[index].SetType(STARTYPE);
+                    else if (k==HDFBHTYPE) Pbaryons[index].SetType(BHTYPE);
 #ifdef EXTRAINPUTINFO
-                    if (opt.iextendedoutput)
+                    if (opt.iextendedoutput || opt.ilazyextrafields)
                     {
-                        Pbaryons[bcount].SetInputFileID(i);
-                        Pbaryons[bcount].SetInputIndexInFile(nn+ninputoffset);
+                        Pbaryons[index].SetInputFileID(i);
+                        Pbaryons[index].SetInputIndexInFile(nn+ninputoffset);
                     }
 #endif
-                    bcount++;
                   }
+                  bcount+=nchunk;
                   ninputoffset+=nchunk;
                 }
               }
@@ -1354,7 +1376,11 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
 #ifdef NOMASS
                   if (k==HDFDMTYPE) opt.MassValue = doublebuff[0];
 #endif
-                  for (int nn=0;nn<nchunk;nn++) Part[count++].SetMass(doublebuff[nn]);
+#ifdef USEOPENMP
+                  #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
+                  for (int nn=0;nn<nchunk;nn++) Part[count+nn].SetMass(doublebuff[nn]);
+                  count+=nchunk;
                 }
               }
               else {
@@ -1376,7 +1402,11 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                     if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
                     //setup hyperslab so that it is loaded into the buffer
                     HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
-                    for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetMass(doublebuff[nn]);
+#ifdef USEOPENMP
+                    #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
+                    for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount+nn].SetMass(doublebuff[nn]);
+                    bcount+=nchunk;
                   }
                 }
                 else {
@@ -1419,7 +1449,11 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   {
                     if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
                     HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
-                    for (int nn=0;nn<nchunk;nn++) Part[count++].SetU(doublebuff[nn]);
+#ifdef USEOPENMP
+                    #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
+                    for (int nn=0;nn<nchunk;nn++) Part[count+nn].SetU(doublebuff[nn]);
+                    count+=nchunk;
                   }
                 }
                 else {
@@ -1437,7 +1471,11 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                     {
                       if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
                       HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
-                      for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetU(doublebuff[nn]);
+#ifdef USEOPENMP
+                      #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
+                      for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount+nn].SetU(doublebuff[nn]);
+                      bcount+=nchunk;
                     }
                   }
                   else {
@@ -1449,44 +1487,28 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
               for (auto &hidval:partsdataspace) HDF5CloseDataSpace(hidval);
               for (auto &hidval:partsdataset) HDF5CloseDataSet(hidval);
 #ifdef STARON
-              //if star forming get star formation rate
-              for (j=0;j<nusetypes;j++) {
-                k=usetypes[j];
-                if (k==HDFGASTYPE){
-                  if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[6]<<endl;
-                  partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[6]);
-                  partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
-                }
-              }
-              if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
-                k=usetypes[j];
-                if (k==HDFGASTYPE){
-                  partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[6]);
-                  partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
-                }
-              }
-              count=count2;
-              bcount=bcount2;
-              for (j=0;j<nusetypes;j++) {
-                k=usetypes[j];
-                if (k==HDFGASTYPE) {
-                  //data loaded into memory in chunks
-                  if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
-                  else nchunk=chunksize;
-                  for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
-                  {
-                    if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
-                    //setup hyperslab so that it is loaded into the buffer
-                    HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
-                    for (int nn=0;nn<nchunk;nn++) Part[count++].SetSFR(doublebuff[nn] > 0. ? doublebuff[nn] : 0.);
+              //star formation rates and metallicities are only needed for particles in groups, so if lazy loading
+              //they are read once the search is done, see ReadHDFExtraFieldsOfGroupParticles
+              if (!opt.ilazyextrafields) {
+                //if star forming get star formation rate
+                for (j=0;j<nusetypes;j++) {
+                  k=usetypes[j];
+                  if (k==HDFGASTYPE){
+                    if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[6]<<endl;
+                    partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[6]);
+                    partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
                   }
                 }
-                else {
-                  count+=hdf_header_info[i].npart[k];
+                if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
+                  k=usetypes[j];
+                  if (k==HDFGASTYPE){
+                    partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[6]);
+                    partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
+                  }
                 }
-              }
-              if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
-                for (j=1;j<=nbusetypes;j++) {
+                count=count2;
+                bcount=bcount2;
+                for (j=0;j<nusetypes;j++) {
                   k=usetypes[j];
                   if (k==HDFGASTYPE) {
                     //data loaded into memory in chunks
@@ -1497,64 +1519,72 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                       if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
                       //setup hyperslab so that it is loaded into the buffer
                       HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
-                      for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetU(doublebuff[nn]);
+#ifdef USEOPENMP
+                      #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
+                      for (int nn=0;nn<nchunk;nn++) Part[count+nn].SetSFR(doublebuff[nn] > 0. ? doublebuff[nn] : 0.);
+                      count+=nchunk;
                     }
                   }
                   else {
                     count+=hdf_header_info[i].npart[k];
                   }
                 }
-              }
-              //close data spaces
-              for (auto &hidval:partsdataspace) HDF5CloseDataSpace(hidval);
-              for (auto &hidval:partsdataset) HDF5CloseDataSet(hidval);
-              //then metallicity
-              for (j=0;j<nusetypes;j++) {
-                k=usetypes[j];
-                if (k==HDFGASTYPE){
-                  if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]<<endl;
-                  partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]);
-                  partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
-                }
-                if (k==HDFSTARTYPE){
-                  if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]<<endl;
-                  partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]);
-                  partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
-                }
-              }
-              if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
-                k=usetypes[j];
-                if (k==HDFGASTYPE){
-                  partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]);
-                  partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
-                }
-                if (k==HDFSTARTYPE){
-                  partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]);
-                  partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
+                if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
+                  for (j=1;j<=nbusetypes;j++) {
+                    k=usetypes[j];
+                    if (k==HDFGASTYPE) {
+                      //data loaded into memory in chunks
+                      if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
+                      else nchunk=chunksize;
+                      for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
+                      {
+                        if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
+                        //setup hyperslab so that it is loaded into the buffer
+                        HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
+#ifdef USEOPENMP
+                        #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
+                        for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount+nn].SetU(doublebuff[nn]);
+                        bcount+=nchunk;
+                      }
+                    }
+                    else {
+                      count+=hdf_header_info[i].npart[k];
+                    }
+                  }
                 }
-              }
-              count=count2;
-              bcount=bcount2;
-              for (j=0;j<nusetypes;j++) {
-                k=usetypes[j];
-                if (k==HDFGASTYPE||k==HDFSTARTYPE) {
-                  //data loaded into memory in chunks
-                  if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
-                  else nchunk=chunksize;
-                  for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
-                  {
-                    if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
-                    //setup hyperslab so that it is loaded into the buffer
-                    HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
-                    for (int nn=0;nn<nchunk;nn++) Part[count++].SetZmet(doublebuff[nn]*zmetconversion);
+                //close data spaces
+                for (auto &hidval:partsdataspace) HDF5CloseDataSpace(hidval);
+                for (auto &hidval:partsdataset) HDF5CloseDataSet(hidval);
+                //then metallicity
+                for (j=0;j<nusetypes;j++) {
+                  k=usetypes[j];
+                  if (k==HDFGASTYPE){
+                    if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]<<endl;
+                    partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]);
+                    partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
+                  }
+                  if (k==HDFSTARTYPE){
+                    if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]<<endl;
+                    partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]);
+                    partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
                   }
                 }
-                else {
-                  count+=hdf_header_info[i].npart[k];
+                if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
+                  k=usetypes[j];
+                  if (k==HDFGASTYPE){
+                    partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]);
+                    partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
+                  }
+                  if (k==HDFSTARTYPE){
+                    partsdataset[i*NHDFTYPE+k]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]);
+                    partsdataspace[i*NHDFTYPE+k]=HDF5OpenDataSpace(partsdataset[i*NHDFTYPE+k]);
+                  }
                 }
-              }
-              if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
-                for (j=1;j<=nbusetypes;j++) {
+                count=count2;
+                bcount=bcount2;
+                for (j=0;j<nusetypes;j++) {
                   k=usetypes[j];
                   if (k==HDFGASTYPE||k==HDFSTARTYPE) {
                     //data loaded into memory in chunks
@@ -1565,17 +1595,45 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                       if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
                       //setup hyperslab so that it is loaded into the buffer
                       HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
-                      for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount++].SetZmet(doublebuff[nn]*zmetconversion);
+#ifdef USEOPENMP
+                      #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
+                      for (int nn=0;nn<nchunk;nn++) Part[count+nn].SetZmet(doublebuff[nn]*zmetconversion);
+                      count+=nchunk;
                     }
                   }
                   else {
                     count+=hdf_header_info[i].npart[k];
                   }
                 }
+                if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
+                  for (j=1;j<=nbusetypes;j++) {
+                    k=usetypes[j];
+                    if (k==HDFGASTYPE||k==HDFSTARTYPE) {
+                      //data loaded into memory in chunks
+                      if (hdf_header_info[i].npart[k]<chunksize)nchunk=hdf_header_info[i].npart[k];
+                      else nchunk=chunksize;
+                      for(n=0;n<hdf_header_info[i].npart[k];n+=nchunk)
+                      {
+                        if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
+                        //setup hyperslab so that it is loaded into the buffer
+                        HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
+#ifdef USEOPENMP
+                        #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
+                        for (int nn=0;nn<nchunk;nn++) Pbaryons[bcount+nn].SetZmet(doublebuff[nn]*zmetconversion);
+                        bcount+=nchunk;
+                      }
+                    }
+                    else {
+                      count+=hdf_header_info[i].npart[k];
+                    }
+                  }
+                }
+                //close data spaces
+                for (auto &hidval:partsdataspace) HDF5CloseDataSpace(hidval);
+                for (auto &hidval:partsdataset) HDF5CloseDataSet(hidval);
               }
-              //close data spaces
-              for (auto &hidval:partsdataspace) HDF5CloseDataSpace(hidval);
-              for (auto &hidval:partsdataset) HDF5CloseDataSet(hidval);
               //then get star formation time, must also adjust so that if tage<0 this is a wind particle in Illustris so change particle type
               for (j=0;j<nusetypes;j++) {
                 k=usetypes[j];
@@ -1605,7 +1663,11 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                     if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
                     //setup hyperslab so that it is loaded into the buffer
                     HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
-                    for (int nn=0;nn<nchunk;nn++) {if (doublebuff[nn]<0) Part[count].SetType(WINDTYPE);Part[count++].SetTage(doublebuff[nn]);}
+#ifdef USEOPENMP
+                    #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
+                    for (int nn=0;nn<nchunk;nn++) {if (doublebuff[nn]<0) Part[count+nn].SetType(WINDTYPE);Part[count+nn].SetTage(doublebuff[nn]);}
+                    count+=nchunk;
                   }
                 }
                 else {
@@ -1624,7 +1686,11 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                       if (hdf_header_info[i].npart[k]-n<chunksize&&hdf_header_info[i].npart[k]-n>0)nchunk=hdf_header_info[i].npart[k]-n;
                       //setup hyperslab so that it is loaded into the buffer
                       HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 1, nchunk, n);
-                      for (int nn=0;nn<nchunk;nn++) {if (doublebuff[nn]<0) Pbaryons[bcount].SetType(WINDTYPE);Pbaryons[bcount++].SetTage(doublebuff[nn]);}
+#ifdef USEOPENMP
+                      #pragma omp parallel for default(shared) schedule(static) if (nchunk>ompreadnum)
+#endif
+                      for (int nn=0;nn<nchunk;nn++) {if (doublebuff[nn]<0) Pbaryons[bcount+nn].SetType(WINDTYPE);Pbaryons[bcount+nn].SetTage(doublebuff[nn]);}
+                      bcount+=nchunk;
                     }
                   }
                   else {
@@ -1638,8 +1704,8 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
 #endif
 #endif
             }//end of if not dark matter then baryon search
-            //now load extra fields if necessary.
-            if (numextrafields>0)
+            //now load extra fields if necessary, unless these are read for particles in groups after the search
+            if (numextrafields>0 && !opt.ilazyextrafields)
             {
 #if defined(GASON)
                 if (opt.gas_internalprop_names.size() + opt.gas_chem_names.size() +
@@ -2178,6 +2244,13 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     else opt.internalenergyinputconversion = opt.velocityinputconversion*opt.velocityinputconversion;
 
     //finally adjust to appropriate units
+#ifdef USEOPENMP
+#ifdef HIGHRES
+    #pragma omp parallel for default(shared) schedule(static) reduction(min:MP_DM) if (nbodies>ompreadnum)
+#else
+    #pragma omp parallel for default(shared) schedule(static) if (nbodies>ompreadnum)
+#endif
+#endif
     for (i=0;i<nbodies;i++)
     {
 #ifdef HIGHRES
@@ -2188,6 +2261,9 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
       for (int j=0;j<3;j++) Part[i].SetPosition(j,Part[i].GetPosition(j)*lscale);
     }
     if (Pbaryons!=NULL && opt.iBaryonSearch==1) {
+#ifdef USEOPENMP
+      #pragma omp parallel for default(shared) schedule(static) if (nbaryons>ompreadnum)
+#endif
       for (i=0;i<nbaryons;i++)
       {
         Pbaryons[i].SetMass(Pbaryons[i].GetMass()*mscale);
@@ -2205,6 +2281,13 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     if (ireadtask[ThisTask]>=0) {
         inreadsend=0;
         count2=bcount2=0;
+        //if reading SWIFT input by cell, select the cells overlapping the local domain
+        HDF_Swift_Cells swiftcells;
+        vector<unsigned long long> chunkoffsets, chunknums;
+        if (opt.iswiftcellread) {
+            HDFReadSwiftCells(Fhdf[ifirstfile], hdf_gnames, swiftcells, opt.num_files);
+            HDFSelectSwiftCells(opt, swiftcells);
+        }
         for(i=0; i<opt.num_files; i++) if(ireadfile[i])
         {
             cout<<ThisTask<<" is reading file "<<i<<endl;
@@ -2281,7 +2364,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   itemp++;
                   for (j=0;j<nusetypes;j++) {
                     k=usetypes[j];
-                    if (k==HDFGASTYPE){
+                    if (k==HDFGASTYPE && !opt.ilazyextrafields){
                       if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[6]<<endl;
                       partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[6]);
                       partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=HDF5OpenDataSpace(partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
@@ -2289,7 +2372,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   }
                   if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
                     k=usetypes[j];
-                    if (k==HDFGASTYPE){
+                    if (k==HDFGASTYPE && !opt.ilazyextrafields){
                       partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[6]);
                       partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=HDF5OpenDataSpace(partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
                     }
@@ -2298,12 +2381,12 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   itemp++;
                   for (j=0;j<nusetypes;j++) {
                     k=usetypes[j];
-                    if (k==HDFGASTYPE){
+                    if (k==HDFGASTYPE && !opt.ilazyextrafields){
                       if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]<<endl;
                       partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]);
                       partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=HDF5OpenDataSpace(partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
                     }
-                    if (k==HDFSTARTYPE){
+                    if (k==HDFSTARTYPE && !opt.ilazyextrafields){
                       if (ThisTask==0 && opt.iverbose>1) cout<<"Opening group "<<hdf_gnames.part_names[k]<<": Data set "<<hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]<<endl;
                       partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]);
                       partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=HDF5OpenDataSpace(partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
@@ -2311,11 +2394,11 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                   }
                   if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
                     k=usetypes[j];
-                    if (k==HDFGASTYPE){
+                    if (k==HDFGASTYPE && !opt.ilazyextrafields){
                       partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[hdf_parts[k]->propindex[HDFGASIMETAL]]);
                       partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=HDF5OpenDataSpace(partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
                     }
-                    if (k==HDFSTARTYPE){
+                    if (k==HDFSTARTYPE && !opt.ilazyextrafields){
                       partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=HDF5OpenDataSet(partsgroup[i*NHDFTYPE+k],hdf_parts[k]->names[hdf_parts[k]->propindex[HDFSTARIMETAL]]);
                       partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]=HDF5OpenDataSpace(partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp]);
                     }
@@ -2342,7 +2425,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
 #endif
                 } //end of baryon read if not running search dm then baryons
 
-                if (numextrafields>0)
+                if (numextrafields>0 && !opt.ilazyextrafields)
                 {
                     iextraoffset = 0;
 #if defined(GASON)
@@ -2486,7 +2569,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                 }
 
 #ifdef USEPARALLELHDF
-                if (opt.num_files<opt.nsnapread) {
+                if (opt.num_files<opt.nsnapread && !opt.iswiftcellread) {
                     plist_id = H5Pcreate(H5P_DATASET_XFER);
                     H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_INDEPENDENT);
                 }
@@ -2497,19 +2580,20 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                     unsigned long long nstart = 0, nend = hdf_header_info[i].npart[k];
                     unsigned long long nlocalsize;
 #ifdef USEPARALLELHDF
-                    if (opt.num_files<opt.nsnapread) {
+                    if (opt.num_files<opt.nsnapread && !opt.iswiftcellread) {
                         nlocalsize = nend / NProcsParallelReadTask;
                         nstart = nlocalsize*ThisParallelReadTask;
                         if (ThisParallelReadTask < NProcsParallelReadTask -1)
                             nend = nlocalsize + nstart;
                     }
 #endif
-                    if (nend-nstart<chunksize)nchunk=nend-nstart;
-                    else nchunk=chunksize;
-                    ninputoffset = 0;
-                    for(n=nstart;n<nend;n+=nchunk)
+                    //get the chunks to read, only those of selected cells if reading by cell
+                    HDFGetReadChunks(swiftcells, i, k, nstart, nend, chunksize, chunkoffsets, chunknums);
+                    for (auto ichunk=0;ichunk<chunknums.size();ichunk++)
                     {
-                        if (nend - n < chunksize && nend - n > 0) nchunk=nend-n;
+                        n=chunkoffsets[ichunk];
+                        nchunk=chunknums[ichunk];
+                        ninputoffset = n;
                         //setup hyperslab so that it is loaded into the buffer
                         //load positions
                         itemp=0;
@@ -2536,13 +2620,13 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
 #ifdef STARON
                         //star formation rate
                         itemp++;
-                        if (k == HDFGASTYPE) {
+                        if (k == HDFGASTYPE && !opt.ilazyextrafields) {
                             HDF5ReadHyperSlabReal(SFRdoublebuff,partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp], partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp], 1, 1, nchunk, n, plist_id);
                         }
 
                         //metallicity
                         itemp++;
-                        if (k == HDFGASTYPE || k == HDFSTARTYPE) {
+                        if ((k == HDFGASTYPE || k == HDFSTARTYPE) && !opt.ilazyextrafields) {
                             HDF5ReadHyperSlabReal(Zdoublebuff,partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp], partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp], 1, 1, nchunk, n, plist_id);
                         }
 
@@ -2554,7 +2638,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
 #endif
 #endif
                         //load extra fields
-                        if (numextrafields>0)
+                        if (numextrafields>0 && !opt.ilazyextrafields)
                         {
                             iextraoffset = 0;
 #if defined(GASON)
@@ -2667,6 +2751,8 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
 #endif
                         }
                     for (unsigned long long nn=0;nn<nchunk;nn++) {
+                        //cells are read by every task overlapping them, keep only the particles in the local domain
+                        if (opt.iswiftcellread && MPIGetParticlesProcessor(opt, doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2],0)!=ThisTask) continue;
                         ibuf=MPIGetParticlesProcessor(opt, doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
                         ibufindex=ibuf*BufSize+Nbuf[ibuf];
                         //reset hydro quantities of buffer
@@ -2732,7 +2818,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                       }
 #endif
 
-                    if (numextrafields>0) {
+                    if (numextrafields>0 && !opt.ilazyextrafields) {
                         iextraoffset = 0;
 #ifdef GASON
                         if (k==HDFGASTYPE && numextrafieldsvec[HDFGASTYPE]) {
@@ -2866,7 +2952,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                     }
 
 #ifdef EXTRAINPUTINFO
-                        if (opt.iextendedoutput)
+                        if (opt.iextendedoutput || opt.ilazyextrafields)
                         {
                             Pbuf[ibufindex].SetInputFileID(i);
                             Pbuf[ibufindex].SetInputIndexInFile(nn+ninputoffset);
@@ -2884,19 +2970,19 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                     unsigned long long nstart = 0, nend = hdf_header_info[i].npart[k];
                     unsigned long long nlocalsize;
 #ifdef USEPARALLELHDF
-                    if (opt.num_files<opt.nsnapread) {
+                    if (opt.num_files<opt.nsnapread && !opt.iswiftcellread) {
                         nlocalsize = nend / NProcsParallelReadTask;
                         nstart = nlocalsize*ThisParallelReadTask;
                         if (ThisParallelReadTask < NProcsParallelReadTask -1)
                             nend = nlocalsize + nstart;
                     }
 #endif
-                    if (nend-nstart<chunksize)nchunk=nend-nstart;
-                    else nchunk=chunksize;
-                    ninputoffset = 0;
-                    for(n=nstart;n<nend;n+=nchunk)
+                    HDFGetReadChunks(swiftcells, i, k, nstart, nend, chunksize, chunkoffsets, chunknums);
+                    for (auto ichunk=0;ichunk<chunknums.size();ichunk++)
                     {
-                      if (nend - n < chunksize && nend - n > 0) nchunk=nend-n;
+                      n=chunkoffsets[ichunk];
+                      nchunk=chunknums[ichunk];
+                      ninputoffset = n;
                       //setup hyperslab so that it is loaded into the buffer
                       //load positions
                       itemp=0;
@@ -2922,13 +3008,13 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
 #ifdef STARON
                       //star formation rate
                       itemp++;
-                      if (k == HDFGASTYPE) {
+                      if (k == HDFGASTYPE && !opt.ilazyextrafields) {
                           HDF5ReadHyperSlabReal(SFRdoublebuff,partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp], partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp], 1, 1, nchunk, n, plist_id);
                       }
 
                       //metallicity
                       itemp++;
-                      if (k == HDFGASTYPE || k == HDFSTARTYPE) {
+                      if ((k == HDFGASTYPE || k == HDFSTARTYPE) && !opt.ilazyextrafields) {
                           HDF5ReadHyperSlabReal(Zdoublebuff,partsdatasetall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp], partsdataspaceall[i*NHDFTYPE*NHDFDATABLOCK+k*NHDFDATABLOCK+itemp], 1, 1, nchunk, n, plist_id);
                       }
 
@@ -2940,6 +3026,11 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
 #endif
 #endif
                       for (int nn=0;nn<nchunk;nn++) {
+                        if (opt.iswiftcellread) {
+                          if (ifloat_pos) ibuf=MPIGetParticlesProcessor(opt, floatbuff[nn*3],floatbuff[nn*3+1],floatbuff[nn*3+2],0);
+                          else ibuf=MPIGetParticlesProcessor(opt, doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2],0);
+                          if (ibuf!=ThisTask) continue;
+                        }
                         if (ifloat_pos) ibuf=MPIGetParticlesProcessor(opt, floatbuff[nn*3],floatbuff[nn*3+1],floatbuff[nn*3+2]);
                         else ibuf=MPIGetParticlesProcessor(opt, doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
                         ibufindex=ibuf*BufSize+Nbuf[ibuf];
@@ -2992,7 +3083,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                         }
 #endif
 #ifdef EXTRAINPUTINFO
-                        if (opt.iextendedoutput)
+                        if (opt.iextendedoutput || opt.ilazyextrafields)
                         {
                             Pbuf[ibufindex].SetInputFileID(i);
                             Pbuf[ibufindex].SetInputIndexInFile(nn+ninputoffset);
@@ -3069,6 +3160,8 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
                 for(ibuf = 0; ibuf < opt.nsnapread; ibuf++) Nreadbuf[ibuf]=0;
             }
         }//end of file if read
+        //make sure any full buffers still in flight have been delivered before the final flush
+        MPIWaitParticleSendsFromReadThreads();
         //once finished reading the file if there are any particles left in the buffer broadcast them
         for(ibuf = 0; ibuf < NProcs; ibuf++) if (ireadtask[ibuf]<0)
         {
@@ -3089,6 +3182,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
         if (opt.nsnapread>1){
             MPI_Allgather(Nreadbuf, opt.nsnapread, MPI_Int_t, mpi_nsend_readthread, opt.nsnapread, MPI_Int_t, mpi_comm_read);
             MPISendParticlesBetweenReadThreads(opt, Preadbuf, Part.data(), ireadtask, readtaskID, Pbaryons, mpi_comm_read, mpi_nsend_readthread, mpi_nsend_readthread_baryon);
+            MPIWaitParticleExchangeBetweenReadThreads(Part.data(), Pbaryons);
             inreadsend++;
             for(ibuf = 0; ibuf < opt.nsnapread; ibuf++) Nreadbuf[ibuf]=0;
         }
@@ -3097,6 +3191,26 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     else {
         MPIReceiveParticlesFromReadThreads(opt,Pbuf,Part.data(),readtaskID, irecv, mpi_irecvflag, Nlocalthreadbuf, mpi_request,Pbaryons);
     }
+    //when reading by cell, particles that have drifted further than the cell buffer outside their top-level cell
+    //are missed, so check that every particle in the header has been read unless only a region of interest was requested
+    if (opt.iswiftcellread && opt.inputregion.size() != 6) {
+        Int_t nreadlocal=Nlocal, nreadtotal, nexpected=0;
+        for (j=0;j<nusetypes;j++) nexpected+=opt.numpart[usetypes[j]];
+        if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
+            nreadlocal+=Nlocalbaryon[0];
+            for (j=1;j<=nbusetypes;j++) nexpected+=opt.numpart[usetypes[j]];
+        }
+        MPI_Allreduce(&nreadlocal, &nreadtotal, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
+        if (nreadtotal != nexpected) {
+            if (ThisTask==0) {
+                cerr<<"Error: reading SWIFT input by cell read "<<nreadtotal<<" particles but the header lists "<<nexpected<<endl;
+                cerr<<"Particles have drifted further than Input_swift_cell_buffer outside their top-level cell. ";
+                cerr<<"Increase Input_swift_cell_buffer or set Input_swift_cell_read = 0"<<endl;
+            }
+            MPI_Abort(MPI_COMM_WORLD,8);
+        }
+        if (ThisTask==0 && opt.iverbose) cout<<"Read all "<<nreadtotal<<" particles by SWIFT cell"<<endl;
+    }
 #endif
 
 
@@ -3195,7 +3309,7 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     //a bit of clean up
 #ifdef USEMPI
 #ifdef USEPARALLELHDF
-    if (opt.nsnapread > opt.num_files) {
+    if (opt.nsnapread > opt.num_files && !opt.iswiftcellread) {
         if (ireadtask[ThisTask] >= 0) MPI_Comm_free(&mpi_comm_parallel_read);
     }
 #endif
@@ -3275,4 +3389,199 @@ void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle
     UpdateExtraFieldNames(opt);
 }
 
+#ifdef EXTRAINPUTINFO
+///read the unique input fields of a list of extra field names for the particles at the given indices of a group,
+///storing the key used to set the property and the values of each field
+static void ReadHDFExtraFieldsAtIndices(const hid_t &group,
+    const vector<string> &names, const vector<unsigned int> &index, const vector<unsigned short> &uniquelist,
+    const vector<hsize_t> &indices, unsigned long long chunksize,
+    vector<string> &keys, vector<vector<double>> &values)
+{
+    hid_t dataset, dataspace;
+    keys.resize(uniquelist.size());
+    values.resize(uniquelist.size());
+    for (auto j=0;j<uniquelist.size();j++) {
+        auto iextra = uniquelist[j];
+        keys[j] = names[iextra] + to_string(index[iextra]);
+        values[j].resize(indices.size());
+        dataset = HDF5OpenDataSet(group, names[iextra]);
+        dataspace = HDF5OpenDataSpace(dataset);
+        HDF5ReadElementsReal(values[j].data(), dataset, dataspace, indices, chunksize, index[iextra]);
+        HDF5CloseDataSpace(dataspace);
+        HDF5CloseDataSet(dataset);
+    }
+}
+
+///returns the hdf particle group from which lazily loaded fields of a particle are read, -1 if there are none
+static inline int HDFLazyFieldType(Options &opt, Particle &p)
+{
+    int type = p.GetType();
+#ifdef GASON
+    if (type == GASTYPE) return HDFGASTYPE;
+#endif
+#ifdef STARON
+    if (type == STARTYPE || type == WINDTYPE) return HDFSTARTYPE;
+#endif
+#ifdef BHON
+    if (type == BHTYPE && opt.bh_internalprop_names.size() + opt.bh_chem_names.size() + opt.bh_chemproduction_names.size() > 0) return HDFBHTYPE;
+#endif
+#ifdef EXTRADMON
+    if (type == DARKTYPE && opt.extra_dm_internalprop_names.size() > 0) return HDFDMTYPE;
+#endif
+    return -1;
+}
+
+///Second phase of the input when \ref Options.ilazyextrafields is set. \ref ReadHDF then skips star formation
+///rates, metallicities and extra gas/star/bh/dm fields, which are only used to calculate the properties of
+///groups. Here these are read for the particles in groups only, using the input file and index stored with each
+///particle. Particles are sorted by file, type and index so that each file and data set is opened once and read
+///in order. Each mpi process reads the fields of its own particles. The input unit conversions applied by
+///\ref AdjustHydroQuantities and \ref AdjustStarQuantities are applied as values are read.
+void ReadHDFExtraFieldsOfGroupParticles(Options &opt, const Int_t nbodies, Particle *Part, Int_t *pfof)
+{
+    char buf[2000];
+    HDF_Group_Names hdf_gnames (opt.ihdfnameconvention);
+    HDF_Part_Info hdf_gas_info(HDFGASTYPE,opt.ihdfnameconvention);
+    HDF_Part_Info hdf_star_info(HDFSTARTYPE,opt.ihdfnameconvention);
+    hid_t Fhdf, group, dataset, dataspace;
+    vector<Int_t> plist;
+    vector<int> ptype;
+    vector<hsize_t> indices;
+    vector<Particle*> pp;
+    vector<double> values;
+    vector<string> keys;
+    vector<vector<double>> extravalues;
+    unsigned long long chunksize = opt.inputbufsize;
+    float zmetconversion=1;
+    if (opt.ihdfnameconvention == HDFILLUSTISNAMES) zmetconversion=ILLUSTRISZMET;
+#ifndef USEMPI
+    int ThisTask=0;
+#endif
+
+    ptype.resize(nbodies);
+    for (Int_t i=0;i<nbodies;i++) {
+        ptype[i] = HDFLazyFieldType(opt, Part[i]);
+        if (pfof[i]>0 && ptype[i]>=0) plist.push_back(i);
+    }
+    sort(plist.begin(), plist.end(), [&](const Int_t &a, const Int_t &b) {
+        if (Part[a].GetInputFileID() != Part[b].GetInputFileID()) return Part[a].GetInputFileID() < Part[b].GetInputFileID();
+        if (ptype[a] != ptype[b]) return ptype[a] < ptype[b];
+        return Part[a].GetInputIndexInFile() < Part[b].GetInputIndexInFile();
+    });
+    if (opt.iverbose) cout<<ThisTask<<" reading extra input fields of "<<plist.size()<<" particles in groups"<<endl;
+
+    size_t ifile = 0, itype, iend;
+    while (ifile < plist.size()) {
+        int i = Part[plist[ifile]].GetInputFileID();
+        if(opt.num_files>1) sprintf(buf,"%s.%d.hdf5",opt.fname,i);
+        else sprintf(buf,"%s.hdf5",opt.fname);
+        Fhdf = H5Fopen(buf, H5F_ACC_RDONLY, H5P_DEFAULT);
+        itype = ifile;
+        while (itype < plist.size() && Part[plist[itype]].GetInputFileID() == i) {
+            int k = ptype[plist[itype]];
+            iend = itype;
+            while (iend < plist.size() && Part[plist[iend]].GetInputFileID() == i && ptype[plist[iend]] == k) iend++;
+            indices.resize(iend - itype);
+            for (auto n=itype;n<iend;n++) indices[n-itype] = Part[plist[n]].GetInputIndexInFile();
+            values.resize(indices.size());
+            pp.resize(indices.size());
+            for (auto n=itype;n<iend;n++) pp[n-itype] = &Part[plist[n]];
+            group = HDF5OpenGroup(Fhdf, hdf_gnames.part_names[k]);
+#ifdef GASON
+            if (k == HDFGASTYPE) {
+#ifdef STARON
+                dataset = HDF5OpenDataSet(group, hdf_gas_info.names[6]);
+                dataspace = HDF5OpenDataSpace(dataset);
+                HDF5ReadElementsReal(values.data(), dataset, dataspace, indices, chunksize);
+                for (auto n=0;n<indices.size();n++) {
+                    pp[n]->SetSFR(values[n] > 0. ? values[n] : 0.);
+                    if (opt.isfrisssfr==1) pp[n]->SetSFR(pp[n]->GetSFR()*pp[n]->GetMass());
+                    pp[n]->SetSFR(pp[n]->GetSFR()*opt.SFRinputconversion);
+                }
+                HDF5CloseDataSpace(dataspace);
+                HDF5CloseDataSet(dataset);
+                dataset = HDF5OpenDataSet(group, hdf_gas_info.names[hdf_gas_info.propindex[HDFGASIMETAL]]);
+                dataspace = HDF5OpenDataSpace(dataset);
+                HDF5ReadElementsReal(values.data(), dataset, dataspace, indices, chunksize);
+                for (auto n=0;n<indices.size();n++) pp[n]->SetZmet(values[n]*zmetconversion*opt.metallicityinputconversion);
+                HDF5CloseDataSpace(dataspace);
+                HDF5CloseDataSet(dataset);
+#endif
+                if (opt.gas_internalprop_names.size() + opt.gas_chem_names.size() + opt.gas_chemproduction_names.size() > 0) {
+                    for (auto n=0;n<indices.size();n++) if (!pp[n]->HasHydroProperties()) pp[n]->InitHydroProperties();
+                }
+                ReadHDFExtraFieldsAtIndices(group, opt.gas_internalprop_names, opt.gas_internalprop_index,
+                    opt.gas_internalprop_unique_input_indexlist, indices, chunksize, keys, extravalues);
+                for (auto j=0;j<keys.size();j++) for (auto n=0;n<indices.size();n++)
+                    pp[n]->GetHydroProperties().SetInternalProperties(keys[j], extravalues[j][n]);
+                ReadHDFExtraFieldsAtIndices(group, opt.gas_chem_names, opt.gas_chem_index,
+                    opt.gas_chem_unique_input_indexlist, indices, chunksize, keys, extravalues);
+                for (auto j=0;j<keys.size();j++) for (auto n=0;n<indices.size();n++)
+                    pp[n]->GetHydroProperties().SetChemistry(keys[j], extravalues[j][n]);
+                ReadHDFExtraFieldsAtIndices(group, opt.gas_chemproduction_names, opt.gas_chemproduction_index,
+                    opt.gas_chemproduction_unique_input_indexlist, indices, chunksize, keys, extravalues);
+                for (auto j=0;j<keys.size();j++) for (auto n=0;n<indices.size();n++)
+                    pp[n]->GetHydroProperties().SetChemistryProduction(keys[j], extravalues[j][n]);
+            }
+#endif
+#ifdef STARON
+            if (k == HDFSTARTYPE) {
+                dataset = HDF5OpenDataSet(group, hdf_star_info.names[hdf_star_info.propindex[HDFSTARIMETAL]]);
+                dataspace = HDF5OpenDataSpace(dataset);
+                HDF5ReadElementsReal(values.data(), dataset, dataspace, indices, chunksize);
+                for (auto n=0;n<indices.size();n++) pp[n]->SetZmet(values[n]*zmetconversion*opt.metallicityinputconversion);
+                HDF5CloseDataSpace(dataspace);
+                HDF5CloseDataSet(dataset);
+                if (opt.star_internalprop_names.size() + opt.star_chem_names.size() + opt.star_chemproduction_names.size() > 0) {
+                    for (auto n=0;n<indices.size();n++) if (!pp[n]->HasStarProperties()) pp[n]->InitStarProperties();
+                }
+                ReadHDFExtraFieldsAtIndices(group, opt.star_internalprop_names, opt.star_internalprop_index,
+                    opt.star_internalprop_unique_input_indexlist, indices, chunksize, keys, extravalues);
+                for (auto j=0;j<keys.size();j++) for (auto n=0;n<indices.size();n++)
+                    pp[n]->GetStarProperties().SetInternalProperties(keys[j], extravalues[j][n]);
+                ReadHDFExtraFieldsAtIndices(group, opt.star_chem_names, opt.star_chem_index,
+                    opt.star_chem_unique_input_indexlist, indices, chunksize, keys, extravalues);
+                for (auto j=0;j<keys.size();j++) for (auto n=0;n<indices.size();n++)
+                    pp[n]->GetStarProperties().SetChemistry(keys[j], extravalues[j][n]);
+                ReadHDFExtraFieldsAtIndices(group, opt.star_chemproduction_names, opt.star_chemproduction_index,
+                    opt.star_chemproduction_unique_input_indexlist, indices, chunksize, keys, extravalues);
+                for (auto j=0;j<keys.size();j++) for (auto n=0;n<indices.size();n++)
+                    pp[n]->GetStarProperties().SetChemistryProduction(keys[j], extravalues[j][n]);
+            }
+#endif
+#ifdef BHON
+            if (k == HDFBHTYPE) {
+                for (auto n=0;n<indices.size();n++) if (!pp[n]->HasBHProperties()) pp[n]->InitBHProperties();
+                ReadHDFExtraFieldsAtIndices(group, opt.bh_internalprop_names, opt.bh_internalprop_index,
+                    opt.bh_internalprop_unique_input_indexlist, indices, chunksize, keys, extravalues);
+                for (auto j=0;j<keys.size();j++) for (auto n=0;n<indices.size();n++)
+                    pp[n]->GetBHProperties().SetInternalProperties(keys[j], extravalues[j][n]);
+                ReadHDFExtraFieldsAtIndices(group, opt.bh_chem_names, opt.bh_chem_index,
+                    opt.bh_chem_unique_input_indexlist, indices, chunksize, keys, extravalues);
+                for (auto j=0;j<keys.size();j++) for (auto n=0;n<indices.size();n++)
+                    pp[n]->GetBHProperties().SetChemistry(keys[j], extravalues[j][n]);
+                ReadHDFExtraFieldsAtIndices(group, opt.bh_chemproduction_names, opt.bh_chemproduction_index,
+                    opt.bh_chemproduction_unique_input_indexlist, indices, chunksize, keys, extravalues);
+                for (auto j=0;j<keys.size();j++) for (auto n=0;n<indices.size();n++)
+                    pp[n]->GetBHProperties().SetChemistryProduction(keys[j], extravalues[j][n]);
+            }
+#endif
+#ifdef EXTRADMON
+            if (k == HDFDMTYPE) {
+                for (auto n=0;n<indices.size();n++) if (!pp[n]->HasExtraDMProperties()) pp[n]->InitExtraDMProperties();
+                ReadHDFExtraFieldsAtIndices(group, opt.extra_dm_internalprop_names, opt.extra_dm_internalprop_index,
+                    opt.extra_dm_internalprop_unique_input_indexlist, indices, chunksize, keys, extravalues);
+                for (auto j=0;j<keys.size();j++) for (auto n=0;n<indices.size();n++)
+                    pp[n]->GetExtraDMProperties().SetExtraProperties(keys[j], extravalues[j][n]);
+            }
+#endif
+            HDF5CloseGroup(group);
+            itype = iend;
+        }
+        HDF5CloseFile(Fhdf);
+        ifile = itype;
+    }
+}
+#endif
+
 #endif
@@ -432,6 +432,40 @@ static inline void HDF5ReadHyperSlabReal(double *buffer,
 
 }
 
+///Read every nstride'th row of a 1d or 2d real data set, starting at row noffset, into buffer.
+///Used to sample a chunk of a data set evenly rather than reading a contiguous prefix.
+static inline void HDF5ReadStridedHyperSlabReal(double *buffer,
+    const hid_t &dataset, const hid_t &dataspace,
+    unsigned long long nsample, unsigned long long noffset, unsigned long long nstride,
+    hid_t plist_id = H5P_DEFAULT
+)
+{
+    vector<hsize_t> start, count, stride, block, memdims(1), dims;
+    hsize_t ndim;
+    hid_t memspace;
+
+    start.push_back(noffset);
+    count.push_back(nsample);
+    stride.push_back(max(nstride,1ULL));
+    block.push_back(1);
+    ndim = H5Sget_simple_extent_ndims(dataspace);
+    dims.resize(ndim);
+    H5Sget_simple_extent_dims(dataspace, dims.data(), NULL);
+    //read all columns of any higher dimensions
+    for (auto i=1;i<ndim;i++) {
+        start.push_back(0);
+        count.push_back(dims[i]);
+        stride.push_back(1);
+        block.push_back(1);
+    }
+    memdims[0]=1;
+    for (auto x:count) memdims[0] *= x;
+    H5Sselect_hyperslab(dataspace, H5S_SELECT_SET, start.data(), stride.data(), count.data(), block.data());
+    memspace = H5Screate_simple (1, memdims.data(), NULL);
+    safe_hdf5<herr_t>(H5Dread, dataset, H5T_NATIVE_DOUBLE, memspace, dataspace, plist_id, buffer);
+    H5Sclose(memspace);
+}
+
 static inline void HDF5ReadHyperSlabInteger(long long *buffer,
     const hid_t &dataset, const hid_t &dataspace,
     const hsize_t datarank, const hsize_t dummy,
@@ -496,6 +530,51 @@ static inline void HDF5ReadHyperSlabInteger(long long *buffer,
     safe_hdf5<herr_t>(H5Dread, dataset, H5T_NATIVE_LONG, memspace, dataspace, plist_id, buffer);
 }
 
+///read the values of a sorted list of (first dimension) indices of a data set into buffer, using column noffset2
+///if the data set is two dimensional. Indices are processed in windows of nchunk entries, windows where
+///at least 1/HDFDENSESELECTIONFAC of the entries are wanted are read as a single hyperslab, sparser windows are read
+///with a point selection
+#define HDFDENSESELECTIONFAC 8
+static inline void HDF5ReadElementsReal(double *buffer,
+    const hid_t &dataset, const hid_t &dataspace,
+    const vector<hsize_t> &indices, unsigned long long nchunk,
+    unsigned long long noffset2 = 0
+)
+{
+    vector<hsize_t> coords;
+    vector<double> slabbuff;
+    hsize_t ndim, npoints, memdims;
+    hid_t memspace;
+    size_t i = 0, j, k;
+
+    ndim = H5Sget_simple_extent_ndims(dataspace);
+    while (i < indices.size()) {
+        //find the entries that lie within this window
+        j = i;
+        while (j < indices.size() && indices[j] < indices[i] + nchunk) j++;
+        npoints = j - i;
+        memdims = indices[j-1] - indices[i] + 1;
+        if (npoints * HDFDENSESELECTIONFAC >= memdims) {
+            slabbuff.resize(memdims);
+            HDF5ReadHyperSlabReal(slabbuff.data(), dataset, dataspace, 1, 1, memdims, indices[i],
+                H5P_DEFAULT, 1, noffset2);
+            for (k = i; k < j; k++) buffer[k] = slabbuff[indices[k] - indices[i]];
+        }
+        else {
+            coords.resize(npoints * ndim);
+            for (k = 0; k < npoints; k++) {
+                coords[k*ndim] = indices[i+k];
+                if (ndim > 1) coords[k*ndim+1] = noffset2;
+            }
+            H5Sselect_elements(dataspace, H5S_SELECT_SET, npoints, coords.data());
+            memspace = H5Screate_simple(1, &npoints, NULL);
+            safe_hdf5<herr_t>(H5Dread, dataset, H5T_NATIVE_DOUBLE, memspace, dataspace, H5P_DEFAULT, &buffer[i]);
+            H5Sclose(memspace);
+        }
+        i = j;
+    }
+}
+
 ///\name HDF class to manage writing information
 class H5OutputFile
 {
@@ -1629,6 +1708,166 @@ inline void HDFSetUsedParticleTypes(Options &opt, int &nusetypes, int &nbusetype
 }
 //@}
 
+/// \name SWIFT top-level cell meta data, used to read only the parts of the files covering a region
+//@{
+///stores the extent of SWIFT top-level cells and where the particles of each cell are stored
+struct HDF_Swift_Cells {
+    ///number of top-level cells
+    unsigned long long numcells;
+    ///width of a cell
+    double cellsize[3];
+    ///centres of the cells
+    vector<double> centres;
+    ///for each particle type, number of particles in each cell, file in which they are stored and offset in that file
+    vector<long long> counts[NHDFTYPE], offsets[NHDFTYPE], files[NHDFTYPE];
+    ///flag for each cell indicating whether it is to be read
+    vector<int> iselected;
+    HDF_Swift_Cells() {
+        numcells = 0;
+    }
+};
+
+///read the SWIFT cell meta data stored in the Cells group of a snapshot file.
+///Counts, files and offsets are only read for the particle types present in the file
+inline void HDFReadSwiftCells(const hid_t &Fhdf, HDF_Group_Names &hdf_gnames, HDF_Swift_Cells &cells, int num_files)
+{
+    hid_t dataset, dataspace;
+    vector<double> vdoublebuff;
+    string offsetname;
+    if (H5Lexists(Fhdf, "Cells", H5P_DEFAULT) <= 0) {
+        cerr<<"Input has no SWIFT Cells group, cannot read input using cell meta data"<<endl;
+#ifdef USEMPI
+        MPI_Abort(MPI_COMM_WORLD,8);
+#else
+        exit(8);
+#endif
+    }
+    vdoublebuff = read_attribute_v<double>(Fhdf, string("Cells/Meta-data/size"));
+    for (auto j=0;j<3;j++) cells.cellsize[j] = vdoublebuff[j];
+    cells.numcells = read_attribute<int>(Fhdf, string("Cells/Meta-data/nr_cells"));
+    cells.centres.resize(cells.numcells*3);
+    dataset = HDF5OpenDataSet(Fhdf, string("Cells/Centres"));
+    dataspace = HDF5OpenDataSpace(dataset);
+    HDF5ReadHyperSlabReal(cells.centres.data(), dataset, dataspace, 1, 3, cells.numcells, 0);
+    HDF5CloseDataSpace(dataspace);
+    HDF5CloseDataSet(dataset);
+    //newer snapshots store offsets within each file, older ones only offsets in the snapshot as a whole
+    //which are also offsets in the file if the snapshot is a single file
+    if (H5Lexists(Fhdf, "Cells/OffsetsInFile", H5P_DEFAULT) > 0) offsetname = string("Cells/OffsetsInFile/");
+    else if (num_files == 1) offsetname = string("Cells/Offsets/");
+    else {
+        cerr<<"SWIFT Cells group does not contain offsets in each file, cannot read input using cell meta data"<<endl;
+#ifdef USEMPI
+        MPI_Abort(MPI_COMM_WORLD,8);
+#else
+        exit(8);
+#endif
+    }
+    for (auto k=0;k<NHDFTYPE;k++) {
+        cells.counts[k].clear();
+        cells.offsets[k].clear();
+        cells.files[k].assign(cells.numcells, 0);
+        if (H5Lexists(Fhdf, ("Cells/Counts/"+hdf_gnames.part_names[k]).c_str(), H5P_DEFAULT) <= 0) continue;
+        cells.counts[k].resize(cells.numcells);
+        cells.offsets[k].resize(cells.numcells);
+        dataset = HDF5OpenDataSet(Fhdf, "Cells/Counts/"+hdf_gnames.part_names[k]);
+        dataspace = HDF5OpenDataSpace(dataset);
+        HDF5ReadHyperSlabInteger(cells.counts[k].data(), dataset, dataspace, 1, 1, cells.numcells, 0);
+        HDF5CloseDataSpace(dataspace);
+        HDF5CloseDataSet(dataset);
+        dataset = HDF5OpenDataSet(Fhdf, offsetname+hdf_gnames.part_names[k]);
+        dataspace = HDF5OpenDataSpace(dataset);
+        HDF5ReadHyperSlabInteger(cells.offsets[k].data(), dataset, dataspace, 1, 1, cells.numcells, 0);
+        HDF5CloseDataSpace(dataspace);
+        HDF5CloseDataSet(dataset);
+        if (H5Lexists(Fhdf, ("Cells/Files/"+hdf_gnames.part_names[k]).c_str(), H5P_DEFAULT) > 0) {
+            dataset = HDF5OpenDataSet(Fhdf, "Cells/Files/"+hdf_gnames.part_names[k]);
+            dataspace = HDF5OpenDataSpace(dataset);
+            HDF5ReadHyperSlabInteger(cells.files[k].data(), dataset, dataspace, 1, 1, cells.numcells, 0);
+            HDF5CloseDataSpace(dataspace);
+            HDF5CloseDataSet(dataset);
+        }
+    }
+    cells.iselected.assign(cells.numcells, 1);
+}
+
+///whether the interval [xmin,xmax] overlaps [rmin,rmax] in a periodic box of the given period
+inline bool HDFPeriodicOverlap(double xmin, double xmax, double rmin, double rmax, double period)
+{
+    for (auto s=-1;s<=1;s++) if (xmin+s*period<=rmax && xmax+s*period>=rmin) return true;
+    return false;
+}
+
+#ifdef USEMPI
+///flag the SWIFT cells that are to be read by this mpi task, those which overlap the task's mesh cells once
+///expanded by \ref Options.swiftcellbuffer of their width (particles drift out of their top-level cell between
+///SWIFT rebuilds) and, if given, the region of interest \ref Options.inputregion
+inline void HDFSelectSwiftCells(Options &opt, HDF_Swift_Cells &cells)
+{
+    int n = opt.numcellsperdim;
+    for (unsigned long long icell=0;icell<cells.numcells;icell++) {
+        double xmin[3], xmax[3];
+        int ilo[3], ihi[3];
+        bool iselect = false;
+        for (auto j=0;j<3;j++) {
+            xmin[j] = cells.centres[icell*3+j] - (0.5+opt.swiftcellbuffer)*cells.cellsize[j];
+            xmax[j] = cells.centres[icell*3+j] + (0.5+opt.swiftcellbuffer)*cells.cellsize[j];
+            ilo[j] = floor(xmin[j]*opt.icellwidth[j]);
+            ihi[j] = floor(xmax[j]*opt.icellwidth[j]);
+            if (ihi[j]-ilo[j]+1 >= n) {ilo[j] = 0; ihi[j] = n-1;}
+        }
+        for (auto ix=ilo[0];ix<=ihi[0] && !iselect;ix++) {
+            for (auto iy=ilo[1];iy<=ihi[1] && !iselect;iy++) {
+                for (auto iz=ilo[2];iz<=ihi[2] && !iselect;iz++) {
+                    unsigned long long index = ((ix%n+n)%n)*n*n + ((iy%n+n)%n)*n + ((iz%n+n)%n);
+                    iselect = (opt.cellnodeids[index] == ThisTask);
+                }
+            }
+        }
+        if (iselect && opt.inputregion.size() == 6) {
+            for (auto j=0;j<3;j++)
+                iselect = iselect && HDFPeriodicOverlap(xmin[j], xmax[j], opt.inputregion[j], opt.inputregion[j+3], opt.spacedimension[j]);
+        }
+        cells.iselected[icell] = iselect;
+    }
+}
+#endif
+
+///produce the list of chunks, offsets and number of entries, to read for a particle type in a file. Without cell meta data
+///this is [nstart,nend) split into chunks of at most chunksize entries, otherwise only the ranges of the selected
+///cells stored in the file are listed, with contiguous cells merged before splitting into chunks
+inline void HDFGetReadChunks(HDF_Swift_Cells &cells, int ifile, int k,
+    unsigned long long nstart, unsigned long long nend, unsigned long long chunksize,
+    vector<unsigned long long> &chunkoffset, vector<unsigned long long> &chunknum)
+{
+    vector<pair<unsigned long long, unsigned long long>> ranges;
+    chunkoffset.clear();
+    chunknum.clear();
+    if (cells.numcells == 0) {
+        if (nend > nstart) ranges.push_back(make_pair(nstart, nend));
+    }
+    else if (cells.counts[k].size() > 0) {
+        for (unsigned long long icell=0;icell<cells.numcells;icell++) {
+            if (!cells.iselected[icell] || cells.counts[k][icell] == 0 || cells.files[k][icell] != ifile) continue;
+            ranges.push_back(make_pair(cells.offsets[k][icell], cells.offsets[k][icell]+cells.counts[k][icell]));
+        }
+        sort(ranges.begin(), ranges.end());
+        auto nranges = 0;
+        for (auto &r:ranges) {
+            if (nranges > 0 && ranges[nranges-1].second == r.first) ranges[nranges-1].second = r.second;
+            else ranges[nranges++] = r;
+        }
+        ranges.resize(nranges);
+    }
+    for (auto &r:ranges) {
+        for (auto n=r.first;n<r.second;n+=chunksize) {
+            chunkoffset.push_back(n);
+            chunknum.push_back(min(chunksize, r.second-n));
+        }
+    }
+}
+//@}
+
 /// \name Get the number of particles in the hdf files
 //@{
 inline Int_t HDF_get_nbodies(char *fname, int ptype, Options &opt)
@@ -315,6 +315,124 @@ void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof){
     cout<<"Done"<<endl;
 }
 
+#ifdef USEMPI
+/*! Writes the tipsy formatted fof.grp array file in parallel without collecting the group ids on a single mpi task. \n
+    Particles are placed in the file according to their id (offset by the minimum id), which for tipsy input corresponds
+    to the input order. If ids do not span a contiguous range or particles are not provided (Part==NULL),
+    particles are instead written in mpi task order. \n
+    The file is split into contiguous blocks of records, one per task. The (record, group id) pairs are exchanged so each task
+    receives the records in its block and then writes its block with collective MPI-IO, so memory per task is O(N/NProcs).
+    Records are fixed width, right aligned, so that offsets can be calculated. Group ids are offset so that they are
+    unique across mpi tasks but the local pfof array is not altered.
+*/
+void MPIWriteFOF(Options &opt, const Int_t nbodies, Particle *Part, Int_t *pfof){
+    char fname[1000];
+    sprintf(fname,"%s.fof.grp",opt.outname);
+    if (ThisTask==0) cout<<"saving fof data to "<<fname<<" using parallel write"<<endl;
+
+    //offset group ids so that they are unique across mpi tasks
+    Int_t ngoffset=0, ngtot=0;
+    for (int j=0;j<NProcs;j++) {
+        if (j<ThisTask) ngoffset+=mpi_ngroups[j];
+        ngtot+=mpi_ngroups[j];
+    }
+
+    //determine the number of records in the file and where the searched particles are placed
+    //the type information is only guaranteed to be present on task 0
+    Int_t numpart[NPARTTYPES], nsearched, nrecords=0, nrecordoffset=0;
+    for (int k=0;k<NPARTTYPES;k++) numpart[k]=opt.numpart[k];
+    MPI_Bcast(numpart, NPARTTYPES, MPI_Int_t, 0, MPI_COMM_WORLD);
+    MPI_Allreduce(&nbodies, &nsearched, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
+    if (opt.partsearchtype!=PSTALL) {
+        for (int k=0;k<NPARTTYPES;k++) nrecords+=numpart[k];
+        if (opt.partsearchtype==PSTDARK) nrecordoffset=numpart[GASTYPE];
+        else if (opt.partsearchtype==PSTSTAR) nrecordoffset=numpart[GASTYPE]+numpart[DARKTYPE];
+    }
+    if (nrecords<nrecordoffset+nsearched) nrecords=nrecordoffset+nsearched;
+
+    //determine the record index of the local particles. If particles are not provided (such as when baryons are stored
+    //separately from the particle array) then use mpi task order
+    int ihavepart=(Part!=NULL||nbodies==0), iallhavepart;
+    MPI_Allreduce(&ihavepart, &iallhavepart, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    long long idmin=LLONG_MAX, idmax=LLONG_MIN, gidmin=0, gidmax=-1;
+    if (iallhavepart) {
+        for (Int_t i=0;i<nbodies;i++) {
+            if (Part[i].GetPID()<idmin) idmin=Part[i].GetPID();
+            if (Part[i].GetPID()>idmax) idmax=Part[i].GetPID();
+        }
+        MPI_Allreduce(&idmin, &gidmin, 1, MPI_LONG_LONG, MPI_MIN, MPI_COMM_WORLD);
+        MPI_Allreduce(&idmax, &gidmax, 1, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+    }
+    bool iidorder=(iallhavepart && gidmax-gidmin+1==nsearched);
+    Int_t ntaskoffset=0;
+    if (!iidorder) {
+        if (ThisTask==0) cout<<"WARNING: particle ids not available or not contiguous, fof.grp file is written in mpi task order"<<endl;
+        vector<Int_t> nlocal(NProcs);
+        MPI_Allgather(&nbodies, 1, MPI_Int_t, nlocal.data(), 1, MPI_Int_t, MPI_COMM_WORLD);
+        for (int j=0;j<ThisTask;j++) ntaskoffset+=nlocal[j];
+    }
+    Int_t *recordindex=new Int_t[nbodies];
+    for (Int_t i=0;i<nbodies;i++) {
+        if (iidorder) recordindex[i]=nrecordoffset+(Part[i].GetPID()-gidmin);
+        else recordindex[i]=nrecordoffset+ntaskoffset+i;
+    }
+
+    //send the records to the task that writes the block of the file containing them
+    Int_t nblock=max((nrecords+NProcs-1)/NProcs,(Int_t)1);
+    Int_t blockstart=min((Int_t)ThisTask*nblock, nrecords), blockend=min(blockstart+nblock, nrecords);
+    vector<int> sendcount(NProcs,0), recvcount(NProcs,0), sendoffset(NProcs,0), recvoffset(NProcs,0);
+    for (Int_t i=0;i<nbodies;i++) sendcount[recordindex[i]/nblock]+=2;
+    MPI_Alltoall(sendcount.data(), 1, MPI_INT, recvcount.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    for (int j=1;j<NProcs;j++) {
+        sendoffset[j]=sendoffset[j-1]+sendcount[j-1];
+        recvoffset[j]=recvoffset[j-1]+recvcount[j-1];
+    }
+    Int_t nrecv=recvoffset[NProcs-1]+recvcount[NProcs-1];
+    Int_t *sendbuf=new Int_t[2*nbodies];
+    Int_t *recvbuf=new Int_t[nrecv];
+    vector<int> ioffset(sendoffset);
+    for (Int_t i=0;i<nbodies;i++) {
+        int itask=recordindex[i]/nblock;
+        sendbuf[ioffset[itask]++]=recordindex[i];
+        sendbuf[ioffset[itask]++]=pfof[i]+(pfof[i]>0)*ngoffset;
+    }
+    delete[] recordindex;
+    MPI_Alltoallv(sendbuf, sendcount.data(), sendoffset.data(), MPI_Int_t,
+        recvbuf, recvcount.data(), recvoffset.data(), MPI_Int_t, MPI_COMM_WORLD);
+    delete[] sendbuf;
+
+    //fill the local block of fixed width records, untagged particles are group 0
+    string header=to_string(nrecords)+"\n";
+    int width=to_string(ngtot).size()+1;
+    Int_t nlocalrecords=blockend-blockstart;
+    vector<Int_t> localpfof(nlocalrecords,0);
+    for (Int_t i=0;i<nrecv;i+=2) localpfof[recvbuf[i]-blockstart]=recvbuf[i+1];
+    delete[] recvbuf;
+    vector<char> writebuf(nlocalrecords*width+1);
+    for (Int_t i=0;i<nlocalrecords;i++) snprintf(&writebuf[i*width], width+1, "%*lld\n", width-1, (long long)localpfof[i]);
+    localpfof.clear();
+
+    //and write collectively in chunks limited by the maximum mpi message size
+    MPI_File fh;
+    MPI_Status status;
+    MPI_File_open(MPI_COMM_WORLD, fname, MPI_MODE_CREATE|MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+    MPI_File_set_size(fh, 0);
+    if (ThisTask==0) MPI_File_write_at(fh, 0, (void*)header.c_str(), header.size(), MPI_CHAR, &status);
+    long long nbytes=(long long)nlocalrecords*width, nchunks, maxnchunks;
+    nchunks=(nbytes+LOCAL_MAX_MSGSIZE-1)/LOCAL_MAX_MSGSIZE;
+    MPI_Allreduce(&nchunks, &maxnchunks, 1, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Offset offset=header.size()+(MPI_Offset)blockstart*width;
+    long long nwritten=0;
+    for (long long ichunk=0;ichunk<maxnchunks;ichunk++) {
+        int nwrite=min(nbytes-nwritten, (long long)LOCAL_MAX_MSGSIZE);
+        MPI_File_write_at_all(fh, offset+nwritten, &writebuf[nwritten], nwrite, MPI_CHAR, &status);
+        nwritten+=nwrite;
+    }
+    MPI_File_close(&fh);
+    if (ThisTask==0) cout<<"Done"<<endl;
+}
+#endif
+
 /*! Writes a particle group list array file that contains the total number of groups,
     local number of groups (if using MPI) and group id followed by number of particles
     in that group and particle ids in the group
@@ -3427,6 +3545,79 @@ void WriteHierarchy(Options &opt, const Int_t &ngroups, const Int_t & nhierarchy
     cout<<"Done saving hierarchy"<<endl;
 }
 
+///Queues the properties, catalogue, particle type and hierarchy output of a set of groups on the output queue.
+///The job owns copies of everything it writes, including the output name, with only the ids and types of particles
+///in groups kept and pglist remapped to this compact particle list, so the caller can reorder Part, free pglist and
+///rename opt.outname once queued. Note that the properties are copied in full, so each queued job holds a copy of
+///the property catalogue of its groups.
+///Arguments match those of \ref WriteProperties, \ref WriteGroupCatalog and \ref WriteHierarchy, with
+///nhierarchygroups the number of groups passed to the latter.
+void QueueGroupOutput(OutputQueue &writer, Options &opt, const Int_t ngroups, Int_t *numingroup, Int_t **pglist, vector<Particle> &Part,
+    PropData *pdata, Int_t nadditional, const Int_t nhierarchygroups, const Int_t nhierarchy, const Int_t nfield,
+    Int_t *nsub, Int_t *parentgid, Int_t *stype, int subflag)
+{
+    struct GroupOutputBuffer {
+        Options opt;
+        string outname;
+        Int_t ngroups, nadditional, nhierarchygroups, nhierarchy, nfield;
+        int subflag;
+        vector<PropData> pdata;
+        vector<Int_t> numingroup, pgdata, nsub, parentgid, stype;
+        vector<Int_t*> pglist;
+        vector<Particle> Part;
+    };
+    auto buf=make_shared<GroupOutputBuffer>();
+    Int_t npart=0;
+
+    buf->opt=opt;
+    //the caller may rename opt.outname in place once queued (e.g. to .sublevels), so the job keeps its own copy
+    buf->outname=opt.outname;
+    buf->opt.outname=&buf->outname[0];
+    buf->ngroups=ngroups;
+    buf->nadditional=nadditional;
+    buf->nhierarchygroups=nhierarchygroups;
+    buf->nhierarchy=nhierarchy;
+    buf->nfield=nfield;
+    buf->subflag=subflag;
+    buf->pdata.assign(pdata,pdata+ngroups+1);
+    buf->numingroup.assign(numingroup,numingroup+ngroups+1);
+    buf->nsub.assign(nsub,nsub+nhierarchygroups+1);
+    buf->parentgid.assign(parentgid,parentgid+nhierarchygroups+1);
+    buf->stype.assign(stype,stype+nhierarchygroups+1);
+
+    //compact copy of the particles in groups, each pglist also stores the number of bound particles at its end
+    for (Int_t i=1;i<=ngroups;i++) npart+=numingroup[i];
+    buf->Part.resize(npart);
+    buf->pgdata.resize(npart+ngroups);
+    buf->pglist.resize(ngroups+1,NULL);
+    npart=0;
+    Int_t *pg=buf->pgdata.data();
+    for (Int_t i=1;i<=ngroups;i++) {
+        buf->pglist[i]=pg;
+        for (Int_t j=0;j<numingroup[i];j++) {
+            buf->Part[npart].SetPID(Part[pglist[i][j]].GetPID());
+            buf->Part[npart].SetType(Part[pglist[i][j]].GetType());
+            pg[j]=npart++;
+        }
+        pg[numingroup[i]]=pglist[i][numingroup[i]];
+        pg+=numingroup[i]+1;
+    }
+
+    //mirror the in place unit conversion done by WriteProperties so that
+    //later output sees the same state as when writing synchronously
+    if (opt.icomoveunit) {
+        opt.p*=opt.h/opt.a;
+        for (Int_t i=1;i<=ngroups;i++) pdata[i].ConverttoComove(opt);
+    }
+
+    writer.Push([buf](){
+        WriteProperties(buf->opt,buf->ngroups,buf->pdata.data());
+        WriteGroupCatalog(buf->opt,buf->ngroups,buf->numingroup.data(),buf->pglist.data(),buf->Part,buf->nadditional);
+        if (buf->opt.partsearchtype==PSTALL) WriteGroupPartType(buf->opt,buf->ngroups,buf->numingroup.data(),buf->pglist.data(),buf->Part);
+        WriteHierarchy(buf->opt,buf->nhierarchygroups,buf->nhierarchy,buf->nfield,buf->nsub.data(),buf->parentgid.data(),buf->stype.data(),buf->subflag);
+    });
+}
+
 ///Write subfind style format of properties, where selection of properties
 ///are written for FOF objects and a larger selection of properties are written
 ///for each object
@@ -136,30 +136,55 @@ if (nbodies > ompsubsearchnum)
 }
 
 
-void DetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *Part, Double_t &meanr,Double_t &sdlow,Double_t &sdhigh, int sublevel)
+/// Reductions applied to the binned ratio distribution. When all particles are local these do nothing.
+struct DenVRatioReduction
+{
+    virtual void Sum(Double_t *x, int n) {}
+    virtual void Min(Double_t &x) {}
+    virtual void Max(Double_t &x) {}
+};
+
+#ifdef USEMPI
+/// Reductions over the tasks of a communicator so that every task fits the same distribution
+struct MPIDenVRatioReduction : DenVRatioReduction
+{
+    MPI_Comm comm;
+    MPIDenVRatioReduction(MPI_Comm c) {comm=c;}
+    void Sum(Double_t *x, int n) {MPI_Allreduce(MPI_IN_PLACE, x, n, MPI_Real_t, MPI_SUM, comm);}
+    void Min(Double_t &x) {MPI_Allreduce(MPI_IN_PLACE, &x, 1, MPI_Real_t, MPI_MIN, comm);}
+    void Max(Double_t &x) {MPI_Allreduce(MPI_IN_PLACE, &x, 1, MPI_Real_t, MPI_MAX, comm);}
+};
+#endif
+
+static void DenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *Part, Double_t &meanr,Double_t &sdlow,Double_t &sdhigh, int sublevel, DenVRatioReduction &reduce)
 {
     Int_t i,nbins,iprob,jprob;
-    Double_t mtot,mtotpeak,deltar,maxprob,minprob,rmin,rmax;
+    Double_t mtot,mtotpeak,deltar,maxprob,minprob,rmin,rmax,npeak,ntot=nbodies;
     vector<Double_t> rbin;
     vector<Double_t> xbin;
+    vector<Double_t> wbin;
     int nthreads=1,tid;
     Double_t w;
     unsigned int ir;
     const int MINBIN = 5;
+    //statistics are based on the total number of particles across all tasks holding the object
+    reduce.Sum(&ntot,1);
     //to determine initial number of bins using modified Sturges' formula
-    nbins = max((int)ceil(log10((Double_t)nbodies)/log10(2.0)+1)*4, MINBIN);
+    nbins = max((int)ceil(log10(ntot)/log10(2.0)+1)*4, MINBIN);
 
     //deterrmine average, rmin,rmax and variance about mean
-    rmin=rmax=Part[0].GetPotential();
+    rmin=MAXVALUE;rmax=-MAXVALUE;
 #ifdef USEOPENMP
     #pragma omp parallel for default(shared) \
     private(i,tid) schedule(static) \
     reduction(min:rmin) reduction(max:rmax) if (nbodies > ompperiodnum)
 #endif
-    for (i=1;i<nbodies;i++) {
+    for (i=0;i<nbodies;i++) {
         if (rmin>Part[i].GetPotential())rmin=Part[i].GetPotential();
         if (rmax<Part[i].GetPotential())rmax=Part[i].GetPotential();
     }
+    reduce.Min(rmin);
+    reduce.Max(rmax);
 
     //now bin data and find initial estimates for most probable value and the FWHM on either side of the most probable value
     //deltar=(rmax-rmin)/(Double_t)nbins;
@@ -184,6 +209,8 @@ void DetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *
         rbin[ir]+=w;
         mtot+=w;
     }
+    reduce.Sum(rbin.data(),nbins);
+    reduce.Sum(&mtot,1);
 
     maxprob=0.;
     for (i=0;i<nbins;i++) {
@@ -217,7 +244,7 @@ void DetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *
     }
 
     //if object is small or bg search (ie sublevel==-1, then to keep statistics high, use preliminary determination of the variance and mean.
-    if (nbodies<2*MINSUBSIZE) {
+    if (ntot<2*MINSUBSIZE) {
         if (opt.iverbose>=2) printf("Using meanr=%e sdlow=%e sdhigh=%e\n",meanr,sdlow,sdhigh);
         return;
     }
@@ -229,8 +256,9 @@ void DetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *
         mtotpeak=0;
         rmin=(meanr-sl*sdlow);
         rmax=(meanr+sl*sdhigh);
-        int npeak=0;
+        npeak=0;
         for (i=0;i<nbodies;i++) if (Part[i].GetPotential()>=rmin&&Part[i].GetPotential()<rmax) npeak++;
+        reduce.Sum(&npeak,1);
         //once have initial estimates of variance bin using Scott's formula
         //deltar=3.5*sdlow/pow(nbodies,1./3.);
         deltar=3.5*sqrt(sdlow*sdlow+sdhigh*sdhigh)/pow(npeak,1./3.);
@@ -240,7 +268,8 @@ void DetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *
         deltar = (rmax-rmin)/(double)nbins;
         W=GMatrix(nbins,nbins);
         rbin.resize(nbins);
-        for (i=0;i<nbins;i++)rbin[i]=0;
+        wbin.resize(nbins);
+        for (i=0;i<nbins;i++)rbin[i]=wbin[i]=0;
         for (int j=0;j<nbins;j++) for (int k=0;k<nbins;k++) W(j,k)=0.;
         for (i=0;i<nbodies;i++) {
             if (Part[i].GetPotential()>=rmin && Part[i].GetPotential()<rmax) {
@@ -254,10 +283,14 @@ void DetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *
                 w = 1.0;
 #endif
                 rbin[ir]+=w;
-                W(ir,ir)+=w*w;
+                wbin[ir]+=w*w;
                 mtotpeak+=w;
             }
         }
+        reduce.Sum(rbin.data(),nbins);
+        reduce.Sum(wbin.data(),nbins);
+        reduce.Sum(&mtotpeak,1);
+        for (i=0;i<nbins;i++) W(i,i)=wbin[i];
         sl*=1.25;
     }while (mtotpeak/mtot<0.2);
 
@@ -299,7 +332,7 @@ void DetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *
     //adjust sdhigh to sdlow due to assymetry
     sdhigh=sdlow;
     //again, if number of particles is low (and so bin statisitics is poor) use initial estimate
-    if (nbodies<16*MINSUBSIZE||sublevel==-1) {
+    if (ntot<16*MINSUBSIZE||sublevel==-1) {
         if (opt.iverbose>=2) printf("Using meanr=%e sdlow=%e sdhigh=%e\n",meanr,sdlow,sdhigh);
         return;
     }
@@ -365,6 +398,24 @@ void DetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *
     if (opt.iverbose>=2) printf("Using meanr=%e sdlow=%e sdhigh=%e\n",meanr,sdlow,sdhigh);
 }
 
+void DetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *Part, Double_t &meanr,Double_t &sdlow,Double_t &sdhigh, int sublevel)
+{
+    DenVRatioReduction reduce;
+    DenVRatioDistribution(opt, nbodies, Part, meanr, sdlow, sdhigh, sublevel, reduce);
+}
+
+#ifdef USEMPI
+/*! Like \ref DetermineDenVRatioDistribution but for an object whose particles are spread over the tasks of comm.
+    The binned distribution is summed over the communicator, so every task fits the same distribution and the
+    result is identical to that of the object held by a single task.
+*/
+void MPIDetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *Part, Double_t &meanr,Double_t &sdlow,Double_t &sdhigh, int sublevel, MPI_Comm comm)
+{
+    MPIDenVRatioReduction reduce(comm);
+    DenVRatioDistribution(opt, nbodies, Part, meanr, sdlow, sdhigh, sublevel, reduce);
+}
+#endif
+
 /*! Calculates the normalized deviations from the mean of the dominated population.
     \todo note that before had FOFSTPROB set density to probability, but here set to ell, the normalized logaritmic "distance" from predicted maxwellian velocity density)
     but could add routine that transforms these values to probablity if necessary.
@@ -383,7 +434,25 @@ Int_t GetOutliersValues(Options &opt, const Int_t nbodies, Particle *Part, int s
     Double_t globalave,globalvar,globalmostprob,globalsdlow,globalsdhigh;
 
     DetermineDenVRatioDistribution(opt,nbodies,Part,globalmostprob,globalsdlow,globalsdhigh, sublevel);
+    nsubset=NormaliseDenVRatio(opt,nbodies,Part,globalmostprob,globalsdlow,globalsdhigh);
+    if (opt.iverbose>=2) cout<<ThisTask<<" Done"<<endl;
+    return nsubset;
+}
+
+#ifdef USEMPI
+///Like \ref GetOutliersValues but for an object whose particles are spread over the tasks of comm. Returns the local number of outliers
+Int_t MPIGetOutliersValues(Options &opt, const Int_t nbodies, Particle *Part, int sublevel, MPI_Comm comm)
+{
+    Double_t globalmostprob,globalsdlow,globalsdhigh;
+    MPIDetermineDenVRatioDistribution(opt,nbodies,Part,globalmostprob,globalsdlow,globalsdhigh,sublevel,comm);
+    return NormaliseDenVRatio(opt,nbodies,Part,globalmostprob,globalsdlow,globalsdhigh);
+}
+#endif
 
+///Replaces the ratio by its normalised deviation from the most probable value and returns the number of outliers
+Int_t NormaliseDenVRatio(Options &opt, const Int_t nbodies, Particle *Part, Double_t globalmostprob, Double_t globalsdlow, Double_t globalsdhigh)
+{
+    Int_t nsubset = 0;
     Double_t temp2,temp3, tempell;
     temp2=1.0/(globalsdhigh);
     temp3=1.0/(globalsdlow);
@@ -399,6 +468,5 @@ Int_t GetOutliersValues(Options &opt, const Int_t nbodies, Particle *Part, int s
         Part[i].SetPotential(tempell);
         nsubset+=(Part[i].GetPotential()>opt.ellthreshold);
     }
-    if (opt.iverbose>=2) cout<<ThisTask<<" Done"<<endl;
     return nsubset;
 }
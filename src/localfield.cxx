@@ -147,14 +147,13 @@ private(i,j,k,tid,id,v2,nnids,nnr2,nnidsneighbours,nnr2neighbours,weight,pqx,pqv
 
     if (opt.impiusemesh) MPIGetNNExportNumUsingMesh(opt, nbodies, Part, maxrdist);
     else MPIGetNNExportNum(nbodies, Part, maxrdist);
-    NNDataIn = new nndata_in[NExport];
-    NNDataGet = new nndata_in[NImport];
+    MPIAllocateNNCommBuffers(NExport, NImport);
     //build the exported particle list using NNData structures
     if (opt.impiusemesh) MPIBuildParticleNNExportListUsingMesh(opt, nbodies, Part, maxrdist);
     else MPIBuildParticleNNExportList(nbodies, Part, maxrdist);
     MPIGetNNImportNum(nbodies, tree, Part, (!(opt.iBaryonSearch>=1 && opt.partsearchtype==PSTALL)));
-    PartDataIn = new Particle[NExport];
-    PartDataGet = new Particle[NImport];
+    MPIAllocatePartCommBuffers(NExport, NImport);
+    MPIReportPlannedMemory(opt, nbodies, "Local velocity density");
     MPI_Barrier(MPI_COMM_WORLD);
     //run search on exported particles and determine which local particles need to be exported back (or imported)
     nimport=MPIBuildParticleNNImportList(opt, nbodies, tree, Part, (!(opt.iBaryonSearch>=1 && opt.partsearchtype==PSTALL)));
@@ -258,10 +257,8 @@ private(i,j,k,tid,pid,pid2,v2,nnids,nnr2,nnidsneighbours,nnr2neighbours,weight,p
     //free memory
     if (itreeflag) delete tree;
     if (nimport>0) delete treeneighbours;
-    delete[] PartDataIn;
-    delete[] PartDataGet;
-    delete[] NNDataIn;
-    delete[] NNDataGet;
+    //hand the communication buffers filled by this exchange back to the arena
+    MPIReleaseCommBuffers();
     if(opt.iverbose) cout<<ThisTask<<" finished other domain search "<<MyGetTime()-time2<<endl;
 #else
     //NO MPI invoked
@@ -601,14 +598,13 @@ private(i,j,k,tid,id,v2,nnids,nnr2,weight,pqv)
     //determines export AND import numbers
     if (opt.impiusemesh) MPIGetNNExportNumUsingMesh(opt, nbodies, Part, maxrdist);
     else MPIGetNNExportNum(nbodies, Part, maxrdist);
-    NNDataIn = new nndata_in[NExport];
-    NNDataGet = new nndata_in[NImport];
+    MPIAllocateNNCommBuffers(NExport, NImport);
     //build the exported particle list using NNData structures
     if (opt.impiusemesh) MPIBuildParticleNNExportListUsingMesh(opt, nbodies, Part, maxrdist);
     else MPIBuildParticleNNExportList(nbodies, Part, maxrdist);
     MPIGetNNImportNum(nbodies, tree, Part, (!(opt.iBaryonSearch>=1 && opt.partsearchtype==PSTALL)));
-    PartDataIn = new Particle[NExport];
-    PartDataGet = new Particle[NImport];
+    MPIAllocatePartCommBuffers(NExport, NImport);
+    MPIReportPlannedMemory(opt, nbodies, "Local velocity density");
     MPI_Barrier(MPI_COMM_WORLD);
     //run search on exported particles and determine which local particles need to be exported back (or imported)
     nimport=MPIBuildParticleNNImportList(opt, nbodies, tree, Part,(!(opt.iBaryonSearch>=1 && opt.partsearchtype==PSTALL)));
@@ -713,10 +709,8 @@ private(i,j,k,tid,pid,pid2,v2,nnids,nnr2,nnidsneighbours,nnr2neighbours,weight,p
 #endif
     //free memory
     if (nimport>0) delete treeneighbours;
-    delete[] PartDataIn;
-    delete[] PartDataGet;
-    delete[] NNDataIn;
-    delete[] NNDataGet;
+    //hand the communication buffers filled by this exchange back to the arena
+    MPIReleaseCommBuffers();
     if(opt.iverbose) cout<<ThisTask<<" finished other domain search "<<MyGetTime()-time2<<endl;
     }
 #endif
@@ -918,17 +912,14 @@ reduction(+:nprocessed,ntot)
     if (opt.impiusemesh) MPIGetNNExportNumUsingMesh(opt, nbodies, Part, maxrdist);
     else MPIGetNNExportNum(nbodies, Part, maxrdist);
 
-    NNDataIn = NNDataGet = NULL;
-    if (NExport>0) NNDataIn = new nndata_in[NExport];
-    if (NImport>0) NNDataGet = new nndata_in[NImport];
+    MPIAllocateNNCommBuffers(NExport, NImport);
     //build the exported particle list using NNData structures
     if (opt.impiusemesh) MPIBuildParticleNNExportListUsingMesh(opt, nbodies, Part, maxrdist);
     else MPIBuildParticleNNExportList(nbodies, Part, maxrdist);
     delete[] maxrdist;
     MPIGetNNImportNum(nbodies, tree, Part,(!(opt.iBaryonSearch>=1 && opt.partsearchtype==PSTALL)));
-    PartDataIn = PartDataGet = NULL;
-    if (NExport>0) PartDataIn = new Particle[NExport];
-    if (NImport>0) PartDataGet = new Particle[NImport];
+    MPIAllocatePartCommBuffers(NExport, NImport);
+    MPIReportPlannedMemory(opt, nbodies, "Local velocity density");
     //run search on exported particles and determine which local particles need to be exported back (or imported)
     nimport=MPIBuildParticleNNImportList(opt, nbodies, tree, Part, (!(opt.iBaryonSearch>=1 && opt.partsearchtype==PSTALL)));
     int nimportsearch=opt.Nsearch;
@@ -1040,10 +1031,8 @@ reduction(+:nprocessed)
 #endif
         delete treeneighbours;
     }
-    delete[] PartDataIn;
-    delete[] PartDataGet;
-    delete[] NNDataIn;
-    delete[] NNDataGet;
+    //hand the communication buffers filled by this exchange back to the arena
+    MPIReleaseCommBuffers();
     if(opt.iverbose) {
         cout<<ThisTask<<" finished other domain search "<<MyGetTime()-time2<<endl;
         cout<<ThisTask<<" mpi processed fraction "<<nprocessed/(float)ntot<<endl;
@@ -1055,3 +1044,207 @@ reduction(+:nprocessed)
     if (itreeflag) delete tree;
     if (period!=NULL) delete[] period;
 }
+
+#ifdef USEMPI
+///Velocity density of particle i from its nearest physical neighbours already found in nnids, see \ref GetVelocityDensityExact
+inline Double_t VelocityDensityFromNeighbours(Options &opt, KDTree *tree, Particle *Part, Int_t i, Int_t *nnids, Double_t *weight, PriorityQueue *pqv)
+{
+    Double_t v2;
+    for (auto j=0;j<opt.Nvel;j++) {
+        pqv->Push(-1, MAXVALUE);
+        weight[j]=1.0;
+    }
+    for (auto j=0;j<opt.Nsearch;j++) {
+        v2=0;
+        Int_t id=nnids[j];
+        for (auto k=0;k<3;k++) v2+=(Part[i].GetVelocity(k)-Part[id].GetVelocity(k))*(Part[i].GetVelocity(k)-Part[id].GetVelocity(k));
+        if (v2 < pqv->TopPriority()){
+            pqv->Pop();
+            pqv->Push(id, v2);
+        }
+    }
+    return tree->CalcSmoothLocalValue(opt.Nvel, pqv, weight);
+}
+
+/*! Velocity density of an object whose particles are spread over the tasks of comm. Only particles of the object are
+    used as neighbours, as in \ref GetVelocityDensityHaloOnlyDen for an object held by a single task.\n
+    The nearest physical neighbours are first found locally. Particles whose search radius lies within the local
+    particles' extent are done. The others are sent to the tasks whose extent their search radius overlaps, which
+    return their particles within the search radius, and the density is recalculated using local and imported particles.
+*/
+void MPIGetVelocityDensityDistributed(Options &opt, const Int_t nbodies, Particle *Part, MPI_Comm comm)
+{
+    int commsize, commrank, nthreads=1;
+    Int_t nimport, nexport;
+    KDTree *tree;
+    Int_t *nnids;
+    Double_t *nnr2, *weight;
+    PriorityQueue *pqv;
+    MPI_Comm_size(comm, &commsize);
+    MPI_Comm_rank(comm, &commrank);
+#ifdef USEOPENMP
+#pragma omp parallel
+    {
+            if (omp_get_thread_num()==0) nthreads=omp_get_num_threads();
+    }
+#endif
+
+    //extent of the local particles of every task
+    vector<Double_t> xlim(6*commsize);
+    for (auto k=0;k<3;k++) {xlim[6*commrank+2*k]=MAXVALUE;xlim[6*commrank+2*k+1]=-MAXVALUE;}
+    for (auto i=0;i<nbodies;i++) for (auto k=0;k<3;k++) {
+        xlim[6*commrank+2*k]=min(xlim[6*commrank+2*k],(Double_t)Part[i].GetPosition(k));
+        xlim[6*commrank+2*k+1]=max(xlim[6*commrank+2*k+1],(Double_t)Part[i].GetPosition(k));
+    }
+    MPI_Allgather(MPI_IN_PLACE, 6, MPI_Real_t, xlim.data(), 6, MPI_Real_t, comm);
+
+    //local search, if there are too few local particles, every other task is searched
+    vector<Double_t> maxrdist(nbodies,MAXVALUE);
+    tree=new KDTree(Part,nbodies,opt.Bsize,tree->TPHYS,tree->KEPAN,1000,0,0,0);
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) \
+private(nnids,nnr2,weight,pqv)
+{
+#endif
+    nnids=new Int_t[opt.Nsearch];
+    nnr2=new Double_t[opt.Nsearch];
+    weight=new Double_t[opt.Nvel];
+    pqv=new PriorityQueue(opt.Nvel);
+#ifdef USEOPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for (auto i=0;i<nbodies;i++) {
+        if (nbodies<opt.Nsearch) continue;
+        tree->FindNearest(i,nnids,nnr2,opt.Nsearch);
+        maxrdist[i]=sqrt(nnr2[opt.Nsearch-1]);
+        Part[i].SetDensity(VelocityDensityFromNeighbours(opt, tree, Part, i, nnids, weight, pqv));
+    }
+    delete[] nnids;
+    delete[] nnr2;
+    delete[] weight;
+    delete pqv;
+#ifdef USEOPENMP
+}
+#endif
+
+    //find particles whose search radius overlaps the extent of another task
+    vector<int> sendcount(commsize,0), recvcount(commsize,0), sendoffset(commsize,0), recvoffset(commsize,0);
+    vector<vector<Int_t>> exportlist(commsize);
+    vector<bool> iexport(nbodies,false);
+    for (auto i=0;i<nbodies;i++) {
+        for (auto j=0;j<commsize;j++) {
+            if (j==commrank) continue;
+            Double_t r2=0, dx;
+            for (auto k=0;k<3;k++) {
+                dx=max((Double_t)0,max(xlim[6*j+2*k]-Part[i].GetPosition(k),Part[i].GetPosition(k)-xlim[6*j+2*k+1]));
+                r2+=dx*dx;
+            }
+            if (r2<maxrdist[i]*maxrdist[i]) {exportlist[j].push_back(i);iexport[i]=true;}
+        }
+    }
+    for (auto j=0;j<commsize;j++) sendcount[j]=exportlist[j].size()*sizeof(nndata_in);
+    MPI_Alltoall(sendcount.data(), 1, MPI_INT, recvcount.data(), 1, MPI_INT, comm);
+    for (auto j=1;j<commsize;j++) {
+        sendoffset[j]=sendoffset[j-1]+sendcount[j-1];
+        recvoffset[j]=recvoffset[j-1]+recvcount[j-1];
+    }
+    nexport=(sendoffset[commsize-1]+sendcount[commsize-1])/sizeof(nndata_in);
+    nimport=(recvoffset[commsize-1]+recvcount[commsize-1])/sizeof(nndata_in);
+    vector<nndata_in> nnsend(nexport), nnrecv(nimport);
+    nexport=0;
+    for (auto j=0;j<commsize;j++) for (auto &i:exportlist[j]) {
+        nnsend[nexport].Pos=Coordinate(Part[i].GetPosition());
+        nnsend[nexport].R2=maxrdist[i]*maxrdist[i];
+        nnsend[nexport].FromTask=commrank;
+        nnsend[nexport].ToTask=j;
+        nexport++;
+    }
+    MPI_Alltoallv(nnsend.data(), sendcount.data(), sendoffset.data(), MPI_BYTE,
+        nnrecv.data(), recvcount.data(), recvoffset.data(), MPI_BYTE, comm);
+
+    //return the local particles within the search radius of the imported particles, each at most once per task
+    vector<int> itaskflagged(nbodies,-1);
+    for (auto &x:exportlist) x.clear();
+    for (auto i=0;i<nimport;i++) {
+        int itask=nnrecv[i].FromTask;
+        vector<Int_t> taggedindex=tree->SearchBallPosTagged(nnrecv[i].Pos, nnrecv[i].R2);
+        for (auto &index:taggedindex) {
+            if (itaskflagged[index]==itask) continue;
+            itaskflagged[index]=itask;
+            exportlist[itask].push_back(index);
+        }
+    }
+    vector<nndata_in>().swap(nnsend);
+    vector<nndata_in>().swap(nnrecv);
+    for (auto j=0;j<commsize;j++) sendcount[j]=exportlist[j].size()*sizeof(Particle);
+    MPI_Alltoall(sendcount.data(), 1, MPI_INT, recvcount.data(), 1, MPI_INT, comm);
+    for (auto j=1;j<commsize;j++) {
+        sendoffset[j]=sendoffset[j-1]+sendcount[j-1];
+        recvoffset[j]=recvoffset[j-1]+recvcount[j-1];
+    }
+    nexport=(sendoffset[commsize-1]+sendcount[commsize-1])/sizeof(Particle);
+    nimport=(recvoffset[commsize-1]+recvcount[commsize-1])/sizeof(Particle);
+    //only mass, position and velocity are needed so copies without extra properties are sent
+    vector<Particle> psend(nexport), precv(nimport);
+    nexport=0;
+    for (auto j=0;j<commsize;j++) for (auto &i:exportlist[j]) {
+        psend[nexport++]=Particle(Part[i].GetMass(),
+            Part[i].GetPosition(0),Part[i].GetPosition(1),Part[i].GetPosition(2),
+            Part[i].GetVelocity(0),Part[i].GetVelocity(1),Part[i].GetVelocity(2),0);
+    }
+    exportlist.clear();
+    MPI_Alltoallv(psend.data(), sendcount.data(), sendoffset.data(), MPI_BYTE,
+        precv.data(), recvcount.data(), recvoffset.data(), MPI_BYTE, comm);
+    vector<Particle>().swap(psend);
+
+    //recalculate the density of exported particles using local and imported particles
+    vector<Int_t> localindex;
+    for (auto i=0;i<nbodies;i++) if (iexport[i]) localindex.push_back(i);
+    KDTree *localtree=tree;
+    if (localindex.size()>0 && nbodies+nimport>=opt.Nsearch) {
+        Int_t nall=nbodies+nimport;
+        Particle *Pall=new Particle[nall];
+        for (auto i=0;i<nbodies;i++) Pall[i]=Particle(Part[i].GetMass(),
+            Part[i].GetPosition(0),Part[i].GetPosition(1),Part[i].GetPosition(2),
+            Part[i].GetVelocity(0),Part[i].GetVelocity(1),Part[i].GetVelocity(2),i);
+        for (auto i=0;i<nimport;i++) {
+            Pall[nbodies+i]=precv[i];
+            Pall[nbodies+i].SetID(nbodies+i);
+        }
+        vector<Particle>().swap(precv);
+        tree=new KDTree(Pall,nall,opt.Bsize,tree->TPHYS,tree->KEPAN,1000,0,0,0);
+        //tree reorders the particles, so store where each local particle is
+        vector<Int_t> treeindex(nall);
+        for (auto i=0;i<nall;i++) treeindex[Pall[i].GetID()]=i;
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) \
+private(nnids,nnr2,weight,pqv)
+{
+#endif
+        nnids=new Int_t[opt.Nsearch];
+        nnr2=new Double_t[opt.Nsearch];
+        weight=new Double_t[opt.Nvel];
+        pqv=new PriorityQueue(opt.Nvel);
+#ifdef USEOPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (auto j=0;j<localindex.size();j++) {
+            Int_t i=treeindex[localindex[j]];
+            tree->FindNearest(i,nnids,nnr2,opt.Nsearch);
+            Part[localindex[j]].SetDensity(VelocityDensityFromNeighbours(opt, tree, Pall, i, nnids, weight, pqv));
+        }
+        delete[] nnids;
+        delete[] nnr2;
+        delete[] weight;
+        delete pqv;
+#ifdef USEOPENMP
+}
+#endif
+        delete tree;
+        delete[] Pall;
+    }
+    //deleting the local tree returns the particles to their input order
+    tree=localtree;
+    delete tree;
+}
+#endif
@@ -162,6 +162,8 @@ int main(int argc,char **argv)
 
 #ifdef USEMPI
     MPI_Bcast(&nbodies,1, MPI_Int_t,0,MPI_COMM_WORLD);
+    //store total so that domain decomposition can scale mesh resolution
+    Ntotal=nbodies;
     //if MPI, possible desired particle types not present in file so update used particle types
     MPIUpdateUseParticleTypes(opt);
     if (opt.iBaryonSearch>0) MPI_Bcast(&nbaryons,1, MPI_Int_t,0,MPI_COMM_WORLD);
@@ -206,7 +208,6 @@ int main(int argc,char **argv)
         Nmemlocal=Nlocal;
         Nlocalbaryon[0]=nbaryons/NProcs*MPIProcFac;
         Nmemlocalbaryon=Nlocalbaryon[0];
-        NExport=NImport=Nlocal*MPIExportFac;
         cout<<ThisTask<<" Have allocated enough memory for "<<Nmemlocal<<" requiring "<<Nmemlocal*sizeof(Particle)/1024./1024./1024.<<"GB of memory "<<endl;
         if (opt.iBaryonSearch>0) cout<<" Have allocated enough memory for "<<Nmemlocalbaryon<<" baryons particles requiring "<<Nmemlocalbaryon*sizeof(Particle)/1024./1024./1024.<<"GB of memory "<<endl;
 #endif
@@ -226,8 +227,13 @@ int main(int argc,char **argv)
 
     //now read particle data
     if (ThisTask==0) cout<<"Loading ... "<<endl;
+#ifdef USEMPI
+    //particle numbers are only estimates so local array grows as particles arrive
+    if (opt.impisinglepassread) mpi_growable_part=&Part;
+#endif
     ReadData(opt, Part, nbodies, Pbaryons, nbaryons);
 #ifdef USEMPI
+    mpi_growable_part=NULL;
     //if mpi and want separate baryon search then once particles are loaded into contigous block of memory and sorted according to type order,
     //allocate memory for baryons
     if (opt.iBaryonSearch>0 && opt.partsearchtype!=PSTALL) {
@@ -243,7 +249,6 @@ int main(int argc,char **argv)
 #ifdef USEMPI
     Ntotal=nbodies;
     nbodies=Nlocal;
-    NExport=NImport=Nlocal*MPIExportFac;
     mpi_period=opt.p;
     MPI_Allgather(&nbodies, 1, MPI_Int_t, mpi_nlocal, 1, MPI_Int_t, MPI_COMM_WORLD);
     MPI_Allreduce(&nbodies, &Ntotal, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
@@ -293,9 +298,6 @@ int main(int argc,char **argv)
         cout<<"TIME:: took "<<time1<<" to search "<<nbodies<<" with "<<nthreads<<endl;
 #else
         //nbodies=Ntotal;
-        ///\todo Communication Buffer size determination and allocation. For example, eventually need something like FoFDataIn = (struct fofdata_in *) CommBuffer;
-        ///At the moment just using NExport
-        NExport=Nlocal*MPIExportFac;
         //Now when MPI invoked this returns pfof after local linking and linking across and also reorders groups
         //according to size and localizes the particles belong to the same group to the same mpi thread.
         //after this is called Nlocal is adjusted to the local subset where groups are localized to a given mpi thread.
@@ -366,9 +368,6 @@ int main(int argc,char **argv)
         pfof=SearchSubset(opt,nbodies,nbodies,Part.data(),ngroup);
 #else
         //nbodies=Ntotal;
-        ///\todo Communication Buffer size determination and allocation. For example, eventually need something like FoFDataIn = (struct fofdata_in *) CommBuffer;
-        ///At the moment just using NExport
-        NExport=Nlocal*MPIExportFac;
         mpi_foftask=MPISetTaskID(nbodies);
 
         //Now when MPI invoked this returns pfof after local linking and linking across and also reorders groups
@@ -433,6 +432,16 @@ int main(int argc,char **argv)
         Nlocal=nbodies;
     }
 
+#if defined(USEHDF) && defined(EXTRAINPUTINFO)
+    //now that groups are final, read fields only needed for the properties of particles in groups
+    if (opt.ilazyextrafields && opt.inputtype==IOHDF) {
+        time1=MyGetTime();
+        ReadHDFExtraFieldsOfGroupParticles(opt, Nlocal, Part.data(), pfof);
+        time1=MyGetTime()-time1;
+        cout<<"TIME::"<<ThisTask<<" took "<<time1<<" to read extra input fields of particles in groups"<<endl;
+    }
+#endif
+
     //output results
     //if want to ignore any information regard particles themselves as particle PIDS are meaningless
     //which might be useful for runs where not interested in tracking just halo catalogues (save for
@@ -461,30 +470,34 @@ int main(int argc,char **argv)
     //if want a simple tipsy still array listing particles group ids in input order
     if(opt.iwritefof) {
 #ifdef USEMPI
-        if (ThisTask==0) {
-            mpi_pfof=new Int_t[Ntotal];
-            //since pfof is a local subset, not all pfof values have been set, thus initialize them to zero.
-            for (Int_t i=0;i<Ntotal;i++) mpi_pfof[i]=0;
-        }
-        MPICollectFOF(Ntotal, pfof);
-        if (ThisTask==0) WriteFOF(opt,Ntotal,mpi_pfof);
+        //if baryons searched separately, the particle array does not contain all particles
+        if (opt.iBaryonSearch>0 && opt.partsearchtype!=PSTALL) MPIWriteFOF(opt,Nlocal,NULL,pfof);
+        else MPIWriteFOF(opt,Nlocal,Part.data(),pfof);
 #else
         WriteFOF(opt,nbodies,pfof);
 #endif
     }
     numingroup=BuildNumInGroup(Nlocal, ngroup, pfof);
+    //if asynchronous, group output is written by a separate thread while the next set of groups is processed
+    OutputQueue writer(opt.iasyncoutput, opt.asyncoutputmaxqueued);
 
     //if separate files explicitly save halos, associated baryons, and subhalos separately
     if (opt.iseparatefiles) {
         if (nhalos>0) {
             pglist=SortAccordingtoBindingEnergy(opt,Nlocal,Part.data(),nhalos,pfof,numingroup,pdata);//alters pglist so most bound particles first
-            WriteProperties(opt,nhalos,pdata);
-            WriteGroupCatalog(opt, nhalos, numingroup, pglist, Part,ngroup-nhalos);
-            //if baryons have been searched output related gas baryon catalogue
-            if (opt.partsearchtype==PSTALL){
-                WriteGroupPartType(opt, nhalos, numingroup, pglist, Part);
+            if (opt.iasyncoutput) {
+                QueueGroupOutput(writer, opt, nhalos, numingroup, pglist, Part, pdata, ngroup-nhalos,
+                    ngroup, nhierarchy, psldata->nsinlevel, nsub, parentgid, stype, 0);
+            }
+            else {
+                WriteProperties(opt,nhalos,pdata);
+                WriteGroupCatalog(opt, nhalos, numingroup, pglist, Part,ngroup-nhalos);
+                //if baryons have been searched output related gas baryon catalogue
+                if (opt.partsearchtype==PSTALL){
+                    WriteGroupPartType(opt, nhalos, numingroup, pglist, Part);
+                }
+                WriteHierarchy(opt,ngroup,nhierarchy,psldata->nsinlevel,nsub,parentgid,stype);
             }
-            WriteHierarchy(opt,ngroup,nhierarchy,psldata->nsinlevel,nsub,parentgid,stype);
             for (Int_t i=1;i<=nhalos;i++) delete[] pglist[i];
             delete[] pglist;
         }
@@ -513,13 +526,22 @@ int main(int argc,char **argv)
     }
 
     if (ng>0) {
+        //the property calculation in the sort can write the spherical overdensity particle lists (see \ref GetSOMasses),
+        //so finish any queued output first as the output libraries need not be thread safe
+        if (opt.iasyncoutput && opt.iSphericalOverdensityPartList) writer.Wait();
         pglist=SortAccordingtoBindingEnergy(opt,Nlocal,Part.data(),ng,pfof,&numingroup[indexii],&pdata[indexii],indexii);//alters pglist so most bound particles first
-        WriteProperties(opt,ng,&pdata[indexii]);
-        WriteGroupCatalog(opt, ng, &numingroup[indexii], pglist, Part);
-        if (opt.iseparatefiles) WriteHierarchy(opt,ngroup,nhierarchy,psldata->nsinlevel,nsub,parentgid,stype,1);
-        else WriteHierarchy(opt,ngroup,nhierarchy,psldata->nsinlevel,nsub,parentgid,stype,-1);
-        if (opt.partsearchtype==PSTALL){
-            WriteGroupPartType(opt, ng, &numingroup[indexii], pglist, Part);
+        if (opt.iasyncoutput) {
+            QueueGroupOutput(writer, opt, ng, &numingroup[indexii], pglist, Part, &pdata[indexii], 0,
+                ngroup, nhierarchy, psldata->nsinlevel, nsub, parentgid, stype, (opt.iseparatefiles?1:-1));
+        }
+        else {
+            WriteProperties(opt,ng,&pdata[indexii]);
+            WriteGroupCatalog(opt, ng, &numingroup[indexii], pglist, Part);
+            if (opt.iseparatefiles) WriteHierarchy(opt,ngroup,nhierarchy,psldata->nsinlevel,nsub,parentgid,stype,1);
+            else WriteHierarchy(opt,ngroup,nhierarchy,psldata->nsinlevel,nsub,parentgid,stype,-1);
+            if (opt.partsearchtype==PSTALL){
+                WriteGroupPartType(opt, ng, &numingroup[indexii], pglist, Part);
+            }
         }
         for (Int_t i=1;i<=ng;i++) delete[] pglist[i];
         delete[] pglist;
@@ -530,6 +552,8 @@ int main(int argc,char **argv)
         //MPI as domain, despite having no groups might need to exchange particles
         if (opt.iInclusiveHalo==3) SortAccordingtoBindingEnergy(opt,Nlocal,Part.data(),ng,pfof,numingroup,pdata);
 #endif
+        //output library need not be thread safe so finish any queued output first
+        writer.Wait();
         WriteProperties(opt,ng,NULL);
         WriteGroupCatalog(opt,ng,&numingroup[indexii],NULL,Part);
         if (opt.iseparatefiles) WriteHierarchy(opt,ngroup,nhierarchy,psldata->nsinlevel,nsub,parentgid,stype,1);
@@ -539,6 +563,9 @@ int main(int argc,char **argv)
         }
     }
 
+    //ensure all group output is on disk before writing anything else
+    writer.Wait();
+
     if (opt.iprofilecalc) WriteProfiles(opt, ngroup, pdata);
 
 #ifdef EXTENDEDHALOOUTPUT
@@ -564,6 +591,7 @@ int main(int argc,char **argv)
     GetMemUsage(opt, __func__+string("--line--")+to_string(__LINE__), (opt.iverbose>=0));
 
 #ifdef USEMPI
+    MPIFreeCommBuffers();
 #ifdef USEADIOS
     adios_finalize(ThisTask);
 #endif
@@ -122,6 +122,130 @@ void MPIDomainDecompositionHDF(Options &opt){
     }
 }
 
+///version of the snapshot index storing the number of particles in each mesh cell, used to skip reading positions
+#define HDFSNAPINDEXVERSION 1
+
+///name of the index file of the input
+static inline string HDFSnapshotIndexName(Options &opt)
+{
+    return string(opt.fname)+string(".vrindex");
+}
+
+///size and modification time of every input file, used to check the index still describes the input
+static void HDFSnapshotFileStats(Options &opt, vector<long long> &filesize, vector<long long> &filetime)
+{
+    char buf[2000];
+    struct stat filestat;
+    filesize.assign(opt.num_files, -1);
+    filetime.assign(opt.num_files, -1);
+    for (auto i=0;i<opt.num_files;i++) {
+        if(opt.num_files>1) sprintf(buf,"%s.%d.hdf5",opt.fname,i);
+        else sprintf(buf,"%s.hdf5",opt.fname);
+        if (stat(buf, &filestat) != 0) continue;
+        filesize[i] = filestat.st_size;
+        filetime[i] = filestat.st_mtime;
+    }
+}
+
+/*!
+    Read the index of the input. Returns 1 if the index matches the input files, covers all the particle types used
+    and is on a mesh whose resolution is a multiple of the current one, in which case the number of particles of each type
+    in each cell of the current mesh is stored in cellcounts (NHDFTYPE*opt.numcells entries).
+*/
+static int HDFReadSnapshotIndex(Options &opt, int nusetypes, int nbusetypes, int usetypes[], vector<Int_t> &cellcounts)
+{
+    fstream Fidx;
+    int version, numfiles, numcellsperdim, itypecounted[NHDFTYPE];
+    double spacedimension[3];
+    vector<long long> filesize, filetime, idxfilesize, idxfiletime, idxnpart;
+    vector<Int_t> idxcounts;
+    unsigned long long idxnumcells, fac;
+
+    Fidx.open(HDFSnapshotIndexName(opt).c_str(), ios::in | ios::binary);
+    if (!Fidx.is_open()) return 0;
+    Fidx.read((char*)&version, sizeof(int));
+    Fidx.read((char*)&numfiles, sizeof(int));
+    Fidx.read((char*)&numcellsperdim, sizeof(int));
+    Fidx.read((char*)spacedimension, sizeof(double)*3);
+    if (!Fidx.good() || version != HDFSNAPINDEXVERSION || numfiles != opt.num_files
+        || numcellsperdim < opt.numcellsperdim || numcellsperdim % opt.numcellsperdim != 0) return 0;
+    for (auto j=0;j<3;j++) if (fabs(spacedimension[j]-opt.spacedimension[j]) > 1e-6*opt.spacedimension[j]) return 0;
+    idxfilesize.resize(numfiles);
+    idxfiletime.resize(numfiles);
+    idxnpart.resize(numfiles*NHDFTYPE);
+    Fidx.read((char*)idxfilesize.data(), sizeof(long long)*numfiles);
+    Fidx.read((char*)idxfiletime.data(), sizeof(long long)*numfiles);
+    Fidx.read((char*)idxnpart.data(), sizeof(long long)*numfiles*NHDFTYPE);
+    HDFSnapshotFileStats(opt, filesize, filetime);
+    if (!Fidx.good() || filesize != idxfilesize || filetime != idxfiletime) return 0;
+    Fidx.read((char*)itypecounted, sizeof(int)*NHDFTYPE);
+    for (auto j=0;j<nusetypes;j++) if (!itypecounted[usetypes[j]]) return 0;
+    if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (auto j=1;j<=nbusetypes;j++) if (!itypecounted[usetypes[j]]) return 0;
+
+    //sum the index cells within each cell of the current mesh
+    idxnumcells = (unsigned long long)numcellsperdim*numcellsperdim*numcellsperdim;
+    fac = numcellsperdim/opt.numcellsperdim;
+    idxcounts.resize(idxnumcells);
+    cellcounts.assign(NHDFTYPE*opt.numcells, 0);
+    for (auto k=0;k<NHDFTYPE;k++) {
+        if (!itypecounted[k]) continue;
+        Fidx.read((char*)idxcounts.data(), sizeof(Int_t)*idxnumcells);
+        for (unsigned long long ix=0;ix<numcellsperdim;ix++)
+            for (unsigned long long iy=0;iy<numcellsperdim;iy++)
+                for (unsigned long long iz=0;iz<numcellsperdim;iz++) {
+                    auto index = (ix/fac)*opt.numcellsperdim*opt.numcellsperdim + (iy/fac)*opt.numcellsperdim + iz/fac;
+                    cellcounts[k*opt.numcells+index] += idxcounts[(ix*numcellsperdim+iy)*numcellsperdim+iz];
+                }
+    }
+    if (!Fidx.good()) return 0;
+    Fidx.close();
+    return 1;
+}
+
+///write the index of the input, written to a temporary file first so that concurrent runs never see a partial index
+static void HDFWriteSnapshotIndex(Options &opt, int itypecounted[], vector<Int_t> &npart, vector<Int_t> &cellcounts)
+{
+    fstream Fidx;
+    int version = HDFSNAPINDEXVERSION;
+    vector<long long> filesize, filetime, idxnpart(npart.begin(), npart.end());
+    string fname = HDFSnapshotIndexName(opt), tmpname = fname + string(".tmp") + to_string(getpid());
+
+    HDFSnapshotFileStats(opt, filesize, filetime);
+    Fidx.open(tmpname.c_str(), ios::out | ios::binary);
+    if (!Fidx.is_open()) {
+        cerr<<"WARNING: Unable to write snapshot index "<<fname<<endl;
+        return;
+    }
+    Fidx.write((char*)&version, sizeof(int));
+    Fidx.write((char*)&opt.num_files, sizeof(int));
+    Fidx.write((char*)&opt.numcellsperdim, sizeof(int));
+    Fidx.write((char*)opt.spacedimension, sizeof(double)*3);
+    Fidx.write((char*)filesize.data(), sizeof(long long)*opt.num_files);
+    Fidx.write((char*)filetime.data(), sizeof(long long)*opt.num_files);
+    Fidx.write((char*)idxnpart.data(), sizeof(long long)*opt.num_files*NHDFTYPE);
+    Fidx.write((char*)itypecounted, sizeof(int)*NHDFTYPE);
+    for (auto k=0;k<NHDFTYPE;k++) if (itypecounted[k]) Fidx.write((char*)&cellcounts[k*opt.numcells], sizeof(Int_t)*opt.numcells);
+    if (!Fidx.good()) {
+        cerr<<"WARNING: Unable to write snapshot index "<<fname<<endl;
+        Fidx.close();
+        remove(tmpname.c_str());
+        return;
+    }
+    Fidx.close();
+    if (rename(tmpname.c_str(), fname.c_str()) != 0) remove(tmpname.c_str());
+    else cout<<"Wrote snapshot index "<<fname<<endl;
+}
+
+///index of the mesh cell containing a position
+static inline unsigned long long HDFMeshCellIndex(Options &opt, double x, double y, double z)
+{
+    long long ix, iy, iz;
+    ix = min(max((long long)floor(x*opt.icellwidth[0]), 0LL), (long long)opt.numcellsperdim-1);
+    iy = min(max((long long)floor(y*opt.icellwidth[1]), 0LL), (long long)opt.numcellsperdim-1);
+    iz = min(max((long long)floor(z*opt.icellwidth[2]), 0LL), (long long)opt.numcellsperdim-1);
+    return (ix*opt.numcellsperdim+iy)*opt.numcellsperdim+iz;
+}
+
 ///reads HDF file to determine number of particles in each MPIDomain
 void MPINumInDomainHDF(Options &opt)
 {
@@ -130,8 +254,8 @@ void MPINumInDomainHDF(Options &opt)
     MPIInitialDomainDecomposition(opt);
     MPIDomainDecompositionHDF(opt);
 
-    Int_t i,j,k;
-    unsigned long long n,nchunk;
+    Int_t i,j,k,weight;
+    unsigned long long n,nchunk,nsample;
     char buf[2000];
     MPI_Status status;
 
@@ -181,6 +305,8 @@ void MPINumInDomainHDF(Options &opt)
     Int_t Nlocalbuf,ibuf=0,*Nbuf, *Nbaryonbuf;
     int *ireadfile,*ireadtask,*readtaskID;
     hid_t plist_id = H5P_DEFAULT;
+    HDF_Swift_Cells swiftcells;
+    vector<unsigned long long> chunkoffsets, chunknums;
     ireadtask=new int[NProcs];
     readtaskID=new int[opt.nsnapread];
     ireadfile=new int[opt.num_files];
@@ -189,7 +315,7 @@ void MPINumInDomainHDF(Options &opt)
     MPI_Comm mpi_comm_read;
     MPI_Comm mpi_comm_parallel_read;
     int ThisReadTask, NProcsReadTask, ThisParallelReadTask, NProcsParallelReadTask;
-    if (opt.nsnapread > opt.num_files) {
+    if (opt.nsnapread > opt.num_files && !opt.iswiftcellread) {
         MPI_Comm_split(MPI_COMM_WORLD, (ireadtask[ThisTask]>=0), ThisTask, &mpi_comm_read);
         int ntaskread = ceil(opt.nsnapread/opt.num_files);
         int ifile = floor(ireadtask[ThisTask]/ntaskread);
@@ -212,8 +338,44 @@ void MPINumInDomainHDF(Options &opt)
     ///Since Illustris contains an unused type of particles (2) and tracer particles (3) really not useful to iterate over all particle types in loops
     int nusetypes,nbusetypes;
     int usetypes[NHDFTYPE];
-    if (ireadtask[ThisTask]>=0) {
-        HDFSetUsedParticleTypes(opt,nusetypes,nbusetypes,usetypes);
+    HDFSetUsedParticleTypes(opt,nusetypes,nbusetypes,usetypes);
+
+    //if an index of the input from a previous run is valid, the number of particles in each cell is known
+    //and no positions need to be read. Otherwise, count the particles in each cell so that an index can be written
+    int iuseindex = 0, iwriteindex = 0, itypecounted[NHDFTYPE];
+    vector<Int_t> indexcellcounts, indexnpart;
+    if (opt.isnapshotindex && opt.impiusemesh) {
+        if (ThisTask==0) iuseindex = HDFReadSnapshotIndex(opt, nusetypes, nbusetypes, usetypes, indexcellcounts);
+        MPI_Bcast(&iuseindex, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        //sampled positions or only part of the volume do not give complete counts
+        iwriteindex = (!iuseindex && !opt.impisinglepassread && opt.inputregion.size() == 0);
+    }
+    if (iuseindex) {
+        if (ThisTask==0) {
+            cout<<"Using snapshot index "<<HDFSnapshotIndexName(opt)<<" to determine number of particles in each mpi domain"<<endl;
+            for (auto index=0;index<opt.numcells;index++) {
+                for (j=0;j<nusetypes;j++) {
+                    weight = indexcellcounts[usetypes[j]*opt.numcells+index];
+                    opt.cellnodenumparts[index] += weight;
+                    Nbuf[opt.cellnodeids[index]] += weight;
+                }
+                if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) {
+                    weight = indexcellcounts[usetypes[j]*opt.numcells+index];
+                    opt.cellnodenumparts[index] += weight;
+                    Nbaryonbuf[opt.cellnodeids[index]] += weight;
+                }
+            }
+        }
+    }
+    if (iwriteindex) {
+        for (k=0;k<NHDFTYPE;k++) itypecounted[k] = 0;
+        for (j=0;j<nusetypes;j++) itypecounted[usetypes[j]] = 1;
+        if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) for (j=1;j<=nbusetypes;j++) itypecounted[usetypes[j]] = 1;
+        indexcellcounts.assign(NHDFTYPE*opt.numcells, 0);
+        indexnpart.assign(opt.num_files*NHDFTYPE, 0);
+    }
+
+    if (ireadtask[ThisTask]>=0 && !iuseindex) {
         hdf_header_info.resize(opt.num_files);
         Fhdf.resize(opt.num_files);
         headerdataspace.resize(opt.num_files);
@@ -241,6 +403,12 @@ void MPINumInDomainHDF(Options &opt)
                 vintbuff = read_attribute_v<int>(Fhdf[i], hdf_header_info[i].names[hdf_header_info[i].INuminFile]);
                 for (k=0;k<NHDFTYPE;k++) hdf_header_info[i].npart[k]=vintbuff[k];
             }
+            if (iwriteindex) for (k=0;k<NHDFTYPE;k++) indexnpart[i*NHDFTYPE+k]=hdf_header_info[i].npart[k];
+            //if reading SWIFT input by cell, select the cells overlapping the local domain, meta data is in every file
+            if (opt.iswiftcellread && swiftcells.numcells == 0) {
+                HDFReadSwiftCells(Fhdf[i], hdf_gnames, swiftcells, opt.num_files);
+                HDFSelectSwiftCells(opt, swiftcells);
+            }
             //open particle group structures
             for (j=0;j<nusetypes;j++) {k=usetypes[j]; partsgroup[i*NHDFTYPE+k]=HDF5OpenGroup(Fhdf[i],hdf_gnames.part_names[k]);}
             if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
@@ -263,7 +431,7 @@ void MPINumInDomainHDF(Options &opt)
                 unsigned long long nstart = 0, nend = hdf_header_info[i].npart[k];
                 unsigned long long nlocalsize;
 #ifdef USEPARALLELHDF
-                if (opt.num_files<opt.nsnapread) {
+                if (opt.num_files<opt.nsnapread && !opt.iswiftcellread) {
                     plist_id = H5Pcreate(H5P_DATASET_XFER);
                     H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_INDEPENDENT);
                     nlocalsize = nend / NProcsParallelReadTask;
@@ -272,16 +440,24 @@ void MPINumInDomainHDF(Options &opt)
                         nend = nlocalsize + nstart;
                 }
 #endif
-                if (nend-nstart<chunksize)nchunk=nend-nstart;
-                else nchunk=chunksize;
-                for(n=nstart;n<nend;n+=nchunk)
+                HDFGetReadChunks(swiftcells, i, k, nstart, nend, chunksize, chunkoffsets, chunknums);
+                for (auto ichunk=0;ichunk<chunknums.size();ichunk++)
                 {
-                    if (nend - n < chunksize && nend - n > 0) nchunk=nend-n;
+                    n=chunkoffsets[ichunk];
+                    nchunk=chunknums[ichunk];
+                    //if sampling, positions are read with a stride spanning the whole chunk, since snapshots are typically
+                    //cell or key sorted so a contiguous prefix would be spatially clustered, and each stands in for several particles
+                    nsample=nchunk;
+                    if (opt.impisinglepassread) nsample=max(1ULL,nchunk/opt.mpisinglepasssamplestride);
                     //setup hyperslab so that it is loaded into the buffer
-                    HDF5ReadHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 3, nchunk, n, plist_id);
-                    for (auto nn=0;nn<nchunk;nn++) {
-                        ibuf=MPIGetParticlesProcessor(opt, doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
-                        Nbuf[ibuf]++;
+                    HDF5ReadStridedHyperSlabReal(doublebuff,partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], nsample, n, nchunk/nsample, plist_id);
+                    for (auto nn=0;nn<nsample;nn++) {
+                        weight=nchunk/nsample+(nn<nchunk%nsample);
+                        //cells are read by every task overlapping them, only the owning task counts the particle
+                        if (opt.iswiftcellread && MPIGetParticlesProcessor(opt, doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2],0)!=ThisTask) continue;
+                        ibuf=MPIGetParticlesProcessor(opt, doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2],weight);
+                        Nbuf[ibuf]+=weight;
+                        if (iwriteindex) indexcellcounts[k*opt.numcells+HDFMeshCellIndex(opt, doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2])]+=weight;
                     }
                 }
             }
@@ -290,24 +466,29 @@ void MPINumInDomainHDF(Options &opt)
                     k=usetypes[j];
                     unsigned long long nstart = 0, nend = hdf_header_info[i].npart[k];
 #ifdef USEPARALLELHDF
-                    if (opt.num_files<opt.nsnapread) {
+                    if (opt.num_files<opt.nsnapread && !opt.iswiftcellread) {
                         unsigned long long nlocalsize = nend / NProcsParallelReadTask;
                         nstart = nlocalsize*ThisParallelReadTask;
                         if (ThisParallelReadTask < NProcsParallelReadTask -1)
                             nend = nlocalsize + nstart;
                     }
 #endif
-                    if (nend-nstart<chunksize)nchunk=nend-nstart;
-                    else nchunk=chunksize;
-                    for(n=nstart;n<nend;n+=nchunk)
+                    HDFGetReadChunks(swiftcells, i, k, nstart, nend, chunksize, chunkoffsets, chunknums);
+                    for (auto ichunk=0;ichunk<chunknums.size();ichunk++)
                     {
-                        if (nend - n < chunksize && nend - n > 0) nchunk=nend-n;
-                        // setup hyperslab so that it is loaded into the buffer
-                        HDF5ReadHyperSlabReal(doublebuff, partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], 1, 3, nchunk, n, plist_id);
+                        n=chunkoffsets[ichunk];
+                        nchunk=chunknums[ichunk];
+                        nsample=nchunk;
+                        if (opt.impisinglepassread) nsample=max(1ULL,nchunk/opt.mpisinglepasssamplestride);
+                        // setup strided hyperslab so that samples span the chunk
+                        HDF5ReadStridedHyperSlabReal(doublebuff, partsdataset[i*NHDFTYPE+k], partsdataspace[i*NHDFTYPE+k], nsample, n, nchunk/nsample, plist_id);
 
-                        for (auto nn=0;nn<nchunk;nn++) {
-                            ibuf=MPIGetParticlesProcessor(opt, doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2]);
-                            Nbaryonbuf[ibuf]++;
+                        for (auto nn=0;nn<nsample;nn++) {
+                            weight=nchunk/nsample+(nn<nchunk%nsample);
+                            if (opt.iswiftcellread && MPIGetParticlesProcessor(opt, doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2],0)!=ThisTask) continue;
+                            ibuf=MPIGetParticlesProcessor(opt, doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2],weight);
+                            Nbaryonbuf[ibuf]+=weight;
+                            if (iwriteindex) indexcellcounts[k*opt.numcells+HDFMeshCellIndex(opt, doublebuff[nn*3],doublebuff[nn*3+1],doublebuff[nn*3+2])]+=weight;
                         }
                     }
                 }
@@ -330,8 +511,20 @@ void MPINumInDomainHDF(Options &opt)
         MPI_Allreduce(Nbaryonbuf,mpi_nlocal,NProcs,MPI_Int_t,MPI_SUM,MPI_COMM_WORLD);
         Nlocalbaryon[0]=mpi_nlocal[ThisTask];
     }
+    //collect counts from all read tasks and write the index
+    if (iwriteindex) {
+        if (ThisTask==0) {
+            MPI_Reduce(MPI_IN_PLACE, indexcellcounts.data(), NHDFTYPE*opt.numcells, MPI_Int_t, MPI_SUM, 0, MPI_COMM_WORLD);
+            MPI_Reduce(MPI_IN_PLACE, indexnpart.data(), opt.num_files*NHDFTYPE, MPI_Int_t, MPI_MAX, 0, MPI_COMM_WORLD);
+            HDFWriteSnapshotIndex(opt, itypecounted, indexnpart, indexcellcounts);
+        }
+        else {
+            MPI_Reduce(indexcellcounts.data(), NULL, NHDFTYPE*opt.numcells, MPI_Int_t, MPI_SUM, 0, MPI_COMM_WORLD);
+            MPI_Reduce(indexnpart.data(), NULL, opt.num_files*NHDFTYPE, MPI_Int_t, MPI_MAX, 0, MPI_COMM_WORLD);
+        }
+    }
 #ifdef USEPARALLELHDF
-    if (opt.nsnapread > opt.num_files) {
+    if (opt.nsnapread > opt.num_files && !opt.iswiftcellread) {
         MPI_Comm_free(&mpi_comm_parallel_read);
         MPI_Comm_free(&mpi_comm_read);
     }
@@ -164,12 +164,86 @@ void MPIInitialDomainDecomposition(Options &opt)
     MPI_Bcast(mpi_domain, NProcs*sizeof(MPI_Domain), MPI_BYTE, 0, MPI_COMM_WORLD);
 }
 
+/// \name Space filling curve keys used to order the top-level mesh cells
+//@{
+
+///spread the lower 21 bits of an integer so that there are two zero bits between each bit,
+///ie: ...b2b1b0 becomes ...b2 0 0 b1 0 0 b0
+inline unsigned long long MPIMeshSpreadBits(unsigned long long x)
+{
+    x &= 0x1fffffULL;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8)  & 0x100f00f00f00f00fULL;
+    x = (x | x << 4)  & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2)  & 0x1249249249249249ULL;
+    return x;
+}
+
+///Morton (z-curve) key of a cell with integer coordinates ix,iy,iz, with x occupying the least significant bit of each triplet
+unsigned long long MPIMeshMortonKey(unsigned int ix, unsigned int iy, unsigned int iz)
+{
+    return MPIMeshSpreadBits(ix) | (MPIMeshSpreadBits(iy) << 1) | (MPIMeshSpreadBits(iz) << 2);
+}
+
+/*!
+    Peano-Hilbert key of a cell with integer coordinates ix,iy,iz on a 2^nbits per dimension mesh.
+    Uses the transpose algorithm of Skilling (2004, AIP Conf. Proc. 707, 381) to convert the coordinates to the
+    transposed Hilbert index and then interleaves the bits to produce a single key. Consecutive keys always
+    correspond to face sharing cells so contiguous runs of keys produce compact domains.
+*/
+unsigned long long MPIMeshPeanoHilbertKey(unsigned int ix, unsigned int iy, unsigned int iz, int nbits)
+{
+    unsigned int x[3] = {ix, iy, iz};
+    unsigned int m = 1u << (nbits - 1), p, q, t;
+    //inverse undo of the excess work
+    for (q = m; q > 1; q >>= 1) {
+        p = q - 1;
+        for (auto i = 0; i < 3; i++) {
+            if (x[i] & q) x[0] ^= p;
+            else {
+                t = (x[0] ^ x[i]) & p;
+                x[0] ^= t;
+                x[i] ^= t;
+            }
+        }
+    }
+    //gray encode
+    for (auto i = 1; i < 3; i++) x[i] ^= x[i-1];
+    t = 0;
+    for (q = m; q > 1; q >>= 1) if (x[2] & q) t ^= q - 1;
+    for (auto i = 0; i < 3; i++) x[i] ^= t;
+    //interleave with the first axis being the most significant bit of each triplet
+    return MPIMeshSpreadBits(x[2]) | (MPIMeshSpreadBits(x[1]) << 1) | (MPIMeshSpreadBits(x[0]) << 2);
+}
+//@}
+
+/*!
+    Determine the resolution of the top-level mesh. If user has not provided a resolution, then resolution
+    is chosen such that each mpi task has roughly \ref MPIMeshCellsPerTask cells, allowing reasonable load balancing
+    when repartitioning, while keeping the average number of particles per cell above \ref MPIMeshMinPartsPerCell.
+    The resolution is always a power of 2 so the space filling curves are well defined and is limited to
+    [opt.minnumcellperdim, \ref MPIMeshMaxCellsPerDim] unless the user minimum is larger than this maximum.
+*/
+int MPIMeshNumCellsPerDim(Options &opt, Int_t nbodies)
+{
+    int numcellsperdim;
+    if (opt.mpimeshnumcellsperdim > 0) numcellsperdim = opt.mpimeshnumcellsperdim;
+    else {
+        double numcells = (double)NProcs * MPIMeshCellsPerTask;
+        if (nbodies > 0) numcells = min(numcells, (double)nbodies / (double)MPIMeshMinPartsPerCell);
+        numcellsperdim = min((int)ceil(cbrt(numcells)), MPIMeshMaxCellsPerDim);
+        //must have at least as many cells as mpi tasks
+        numcellsperdim = max(numcellsperdim, (int)ceil(cbrt((double)NProcs)));
+    }
+    numcellsperdim = max(numcellsperdim, opt.minnumcellperdim);
+    //round up to power of 2
+    return (int)pow(2, (int)ceil(log((double)numcellsperdim)/log(2.0)));
+}
+
 void MPIInitialDomainDecompositionWithMesh(Options &opt){
     if (ThisTask==0) {
-        //each processor takes subsection of volume where use simple 2^(ceil(log(NProcs)/log(2))) subdivision
-        opt.numcellsperdim = max((int)pow(2,(int)ceil(log((float)NProcs)/log(2.0))), opt.minnumcellperdim);
-        //each processor takes subsection of volume where use simple NProcs^(1/3) subdivision
-        // opt.numcellsperdim = max((int)ceil(pow((double)NProcs,(double)(1.0/3.0)))*8, opt.minnumcellperdim);
+        opt.numcellsperdim = MPIMeshNumCellsPerDim(opt, Ntotal);
         unsigned int n3 = opt.numcells = opt.numcellsperdim*opt.numcellsperdim*opt.numcellsperdim;
         double idelta = 1.0/(double)opt.numcellsperdim;
         for (auto i=0; i<3; i++) {
@@ -178,13 +252,12 @@ void MPIInitialDomainDecompositionWithMesh(Options &opt){
             opt.icellwidth[i] = 1.0/opt.cellwidth[i];
         }
 
-        //now order according to Z-curve or Morton curve
+        //now order according to Peano-Hilbert curve or Z-curve (Morton curve)
         //first fill curve
-        vector<bitset<16>> zcurvevalue(3);
+        int nbits = (int)round(log((double)opt.numcellsperdim)/log(2.0));
         struct zcurvestruct{
-            unsigned int coord[3];
             unsigned long long index;
-            bitset<48> zcurvevalue;
+            unsigned long long key;
         };
         vector<zcurvestruct> zcurve(n3);
         unsigned long long index;
@@ -192,25 +265,17 @@ void MPIInitialDomainDecompositionWithMesh(Options &opt){
             for (auto iy=0;iy<opt.numcellsperdim;iy++) {
                 for (auto iz=0;iz<opt.numcellsperdim;iz++) {
                     index = ix*opt.numcellsperdim*opt.numcellsperdim + iy*opt.numcellsperdim + iz;
-                    zcurve[index].coord[0] = ix;
-                    zcurve[index].coord[1] = iy;
-                    zcurve[index].coord[2] = iz;
                     zcurve[index].index = index;
-                    zcurvevalue[0] = bitset<16>(ix);
-                    zcurvevalue[1] = bitset<16>(iy);
-                    zcurvevalue[2] = bitset<16>(iz);
-                    for (auto j=0; j<16;j++)
-                    {
-                        for (auto i = 0; i<3; i++) {
-                            zcurve[index].zcurvevalue[j*3+i] = zcurvevalue[i][j];
-                        }
-                    }
+                    if (opt.mpimeshcurvetype == MPIMESHCURVEHILBERT)
+                        zcurve[index].key = MPIMeshPeanoHilbertKey(ix, iy, iz, nbits);
+                    else
+                        zcurve[index].key = MPIMeshMortonKey(ix, iy, iz);
                 }
             }
         }
-        //then sort index array based on the zcurvearray value
-        sort(zcurve.begin(), zcurve.end(), [](zcurvestruct &a, zcurvestruct &b){
-            return a.zcurvevalue.to_ullong() < b.zcurvevalue.to_ullong();
+        //then sort index array based on the curve key
+        sort(zcurve.begin(), zcurve.end(), [](const zcurvestruct &a, const zcurvestruct &b){
+            return a.key < b.key;
         });
         //finally assign cells to tasks
         opt.cellnodeids = new int[n3];
@@ -231,7 +296,8 @@ void MPIInitialDomainDecompositionWithMesh(Options &opt){
             numcellspertask[itask]++;
             count++;
         }
-        cout<<"Z-curve Mesh MPI decomposition: "<<endl;
+        if (opt.mpimeshcurvetype == MPIMESHCURVEHILBERT) cout<<"Peano-Hilbert curve Mesh MPI decomposition: "<<endl;
+        else cout<<"Z-curve Mesh MPI decomposition: "<<endl;
         cout<<"Mesh has resolution of "<<opt.numcellsperdim<<" per spatial dim "<<endl;
         cout<<"with each mesh spanning ("<<opt.cellwidth[0]<<", "<<opt.cellwidth[1]<<", "<<opt.cellwidth[2]<<")"<<endl;
         cout<<"MPI tasks :"<<endl;
@@ -342,6 +408,12 @@ void MPINumInDomain(Options &opt)
     return;
     }
     int nsnapread=opt.nsnapread;
+    //a single pass read only samples positions here, so the mesh is needed to turn the sampled cell counts into
+    //a decomposition and the local particle arrays must be able to grow (not possible for separate baryon arrays)
+    if (opt.impisinglepassread && (!opt.impiusemesh || opt.inputtype!=IOHDF || (opt.iBaryonSearch>0 && opt.partsearchtype!=PSTALL))) {
+        if (ThisTask==0) cout<<"WARNING: single pass read requires HDF input, the mesh decomposition and no separate baryon search. Counting all particles instead."<<endl;
+        opt.impisinglepassread=0;
+    }
     //opt.nsnapread=min(NProcs,opt.num_files);
     if(opt.inputtype==IOTIPSY) MPINumInDomainTipsy(opt);
     else if (opt.inputtype==IOGADGET) MPINumInDomainGadget(opt);
@@ -368,6 +440,7 @@ void MPINumInDomain(Options &opt)
         }
     }
     opt.nsnapread=nsnapread;
+    if (opt.impisinglepassread && ThisTask==0) cout<<"Estimated number of particles in each mpi domain from one in "<<opt.mpisinglepasssamplestride<<" positions"<<endl;
     //adjust the memory allocated to allow some buffer room.
     Nmemlocal=Nlocal*(1.0+opt.mpipartfac);
     if (opt.iBaryonSearch) Nmemlocalbaryon=Nlocalbaryon[0]*(1.0+opt.mpipartfac);
@@ -427,7 +500,8 @@ void MPIAdjustDomainWithMesh(Options &opt)
 
 
 ///given a position and a mpi thread domain information, determine which processor a particle is assigned to
-int MPIGetParticlesProcessor(Options &opt, Double_t x, Double_t y, Double_t z){
+///the weight is added to the particle count of the top-level cell, allowing counts to be estimated from a sample of positions
+int MPIGetParticlesProcessor(Options &opt, Double_t x, Double_t y, Double_t z, const Int_t weight){
     if (NProcs==1) return 0;
     if (opt.impiusemesh) {
         unsigned int ix, iy, iz;
@@ -436,7 +510,7 @@ int MPIGetParticlesProcessor(Options &opt, Double_t x, Double_t y, Double_t z){
         iy=floor(y*opt.icellwidth[1]);
         iz=floor(z*opt.icellwidth[2]);
         index = ix*opt.numcellsperdim*opt.numcellsperdim+iy*opt.numcellsperdim+iz;
-        opt.cellnodenumparts[index]++;
+        opt.cellnodenumparts[index]+=weight;
         if (index >= 0 && index < opt.numcells) return opt.cellnodeids[index];
     }
     else {
@@ -1332,19 +1406,66 @@ void MPIISendExtraDMInfo(Options &opt, Int_t nlocalbuff, Particle *Part, int dst
 }
 
 //adds a particle read from an input file to the appropriate buffers
+/*! When reading input in a single pass (\ref mpi_growable_part is set) and Part is the start of that vector,
+    grow the vector so that nadd more particles can be stored after the first nlocal.
+    Returns the (possibly new) start of the local particle array.
+*/
+Particle *MPIGrowLocalParticles(Particle *Part, const Int_t nlocal, const Int_t nadd)
+{
+    if (mpi_growable_part==NULL || Part!=mpi_growable_part->data()) return Part;
+    if (nlocal+nadd<=(Int_t)mpi_growable_part->size()) return Part;
+    Int_t newsize=max(nlocal+nadd,(Int_t)(mpi_growable_part->size()*MPIReadGrowthFac));
+    mpi_growable_part->resize(newsize);
+    Nmemlocal=newsize;
+    return mpi_growable_part->data();
+}
+
+static vector<vector<Particle>> mpi_readsendbuf;
+static vector<Int_t> mpi_readsendnum;
+static vector<MPI_Request> mpi_readsendreq;
+/*! Send a full buffer of particles from a read thread to a non-reading task without waiting for the receiver.
+    The buffer is copied to a per-task send buffer so that the read thread can continue filling Pbuf while the
+    message is in flight. There is at most one outstanding count/particle message pair per destination,
+    so messages stay ordered and the receiver sees them in the same order as with blocking sends.
+    Extra hydro/star/bh/dm properties are still sent with blocking calls.
+*/
+void MPIIsendParticlesFromReadThreads(Options &opt, Int_t nlocalbuff, Particle *Pbuf, int taskID)
+{
+    if (mpi_readsendreq.size()==0) {
+        mpi_readsendbuf.resize(NProcs);
+        mpi_readsendnum.resize(NProcs,0);
+        mpi_readsendreq.resize(2*NProcs,MPI_REQUEST_NULL);
+    }
+    MPI_Waitall(2, &mpi_readsendreq[2*taskID], MPI_STATUSES_IGNORE);
+    mpi_readsendbuf[taskID].assign(Pbuf, Pbuf+nlocalbuff);
+    mpi_readsendnum[taskID]=nlocalbuff;
+    MPI_Isend(&mpi_readsendnum[taskID], 1, MPI_Int_t, taskID, taskID+NProcs, MPI_COMM_WORLD, &mpi_readsendreq[2*taskID]);
+    MPI_Isend(mpi_readsendbuf[taskID].data(), sizeof(Particle)*nlocalbuff, MPI_BYTE, taskID, taskID, MPI_COMM_WORLD, &mpi_readsendreq[2*taskID+1]);
+    MPISendHydroInfoFromReadThreads(opt, nlocalbuff, mpi_readsendbuf[taskID].data(), taskID);
+    MPISendStarInfoFromReadThreads(opt, nlocalbuff, mpi_readsendbuf[taskID].data(), taskID);
+    MPISendBHInfoFromReadThreads(opt, nlocalbuff, mpi_readsendbuf[taskID].data(), taskID);
+    MPISendExtraDMInfoFromReadThreads(opt, nlocalbuff, mpi_readsendbuf[taskID].data(), taskID);
+}
+
+///wait for all outstanding sends issued by \ref MPIIsendParticlesFromReadThreads and free the send buffers
+void MPIWaitParticleSendsFromReadThreads()
+{
+    if (mpi_readsendreq.size()==0) return;
+    MPI_Waitall(mpi_readsendreq.size(), mpi_readsendreq.data(), MPI_STATUSES_IGNORE);
+    vector<vector<Particle>>().swap(mpi_readsendbuf);
+    vector<Int_t>().swap(mpi_readsendnum);
+    vector<MPI_Request>().swap(mpi_readsendreq);
+}
+
 void MPIAddParticletoAppropriateBuffer(Options &opt, const int &ibuf, Int_t ibufindex, int *&ireadtask, const Int_t &BufSize, Int_t *&Nbuf, Particle *&Pbuf, Int_t &numpart, Particle *Part, Int_t *&Nreadbuf, vector<Particle>*&Preadbuf){
     if (ibuf==ThisTask) {
         Nbuf[ibuf]--;
+        Part=MPIGrowLocalParticles(Part,numpart,1);
         Part[numpart++]=Pbuf[ibufindex];
     }
     else {
         if(Nbuf[ibuf]==BufSize&&ireadtask[ibuf]<0) {
-            MPI_Send(&Nbuf[ibuf], 1, MPI_Int_t, ibuf, ibuf+NProcs, MPI_COMM_WORLD);
-            MPI_Send(&Pbuf[ibuf*BufSize],sizeof(Particle)*Nbuf[ibuf],MPI_BYTE,ibuf,ibuf,MPI_COMM_WORLD);
-            MPISendHydroInfoFromReadThreads(opt, Nbuf[ibuf], &Pbuf[ibuf*BufSize], ibuf);
-            MPISendStarInfoFromReadThreads(opt, Nbuf[ibuf], &Pbuf[ibuf*BufSize], ibuf);
-            MPISendBHInfoFromReadThreads(opt, Nbuf[ibuf], &Pbuf[ibuf*BufSize], ibuf);
-            MPISendExtraDMInfoFromReadThreads(opt, Nbuf[ibuf], &Pbuf[ibuf*BufSize], ibuf);
+            MPIIsendParticlesFromReadThreads(opt, Nbuf[ibuf], &Pbuf[ibuf*BufSize], ibuf);
             Nbuf[ibuf]=0;
         }
         else if (ireadtask[ibuf]>=0) {
@@ -1629,6 +1750,12 @@ int MPISearchForOverlapUsingMesh(Options &opt, Double_t xsearch[3][2]){
 //@{
 ///Distribute the mpi processes that read the input files so as to spread the read threads evenly throughout the MPI_COMM_WORLD
 void MPIDistributeReadTasks(Options&opt, int *&ireadtask, int*&readtaskID){
+    //when reading SWIFT input by cell, every task reads the cells overlapping its own domain
+    if (opt.iswiftcellread) {
+        opt.nsnapread=NProcs;
+        for (int i=0;i<NProcs;i++) {ireadtask[i]=i;readtaskID[i]=i;}
+        return;
+    }
     //initialize
     if (opt.nsnapread>NProcs) opt.nsnapread=NProcs;
 #ifndef USEPARALLELHDF
@@ -1637,6 +1764,9 @@ void MPIDistributeReadTasks(Options&opt, int *&ireadtask, int*&readtaskID){
 #else
     //if parallel hdf5 but not reading hdf then again, max one task per file
     if (opt.inputtype!=IOHDF) if (opt.num_files<opt.nsnapread) opt.nsnapread=opt.num_files;
+    //otherwise limit the number of tasks sharing a file, more readers than stripes just contend for the same servers
+    else if (opt.mpinumreadtasksperfile>0 && opt.nsnapread>opt.num_files*opt.mpinumreadtasksperfile)
+        opt.nsnapread=opt.num_files*opt.mpinumreadtasksperfile;
 #endif
     for (int i=0;i<NProcs;i++) ireadtask[i]=-1;
     int spacing=max(1,(int)floor(NProcs/opt.nsnapread));
@@ -1648,6 +1778,11 @@ int MPISetFilesRead(Options&opt, int *&ireadfile, int *&ireadtask){
     ireadfile=new int[opt.num_files];
     int nread, niread, nfread;
     for (int i=0;i<opt.num_files;i++) ireadfile[i]=0;
+    //when reading SWIFT input by cell, any file can hold cells overlapping the task's domain
+    if (opt.iswiftcellread) {
+        for (int i=0;i<opt.num_files;i++) ireadfile[i]=1;
+        return 0;
+    }
 #ifndef USEPARALLELHDF
     nread=opt.num_files/opt.nsnapread;
     niread=ireadtask[ThisTask]*nread;
@@ -1714,6 +1849,135 @@ void MPIFreeWriteComm(){
 }
 //@}
 
+/// \name Routines managing the communication buffer arena
+/// The export and import buffers are sized from the exact counts determined by the counting
+/// routines (eg: \ref MPIGetExportNum) rather than a fixed fraction of the local particle number,
+/// and are all carved from a single arena, \ref mpi_commarena, that persists across phases.
+/// Each phase carves its buffers from the start of the arena and hands them back with
+/// \ref MPIReleaseCommBuffers, which keeps the storage, so the arena is allocated by the first phase
+/// and only grows if a later phase needs more. It is freed by \ref MPIFreeCommBuffers at the end of the run.
+//@{
+
+///buffers that are carved from the arena
+enum {MPICOMMPARTIN, MPICOMMPARTGET, MPICOMMFOFIN, MPICOMMFOFGET, MPICOMMNNIN, MPICOMMNNGET, MPICOMMNUM};
+///alignment in bytes of buffers in the arena
+#define MPICOMMALIGN 64
+///byte offset and number of elements of each buffer carved in the current phase
+static size_t mpi_commoffset[MPICOMMNUM];
+static Int_t mpi_commnum[MPICOMMNUM];
+///bytes of the arena in use by the current phase
+static size_t mpi_commused=0;
+///largest planned memory of any phase, see \ref MPIReportPlannedMemory
+static double mpi_plannedpeakmem=0;
+
+template<class T> static inline T *MPICommBufferStart(const int ibuf)
+{
+    if (mpi_commnum[ibuf]==0) return NULL;
+    return (T*)(mpi_commarena.data()+mpi_commoffset[ibuf]);
+}
+
+///point the global communication buffers at their place in the arena
+static void MPISetCommBufferPointers()
+{
+    PartDataIn = MPICommBufferStart<Particle>(MPICOMMPARTIN);
+    PartDataGet = MPICommBufferStart<Particle>(MPICOMMPARTGET);
+    FoFDataIn = MPICommBufferStart<fofdata_in>(MPICOMMFOFIN);
+    FoFDataGet = MPICommBufferStart<fofdata_in>(MPICOMMFOFGET);
+    NNDataIn = MPICommBufferStart<nndata_in>(MPICOMMNNIN);
+    NNDataGet = MPICommBufferStart<nndata_in>(MPICOMMNNGET);
+}
+
+template<class T> static inline void MPIDestroyCommBuffer(const int ibuf)
+{
+    T *p = MPICommBufferStart<T>(ibuf);
+    for (Int_t i=0;i<mpi_commnum[ibuf];i++) p[i].~T();
+    mpi_commnum[ibuf]=0;
+}
+
+/*! Carve a buffer of at least n elements from the arena. A buffer already carved in this phase is
+    reused if it is large enough, otherwise space is taken from the end of the buffers in use, growing
+    the arena (and moving the buffers in use) only if no earlier phase has needed as much.
+*/
+template<class T> static T *MPICarveCommBuffer(const int ibuf, const Int_t n)
+{
+    Int_t nreq = max(n, (Int_t)1);
+    if (mpi_commnum[ibuf] >= nreq) return MPICommBufferStart<T>(ibuf);
+    MPIDestroyCommBuffer<T>(ibuf);
+    size_t offset = (mpi_commused+MPICOMMALIGN-1)/MPICOMMALIGN*MPICOMMALIGN;
+    size_t bytes = nreq*sizeof(T);
+    if (offset+bytes > mpi_commarena.size()) {
+        vector<char> newarena(offset+bytes);
+        if (mpi_commused>0) memcpy(newarena.data(), mpi_commarena.data(), mpi_commused);
+        mpi_commarena.swap(newarena);
+    }
+    T *p = (T*)(mpi_commarena.data()+offset);
+    for (Int_t i=0;i<nreq;i++) new (&p[i]) T();
+    mpi_commoffset[ibuf] = offset;
+    mpi_commnum[ibuf] = nreq;
+    mpi_commused = offset+bytes;
+    MPISetCommBufferPointers();
+    return p;
+}
+
+void MPIAllocatePartCommBuffers(const Int_t nexport, const Int_t nimport)
+{
+    MPICarveCommBuffer<Particle>(MPICOMMPARTIN, nexport);
+    MPICarveCommBuffer<Particle>(MPICOMMPARTGET, nimport);
+}
+
+void MPIAllocateFoFCommBuffers(const Int_t nexport, const Int_t nimport)
+{
+    MPICarveCommBuffer<fofdata_in>(MPICOMMFOFIN, nexport);
+    MPICarveCommBuffer<fofdata_in>(MPICOMMFOFGET, nimport);
+}
+
+void MPIAllocateNNCommBuffers(const Int_t nexport, const Int_t nimport)
+{
+    MPICarveCommBuffer<nndata_in>(MPICOMMNNIN, nexport);
+    MPICarveCommBuffer<nndata_in>(MPICOMMNNGET, nimport);
+}
+
+///Hands the buffers of a phase back to the arena, keeping its storage for the next phase
+void MPIReleaseCommBuffers()
+{
+    MPIDestroyCommBuffer<Particle>(MPICOMMPARTIN);
+    MPIDestroyCommBuffer<Particle>(MPICOMMPARTGET);
+    MPIDestroyCommBuffer<fofdata_in>(MPICOMMFOFIN);
+    MPIDestroyCommBuffer<fofdata_in>(MPICOMMFOFGET);
+    MPIDestroyCommBuffer<nndata_in>(MPICOMMNNIN);
+    MPIDestroyCommBuffer<nndata_in>(MPICOMMNNGET);
+    mpi_commused = 0;
+    MPISetCommBufferPointers();
+}
+
+///Releases the buffers and frees the arena once no further phases need it
+void MPIFreeCommBuffers()
+{
+    MPIReleaseCommBuffers();
+    vector<char>().swap(mpi_commarena);
+}
+
+/*! Reports the planned peak memory of each task, that is the largest over the phases so far of the
+    local particle array plus the communication arena, which persists between phases. The maximum and
+    minimum across tasks are reported so that imbalances are visible before a phase starts.
+*/
+void MPIReportPlannedMemory(Options &opt, const Int_t nbodies, string phase)
+{
+    double bytes[2], maxbytes[2], minbytes[2];
+    mpi_plannedpeakmem = max(mpi_plannedpeakmem, (double)nbodies*sizeof(Particle)+(double)mpi_commarena.size());
+    if (opt.iverbose<1) return;
+    bytes[0] = mpi_plannedpeakmem;
+    bytes[1] = mpi_commarena.size();
+    MPI_Reduce(bytes, maxbytes, 2, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(bytes, minbytes, 2, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+    if (opt.iverbose>=2) cout<<ThisTask<<": "<<phase<<" planned peak memory of particles and comm arena "<<bytes[0]/pow(1024.0,3.0)<<" GB of which arena "<<bytes[1]/pow(1024.0,3.0)<<" GB"<<endl;
+    if (ThisTask==0) {
+        cout<<phase<<" planned peak memory across tasks: [min,max] = ["<<minbytes[0]/pow(1024.0,3.0)<<","<<maxbytes[0]/pow(1024.0,3.0)<<"] GB, ";
+        cout<<"comm arena [min,max] = ["<<minbytes[1]/pow(1024.0,3.0)<<","<<maxbytes[1]/pow(1024.0,3.0)<<"] GB"<<endl;
+    }
+}
+//@}
+
 /// \name Routines involved in exporting particles
 //@{
 
@@ -2079,38 +2343,31 @@ void MPIReceiveParticlesFromReadThreads(Options &opt, Particle *&Pbuf, Particle
 
     //for all threads not reading snapshots, simply receive particles as necessary from all threads involved with reading the data
     //first determine which threads are going to send information to this thread.
-    for (i=0;i<opt.nsnapread;i++) if (irecv[i]) {
+    for (i=0;i<opt.nsnapread;i++) {
         mpi_irecvflag[i]=0;
-        MPI_Irecv(&Nlocalthreadbuf[i], 1, MPI_Int_t, readtaskID[i], ThisTask+NProcs, MPI_COMM_WORLD, &mpi_request[i]);
+        mpi_request[i]=MPI_REQUEST_NULL;
+        if (irecv[i]) MPI_Irecv(&Nlocalthreadbuf[i], 1, MPI_Int_t, readtaskID[i], ThisTask+NProcs, MPI_COMM_WORLD, &mpi_request[i]);
     }
     Nlocaltotalbuf=0;
-    //non-blocking receives for the number of particles one expects to receive
+    //wait for any read thread to announce the number of particles it is about to send rather than polling all of them.
+    //completed requests are set to MPI_REQUEST_NULL so once every read thread has sent a zero count MPI_Waitany returns MPI_UNDEFINED
     do {
-        irecvflag=0;
-        for (i=0;i<opt.nsnapread;i++) if (irecv[i]) {
-            if (mpi_irecvflag[i]==0) {
-                //test if a request has been sent for a Recv call by one of the read threads
-                MPI_Test(&mpi_request[i], &mpi_irecvflag[i], &status);
-                if (mpi_irecvflag[i]) {
-                    if (Nlocalthreadbuf[i]>0) {
-                        MPI_Recv(&Part[Nlocal],sizeof(Particle)*Nlocalthreadbuf[i],MPI_BYTE,readtaskID[i],ThisTask, MPI_COMM_WORLD,&status);
-                        MPIReceiveHydroInfoFromReadThreads(opt, Nlocalthreadbuf[i], &Part[Nlocal], readtaskID[i]);
-                        MPIReceiveStarInfoFromReadThreads(opt, Nlocalthreadbuf[i], &Part[Nlocal], readtaskID[i]);
-                        MPIReceiveBHInfoFromReadThreads(opt, Nlocalthreadbuf[i], &Part[Nlocal], readtaskID[i]);
-                        MPIReceiveExtraDMInfoFromReadThreads(opt, Nlocalthreadbuf[i], &Part[Nlocal], readtaskID[i]);
-                        Nlocal+=Nlocalthreadbuf[i];
-                        Nlocaltotalbuf+=Nlocalthreadbuf[i];
-                        mpi_irecvflag[i]=0;
-                        MPI_Irecv(&Nlocalthreadbuf[i], 1, MPI_Int_t, readtaskID[i], ThisTask+NProcs, MPI_COMM_WORLD, &mpi_request[i]);
-                    }
-                    else {
-                        irecv[i]=0;
-                    }
-                }
-            }
-        }
-        for (i=0;i<opt.nsnapread;i++) irecvflag+=irecv[i];
-    } while(irecvflag>0);
+        MPI_Waitany(opt.nsnapread, mpi_request, &irecvflag, &status);
+        if (irecvflag==MPI_UNDEFINED) break;
+        i=irecvflag;
+        if (Nlocalthreadbuf[i]>0) {
+            Part=MPIGrowLocalParticles(Part,Nlocal,Nlocalthreadbuf[i]);
+            MPI_Recv(&Part[Nlocal],sizeof(Particle)*Nlocalthreadbuf[i],MPI_BYTE,readtaskID[i],ThisTask, MPI_COMM_WORLD,&status);
+            MPIReceiveHydroInfoFromReadThreads(opt, Nlocalthreadbuf[i], &Part[Nlocal], readtaskID[i]);
+            MPIReceiveStarInfoFromReadThreads(opt, Nlocalthreadbuf[i], &Part[Nlocal], readtaskID[i]);
+            MPIReceiveBHInfoFromReadThreads(opt, Nlocalthreadbuf[i], &Part[Nlocal], readtaskID[i]);
+            MPIReceiveExtraDMInfoFromReadThreads(opt, Nlocalthreadbuf[i], &Part[Nlocal], readtaskID[i]);
+            Nlocal+=Nlocalthreadbuf[i];
+            Nlocaltotalbuf+=Nlocalthreadbuf[i];
+            MPI_Irecv(&Nlocalthreadbuf[i], 1, MPI_Int_t, readtaskID[i], ThisTask+NProcs, MPI_COMM_WORLD, &mpi_request[i]);
+        }
+        else irecv[i]=0;
+    } while(true);
     //now that data is local, must adjust data iff a separate baryon search is required.
     if (opt.partsearchtype==PSTDARK && opt.iBaryonSearch) {
         for (i=0;i<Nlocal;i++) {
@@ -2959,9 +3216,113 @@ void MPISendParticlesBetweenReadThreads(Options &opt, Particle *&Pbuf, Particle
     }
 }
 
+///particles exchanged between read threads that are still in flight, see \ref MPISendParticlesBetweenReadThreads
+static vector<vector<Particle>> mpi_readexchsendbuf, mpi_readexchrecvbuf, mpi_readexchrecvbufbaryon;
+static vector<MPI_Request> mpi_readexchreq;
+
+///returns whether particles carry extra hydro/star/bh/dm properties that must be exchanged alongside them
+static bool MPIReadThreadsHaveExtraInfo(Options &opt)
+{
+    size_t numextrafields = 0;
+#ifdef GASON
+    numextrafields += opt.gas_internalprop_unique_input_names.size() + opt.gas_chem_unique_input_names.size() + opt.gas_chemproduction_unique_input_names.size();
+#endif
+#ifdef STARON
+    numextrafields += opt.star_internalprop_unique_input_names.size() + opt.star_chem_unique_input_names.size() + opt.star_chemproduction_unique_input_names.size();
+#endif
+#ifdef BHON
+    numextrafields += opt.bh_internalprop_unique_input_names.size() + opt.bh_chem_unique_input_names.size() + opt.bh_chemproduction_unique_input_names.size();
+#endif
+#ifdef EXTRADMON
+    numextrafields += opt.extra_dm_internalprop_unique_input_names.size();
+#endif
+    return numextrafields > 0;
+}
+
+/*! Wait for the exchange posted by the last call to \ref MPISendParticlesBetweenReadThreads to finish
+    and append the received particles to the local particle (and baryon) arrays.
+    Returns the (possibly new) start of the local particle array.
+*/
+Particle *MPIWaitParticleExchangeBetweenReadThreads(Particle *Part, Particle *&Pbaryons)
+{
+    if (mpi_readexchreq.size()==0) return Part;
+    MPI_Waitall(mpi_readexchreq.size(), mpi_readexchreq.data(), MPI_STATUSES_IGNORE);
+    for (auto &recvbuf:mpi_readexchrecvbuf) {
+        if (recvbuf.size()==0) continue;
+        Part=MPIGrowLocalParticles(Part,Nlocal,recvbuf.size());
+        copy(recvbuf.begin(), recvbuf.end(), &Part[Nlocal]);
+        Nlocal+=recvbuf.size();
+    }
+    for (auto &recvbuf:mpi_readexchrecvbufbaryon) {
+        if (recvbuf.size()==0) continue;
+        copy(recvbuf.begin(), recvbuf.end(), &Pbaryons[Nlocalbaryon[0]]);
+        Nlocalbaryon[0]+=recvbuf.size();
+    }
+    vector<vector<Particle>>().swap(mpi_readexchsendbuf);
+    vector<vector<Particle>>().swap(mpi_readexchrecvbuf);
+    vector<vector<Particle>>().swap(mpi_readexchrecvbufbaryon);
+    vector<MPI_Request>().swap(mpi_readexchreq);
+    return Part;
+}
+
+/*! Post non-blocking sends and receives of nsend particles starting at Psend to recvTask in chunks
+    no larger than maxchunksize particles, receiving nrecv particles into Precv.
+    Chunks use tags tag, tag+2, ... so that \ref TAG_IO_A and \ref TAG_IO_B messages do not overlap.
+*/
+static void MPIIsendIrecvParticleChunks(Particle *Psend, Int_t nsend, Particle *Precv, Int_t nrecv, Int_t maxchunksize, int recvTask, int tag, MPI_Comm &mpi_comm_read)
+{
+    MPI_Request req;
+    int ichunk=0;
+    for (Int_t offset=0;offset<nrecv;offset+=maxchunksize,ichunk++) {
+        MPI_Irecv(&Precv[offset], sizeof(Particle)*min(maxchunksize,nrecv-offset), MPI_BYTE, recvTask, tag+2*ichunk, mpi_comm_read, &req);
+        mpi_readexchreq.push_back(req);
+    }
+    ichunk=0;
+    for (Int_t offset=0;offset<nsend;offset+=maxchunksize,ichunk++) {
+        MPI_Isend(&Psend[offset], sizeof(Particle)*min(maxchunksize,nsend-offset), MPI_BYTE, recvTask, tag+2*ichunk, mpi_comm_read, &req);
+        mpi_readexchreq.push_back(req);
+    }
+}
+
+/*! Exchange the particles collected in Preadbuf between read threads.
+    Unless extra hydro/star/bh/dm properties are read, which need the blocking exchange, the sends and
+    receives are posted without waiting. The particle buffers are moved into in-flight storage so the read
+    thread can continue reading the next file, and the received particles are added to the local arrays
+    by the next call or by \ref MPIWaitParticleExchangeBetweenReadThreads, which must be called after the
+    final exchange.
+*/
 void MPISendParticlesBetweenReadThreads(Options &opt, vector<Particle> *&Preadbuf, Particle *Part, int *&ireadtask, int *&readtaskID, Particle *&Pbaryons, MPI_Comm &mpi_comm_read, Int_t *&mpi_nsend_readthread, Int_t *&mpi_nsend_readthread_baryon)
 {
-    if (ireadtask[ThisTask]>=0) {
+    if (ireadtask[ThisTask]<0) return;
+    //finish the previous exchange so that at most one is in flight
+    Part=MPIWaitParticleExchangeBetweenReadThreads(Part,Pbaryons);
+    if (!MPIReadThreadsHaveExtraInfo(opt)) {
+        Int_t maxchunksize=2147483647/sizeof(Particle);
+        Int_t nsend,nrecv,nsendbaryon,nrecvbaryon;
+        int sendTask=ireadtask[ThisTask], recvTask;
+        mpi_readexchsendbuf.resize(opt.nsnapread);
+        mpi_readexchrecvbuf.resize(opt.nsnapread);
+        mpi_readexchrecvbufbaryon.resize(opt.nsnapread);
+        for (recvTask=0;recvTask<opt.nsnapread;recvTask++) {
+            if (recvTask==sendTask) continue;
+            nsend=mpi_nsend_readthread[sendTask * opt.nsnapread + recvTask];
+            nrecv=mpi_nsend_readthread[recvTask * opt.nsnapread + sendTask];
+            nsendbaryon=nrecvbaryon=0;
+            if (opt.iBaryonSearch && opt.partsearchtype!=PSTALL) {
+                nsendbaryon=mpi_nsend_readthread_baryon[sendTask * opt.nsnapread + recvTask];
+                nrecvbaryon=mpi_nsend_readthread_baryon[recvTask * opt.nsnapread + sendTask];
+            }
+            //keep the buffer being sent and give the reader an empty one to refill
+            mpi_readexchsendbuf[recvTask].swap(Preadbuf[recvTask]);
+            Preadbuf[recvTask].reserve(mpi_readexchsendbuf[recvTask].capacity());
+            mpi_readexchrecvbuf[recvTask].resize(nrecv);
+            mpi_readexchrecvbufbaryon[recvTask].resize(nrecvbaryon);
+            MPIIsendIrecvParticleChunks(mpi_readexchsendbuf[recvTask].data(), nsend, mpi_readexchrecvbuf[recvTask].data(), nrecv, maxchunksize, recvTask, TAG_IO_A, mpi_comm_read);
+            MPIIsendIrecvParticleChunks(mpi_readexchsendbuf[recvTask].data()+nsend, nsendbaryon, mpi_readexchrecvbufbaryon[recvTask].data(), nrecvbaryon, maxchunksize, recvTask, TAG_IO_B, mpi_comm_read);
+        }
+        return;
+    }
+    {
         //split the communication into small buffers
         int icycle=0,ibuf;
         //maximum send size
@@ -3001,6 +3362,7 @@ void MPISendParticlesBetweenReadThreads(Options &opt, vector<Particle> *&Preadbu
                     //determine amount to be sent
                     cursendchunksize=min(maxchunksize,nsend-sendoffset);
                     currecvchunksize=min(maxchunksize,nrecv-recvoffset);
+                    Part=MPIGrowLocalParticles(Part,Nlocal,currecvchunksize);
                     //blocking point-to-point send and receive. Here must determine the appropriate offset point in the local export buffer
                     //for sending data and also the local appropriate offset in the local the receive buffer for information sent from the local receiving buffer
                     MPI_Sendrecv(&Preadbuf[recvTask][sendoffset],sizeof(Particle)*cursendchunksize, MPI_BYTE, recvTask, TAG_IO_A+isendrecv,
@@ -4775,6 +5137,96 @@ Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&
     delete[] nn;
     return links;
 }
+/*! Groups that are larger than opt.mpilargegroupsize are reassigned to mpi tasks prior to \ref MPIGroupExchange
+    so that the task that hosts the largest group does not also host other large groups.
+    The substructure search, unbinding and property calculation of a group are done by the single task hosting it,
+    so the largest groups dominate the run time of the task that receives them and that task becomes the straggler.\n
+    Here the total size of every group is accumulated by a task determined by the group id. Groups above the threshold
+    are gathered on all tasks and assigned (largest first) to the task with the smallest expected number of particles,
+    ie: longest processing time first scheduling. Since all tasks have the same list, the assignment is deterministic and
+    only the mpi_foftask values of local particles belonging to these groups need to be updated.
+    Also reports the memory required to host the largest group.\n
+    The ids of the large groups, largest first, are returned in largegroups, which is identical on all tasks, so that
+    their first level of substructure can be searched cooperatively by \ref MPISearchLargeGroups before the exchange.
+*/
+void MPIBalanceLargeGroups(Options &opt, const Int_t nbodies, Int_t *pfof, vector<Int_t> &largegroups){
+    largegroups.clear();
+    if (opt.mpilargegroupsize<=0 || NProcs==1) return;
+    double time1=MyGetTime();
+
+    //determine the local number of particles in each group and send them to the task that accumulates the group size
+    unordered_map<Int_t, Int_t> localsize;
+    for (Int_t i=0;i<nbodies;i++) if (pfof[i]>0) localsize[pfof[i]]++;
+    vector<int> sendcount(NProcs,0), recvcount(NProcs,0), sendoffset(NProcs,0), recvoffset(NProcs,0);
+    for (auto &x:localsize) sendcount[x.first%NProcs]+=2;
+    MPI_Alltoall(sendcount.data(), 1, MPI_INT, recvcount.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    for (int j=1;j<NProcs;j++) {
+        sendoffset[j]=sendoffset[j-1]+sendcount[j-1];
+        recvoffset[j]=recvoffset[j-1]+recvcount[j-1];
+    }
+    vector<Int_t> sendbuf(sendoffset[NProcs-1]+sendcount[NProcs-1]), recvbuf(recvoffset[NProcs-1]+recvcount[NProcs-1]);
+    vector<int> ioffset(sendoffset);
+    for (auto &x:localsize) {
+        int itask=x.first%NProcs;
+        sendbuf[ioffset[itask]++]=x.first;
+        sendbuf[ioffset[itask]++]=x.second;
+    }
+    MPI_Alltoallv(sendbuf.data(), sendcount.data(), sendoffset.data(), MPI_Int_t,
+        recvbuf.data(), recvcount.data(), recvoffset.data(), MPI_Int_t, MPI_COMM_WORLD);
+    sendbuf.clear();
+    unordered_map<Int_t, Int_t> groupsize;
+    for (size_t i=0;i<recvbuf.size();i+=2) groupsize[recvbuf[i]]+=recvbuf[i+1];
+    recvbuf.clear();
+
+    //gather the large groups on all tasks
+    vector<Int_t> locallarge;
+    for (auto &x:groupsize) if (x.second>=opt.mpilargegroupsize) {
+        locallarge.push_back(x.first);
+        locallarge.push_back(x.second);
+    }
+    groupsize.clear();
+    int nlarge=locallarge.size(), nlargetot;
+    MPI_Allgather(&nlarge, 1, MPI_INT, recvcount.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    recvoffset[0]=0;
+    for (int j=1;j<NProcs;j++) recvoffset[j]=recvoffset[j-1]+recvcount[j-1];
+    nlargetot=recvoffset[NProcs-1]+recvcount[NProcs-1];
+    if (nlargetot==0) return;
+    vector<Int_t> alllargegroups(nlargetot);
+    MPI_Allgatherv(locallarge.data(), nlarge, MPI_Int_t, alllargegroups.data(), recvcount.data(), recvoffset.data(), MPI_Int_t, MPI_COMM_WORLD);
+    vector<pair<Int_t,Int_t>> largelist(nlargetot/2);
+    for (int i=0;i<nlargetot/2;i++) largelist[i]=make_pair(alllargegroups[2*i+1],alllargegroups[2*i]);
+    alllargegroups.clear();
+    sort(largelist.begin(), largelist.end(), [](const pair<Int_t,Int_t> &a, const pair<Int_t,Int_t> &b){
+        if (a.first!=b.first) return a.first>b.first;
+        return a.second<b.second;
+    });
+    for (auto &x:largelist) largegroups.push_back(x.second);
+
+    //expected load of each task is the number of local particles not in large groups
+    //after large groups are removed, particles of other groups can still move but this is typically small
+    Int_t nlocalsmall=0;
+    unordered_map<Int_t, int> newtask;
+    for (auto &x:largelist) newtask[x.second]=-1;
+    for (Int_t i=0;i<nbodies;i++) if (newtask.find(pfof[i])==newtask.end()) nlocalsmall++;
+    vector<Int_t> load(NProcs);
+    MPI_Allgather(&nlocalsmall, 1, MPI_Int_t, load.data(), 1, MPI_Int_t, MPI_COMM_WORLD);
+    for (auto &x:largelist) {
+        int itask=min_element(load.begin(), load.end())-load.begin();
+        newtask[x.second]=itask;
+        load[itask]+=x.first;
+    }
+    for (Int_t i=0;i<nbodies;i++) {
+        auto it=newtask.find(pfof[i]);
+        if (it!=newtask.end()) mpi_foftask[i]=it->second;
+    }
+    if (ThisTask==0) {
+        cout<<"Balanced "<<largelist.size()<<" groups with at least "<<opt.mpilargegroupsize<<" particles across mpi tasks in "<<MyGetTime()-time1<<endl;
+        cout<<"Largest group has "<<largelist[0].first<<" particles requiring "<<largelist[0].first*sizeof(Particle)/1024./1024./1024.<<"GB and is hosted whole by task "<<newtask[largelist[0].second]<<endl;
+        Int_t maxload=*max_element(load.begin(), load.end());
+        cout<<"Maximum expected number of particles on a task is "<<maxload<<" requiring "<<maxload*sizeof(Particle)/1024./1024./1024.<<"GB"<<endl;
+    }
+}
+
 /*!
     Group particles belong to a group to a particular mpi thread so that locally easy to determine
     the maximum group size and reoder the group ids according to descending group size.
@@ -4921,6 +5373,201 @@ Int_t MPIGroupExchange(Options &opt, const Int_t nbodies, Particle *Part, Int_t
     return nlocal;
 }
 
+///free space for particles arriving in \ref MPIGroupExchange: slots vacated by sent particles, unused
+///space beyond the original particles and what is left of the spill budget
+static inline Int_t MPIGroupExchangeFreeSpace(const vector<pair<Int_t,Int_t>> &freeslots, const Int_t itop, const Int_t nmem, const Int_t nspill, const Int_t spillbudget)
+{
+    Int_t nfree=nmem-itop+max((Int_t)0,spillbudget-nspill);
+    for (auto &x:freeslots) nfree+=x.second-x.first;
+    return nfree;
+}
+
+///place a particle arriving in \ref MPIGroupExchange in a vacated slot, beyond the original particles or in the spill buffer
+static inline void MPIGroupExchangePlace(vector<Particle> &Part, Particle &p, vector<pair<Int_t,Int_t>> &freeslots, Int_t &itop, const Int_t nmem, vector<Particle> &spill)
+{
+    if (freeslots.size()>0) {
+        Part[freeslots.back().first++]=move(p);
+        if (freeslots.back().first==freeslots.back().second) freeslots.pop_back();
+    }
+    else if (itop<nmem) Part[itop++]=move(p);
+    else spill.push_back(move(p));
+}
+
+/*!
+    Streaming version of \ref MPIGroupExchange for local particles stored in a vector.
+    Exported particles are sent directly from the local array in batches of at most
+    \ref MPIGroupExchangeBatchSize particles using nonblocking sends and two alternating receive buffers.
+    Arriving particles are placed in the slots vacated by departed particles (or in the space beyond
+    the original particles if more particles are imported than exported). Before each batch the two tasks
+    exchange how many particles they can accept, so that at most one batch of particles is ever held
+    in the spill buffer. A pair of tasks that cannot make progress is revisited once exchanges with other
+    tasks have freed space, so apart from any growth of the local array only O(batch) extra memory is needed.
+    Particle ids store the (negative) group id as expected by \ref MPICompileGroups and \ref FoFGroupDataLocal is not used.
+    return the new local number of particles
+*/
+Int_t MPIGroupExchange(Options &opt, const Int_t nbodies, vector<Particle> &Part, Int_t *&pfof){
+    Int_t i, j, nexport, nimport, nlocal, nmem, maxrecv;
+    Int_t nsend_local[NProcs], noffset_export[NProcs];
+    Int_t nsend, nrecv, cursend, currecv, nextsend, nextrecv, nfree;
+    Int_t itop, nmoved, nmovedtotal, spillbudget, maxspill=0;
+    Int_t batchsize = min((Int_t)MPIGroupExchangeBatchSize, (Int_t)(LOCAL_MAX_MSGSIZE/sizeof(Particle)));
+    int ibuf, npass=0;
+    MPI_Status status;
+    MPI_Request sendreq, recvreq[2];
+    MPI_Comm mpi_comm = MPI_COMM_WORLD;
+    double time1=MyGetTime();
+
+    FoFGroupDataExport=NULL;
+    FoFGroupDataLocal=NULL;
+    for (j=0;j<NProcs;j++) nsend_local[j]=0;
+    for (i=0;i<nbodies;i++) {
+        if (mpi_foftask[i]!=ThisTask)
+            nsend_local[mpi_foftask[i]]++;
+    }
+    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
+    nexport=nimport=maxrecv=0;
+    for (j=0;j<NProcs;j++){
+        nimport+=mpi_nsend[ThisTask+j*NProcs];
+        nexport+=mpi_nsend[j+ThisTask*NProcs];
+        if (j!=ThisTask) maxrecv=max(maxrecv,mpi_nsend[ThisTask+j*NProcs]);
+    }
+    nlocal=nbodies-nexport+nimport;
+    NImport=nimport;
+    Noldlocal=nbodies-nexport;
+
+    //order particles so that those staying are first, followed by exported particles ordered by destination task
+    //the type temporarily stores the sort key and the id stores the original index, then the group id
+    Int_t *storeval=new Int_t[nbodies];
+    for (i=0;i<nbodies;i++) storeval[i]=Part[i].GetType();
+    for (i=0;i<nbodies;i++) {
+        Part[i].SetType((mpi_foftask[i]==ThisTask)?-1:mpi_foftask[i]);
+        Part[i].SetID(i);
+    }
+    qsort(Part.data(),nbodies,sizeof(Particle),TypeCompare);
+    for (i=0;i<nbodies;i++) Part[i].SetType(storeval[Part[i].GetID()]);
+    for (i=0;i<nbodies;i++) storeval[i]=pfof[Part[i].GetID()];
+    for (i=0;i<nbodies;i++) Part[i].SetID(-storeval[i]);
+    delete[] storeval;
+    noffset_export[0]=Noldlocal;
+    for (j=1;j<NProcs;j++) noffset_export[j]=noffset_export[j-1]+mpi_nsend[(j-1)+ThisTask*NProcs];
+
+    //grow the local array before any particles are in flight so that the old array, the new
+    //array and communication buffers are never all held at once. Reserve exactly what is needed
+    //as resize alone can double the allocation, and use all of the array if it is already larger
+    if ((Int_t)Part.size()<nlocal) {
+        Part.reserve(nlocal);
+        Part.resize(nlocal);
+    }
+    nmem=Part.size();
+
+    vector<Particle> recvbuf[2], spill;
+    recvbuf[0].resize(max((Int_t)1,min(batchsize,maxrecv)));
+    recvbuf[1].resize(max((Int_t)1,min(batchsize,maxrecv)));
+    vector<Int_t> indices_gas_send;
+    vector<float> propbuff_gas_send;
+    vector<Int_t> indices_star_send;
+    vector<float> propbuff_star_send;
+    vector<Int_t> indices_bh_send;
+    vector<float> propbuff_bh_send;
+    vector<Int_t> indices_extra_dm_send;
+    vector<float> propbuff_extra_dm_send;
+
+    //freeslots holds the ranges vacated by sent particles and itop the next free slot beyond the original particles
+    //nsent and nrecvd track the progress of the exchange with each task, which both tasks of a pair agree on
+    vector<pair<Int_t,Int_t>> freeslots;
+    vector<Int_t> nsent(NProcs,0), nrecvd(NProcs,0);
+    itop=nbodies;
+    spillbudget=batchsize;
+    do {
+        nmoved=0;
+        for (j=0;j<NProcs;j++)
+        {
+            if (j==ThisTask) continue;
+            nsend=mpi_nsend[j+ThisTask*NProcs];
+            nrecv=mpi_nsend[ThisTask+j*NProcs];
+            if (nsent[j]==nsend && nrecvd[j]==nrecv) continue;
+            //each side offers to receive what fits, which is what the other side then sends
+            nfree=MPIGroupExchangeFreeSpace(freeslots, itop, nmem, spill.size(), spillbudget);
+            currecv=min(min(batchsize,nrecv-nrecvd[j]),nfree);
+            MPI_Sendrecv(&currecv, 1, MPI_Int_t, j, TAG_FOF_D, &cursend, 1, MPI_Int_t, j, TAG_FOF_D, mpi_comm, &status);
+            ibuf=0;
+            if (currecv>0) MPI_Irecv(recvbuf[ibuf].data(), currecv*sizeof(Particle), MPI_BYTE, j, TAG_FOF_C, mpi_comm, &recvreq[ibuf]);
+            while (cursend>0 || currecv>0)
+            {
+                Particle *psend=Part.data()+noffset_export[j]+nsent[j];
+                //strip extra properties from the outgoing particles and send them straight from the local array
+                MPIFillBuffWithHydroInfo(opt, cursend, psend, indices_gas_send, propbuff_gas_send, true);
+                MPIFillBuffWithStarInfo(opt, cursend, psend, indices_star_send, propbuff_star_send, true);
+                MPIFillBuffWithBHInfo(opt, cursend, psend, indices_bh_send, propbuff_bh_send, true);
+                MPIFillBuffWithExtraDMInfo(opt, cursend, psend, indices_extra_dm_send, propbuff_extra_dm_send, true);
+                if (cursend>0) MPI_Isend(psend, cursend*sizeof(Particle), MPI_BYTE, j, TAG_FOF_C, mpi_comm, &sendreq);
+                //once this batch is placed the space changes by what is sent less what is received, so the next
+                //batch can be agreed and its receive posted into the other buffer to overlap with placing this batch
+                nextrecv=min(min(batchsize,nrecv-nrecvd[j]-currecv),nfree+cursend-currecv);
+                MPI_Sendrecv(&nextrecv, 1, MPI_Int_t, j, TAG_FOF_D, &nextsend, 1, MPI_Int_t, j, TAG_FOF_D, mpi_comm, &status);
+                if (nextrecv>0) MPI_Irecv(recvbuf[1-ibuf].data(), nextrecv*sizeof(Particle), MPI_BYTE, j, TAG_FOF_C, mpi_comm, &recvreq[1-ibuf]);
+                if (currecv>0) MPI_Wait(&recvreq[ibuf], &status);
+                if (cursend>0) MPI_Wait(&sendreq, &status);
+                MPISendReceiveBuffWithHydroInfoBetweenThreads(opt, recvbuf[ibuf].data(), indices_gas_send, propbuff_gas_send, j, TAG_FOF_C_HYDRO, mpi_comm);
+                MPISendReceiveBuffWithStarInfoBetweenThreads(opt, recvbuf[ibuf].data(), indices_star_send, propbuff_star_send, j, TAG_FOF_C_STAR, mpi_comm);
+                MPISendReceiveBuffWithBHInfoBetweenThreads(opt, recvbuf[ibuf].data(), indices_bh_send, propbuff_bh_send, j, TAG_FOF_C_BH, mpi_comm);
+                MPISendReceiveBuffWithExtraDMInfoBetweenThreads(opt, recvbuf[ibuf].data(), indices_extra_dm_send, propbuff_extra_dm_send, j, TAG_FOF_C_EXTRA_DM, mpi_comm);
+                //slots of the sent particles are now free, and spilled particles are placed first
+                if (cursend>0) freeslots.push_back(make_pair(noffset_export[j]+nsent[j], noffset_export[j]+nsent[j]+cursend));
+                while (spill.size()>0 && freeslots.size()>0) {
+                    MPIGroupExchangePlace(Part, spill.back(), freeslots, itop, nmem, spill);
+                    spill.pop_back();
+                }
+                for (i=0;i<currecv;i++) MPIGroupExchangePlace(Part, recvbuf[ibuf][i], freeslots, itop, nmem, spill);
+                maxspill=max(maxspill,(Int_t)spill.size());
+                nsent[j]+=cursend;
+                nrecvd[j]+=currecv;
+                nmoved+=cursend+currecv;
+                nfree+=cursend-currecv;
+                cursend=nextsend;
+                currecv=nextrecv;
+                ibuf=1-ibuf;
+            }
+        }
+        //if no task could make progress, space is only freed by exchanges that are themselves waiting for space,
+        //so lift the spill budget to guarantee completion
+        MPI_Allreduce(&nmoved, &nmovedtotal, 1, MPI_Int_t, MPI_SUM, mpi_comm);
+        if (nmovedtotal==0) {
+            Int_t nleft=0;
+            for (j=0;j<NProcs;j++) if (j!=ThisTask) nleft+=mpi_nsend[j+ThisTask*NProcs]-nsent[j]+mpi_nsend[ThisTask+j*NProcs]-nrecvd[j];
+            MPI_Allreduce(MPI_IN_PLACE, &nleft, 1, MPI_Int_t, MPI_SUM, mpi_comm);
+            if (nleft==0) break;
+            if (ThisTask==0 && opt.iverbose>=1) cout<<"Group exchange stalled with "<<nleft<<" particles left to exchange, lifting spill budget"<<endl;
+            spillbudget=nlocal;
+        }
+        npass++;
+    } while (true);
+    //all particles have been sent, so any spilled particles now fit in the vacated slots or beyond the original particles
+    while (spill.size()>0) {
+        MPIGroupExchangePlace(Part, spill.back(), freeslots, itop, nmem, spill);
+        spill.pop_back();
+    }
+    //close the gaps left by departed particles by moving the last occupied particles into them
+    sort(freeslots.begin(), freeslots.end());
+    Int_t iend=itop;
+    int klast=(int)freeslots.size()-1;
+    for (int k=0;k<(int)freeslots.size() && freeslots[k].first<iend;k++) {
+        for (Int_t islot=freeslots[k].first;islot<freeslots[k].second;islot++) {
+            //particles at iend and beyond have been moved, so skip free slots at the new end
+            while (klast>=k && iend<=freeslots[klast].second) iend=min(iend,freeslots[klast--].first);
+            if (islot>=iend) break;
+            Part[islot]=move(Part[--iend]);
+        }
+    }
+    //the local array now holds exactly the particles of the local groups
+    Part.resize(nlocal);
+    //all particles are now local, ensure that MPICompileGroups does not copy from FoFGroupDataLocal
+    Noldlocal=nlocal;
+    if (opt.iverbose>=2) cout<<ThisTask<<" exchanged "<<nexport<<" and "<<nimport<<" particles in batches of "<<batchsize<<" over "<<npass<<" passes with at most "<<maxspill<<" spilled in "<<MyGetTime()-time1<<endl;
+    Nlocal=nlocal;
+    return nlocal;
+}
+
 /*!
     The baryon equivalent of \ref MPIGroupExchange. Here assume baryons are searched afterwards
 */
@@ -5437,52 +6084,6 @@ inline void MPIAdjustGroupIDs(const Int_t nbodies,Int_t *pfof) {
     for (Int_t i=0;i<nbodies;i++) if (pfof[i]>0) pfof[i]+=noffset;
 }
 
-///Collect FOF from all
-void MPICollectFOF(const Int_t nbodies, Int_t *&pfof){
-    Int_t sendTask,recvTask;
-    MPI_Status status;
-    //if using mpi, offset the pfof so that group ids are no unique, before just local to thread
-    MPIAdjustGroupIDs(Nlocal,pfof);
-    //now send the data from all MPI threads to thread zero
-    //first must send how much data is local to a processor
-    Int_t nsend_local[NProcs];
-    for (int i=0;i<NProcs;i++) nsend_local[i]=0;
-    if (ThisTask!=0)nsend_local[0]=Nlocal;
-    MPI_Allgather(nsend_local, NProcs, MPI_Int_t, mpi_nsend, NProcs, MPI_Int_t, MPI_COMM_WORLD);
-    recvTask=0;
-    //next copy task zero pfof into global mpi_pfof to the appropriate indices
-    if (ThisTask==0) {
-        for (Int_t i=0;i<Nlocal;i++) mpi_pfof[mpi_indexlist[i]]=pfof[i];
-    }
-    //then for each processor copy their values into local pfof and mpi_indexlist
-    //note mpi_idlist contains id values whereas indexlist contains the index order of how particles were loaded
-    //this requires determining the largest size needed
-    if (ThisTask==0) {
-        Int_t maxnlocal=0;
-        for(int j=1;j<NProcs;j++) if (maxnlocal<mpi_nsend[j*NProcs]) maxnlocal=mpi_nsend[j*NProcs];
-        delete[] pfof;
-        delete[] mpi_indexlist;
-        pfof=new Int_t[maxnlocal];
-        mpi_indexlist=new Int_t[maxnlocal];
-    }
-    MPI_Barrier(MPI_COMM_WORLD);
-    //now for each mpi task, copy appropriate data to mpi thread 0 local buffers
-    for(int j=1;j<NProcs;j++)
-    {
-        sendTask=j;
-        recvTask=0;
-        if (ThisTask==sendTask) {
-            MPI_Ssend(pfof, Nlocal , MPI_Int_t,0, TAG_FOF_D, MPI_COMM_WORLD);
-            MPI_Ssend(mpi_indexlist, Nlocal , MPI_Int_t,0, TAG_FOF_E, MPI_COMM_WORLD);
-        }
-        if(ThisTask==0) {
-            MPI_Recv(pfof, mpi_nsend[sendTask*NProcs], MPI_Int_t, sendTask, TAG_FOF_D, MPI_COMM_WORLD, &status);
-            MPI_Recv(mpi_indexlist, mpi_nsend[sendTask*NProcs], MPI_Int_t, sendTask, TAG_FOF_E, MPI_COMM_WORLD, &status);
-            for (Int_t i=0;i<mpi_nsend[sendTask*NProcs];i++) mpi_pfof[mpi_indexlist[i]]=pfof[i];
-        }
-        MPI_Barrier(MPI_COMM_WORLD);
-    }
-}
 //@}
 
 /// \name Routines related to distributing the grid cells used to calculate the coarse-grained mean field
@@ -5533,6 +6134,41 @@ void MPIBuildGridData(const Int_t ngrid, GridCell *grid, Coordinate *gvel, Matri
         }
     }
 }
+
+/*! Gathers the grid cells of an object whose particles are spread over the tasks of comm so that every task can
+    interpolate the mean field at the positions of its particles. Only the cell centres are used by the interpolation,
+    so the cells are rebuilt rather than copied byte-wise, which would also copy another task's particle index arrays.
+*/
+void MPIGatherGridData(MPI_Comm comm, Int_t &ngrid, GridCell *&grid, Coordinate *&gvel, Matrix *&gveldisp){
+    const int nval=15;
+    int commsize, nlocal=ngrid;
+    Int_t ngridtotal;
+    MPI_Comm_size(comm, &commsize);
+    vector<int> recvcount(commsize), recvoffset(commsize,0);
+    MPI_Allgather(&nlocal, 1, MPI_INT, recvcount.data(), 1, MPI_INT, comm);
+    for (auto &x:recvcount) x*=nval;
+    for (auto j=1;j<commsize;j++) recvoffset[j]=recvoffset[j-1]+recvcount[j-1];
+    ngridtotal=(recvoffset[commsize-1]+recvcount[commsize-1])/nval;
+    vector<Double_t> sendbuf(nval*ngrid), recvbuf(nval*ngridtotal);
+    for (auto i=0;i<ngrid;i++) {
+        for (auto j=0;j<3;j++) sendbuf[nval*i+j]=grid[i].xm[j];
+        for (auto j=0;j<3;j++) sendbuf[nval*i+3+j]=gvel[i][j];
+        for (auto j=0;j<3;j++) for (auto k=0;k<3;k++) sendbuf[nval*i+6+3*j+k]=gveldisp[i](j,k);
+    }
+    MPI_Allgatherv(sendbuf.data(), nval*ngrid, MPI_Real_t, recvbuf.data(), recvcount.data(), recvoffset.data(), MPI_Real_t, comm);
+    delete[] grid;
+    delete[] gvel;
+    delete[] gveldisp;
+    ngrid=ngridtotal;
+    grid=new GridCell[ngrid];
+    gvel=new Coordinate[ngrid];
+    gveldisp=new Matrix[ngrid];
+    for (auto i=0;i<ngrid;i++) {
+        for (auto j=0;j<3;j++) grid[i].xm[j]=recvbuf[nval*i+j];
+        for (auto j=0;j<3;j++) gvel[i][j]=recvbuf[nval*i+3+j];
+        for (auto j=0;j<3;j++) for (auto k=0;k<3;k++) gveldisp[i](j,k)=recvbuf[nval*i+6+3*j+k];
+    }
+}
 //@}
 
 /// \name config updates for MPI
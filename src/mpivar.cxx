@@ -31,11 +31,14 @@ Int_t *mpi_ngroups, *mpi_pfof, *mpi_indexlist, *mpi_nhalos;
 int *mpi_part_send_domain;
 
 Int_t mpi_maxgid,mpi_gidoffset;
+unordered_map<Int_t, Int_t> mpi_largegroupsublabels;
 fofdata_in *FoFDataIn, *FoFDataGet;
 fofid_in *FoFGroupDataLocal, *FoFGroupDataExport;
 nndata_in *NNDataIn, *NNDataGet;
 Particle *PartDataIn, *PartDataGet;
+vector<char> mpi_commarena;
 Particle *mpi_Part1=NULL, *mpi_Part2=NULL;
+vector<Particle> *mpi_growable_part=NULL;
 
 Int_t MinNumMPI,MinNumOld;
 
@@ -12,6 +12,8 @@
 #include <fstream>
 #include <cmath>
 #include <string>
+#include <vector>
+#include <unordered_map>
 #include <getopt.h>
 #include <sys/stat.h>
 
@@ -59,6 +61,20 @@ using namespace NBody;
 ///particles are sent from one MPI thread to another, assume at most this factor of particle will need to be sent
 #define MPIExportFac 0
 #define MAXNNEXPORT 32
+///maximum number of particles sent in one batch when localising groups, bounds the extra memory used by \ref MPIGroupExchange
+#define MPIGroupExchangeBatchSize 1000000
+///factor by which the local particle array is grown when it fills during a single pass read
+#define MPIReadGrowthFac 1.25
+
+///\name parameters used to automatically determine the resolution of the top-level mesh used in the mpi decomposition
+//@{
+///desired number of top-level cells per mpi task, allows for load balancing when repartitioning
+#define MPIMeshCellsPerTask 512
+///minimum average number of particles per top-level cell
+#define MPIMeshMinPartsPerCell 1000
+///maximum number of cells per dimension chosen automatically, limits the memory used by the mesh
+#define MPIMeshMaxCellsPerDim 256
+//@}
 
 ///define a type to store the maxium number of mpi tasks
 #ifdef HUGEMPI
@@ -173,6 +189,8 @@ extern Int_t *mpi_pfof;
 extern int *mpi_part_send_domain;
 ///store the max group id across all threads and the group id offset to be used with unlinked particles
 extern Int_t mpi_maxgid,mpi_gidoffset;
+///substructure labels, keyed by particle id, of groups searched over several mpi tasks by \ref MPISearchLargeGroups. Stored by the task hosting the group and used at the first sublevel of \ref SearchSubSub
+extern unordered_map<Int_t, Int_t> mpi_largegroupsublabels;
 ///structure facilitates linking across mpi threads
 extern struct fofdata_in
 {
@@ -187,6 +205,8 @@ extern struct fofdata_in
 extern Particle *PartDataIn, *PartDataGet;
 ///Particle arrays that allow allocation of memory need when deallocating local particle arrays that then need to be reassigned
 extern Particle *mpi_Part1,*mpi_Part2;
+///local particle vector that can be grown while reading input in a single pass, NULL otherwise
+extern vector<Particle> *mpi_growable_part;
 
 ///structure facilitates passing ids across threads so that determine number of groups and reorder group
 ///ids so that reflects group size
@@ -207,6 +227,10 @@ extern struct nndata_in
     Double_t R2,V2;//NNR2[MAXNNEXPORT],NNV2[MAXNNEXPORT];
 }
 *NNDataIn, *NNDataGet;
+
+///arena backing the communication buffers, sized from the exact export/import counts and kept
+///across phases so that successive phases reuse the same memory rather than allocating and freeing it
+extern vector<char> mpi_commarena;
 //extern Particle *NNPartReturn, *NNPartReturnLocal;
 
 ///For transmitting grid data
@@ -479,6 +479,7 @@ void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Part
         fpos[j]=fopen((string(opt.fname)+ nchilada_part_name.part_names[usetypes[j]]+string("pos")).c_str(), "rb");
         fvel[j]=fopen((string(opt.fname)+ nchilada_part_name.part_names[usetypes[j]]+string("vel")).c_str(), "rb");
         fmass[j]=fopen((string(opt.fname)+ nchilada_part_name.part_names[usetypes[j]]+string("mass")).c_str(), "rb");
+        fid[j]=fopen((string(opt.fname)+ nchilada_part_name.part_names[usetypes[j]]+string("iord")).c_str(), "rb");
     }
 #ifdef GASON
     if (opt.partsearchtype==PSTALL || (opt.partsearchtype==PSTDARK && opt.iBaryonSearch>=1) || opt.partsearchtype==PSTGAS) {
@@ -499,29 +500,67 @@ void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Part
 
     for (j=0;j<nusetypes;j++) {
         k=usetypes[j];
+        //each field is stored in its own file so read them concurrently
+#ifdef USEOPENMP
+#pragma omp parallel sections default(shared)
+#endif
+        {
+#ifdef USEOPENMP
+#pragma omp section
+#endif
+        {
         posdata=readFieldData(fpos[j],fhpos, 3, numParticles,startParticle);
         if (fhpos.code==float32) posfloatbuff=(float*)posdata;
         else posdoublebuff=(double*)posdata;
+        }
+#ifdef USEOPENMP
+#pragma omp section
+#endif
+        {
         veldata=readFieldData(fvel[j],fhvel, 3, numParticles,startParticle);
         if (fhvel.code==float32) velfloatbuff=(float*)veldata;
         else veldoublebuff=(double*)veldata;
+        }
+#ifdef USEOPENMP
+#pragma omp section
+#endif
+        {
         massdata=readFieldData(fmass[j],fhmass, 1, numParticles,startParticle);
         if (fhmass.code==float32) massfloatbuff=(float*)massdata;
         else massdoublebuff=(double*)massdata;
+        }
+#ifdef USEOPENMP
+#pragma omp section
+#endif
+        {
         iddata=readFieldData(fid[j],fhid, 1, numParticles,startParticle);
         if (fhid.code==int32) intbuff=(int*)iddata;
         else if(fhid.code==int64) longbuff=(long long*)iddata;
         else if(fhid.code==uint32) uintbuff=(unsigned int*)iddata;
         else if (fhid.code==uint64) ulongbuff=(unsigned long long*)iddata;
+        }
 #ifdef GASON
+#ifdef USEOPENMP
+#pragma omp section
+#endif
+        {
         gasudata=readFieldData(fgasu,fhgasu, 1, numParticles,startParticle);
         if (fhgasu.code==float32) gasufloatbuff=(float*)gasudata;
         else gasudoublebuff=(double*)gasudata;
+        }
 #ifdef STARON
+#ifdef USEOPENMP
+#pragma omp section
+#endif
         if (usetypes[j]==NCHILADAGASTYPE) {
             gaszdata=readFieldData(fgasz,fhgasz, 1, numParticles,startParticle);
             if (fhgasz.code==float32) gaszfloatbuff=(float*)gaszdata;
             else gaszdoublebuff=(double*)gaszdata;
+        }
+#ifdef USEOPENMP
+#pragma omp section
+#endif
+        if (usetypes[j]==NCHILADAGASTYPE) {
             gassfrdata=readFieldData(fgassfr,fhgassfr, 1, numParticles,startParticle);
             if (fhgassfr.code==float32) gassfrfloatbuff=(float*)gassfrdata;
             else gassfrdoublebuff=(double*)gassfrdata;
@@ -529,15 +568,24 @@ void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Part
 #endif
 #endif
 #ifdef STARON
+#ifdef USEOPENMP
+#pragma omp section
+#endif
         if (usetypes[j]==NCHILADASTARTYPE) {
             starzdata=readFieldData(fstarz,fhstarz, 1, numParticles,startParticle);
             if (fhstarz.code==float32) starzfloatbuff=(float*)starzdata;
             else starzdoublebuff=(double*)starzdata;
+        }
+#ifdef USEOPENMP
+#pragma omp section
+#endif
+        if (usetypes[j]==NCHILADASTARTYPE) {
             startagedata=readFieldData(fstartage,fhstartage, 1, numParticles,startParticle);
             if (fhstartage.code==float32) startagefloatbuff=(float*)startagedata;
             else startagedoublebuff=(double*)startagedata;
         }
 #endif
+        }
         for (i=0;i<fhpos.nbodies;i++) {
 #ifdef USEMPI
             if (fhpos.code==float32) ibuf=MPIGetParticlesProcessor(opt, posfloatbuff[i],posfloatbuff[i+nbodies],posfloatbuff[i+nbodies*2]);
@@ -670,6 +718,7 @@ void ReadNchilada(Options &opt, vector<Particle> &Part, const Int_t nbodies,Part
         fclose(fpos[j]);
         fclose(fvel[j]);
         fclose(fmass[j]);
+        if (fid[j]) fclose(fid[j]);
     }
 #ifdef GASON
     if (opt.partsearchtype==PSTALL || (opt.partsearchtype==PSTDARK && opt.iBaryonSearch>=1) || opt.partsearchtype==PSTGAS) {
@@ -20,6 +20,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <assert.h>
+#include <type_traits>
 
 #include "endianutils.h"
 #include <rpc/types.h>
@@ -139,6 +140,37 @@ inline bool_t xdr_template(XDR* xdrs, struct nchilada_dump* h) {
 //@}
 
 
+///number of XDR values decoded at once when reading fields in blocks
+#define NCHILADAXDRBLOCKSIZE 1048576
+
+/*! Read n values of a field from an XDR stream in one block rather than one value at a time.
+ XDR stores every type as 4 big endian bytes, except 8 byte floating point values, so blocks are read
+ directly from the underlying file, converted to the endian of the system in one go and then cast to the type.
+ */
+template <typename T> inline bool xdr_read_block(XDR* xdrs, T* data, const u_int64_t n) {
+    FILE *fp = (FILE *)xdrs->x_private;
+    if (std::is_floating_point<T>::value && sizeof(T) == 8) {
+        if (fread(data, 8, n, fp) != n) return false;
+        BigEndian8Array(data, n);
+        return true;
+    }
+    if (sizeof(T) == 4) {
+        if (fread(data, 4, n, fp) != n) return false;
+        BigEndian4Array(data, n);
+        return true;
+    }
+    //narrower and wider integers are stored as 4 byte words
+    vector<uint32_t> words(min(n, (u_int64_t)NCHILADAXDRBLOCKSIZE));
+    for (u_int64_t i = 0; i < n; i += words.size()) {
+        u_int64_t nwords = min(n - i, (u_int64_t)words.size());
+        if (fread(words.data(), 4, nwords, fp) != nwords) return false;
+        BigEndian4Array(words.data(), nwords);
+        if (std::is_signed<T>::value) for (u_int64_t j = 0; j < nwords; j++) data[i+j] = (T)(int32_t)words[j];
+        else for (u_int64_t j = 0; j < nwords; j++) data[i+j] = (T)words[j];
+    }
+    return true;
+}
+
 /*! Allocate for and read in a field from an XDR stream.  You need to have
  read the header already.  The min/max pair are put at the end of the array.
  */
@@ -179,11 +211,9 @@ template <typename T> inline T* readField(XDR* xdrs, const u_int64_t N, const u_
         }
 #endif
         */
-        for(u_int64_t i = 0; i < N; ++i) {
-            if(!xdr_template(xdrs, data + i)) {
-                delete[] data;
-                return 0;
-            }
+        if(!xdr_read_block(xdrs, data, N)) {
+            delete[] data;
+            return 0;
         }
     }
     return data;
@@ -226,11 +256,9 @@ template <typename T> inline T* readField3D(XDR* xdrs, const u_int64_t N, const
             }
 #endif
             */
-            for(u_int64_t i = 0; i < N; ++i) {
-                if(!xdr_template(xdrs, data + i+ioffset)) {
-                    delete[] data;
-                    return 0;
-                }
+            if(!xdr_read_block(xdrs, data + ioffset, N)) {
+                delete[] data;
+                return 0;
             }
         }
     }
@@ -33,6 +33,8 @@ using namespace NBody;
 #define omppropnum 50000
 #define ompfofsearchnum 2000000
 #define ompsortsize 1000000
+///minimum number of particles in an input chunk before unpacking it is done in parallel
+#define ompreadnum 100000
 //@}
 
 #ifdef USEOPENMP 
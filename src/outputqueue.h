@@ -0,0 +1,109 @@
+/*! \file outputqueue.h
+ *  \brief this file declares the queue used to write catalogue output in the background
+ */
+
+#ifndef OUTPUTQUEUE_H
+#define OUTPUTQUEUE_H
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <memory>
+#ifndef USEMPI
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+/*! \class OutputQueue
+    \brief Bounded queue of output jobs processed in order by a single writer thread.
+
+    Each job must own (immutable) copies of the data it writes so that the caller is free to reorder or free
+    its own arrays once the job is queued. \ref Push blocks while the queue is full, bounding the memory held
+    in pending output, and \ref Wait blocks until every queued job has been written.
+    The output routines use MPI collectives and write through a library that is not necessarily thread safe, so
+    with MPI, or if asynchronous output is off, jobs are simply run by the calling thread when pushed.
+*/
+class OutputQueue {
+    public:
+    OutputQueue(int iasync=0, int maxqueued=1){
+        nmaxqueued=std::max(maxqueued,1);
+#ifndef USEMPI
+        iactive=(iasync!=0);
+        ifinish=false;
+        ibusy=false;
+        if (iactive) writer=std::thread(&OutputQueue::Run,this);
+#endif
+    }
+    ~OutputQueue(){
+#ifndef USEMPI
+        if (!iactive) return;
+        Wait();
+        {
+            std::unique_lock<std::mutex> lock(m);
+            ifinish=true;
+        }
+        cvjob.notify_all();
+        writer.join();
+#endif
+    }
+    OutputQueue(const OutputQueue &)=delete;
+    OutputQueue& operator=(const OutputQueue &)=delete;
+
+    ///add a job to the queue, blocking if the maximum number of jobs are already pending
+    void Push(std::function<void()> job){
+#ifndef USEMPI
+        if (iactive) {
+            std::unique_lock<std::mutex> lock(m);
+            cvspace.wait(lock, [this]{return (int)jobs.size()<nmaxqueued;});
+            jobs.push_back(std::move(job));
+            lock.unlock();
+            cvjob.notify_one();
+            return;
+        }
+#endif
+        job();
+    }
+    ///block until all queued jobs have been written
+    void Wait(){
+#ifndef USEMPI
+        if (!iactive) return;
+        std::unique_lock<std::mutex> lock(m);
+        cvspace.wait(lock, [this]{return jobs.size()==0 && !ibusy;});
+#endif
+    }
+
+    private:
+    int nmaxqueued;
+#ifndef USEMPI
+    bool iactive, ifinish, ibusy;
+    std::deque<std::function<void()>> jobs;
+    std::mutex m;
+    std::condition_variable cvjob, cvspace;
+    std::thread writer;
+
+    ///writer thread, processes jobs in the order they were queued
+    void Run(){
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cvjob.wait(lock, [this]{return ifinish || jobs.size()>0;});
+                if (jobs.size()==0) return;
+                job=std::move(jobs.front());
+                jobs.pop_front();
+                ibusy=true;
+            }
+            cvspace.notify_all();
+            job();
+            {
+                std::unique_lock<std::mutex> lock(m);
+                ibusy=false;
+            }
+            cvspace.notify_all();
+        }
+    }
+#endif
+};
+
+#endif
@@ -46,6 +46,10 @@ void ReadTipsy(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particl
 #ifdef USEHDF
 ///Read HDF format
 void ReadHDF(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle *&Pbaryons, Int_t nbaryons=0);
+#ifdef EXTRAINPUTINFO
+///Read the HDF fields skipped by \ref ReadHDF when lazy loading for particles in groups
+void ReadHDFExtraFieldsOfGroupParticles(Options &opt, const Int_t nbodies, Particle *Part, Int_t *pfof);
+#endif
 #endif
 ///Read ramses file
 void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particle *&Pbaryons, Int_t nbaryons=0);
@@ -66,6 +70,10 @@ void WriteLocalVelocityDensity(Options &opt, const Int_t nbodies, vector<Particl
 
 ///Writes a tipsy formatted fof.grpfile
 void WriteFOF(Options &opt, const Int_t nbodies, Int_t *pfof);
+#ifdef USEMPI
+///Writes a tipsy formatted fof.grp file in parallel using MPI-IO
+void MPIWriteFOF(Options &opt, const Int_t nbodies, Particle *Part, Int_t *pfof);
+#endif
 ///Writes a pg list file (first in effective index order of input file(s), second is particle ids
 void WritePGList(Options &opt, const Int_t ngroups, const Int_t ng, Int_t *numingroup, Int_t **pglist, Int_t *ids);
 ///Write catalog information (number of groups, number in groups, number of particles in groups, particle pids)
@@ -79,6 +87,10 @@ void WriteSUBFINDProperties(Options &opt, const Int_t ngroups, PropData *pdata);
 ///Writes the structure hierarchy
 //void WriteHierarchy(Options &opt, Int_t ngroups, int subflag=0);
 void WriteHierarchy(Options &opt, const Int_t &ngroups, const Int_t &nhierarchy, const Int_t &nfield, Int_t *nsub, Int_t *parentgid, Int_t *stype,int subflag=0);
+///Copies the group output of \ref WriteProperties, \ref WriteGroupCatalog, \ref WriteGroupPartType and \ref WriteHierarchy into a buffer and queues it for writing
+void QueueGroupOutput(OutputQueue &writer, Options &opt, const Int_t ngroups, Int_t *numingroup, Int_t **pglist, vector<Particle> &Part,
+    PropData *pdata, Int_t nadditional, const Int_t nhierarchygroups, const Int_t nhierarchy, const Int_t nfield,
+    Int_t *nsub, Int_t *parentgid, Int_t *stype, int subflag);
 
 ///Write Extended Output
 void WriteExtendedOutput(Options &opt, Int_t numgroups, Int_t nbodies, PropData *pdata, vector<Particle> &p, Int_t * pfof);
@@ -182,6 +194,8 @@ void GetDenVRatio(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngrid
 void DetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *Part, Double_t &meanr,Double_t &sdlow,Double_t &sdhigh, int subleve=0);
 ///Calculate normalized residual
 Int_t GetOutliersValues(Options &opt, const Int_t nbodies, Particle *Part, int sublevel=0);
+///Normalise the ratio given the characterised distribution and return the number of outliers
+Int_t NormaliseDenVRatio(Options &opt, const Int_t nbodies, Particle *Part, Double_t globalmostprob, Double_t globalsdlow, Double_t globalsdhigh);
 
 //@}
 
@@ -320,8 +334,18 @@ Double_t CalcCosmicTime(Options &opt, Double_t a1, Double_t a2);
 //@{
 ///Get Centre of mass quantities
 void GetCM(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngroup, Int_t *&pfof, Int_t *&numingroup, PropData *&pdata, Int_t *&noffset);
+///Get the shrinking sphere centre of mass and velocity of a set of particles
+void GetShrinkingSphereCM(Options &opt, const Int_t nbodies, Particle *Part, Coordinate &cm, Coordinate &cmvel, Double_t &ri);
+///Order particles radially by sorting packed keys and permuting the particles once
+void SortParticlesByRadius(const Int_t nbodies, Particle *Part);
+///Radix sort of radial keys
+void RadixSortRadialKeys(vector<RadialKey> &keys);
+///Get the optional property calculations needed for an output field
+unsigned int GetPropertyKernels(const string &fieldname);
 ///Get the properties of the substructures and output the results
 void GetProperties(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngroup, Int_t *&pfof, Int_t *&numingroup, PropData *&pdata, Int_t *&noffset);
+///Get the counts, masses and bulk sums of each particle type of a group in a single pass
+void GetTypeSums(Options &opt, PropData &pdata, Int_t nbodies, Particle *Part);
 ///Get CM properties
 //void GetCMProp(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngroup, Int_t *&pfof, Int_t *&numingroup, PropData *&pdata, Int_t *&noffset);
 ///Get max dist to several reference frames
@@ -345,6 +369,8 @@ void ReorderInclusiveMasses(const Int_t &nold, const Int_t &nnew, Int_t *&numing
 ///Get Binding Energy
 void GetBindingEnergy(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngroup, Int_t *&pfof, Int_t *&numingroup, PropData *&pdata, Int_t *&noffset);
 
+///Analytic eigenvalues and eigenvectors of a symmetric 3x3 matrix
+void SymmetricEigen3x3(Matrix &A, Coordinate &e, Matrix &eigenvec);
 ///Get Morphology properties (since this is for a particular system just use pointer interface)
 void GetGlobalSpatialMorphology(const Int_t nbodies, Particle *p, Double_t& q, Double_t& s, Double_t Error, Matrix& eigenvec, int imflag=0, int itype=-1, int iiterate=1);
 ///Calculate inertia tensor and eigvector
@@ -357,35 +383,23 @@ void CalcVelSigmaTensor(const Int_t n, Particle *p, Double_t &a, Double_t &b, Do
 void CalcPhaseSigmaTensor(const Int_t n, Particle *p, GMatrix &eigenvalues, GMatrix& eigenvec, GMatrix &I, int itype=-1);
 ///Calculate phase-space dispersion tensor
 void CalcPhaseSigmaTensor(const Int_t n, Particle *p, GMatrix &I, int itype=-1);
-///Calculate the reduced weighted inertia tensor used to determine the spatial morphology
-void CalcMTensor(Matrix& M, const Double_t q, const Double_t s, const Int_t n, Particle *p, int itype);
-///Same as \ref CalcMTensor but include mass
-void CalcMTensorWithMass(Matrix& M, const Double_t q, const Double_t s, const Int_t n, Particle *p, int itype);
-///Rotate particles to some coordinate frame
-void RotParticles(const Int_t n, Particle *p, Matrix &R);
 ///get phase-space center-of-mass
 GMatrix CalcPhaseCM(const Int_t n, Particle *p, int itype=-1);
 
-///get concentration routines associted with finding concentrations via root finding
-void CalcConcentration(PropData &p);
-//root finding using half masses
-double CalcConcentrationRootFindingRhalf(double , double);
-//root finding using Vmax
-double CalcConcentrationRootFindingVmax(double , double);
-///wrappers for root finding used to get concentration
-double mycNFW(double c, void *params);
-///wrappers for root finding used to get concentration
-double mycNFW_deriv(double c, void *params);
-///wrappers for root finding used to get concentration
-double mycNFW_fdf(double c, void *params, double*y,double *dy);
-///wrappers for root finding used to get concentration
-double mycNFWRhalf(double c, void *params);
+///get concentration from the ratio of the half mass radius to the overdensity radius
+double CalcConcentrationRootFindingRhalf(double);
+///get concentration from Vmax/Vvir
+double CalcConcentrationRootFindingVmax(double);
 ///Calculate aperture quantities
 void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, PropData &pdata);
 ///determine the radial bin for calculating profiles
 int GetRadialBin(Options &opt, Double_t rc, int &ibin);
 ///add a particle's properties to the appropriate radial bin.
 void AddParticleToRadialBin(Options &opt, Particle *Pval, Double_t irnorm, int &ibin, PropData &pdata);
+///determine the radial bins of a set of particles, -1 if outside the profile
+void GetRadialBins(Options &opt, const Int_t n, Particle *Part, Double_t irnorm, vector<int> &ibins, bool iparallel=false);
+///add a group's particles to its radial profiles using local histograms
+void AddParticlesToRadialBins(Options &opt, const Int_t n, Particle *Part, Double_t irnorm, PropData &pdata);
 ///add data to the appropriate radial bin
 void AddDataToRadialBin(Options &opt, Double_t rval, Double_t massval,
 #if defined(GASON) || defined(STARON) || defined(BHON)
@@ -400,6 +414,8 @@ void AddDataToRadialBinInclusive(Options &opt, Double_t rval, Double_t massval,
 #endif
     Double_t irnorm, int &ibin, PropData &pdata);
 
+///resolve the extra property name lists into slot based calculation plans
+void SetExtraPropPlans(Options &opt);
 ///calculate extra hydro properties
 void GetExtraHydroProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pval);
 ///calculate extra star properties
@@ -409,6 +425,11 @@ void GetExtraBHProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pval
 ///calculate extra dm properties
 void GetExtraDMProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pval);
 
+///order haloes so that consecutive entries are spatial neighbours
+void SortHalosBySpatialKey(vector<Int_t> &haloorder, PropData *pdata);
+///order SO search candidates radially, returning the number sorted
+Int_t SortSphericalOverdensityShells(Options &opt, vector<Double_t> &radii, vector<Double_t> &masses, vector<Int_t> &indices,
+    Double_t maxrad, Double_t minlgrhoval);
 ///calculate spherical overdensity from vector of radii, masses and indices
 Int_t CalculateSphericalOverdensity(Options &opt, PropData &pdata,
     vector<Double_t> &radii, vector<Double_t> &masses, vector<Int_t> &indices,
@@ -432,6 +453,7 @@ void CalculateExtraSphericalOverdensityProperties(Options &opt, PropData &pdata,
     vector<Coordinate> &posparts, vector<Coordinate> &velparts, vector<int> &typeparts);
 
 void SetSphericalOverdensityMasstoFlagValue(Options &opt, PropData &pdata);
+void ResetSphericalOverdensityMass(Options &opt, PropData &pdata);
 void SetSphericalOverdensityMasstoTotalMass(Options &opt, PropData &pdata);
 void SetSphericalOverdensityMasstoTotalMassExclusive(Options &opt, PropData &pdata);
 ///used to sort a pglist based on substructure binding energy
@@ -508,7 +530,13 @@ void MPIInitialDomainDecomposition(Options &opt);
 void MPIDomainExtent(Options &opt);
 ///domain decomposition
 void MPIDomainDecomposition(Options &opt);
-///z-curve based mesh decomposition
+///Morton (z-curve) key of a top-level mesh cell
+unsigned long long MPIMeshMortonKey(unsigned int ix, unsigned int iy, unsigned int iz);
+///Peano-Hilbert key of a top-level mesh cell on a 2^nbits per dimension mesh
+unsigned long long MPIMeshPeanoHilbertKey(unsigned int ix, unsigned int iy, unsigned int iz, int nbits);
+///determine the number of top-level cells per dimension
+int MPIMeshNumCellsPerDim(Options &opt, Int_t nbodies);
+///space filling curve based mesh decomposition
 void MPIInitialDomainDecompositionWithMesh(Options &opt);
 ///z-curve repartitioning of cells
 bool MPIRepartitionDomainDecompositionWithMesh(Options &opt);
@@ -540,8 +568,10 @@ void MPIDomainExtentNchilada(Options &opt);
 ///Determine Domain for Gadget input
 void MPIDomainDecompositionNchilada(Options &opt);
 
+///grow the local particle vector when reading in a single pass so that nadd more particles fit, returns the start of the local array
+Particle *MPIGrowLocalParticles(Particle *Part, const Int_t nlocal, const Int_t nadd);
 ///determine what processor a particle is sent to based on domain decomposition
-int MPIGetParticlesProcessor(Options &opt, const Double_t,const Double_t,const Double_t);
+int MPIGetParticlesProcessor(Options &opt, const Double_t,const Double_t,const Double_t, const Int_t weight=1);
 /// Determine number of local particles wrapper
 void MPINumInDomain(Options &opt);
 
@@ -597,6 +627,10 @@ vector<int> MPIGetCellListInSearchUsingMesh(Options &opt, Double_t xsearch[3][2]
 /// see \ref mpiroutines.cxx for implementation
 //@{
 
+///nonblocking send of a full particle buffer from a read thread to a non-reading task
+void MPIIsendParticlesFromReadThreads(Options &opt, Int_t nlocalbuff, Particle *Pbuf, int taskID);
+///wait for outstanding nonblocking sends from read threads and free their buffers
+void MPIWaitParticleSendsFromReadThreads();
 ///adds particles to appropriate send buffers and initiates sends if necessary.
 void MPIAddParticletoAppropriateBuffer(Options &opt, const int &ibuf, Int_t ibufindex, int *&ireadtask, const Int_t &Bufsize, Int_t *&Nbuf, Particle *&Pbuf, Int_t &numpart, Particle *Part, Int_t *&Nreadbuf, vector<Particle>*&Preadbuf);
 ///Send particle information from read threads to non read threads using MPI_COMM_WORLD
@@ -607,6 +641,8 @@ void MPIReceiveParticlesFromReadThreads(Options &opt, Particle *&Pbuf, Particle
 void MPISendParticlesBetweenReadThreads(Options &opt, Particle *&Pbuf, Particle *Part, Int_t *&nreadoffset, int *&ireadtask, int *&readtaskID, Particle *&Pbaryons, Int_t *&mpi_nsend_baryon);
 ///Send/recv particle data stored in vector using the read thread communication domain
 void MPISendParticlesBetweenReadThreads(Options &opt, vector<Particle> *&Pbuf, Particle *Part, int *&ireadtask, int *&readtaskID, Particle *&Pbaryons, MPI_Comm &mpi_read_comm, Int_t *&mpi_nsend_readthread, Int_t *&mpi_nsend_readthread_baryon);
+///wait for the exchange posted by \ref MPISendParticlesBetweenReadThreads and add the received particles to the local arrays
+Particle *MPIWaitParticleExchangeBetweenReadThreads(Particle *Part, Particle *&Pbaryons);
 
 ///Interrupt send of particle information to destination taskID using MPI_COMM_WORLD
 void MPIISendParticleInfo(Options &opt, Int_t nlocalbuff, Particle *Part, int taskID, int tag, MPI_Request &rqst);
@@ -711,6 +747,18 @@ void MPISendReceiveFOFExtraDMInfoBetweenThreads(Options &opt, fofid_in *FoFGroup
 short_mpi_t *MPISetTaskID(const Int_t nbodies);
 /// Adjust local group ids so that mpi threads are all offset from one another unless a particle belongs to group zero (ie: completely unlinked)
 void MPIAdjustLocalGroupIDs(const Int_t nbodies, Int_t *pfof);
+///Point \ref PartDataIn and \ref PartDataGet to buffers in the communication arena large enough to hold the exact export and import counts
+void MPIAllocatePartCommBuffers(const Int_t nexport, const Int_t nimport);
+///Point \ref FoFDataIn and \ref FoFDataGet to buffers in the communication arena large enough to hold the exact export and import counts
+void MPIAllocateFoFCommBuffers(const Int_t nexport, const Int_t nimport);
+///Point \ref NNDataIn and \ref NNDataGet to buffers in the communication arena large enough to hold the exact export and import counts
+void MPIAllocateNNCommBuffers(const Int_t nexport, const Int_t nimport);
+///Hand the communication buffers of a phase back to the arena, keeping its memory for later phases
+void MPIReleaseCommBuffers();
+///Free the memory held by the communication arena
+void MPIFreeCommBuffers();
+///Report the planned peak memory of local particles and the communication arena across mpi tasks
+void MPIReportPlannedMemory(Options &opt, const Int_t nbodies, string phase);
 ///Determine number of particles that need to be exported to another mpi thread from local mpi thread based on rdist
 void MPIGetExportNum(const Int_t nbodies, Particle *Part, Double_t rdist);
 ///Determine number of particles that need to be exported to another mpi thread from local mpi thread based on rdist using the SWIFT mesh
@@ -727,8 +775,12 @@ Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&
 Int_t MPILinkAcross(const Int_t nbodies, KDTree *&tree, Particle *Part, Int_t *&pfof, Int_tree_t *&Len, Int_tree_t *&Head, Int_tree_t *&Next, Double_t rdist2, FOFcheckfunc &check, Double_t *params);
 ///update export list after after linking across
 void MPIUpdateExportList(const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_tree_t *&Len);
+///reassign the mpi task of large groups to balance the load before they are localized
+void MPIBalanceLargeGroups(Options &opt, const Int_t nbodies, Int_t *pfof, vector<Int_t> &largegroups);
 ///localize groups to a single mpi thread
 Int_t MPIGroupExchange(Options &opt, const Int_t nbodies, Particle *Part, Int_t *&pfof);
+///Streaming version of \ref MPIGroupExchange that moves particles in bounded batches within the local vector
+Int_t MPIGroupExchange(Options &opt, const Int_t nbodies, vector<Particle> &Part, Int_t *&pfof);
 ///Determine the local number of groups and their sizes (groups must be local to an mpi thread)
 Int_t MPICompileGroups(Options &opt, const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_t minsize);
 ///similar to \ref MPIGroupExchange but optimised for separate baryon search, assumes only looking at baryons
@@ -736,8 +788,6 @@ Int_t MPIBaryonGroupExchange(Options &opt, const Int_t nbodies, Particle *Part,
 ///similar to \ref MPICompileGroups but optimised for separate baryon search, assumes only looking at baryons
 Int_t MPIBaryonCompileGroups(Options &opt, const Int_t nbodies, Particle *Part, Int_t *&pfof, Int_t minsize, int iorder=1);
 ///localize baryons particle members of groups to a single mpi thread
-///Collect FOF from all
-void MPICollectFOF(const Int_t nbodies, Int_t *&pfof);
 ///comparison function to order particles for export
 int fof_export_cmp(const void *a, const void *b);
 ///comparison function to order particles for export and fof group localization.
@@ -756,6 +806,8 @@ Int_t MPIBaryonExchange(const Int_t nbaryons, Particle *&Pbaryons, Int_t *&pfofb
 
 ///Effectively is an allgather for the grid data so that particles can find nearest cells and use appropriate nearest neighbouring cells for calculating estimated background velocity density function
 void MPIBuildGridData(const Int_t ngrid, GridCell *grid, Coordinate *gvel, Matrix *gveldisp);
+///Allgather the grid data of a group spread over the tasks of a communicator, replacing the local grid with that of the whole group
+void MPIGatherGridData(MPI_Comm comm, Int_t &ngrid, GridCell *&grid, Coordinate *&gvel, Matrix *&gveldisp);
 ///Determine number of particles that need to be exported to another mpi thread from local mpi thread based on array of distances for each particle for NN search
 void MPIGetNNExportNum(const Int_t nbodies, Particle *Part, Double_t *rdist);
 ///Determine number of particles that need to be exported to another mpi thread from local mpi thread based on array of distances for each particle for NN search
@@ -787,6 +839,26 @@ Int_t MPIBuildHaloSearchImportList(Options &opt, const Int_t nbodies, KDTree *tr
 void MPISwiftExchange(vector<Particle> &Part);
 #endif
 //@}
+
+/// \name MPI search of large groups spread across mpi tasks
+/// see \ref search.cxx, \ref localfield.cxx, \ref localbgcomp.cxx and \ref unbind.cxx for implementation
+//@{
+
+///Search for the first level of substructure of large groups before they are localized
+void MPISearchLargeGroups(Options &opt, const Int_t nbodies, Particle *Part, Int_t *pfof, vector<Int_t> &largegroups);
+///Return the substructure of a group searched by \ref MPISearchLargeGroups or NULL if it was not searched
+Int_t *MPIGetLargeGroupSubstructure(Options &opt, const Int_t nsubset, Particle *Partsubset, Int_t &numgroups, Int_t *pnumcores=NULL);
+///Subset search of outliers spread over the tasks of a communicator
+Int_t *MPISearchSubsetDistributed(Options &opt, const Int_t nsubset, Particle *Partsubset, Int_t &numgroups, MPI_Comm comm);
+///Velocity density of particles of a group spread over the tasks of a communicator
+void MPIGetVelocityDensityDistributed(Options &opt, const Int_t nbodies, Particle *Part, MPI_Comm comm);
+///Characterize the ratio distribution of a group spread over the tasks of a communicator
+void MPIDetermineDenVRatioDistribution(Options &opt,const Int_t nbodies, Particle *Part, Double_t &meanr,Double_t &sdlow,Double_t &sdhigh, int sublevel, MPI_Comm comm);
+///Calculate normalized residual of a group spread over the tasks of a communicator
+Int_t MPIGetOutliersValues(Options &opt, const Int_t nbodies, Particle *Part, int sublevel, MPI_Comm comm);
+///Unbind groups spread over the tasks of a communicator
+Int_t MPIUnbindDistributed(Options &opt, const Int_t nbodies, Particle *Part, Int_t numgroups, Int_t *pfof, MPI_Comm comm);
+//@}
 #endif
 
 /// \name Extra routines for building arrays that access the particle data or reorder arrays
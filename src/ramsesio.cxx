@@ -66,6 +66,43 @@ int RAMSES_fortran_read(fstream &F, RAMSESFLOAT *f){
     return byteoffset;
 }
 
+///scan the record markers of a fortran unformatted file once, storing the offset of the data of each record and its size in bytes.
+///the stream is left at the start of the file
+int RAMSES_fortran_index(fstream &F, vector<streamoff> &recordoffset, vector<int> &recordsize){
+    int dummy;
+    streamoff pos=0, fsize;
+    recordoffset.clear();
+    recordsize.clear();
+    F.clear();
+    F.seekg(0,ios::end);
+    fsize=F.tellg();
+    F.seekg(0,ios::beg);
+    while (pos+2*(streamoff)sizeof(int)<=fsize) {
+        F.read((char*)&dummy, sizeof(dummy));
+        if (!F || dummy<0 || pos+2*(streamoff)sizeof(int)+dummy>fsize) break;
+        recordoffset.push_back(pos+sizeof(int));
+        recordsize.push_back(dummy);
+        pos+=2*sizeof(int)+dummy;
+        F.seekg(pos,ios::beg);
+    }
+    F.clear();
+    F.seekg(0,ios::beg);
+    return recordoffset.size();
+}
+
+///read the data of record irecord in a single call, reading at most nbytes. Any part of buff not filled
+///(record missing or shorter than nbytes) is zeroed. Returns the number of bytes read
+int RAMSES_fortran_read_record(fstream &F, const vector<streamoff> &recordoffset, const vector<int> &recordsize, int irecord, void *buff, size_t nbytes){
+    size_t nread=0;
+    if (irecord>=0 && irecord<(int)recordoffset.size()) {
+        nread=min(nbytes,(size_t)recordsize[irecord]);
+        F.seekg(recordoffset[irecord],ios::beg);
+        F.read((char*)buff, nread);
+    }
+    if (nread<nbytes) memset((char*)buff+nread, 0, nbytes-nread);
+    return nread;
+}
+
 int RAMSES_fortran_skip(fstream &F, int nskips){
     int dummy,byteoffset=0;
     for (int i=0;i<nskips;i++) {
@@ -79,14 +116,12 @@ int RAMSES_fortran_skip(fstream &F, int nskips){
 Int_t RAMSES_get_nbodies(char *fname, int ptype, Options &opt)
 {
     char buf[2000],buf1[2000],buf2[2000];
-    double * dummy_age, * dummy_mass;
     double dmp_mass;
     double OmegaM, OmegaB;
     int totalghost = 0;
     int totalstars = 0;
     int totaldm    = 0;
     int alltotal   = 0;
-    int ghoststars = 0;
     string stringbuf;
     int ninputoffset = 0;
     sprintf(buf1,"%s/amr_%s.out00001",fname,opt.ramsessnapname);
@@ -242,6 +277,7 @@ Int_t RAMSES_get_nbodies(char *fname, int ptype, Options &opt)
         Framses.read((char*)&dummy, sizeof(dummy));
         Framses.read((char*)&ramses_header_info.npart[RAMSESGASTYPE], sizeof(int));
         Framses.read((char*)&dummy, sizeof(dummy));
+        Framses.close();
         ramses_header_info.npartTotal[RAMSESGASTYPE]+=ramses_header_info.npart[RAMSESGASTYPE];
     }
 
@@ -297,118 +333,66 @@ Int_t RAMSES_get_nbodies(char *fname, int ptype, Options &opt)
     Finfo.close();
     dmp_mass = 1.0 / (opt.Neff*opt.Neff*opt.Neff) * (OmegaM - OmegaB) / OmegaM;
 
-    //now particle info
-    for (i=0;i<ramses_header_info.num_files;i++)
+    //now particle info. Files are independent so they are scanned in parallel, each indexing its
+    //record markers once and reading only the mass and birth epoch records
+    Int_t npartdm=0, npartstar=0;
+    int nsinktotal=0;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(dynamic) \
+reduction(+:npartdm,npartstar,totalghost,totalstars,totaldm,alltotal)
+#endif
+    for (int ifile=0;ifile<ramses_header_info.num_files;ifile++)
     {
-        sprintf(buf1,"%s/part_%s.out%05d",fname,opt.ramsessnapname,i+1);
-        sprintf(buf2,"%s/part_%s.out",fname,opt.ramsessnapname);
-        if (FileExists(buf1)) sprintf(buf,"%s",buf1);
-        else if (FileExists(buf2)) sprintf(buf,"%s",buf2);
-        Framses.open(buf, ios::binary|ios::in);
-
-        ramses_header_info.npart[RAMSESDMTYPE]   = 0;
-        ramses_header_info.npart[RAMSESSTARTYPE] = 0;
-        ramses_header_info.npart[RAMSESSINKTYPE] = 0;
-
-        //number of cpus
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        //number of dimensions
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Total number of LOCAL particles
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.read((char*)&ramses_header_info.npartlocal, sizeof(int));
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Random seeds
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Total number of Stars over all processors
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.read((char*)&ramses_header_info.nstarTotal, sizeof(int));
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Total mass of stars
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Total lost mass of stars
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Number of sink particles over the whole simulation (all are included in
-        // all processors)
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.read((char*)&ramses_header_info.npartTotal[RAMSESSINKTYPE], sizeof(int));
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        //to determine how many particles of each type, need to look at the mass
-        // Skip pos, vel, mass
-        for (j = 0; j < 6; j++)
-        {
-            Framses.read((char*)&dummy, sizeof(dummy));
-            Framses.seekg(dummy,ios::cur);
-            Framses.read((char*)&dummy, sizeof(dummy));
+        char fbuf[2000],fbuf1[2000],fbuf2[2000];
+        fstream Fpart;
+        vector<streamoff> recordoffset;
+        vector<int> recordsize;
+        vector<RAMSESFLOAT> massbuff, agebuff;
+        int npartlocal=0, nsink=0, ndm=0, nstar=0, nghost=0, ndim=0, imassrecord;
+        sprintf(fbuf1,"%s/part_%s.out%05d",fname,opt.ramsessnapname,ifile+1);
+        sprintf(fbuf2,"%s/part_%s.out",fname,opt.ramsessnapname);
+        if (FileExists(fbuf1)) sprintf(fbuf,"%s",fbuf1);
+        else if (FileExists(fbuf2)) sprintf(fbuf,"%s",fbuf2);
+        Fpart.open(fbuf, ios::binary|ios::in);
+        //records are ncpu, ndim, npart, seeds, nstartot, mstartot, mstarlost, nsink,
+        //then ndim position and ndim velocity records, mass, id, level and birth epoch
+        RAMSES_fortran_index(Fpart, recordoffset, recordsize);
+        RAMSES_fortran_read_record(Fpart, recordoffset, recordsize, 1, &ndim, sizeof(int));
+        RAMSES_fortran_read_record(Fpart, recordoffset, recordsize, 2, &npartlocal, sizeof(int));
+        RAMSES_fortran_read_record(Fpart, recordoffset, recordsize, 7, &nsink, sizeof(int));
+        if (ndim<1 || ndim>3) {
+            printf("Error. Particle file `%s' lists %d dimensions\n", fbuf, ndim);
+            exit(9);
         }
-        //allocate memory to store masses and ages
-        dummy_mass = new double [ramses_header_info.npartlocal];
-        dummy_age  = new double [ramses_header_info.npartlocal];
-
-        // Read Mass
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.read((char*)&dummy_mass[0], sizeof(dummy));
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Skip Id
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Skip level
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.seekg(dummy,ios::cur);
-        Framses.read((char*)&dummy, sizeof(dummy));
-
-        // Read Birth epoch
+        imassrecord=8+2*ndim;
+        massbuff.resize(npartlocal);
+        agebuff.resize(npartlocal);
+        RAMSES_fortran_read_record(Fpart, recordoffset, recordsize, imassrecord, massbuff.data(), sizeof(RAMSESFLOAT)*npartlocal);
         //necessary to separate ghost star particles with negative ages from real one
-        Framses.read((char*)&dummy, sizeof(dummy));
-        Framses.read((char*)&dummy_age[0], sizeof(dummy));
-        Framses.read((char*)&dummy, sizeof(dummy));
+        RAMSES_fortran_read_record(Fpart, recordoffset, recordsize, imassrecord+3, agebuff.data(), sizeof(RAMSESFLOAT)*npartlocal);
+        Fpart.close();
 
-        ghoststars = 0;
-        for (j = 0; j < ramses_header_info.npartlocal; j++)
+        for (int n = 0; n < npartlocal; n++)
         {
-            if (fabs((dummy_mass[j]-dmp_mass)/dmp_mass) < 1e-5)
-                ramses_header_info.npart[RAMSESDMTYPE]++;
-            else
-                if (dummy_age[j] != 0.0)
-                    ramses_header_info.npart[RAMSESSTARTYPE]++;
-                else
-                ghoststars++;
+            if (fabs((massbuff[n]-dmp_mass)/dmp_mass) < 1e-5) ndm++;
+            else if (agebuff[n] != 0.0) nstar++;
+            else nghost++;
         }
-        delete [] dummy_age;
-        delete [] dummy_mass;
-        Framses.close();
 
-        totalghost += ghoststars;
-        totalstars += ramses_header_info.npart[RAMSESSTARTYPE];
-        totaldm    += ramses_header_info.npart[RAMSESDMTYPE];
-        alltotal   += ramses_header_info.npartlocal;
+        totalghost += nghost;
+        totalstars += nstar;
+        totaldm    += ndm;
+        alltotal   += npartlocal;
 
         //now with information loaded, set totals
-        ramses_header_info.npartTotal[RAMSESDMTYPE]+=ramses_header_info.npart[RAMSESDMTYPE];
-        ramses_header_info.npartTotal[RAMSESSTARTYPE]+=ramses_header_info.npart[RAMSESSTARTYPE];
-        ramses_header_info.npartTotal[RAMSESSINKTYPE]+=ramses_header_info.npart[RAMSESSINKTYPE];
+        npartdm   += ndm;
+        npartstar += nstar;
+        //number of sink particles is over the whole simulation and stored in every file
+        if (ifile==ramses_header_info.num_files-1) nsinktotal=nsink;
     }
+    ramses_header_info.npartTotal[RAMSESDMTYPE]+=npartdm;
+    ramses_header_info.npartTotal[RAMSESSTARTYPE]+=npartstar;
+    ramses_header_info.npartTotal[RAMSESSINKTYPE]=nsinktotal;
     for(j=0, nbodies=0; j<nusetypes; j++) {
         k=usetypes[j];
         nbodies+=ramses_header_info.npartTotal[k];
@@ -435,7 +419,10 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
     fstream Finfo;
     fstream *Famr;
     fstream *Fhydro;
-    fstream *Fpart, *Fpartvel,*Fpartid,*Fpartmass, *Fpartlevel, *Fpartage, *Fpartmet;
+    fstream *Fpart;
+    vector<streamoff> recordoffset;
+    vector<int> recordsize;
+    int irecord;
     RAMSES_Header *header;
     int intbuff[NRAMSESTYPE];
     long long longbuff[NRAMSESTYPE];
@@ -471,19 +458,13 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
     ///\todo because of the stupid fortran format, easier if chunksize is BIG so that
     ///number of particles local to a file are smaller
     Int_t chunksize=RAMSESCHUNKSIZE,nchunk;
-    RAMSESFLOAT *xtempchunk, *vtempchunk, *mtempchunk, *sphtempchunk, *agetempchunk, *mettempchunk, *hydrotempchunk;
-    RAMSESIDTYPE *idvalchunk, *levelchunk;
+    RAMSESFLOAT *xtempchunk, *vtempchunk, *mtempchunk, *sphtempchunk, *agetempchunk, *hydrotempchunk;
+    RAMSESIDTYPE *idvalchunk;
     int *icellchunk;
 
     Famr       = new fstream[opt.num_files];
     Fhydro     = new fstream[opt.num_files];
     Fpart      = new fstream[opt.num_files];
-    Fpartvel   = new fstream[opt.num_files];
-    Fpartmass  = new fstream[opt.num_files];
-    Fpartid    = new fstream[opt.num_files];
-    Fpartlevel = new fstream[opt.num_files];
-    Fpartage   = new fstream[opt.num_files];
-    Fpartmet   = new fstream[opt.num_files];
     header     = new RAMSES_Header[opt.num_files];
 
     Particle *Pbuf;
@@ -671,66 +652,11 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
         if (FileExists(buf1)) sprintf(buf,"%s",buf1);
         else if (FileExists(buf2)) sprintf(buf,"%s",buf2);
         Fpart[i].open(buf, ios::binary|ios::in);
-        Fpartvel[i].open(buf, ios::binary|ios::in);
-        Fpartmass[i].open(buf, ios::binary|ios::in);
-        Fpartid[i].open(buf, ios::binary|ios::in);
-        Fpartlevel[i].open(buf, ios::binary|ios::in);
-        Fpartage[i].open(buf, ios::binary|ios::in);
-        Fpartmet[i].open(buf, ios::binary|ios::in);
-
-        //skip header information in each file save for number in the file
-        //@{
-        byteoffset=0;
-        // ncpus
-        byteoffset+=RAMSES_fortran_skip(Fpart[i]);
-        // ndims
-        byteoffset+=RAMSES_fortran_skip(Fpart[i]);
-        // store number of particles locally in file
-        byteoffset+=RAMSES_fortran_read(Fpart[i],header[i].npartlocal);
-        // skip local seeds, nstartot, mstartot, mstarlost, nsink
-        byteoffset+=RAMSES_fortran_skip(Fpart[i],5);
-
-        //byteoffset now stores size of header offset for particles
-        Fpartvel[i].seekg(byteoffset,ios::cur);
-        Fpartmass[i].seekg(byteoffset,ios::cur);
-        Fpartid[i].seekg(byteoffset,ios::cur);
-        Fpartlevel[i].seekg(byteoffset,ios::cur);
-        Fpartage[i].seekg(byteoffset,ios::cur);
-        Fpartmet[i].seekg(byteoffset,ios::cur);
-        //skip positions
-        for(idim=0;idim<header[ifirstfile].ndim;idim++)
-        {
-            RAMSES_fortran_skip(Fpartvel[i]);
-            RAMSES_fortran_skip(Fpartmass[i]);
-            RAMSES_fortran_skip(Fpartid[i]);
-            RAMSES_fortran_skip(Fpartlevel[i]);
-            RAMSES_fortran_skip(Fpartage[i]);
-            RAMSES_fortran_skip(Fpartmet[i]);
-        }
-        //skip velocities
-        for(idim=0;idim<header[ifirstfile].ndim;idim++)
-        {
-            RAMSES_fortran_skip(Fpartmass[i]);
-            RAMSES_fortran_skip(Fpartid[i]);
-            RAMSES_fortran_skip(Fpartlevel[i]);
-            RAMSES_fortran_skip(Fpartage[i]);
-            RAMSES_fortran_skip(Fpartmet[i]);
-        }
-        //skip mass
-        RAMSES_fortran_skip(Fpartid[i]);
-        RAMSES_fortran_skip(Fpartlevel[i]);
-        RAMSES_fortran_skip(Fpartage[i]);
-        RAMSES_fortran_skip(Fpartmet[i]);
-        //skip ids;
-        RAMSES_fortran_skip(Fpartlevel[i]);
-        RAMSES_fortran_skip(Fpartage[i]);
-        RAMSES_fortran_skip(Fpartmet[i]);
-        //skip levels
-        RAMSES_fortran_skip(Fpartage[i]);
-        RAMSES_fortran_skip(Fpartmet[i]);
-        //skip ages
-        RAMSES_fortran_skip(Fpartmet[i]);
-        //@}
+        //index the record markers once, then read each record needed in a single call.
+        //records are ncpu, ndim, npart, seeds, nstartot, mstartot, mstarlost, nsink,
+        //followed by positions and velocities (ndim records each), mass, id, level, birth epoch and metallicity
+        RAMSES_fortran_index(Fpart[i], recordoffset, recordsize);
+        RAMSES_fortran_read_record(Fpart[i], recordoffset, recordsize, 2, &header[i].npartlocal, sizeof(int));
 
         //data loaded into memory in chunks
         chunksize    = nchunk = header[i].npartlocal;
@@ -739,22 +665,21 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
         vtempchunk   = new RAMSESFLOAT  [3*chunksize];
         mtempchunk   = new RAMSESFLOAT  [chunksize];
         idvalchunk   = new RAMSESIDTYPE [chunksize];
-        levelchunk   = new RAMSESIDTYPE [chunksize];
         agetempchunk = new RAMSESFLOAT  [chunksize];
-        mettempchunk = new RAMSESFLOAT  [chunksize];
 
+        irecord=8;
         for(idim=0;idim<header[ifirstfile].ndim;idim++)
-        {
-            RAMSES_fortran_read(Fpart[i],&xtempchunk[idim*nchunk]);
-            RAMSES_fortran_read(Fpartvel[i],&vtempchunk[idim*nchunk]);
-        }
-        RAMSES_fortran_read(Fpartmass[i],  mtempchunk);
-        RAMSES_fortran_read(Fpartid[i],    idvalchunk);
-        RAMSES_fortran_read(Fpartlevel[i], levelchunk);
-        RAMSES_fortran_read(Fpartage[i],   agetempchunk);
-        RAMSES_fortran_read(Fpartmet[i],   mettempchunk);
-
-        RAMSES_fortran_read(Fpartid[i],idvalchunk);
+            RAMSES_fortran_read_record(Fpart[i], recordoffset, recordsize, irecord+idim, &xtempchunk[idim*nchunk], sizeof(RAMSESFLOAT)*nchunk);
+        irecord+=header[ifirstfile].ndim;
+        for(idim=0;idim<header[ifirstfile].ndim;idim++)
+            RAMSES_fortran_read_record(Fpart[i], recordoffset, recordsize, irecord+idim, &vtempchunk[idim*nchunk], sizeof(RAMSESFLOAT)*nchunk);
+        irecord+=header[ifirstfile].ndim;
+        RAMSES_fortran_read_record(Fpart[i], recordoffset, recordsize, irecord++, mtempchunk, sizeof(RAMSESFLOAT)*nchunk);
+        RAMSES_fortran_read_record(Fpart[i], recordoffset, recordsize, irecord++, idvalchunk, sizeof(RAMSESIDTYPE)*nchunk);
+        //skip level
+        irecord++;
+        //birth epoch is zero if the run has no star formation
+        RAMSES_fortran_read_record(Fpart[i], recordoffset, recordsize, irecord++, agetempchunk, sizeof(RAMSESFLOAT)*nchunk);
         for (int nn=0;nn<nchunk;nn++)
         {
             if (fabs((mtempchunk[nn]-dmp_mass)/dmp_mass) > 1e-5 && (agetempchunk[nn] == 0.0))
@@ -976,15 +901,7 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
         delete[] mtempchunk;
         delete[] idvalchunk;
         delete[] agetempchunk;
-        delete[] levelchunk;
-        delete[] mettempchunk;
         Fpart[i].close();
-        Fpartvel[i].close();
-        Fpartmass[i].close();
-        Fpartid[i].close();
-        Fpartlevel[i].close();
-        Fpartage[i].close();
-        Fpartmet[i].close();
 #ifdef USEMPI
 
         //send information between read threads
@@ -998,6 +915,8 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
     }//end of whether reading a file
     }//end of loop over file
 #ifdef USEMPI
+    //make sure any full buffers still in flight have been delivered before the final flush
+    MPIWaitParticleSendsFromReadThreads();
     //once finished reading the file if there are any particles left in the buffer broadcast them
     for(ibuf = 0; ibuf < NProcs; ibuf++) if (ireadtask[ibuf]<0)
     {
@@ -1012,6 +931,7 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
     if (opt.nsnapread>1){
         MPI_Allgather(Nreadbuf, opt.nsnapread, MPI_Int_t, mpi_nsend_readthread, opt.nsnapread, MPI_Int_t, mpi_comm_read);
         MPISendParticlesBetweenReadThreads(opt, Preadbuf, Part.data(), ireadtask, readtaskID, Pbaryons, mpi_comm_read, mpi_nsend_readthread, mpi_nsend_readthread_baryon);
+        MPIWaitParticleExchangeBetweenReadThreads(Part.data(), Pbaryons);
     }
     }//end of ireadtask[ibuf]>0
 #endif
@@ -1285,6 +1205,8 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
 #endif
     }
 #ifdef USEMPI
+    //make sure any full buffers still in flight have been delivered before the final flush
+    MPIWaitParticleSendsFromReadThreads();
     //once finished reading the file if there are any particles left in the buffer broadcast them
     for(ibuf = 0; ibuf < NProcs; ibuf++) if (ireadtask[ibuf]<0)
     {
@@ -1302,6 +1224,7 @@ void ReadRamses(Options &opt, vector<Particle> &Part, const Int_t nbodies, Parti
     if (opt.nsnapread>1){
         MPI_Allgather(Nreadbuf, opt.nsnapread, MPI_Int_t, mpi_nsend_readthread, opt.nsnapread, MPI_Int_t, mpi_comm_read);
         MPISendParticlesBetweenReadThreads(opt, Preadbuf, Part.data(), ireadtask, readtaskID, Pbaryons, mpi_comm_read, mpi_nsend_readthread, mpi_nsend_readthread_baryon);
+        MPIWaitParticleExchangeBetweenReadThreads(Part.data(), Pbaryons);
     }
     }//end of reading task
 #endif
@@ -97,6 +97,8 @@ int RAMSES_fortran_read(fstream &, int*);
 int RAMSES_fortran_read(fstream &, RAMSESFLOAT *);
 int RAMSES_fortran_read(fstream &, RAMSESIDTYPE *);
 int RAMSES_fortran_skip(fstream &, int nskips=1);
+int RAMSES_fortran_index(fstream &, vector<streamoff> &, vector<int> &);
+int RAMSES_fortran_read_record(fstream &, const vector<streamoff> &, const vector<int> &, int, void *, size_t);
 
 /// \name Get the number of particles in the ramses files
 //@{
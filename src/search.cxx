@@ -315,20 +315,16 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
     //Also must ensure that group ids do not overlap between mpi threads so adjust group ids
     MPI_Allgather(&numgroups, 1, MPI_Int_t, mpi_ngroups, 1, MPI_Int_t, MPI_COMM_WORLD);
     MPIAdjustLocalGroupIDs(nbodies, pfof);
-    //then determine export particles, declare arrays used to export data
-#ifdef MPIREDUCEMEM
-
+    //then determine the exact number of particles to export and import, declare arrays used to export data
     if (opt.impiusemesh) MPIGetExportNumUsingMesh(opt, nbodies, Part.data(), sqrt(param[1]));
     else MPIGetExportNum(nbodies, Part.data(), sqrt(param[1]));
-#endif
     //allocate memory to store info
     cout<<ThisTask<<": Finished local search, nexport/nimport = "<<NExport<<" "<<NImport<<" in "<<MyGetTime()-time2<<endl;
     cout<<ThisTask<<": MPI search will require extra memory of "<<(sizeof(Particle)+sizeof(fofdata_in))*(NExport+NImport)/pow(1024.0,3.0)<<" GB"<<endl;
 
-    PartDataIn = new Particle[NExport];
-    PartDataGet = new Particle[NImport];
-    FoFDataIn = new fofdata_in[NExport];
-    FoFDataGet = new fofdata_in[NImport];
+    MPIAllocatePartCommBuffers(NExport, NImport);
+    MPIAllocateFoFCommBuffers(NExport, NImport);
+    MPIReportPlannedMemory(opt, nbodies, "FOF link across");
     //if using MPI must determine which local particles need to be exported to other threads and used to search
     //that threads particles. This is done by seeing if the any particles have a search radius that overlaps with
     //the boundaries of another threads domain. Then once have exported particles must search local particles
@@ -365,10 +361,8 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
     }while(links_across_total>0);
     if (ThisTask==0) cout<<ThisTask<<": finished linking across MPI domains in "<<MyGetTime()-time2<<endl;
 
-    delete[] FoFDataIn;
-    delete[] FoFDataGet;
-    delete[] PartDataIn;
-    delete[] PartDataGet;
+    //hand the communication buffers back to the arena, which is kept for later phases
+    MPIReleaseCommBuffers();
 
     //reorder local particle array and delete memory associated with Head arrays, only need to keep Particles, pfof and some id and idexing information
     delete tree;
@@ -377,13 +371,14 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
     delete[] Len;
     //Now redistribute groups so that they are local to a processor (also orders the group ids according to size
     opt.HaloMinSize=MinNumOld;//reset minimum size
-    Int_t newnbodies=MPIGroupExchange(opt, nbodies, Part.data(), pfof);
-    //once groups are local, can free up memory. Might need to increase size
-    //of vector
-    if (Nmemlocal<Nlocal) {
-        Part.resize(Nlocal);
-        Nmemlocal=Nlocal;
-    }
+    //spread large groups across tasks so that a single task does not host several large groups
+    vector<Int_t> largegroups;
+    MPIBalanceLargeGroups(opt, nbodies, pfof, largegroups);
+    //and search for the first level of substructure in large groups while their particles are still spread across tasks
+    MPISearchLargeGroups(opt, nbodies, Part.data(), pfof, largegroups);
+    //particles are streamed in batches and the vector is sized to the exact number of particles after the exchange
+    Int_t newnbodies=MPIGroupExchange(opt, nbodies, Part, pfof);
+    Nmemlocal=Part.size();
     delete[] mpi_foftask;
     delete[] pfof;
     pfof=new Int_t[newnbodies];
@@ -448,6 +443,15 @@ Int_t* SearchFullSet(Options &opt, const Int_t nbodies, vector<Particle> &Part,
             delete[] numingroup;
             numingroup=NULL;
         }
+        //density of particles in large groups searched across mpi tasks has already been calculated
+        if (mpi_largegroupsublabels.size()>0) {
+            for (i=0;i<Nlocal;i++) {
+                if (Part[i].GetType()<=0) continue;
+                if (mpi_largegroupsublabels.find(Part[i].GetPID())==mpi_largegroupsublabels.end()) continue;
+                Part[i].SetType(0);
+                numlocalden--;
+            }
+        }
         for (i=0;i<Nlocal;i++) {numinstrucs+=(pfof[i]>0);}
         Int_t numlocalden_total;
         MPI_Allreduce(&numlocalden, &numlocalden_total, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
@@ -1844,16 +1848,13 @@ private(i,tid)
     MPI_Allgather(&numgroups, 1, MPI_Int_t, mpi_ngroups, 1, MPI_Int_t, MPI_COMM_WORLD);
     MPIAdjustLocalGroupIDs(nsubset, pfof);
 
-    //then determine export particles, declare arrays used to export data
-#ifdef MPIREDUCEMEM
+    //then determine the exact number of particles to export and import
     if (opt.impiusemesh) MPIGetExportNumUsingMesh(opt, nbodies, Partsubset, sqrt(param[1]));
     else MPIGetExportNum(nbodies, Partsubset, sqrt(param[1]));
-#endif
-    //then determine export particles, declare arrays used to export data
-    PartDataIn = new Particle[NExport];
-    PartDataGet = new Particle[NExport];
-    FoFDataIn = new fofdata_in[NExport];
-    FoFDataGet = new fofdata_in[NExport];
+    //then declare arrays used to export data
+    MPIAllocatePartCommBuffers(NExport, NImport);
+    MPIAllocateFoFCommBuffers(NExport, NImport);
+    MPIReportPlannedMemory(opt, nsubset, "FOF link across");
     //I have adjusted FOF data structure to have local group length and also seperated the export particles from export fof data
     //the reason is that will have to update fof data in iterative section but don't need to update particle information.
     if (opt.impiusemesh) MPIBuildParticleExportListUsingMesh(opt, nsubset, Partsubset, pfof, Len, sqrt(param[1]));
@@ -1875,10 +1876,7 @@ private(i,tid)
     delete[] Next;
     delete[] Len;
     delete[] numingroup;
-    delete[] FoFDataIn;
-    delete[] FoFDataGet;
-    delete[] PartDataIn;
-    delete[] PartDataGet;
+    MPIReleaseCommBuffers();
 
     //Now redistribute groups so that they are local to a processor (also orders the group ids according to size
     if (opt.iSingleHalo) opt.MinSize=MinNumOld;//reset minimum size
@@ -2845,6 +2843,389 @@ void UpdateGroupIDsFromSubstructure(Int_t activenumgroups, Int_t oldnumgroups,
     }
 }
 
+#ifdef USEMPI
+///\name Search for substructure in large groups spread across mpi tasks
+//@{
+
+///copy a particle for a substructure search, giving the copy its own hydro, star, black hole and extra dark matter properties
+inline void CopySubSearchParticle(Particle &p, Particle &porig)
+{
+    p=porig;
+#ifdef GASON
+    if (p.HasHydroProperties()) p.SetHydroProperties();
+#endif
+#ifdef STARON
+    if (p.HasStarProperties()) p.SetStarProperties();
+#endif
+#ifdef BHON
+    if (p.HasBHProperties()) p.SetBHProperties();
+#endif
+#ifdef EXTRADMON
+    if (p.HasExtraDMProperties()) p.SetExtraDMProperties();
+#endif
+}
+
+/*! Search for substructure in outlier particles spread over the tasks of comm using the \ref FOFStreamwithprob criterion.
+    Each task links its local particles, then exports particles within the linking length of the outliers of other tasks
+    and these tasks return the local groups linked to them. The links are gathered by all tasks and joined, with a group
+    labelled by the smallest label it contains, so every task has the same groups. Groups with at least opt.MinSize particles
+    are kept and ordered by size, largest first. \n
+    Unlike \ref SearchSubset there is no iterative search, no halo core search and no merging of candidates.
+    Particles must have ids 0..nsubset-1 and the returned group ids are indexed by particle id.
+*/
+Int_t *MPISearchSubsetDistributed(Options &opt, const Int_t nsubset, Particle *Partsubset, Int_t &numgroups, MPI_Comm comm)
+{
+    KDTree *tree;
+    FOFcompfunc fofcmp=&FOFStreamwithprob;
+    Double_t param[20], xlim[6], rdist;
+    Int_t *pfof, *localpfof=NULL, nlocalgroups=0, labeloffset=0, nimport, nt;
+    int commsize, commrank;
+    MPI_Comm_size(comm, &commsize);
+    MPI_Comm_rank(comm, &commrank);
+    numgroups=0;
+
+    param[1]=(opt.ellxscale*opt.ellxscale)*(opt.ellphys*opt.ellphys);
+    param[2]=(opt.ellvscale*opt.ellvscale)*(opt.ellvel*opt.ellvel);
+    param[6]=param[1];
+    param[7]=opt.Vratio;
+    param[8]=cos(opt.thetaopen*M_PI);
+    param[9]=opt.ellthreshold;
+    rdist=sqrt(param[6]);
+
+    //link local particles keeping single particles as they can still be linked to particles on other tasks
+    tree=NULL;
+    if (nsubset>0) {
+        tree=new KDTree(Partsubset,nsubset,opt.Bsize,tree->TPHYS);
+        param[0]=tree->GetTreeType();
+        localpfof=tree->FOFCriterion(fofcmp,param,nlocalgroups,1,1,1,FOFchecksub);
+    }
+    MPI_Exscan(&nlocalgroups, &labeloffset, 1, MPI_Int_t, MPI_SUM, comm);
+    if (commrank==0) labeloffset=0;
+
+    //export copies of particles near the outliers of other tasks, with their id set to their label
+    for (auto k=0;k<3;k++) {xlim[k]=MAXVALUE;xlim[k+3]=-MAXVALUE;}
+    for (auto i=0;i<nsubset;i++) for (auto k=0;k<3;k++) {
+        xlim[k]=min(xlim[k],(Double_t)Partsubset[i].GetPosition(k));
+        xlim[k+3]=max(xlim[k+3],(Double_t)Partsubset[i].GetPosition(k));
+    }
+    vector<Double_t> allxlim(6*commsize);
+    MPI_Allgather(xlim, 6, MPI_Real_t, allxlim.data(), 6, MPI_Real_t, comm);
+    vector<vector<Particle>> exportpart(commsize);
+    for (auto i=0;i<nsubset;i++) {
+        Int_t label=localpfof[Partsubset[i].GetID()];
+        if (label==0) continue;
+        for (auto j=0;j<commsize;j++) {
+            if (j==commrank) continue;
+            Double_t r2=0, dx;
+            for (auto k=0;k<3;k++) {
+                dx=max((Double_t)0.,max(allxlim[6*j+k]-Partsubset[i].GetPosition(k),Partsubset[i].GetPosition(k)-allxlim[6*j+k+3]));
+                r2+=dx*dx;
+            }
+            if (r2>param[6]) continue;
+            Particle p(Partsubset[i].GetMass(),
+                Partsubset[i].GetPosition(0),Partsubset[i].GetPosition(1),Partsubset[i].GetPosition(2),
+                Partsubset[i].GetVelocity(0),Partsubset[i].GetVelocity(1),Partsubset[i].GetVelocity(2),
+                labeloffset+label);
+            p.SetPotential(Partsubset[i].GetPotential());
+            exportpart[j].push_back(p);
+        }
+    }
+    vector<int> sendcount(commsize), recvcount(commsize), sendoffset(commsize,0), recvoffset(commsize,0);
+    for (auto j=0;j<commsize;j++) sendcount[j]=exportpart[j].size()*sizeof(Particle);
+    MPI_Alltoall(sendcount.data(), 1, MPI_INT, recvcount.data(), 1, MPI_INT, comm);
+    for (auto j=1;j<commsize;j++) {
+        sendoffset[j]=sendoffset[j-1]+sendcount[j-1];
+        recvoffset[j]=recvoffset[j-1]+recvcount[j-1];
+    }
+    vector<Particle> sendpart, recvpart;
+    for (auto &x:exportpart) {sendpart.insert(sendpart.end(), x.begin(), x.end()); vector<Particle>().swap(x);}
+    nimport=(recvoffset[commsize-1]+recvcount[commsize-1])/sizeof(Particle);
+    recvpart.resize(nimport);
+    MPI_Alltoallv(sendpart.data(), sendcount.data(), sendoffset.data(), MPI_BYTE,
+        recvpart.data(), recvcount.data(), recvoffset.data(), MPI_BYTE, comm);
+    vector<Particle>().swap(sendpart);
+
+    //find the local groups linked to imported particles, storing each pair of labels once
+    set<pair<Int_t,Int_t>> links;
+    if (nsubset>0 && nimport>0) {
+        Int_t *nn=new Int_t[nsubset];
+        for (auto i=0;i<nimport;i++) {
+            nt=tree->SearchCriterionTagged(recvpart[i], fofcmp, param, nn);
+            for (auto ii=0;ii<nt;ii++) {
+                Int_t label=localpfof[Partsubset[nn[ii]].GetID()];
+                if (label==0) continue;
+                label+=labeloffset;
+                links.insert(make_pair(min(label,(Int_t)recvpart[i].GetID()),max(label,(Int_t)recvpart[i].GetID())));
+            }
+        }
+        delete[] nn;
+    }
+    vector<Particle>().swap(recvpart);
+    if (tree!=NULL) delete tree;
+
+    //gather links and join labels, so that a group is labelled by its smallest label
+    vector<Int_t> locallinks, alllinks;
+    for (auto &x:links) {locallinks.push_back(x.first);locallinks.push_back(x.second);}
+    links.clear();
+    int nlinks=locallinks.size();
+    MPI_Allgather(&nlinks, 1, MPI_INT, recvcount.data(), 1, MPI_INT, comm);
+    recvoffset[0]=0;
+    for (auto j=1;j<commsize;j++) recvoffset[j]=recvoffset[j-1]+recvcount[j-1];
+    alllinks.resize(recvoffset[commsize-1]+recvcount[commsize-1]);
+    MPI_Allgatherv(locallinks.data(), nlinks, MPI_Int_t, alllinks.data(), recvcount.data(), recvoffset.data(), MPI_Int_t, comm);
+    vector<Int_t>().swap(locallinks);
+    unordered_map<Int_t, Int_t> root;
+    auto findroot=[&root](Int_t label) {
+        Int_t r=label;
+        while (root[r]!=r) r=root[r];
+        while (root[label]!=r) {Int_t next=root[label];root[label]=r;label=next;}
+        return r;
+    };
+    for (auto &x:alllinks) if (root.find(x)==root.end()) root[x]=x;
+    for (size_t i=0;i<alllinks.size();i+=2) {
+        Int_t r1=findroot(alllinks[i]), r2=findroot(alllinks[i+1]);
+        if (r1<r2) root[r2]=r1;
+        else if (r2<r1) root[r1]=r2;
+    }
+    vector<Int_t>().swap(alllinks);
+
+    //sizes of groups spanning several tasks are summed over tasks, other groups are local
+    vector<Int_t> label(nsubset,0), crossroots;
+    for (auto &x:root) if (findroot(x.first)==x.first) crossroots.push_back(x.first);
+    sort(crossroots.begin(), crossroots.end());
+    vector<Int_t> crosssize(crossroots.size(),0);
+    unordered_map<Int_t, Int_t> localsize;
+    for (auto i=0;i<nsubset;i++) {
+        if (localpfof[i]==0) continue;
+        label[i]=labeloffset+localpfof[i];
+        if (root.find(label[i])!=root.end()) {
+            label[i]=findroot(label[i]);
+            crosssize[lower_bound(crossroots.begin(), crossroots.end(), label[i])-crossroots.begin()]++;
+        }
+        else localsize[label[i]]++;
+    }
+    if (localpfof!=NULL) delete[] localpfof;
+    MPI_Allreduce(MPI_IN_PLACE, crosssize.data(), crosssize.size(), MPI_Int_t, MPI_SUM, comm);
+
+    //gather groups that are large enough and order them by size
+    vector<Int_t> localkept, allkept;
+    for (auto &x:localsize) if (x.second>=opt.MinSize) {localkept.push_back(x.second);localkept.push_back(x.first);}
+    if (commrank==0) for (size_t j=0;j<crossroots.size();j++) if (crosssize[j]>=opt.MinSize) {
+        localkept.push_back(crosssize[j]);
+        localkept.push_back(crossroots[j]);
+    }
+    int nkept=localkept.size();
+    MPI_Allgather(&nkept, 1, MPI_INT, recvcount.data(), 1, MPI_INT, comm);
+    recvoffset[0]=0;
+    for (auto j=1;j<commsize;j++) recvoffset[j]=recvoffset[j-1]+recvcount[j-1];
+    allkept.resize(recvoffset[commsize-1]+recvcount[commsize-1]);
+    MPI_Allgatherv(localkept.data(), nkept, MPI_Int_t, allkept.data(), recvcount.data(), recvoffset.data(), MPI_Int_t, comm);
+    vector<pair<Int_t,Int_t>> grouplist(allkept.size()/2);
+    for (size_t j=0;j<grouplist.size();j++) grouplist[j]=make_pair(allkept[2*j],allkept[2*j+1]);
+    sort(grouplist.begin(), grouplist.end(), [](const pair<Int_t,Int_t> &a, const pair<Int_t,Int_t> &b){
+        if (a.first!=b.first) return a.first>b.first;
+        return a.second<b.second;
+    });
+    unordered_map<Int_t, Int_t> groupid;
+    for (auto &x:grouplist) groupid[x.second]=++numgroups;
+
+    pfof=new Int_t[nsubset];
+    for (auto i=0;i<nsubset;i++) {
+        pfof[i]=0;
+        if (label[i]==0) continue;
+        auto it=groupid.find(label[i]);
+        if (it!=groupid.end()) pfof[i]=it->second;
+    }
+    if (opt.iverbose>=2 && commrank==0) cout<<ThisTask<<" found "<<numgroups<<" substructures across "<<commsize<<" mpi tasks"<<endl;
+    return pfof;
+}
+
+/*! For groups of at least opt.mpilargegroupsize particles, searches for the first level of substructure while the particles of the
+    group are still spread across mpi tasks, ie: before \ref MPIGroupExchange.
+    For each group the tasks holding its particles form a sub-communicator over which the velocity density (if calculated per structure),
+    the grid of the background velocity distribution, the outlier values, the subset search and the unbinding of candidates are calculated
+    cooperatively using \ref MPIGetVelocityDensityDistributed, \ref MPIGatherGridData, \ref MPIGetOutliersValues,
+    \ref MPISearchSubsetDistributed and \ref MPIUnbindDistributed.
+    The labels of all particles in a searched group are sent to the task hosting the group and stored in \ref mpi_largegroupsublabels,
+    which \ref SearchSubSub uses in place of the search at the first sublevel. Deeper sublevels and properties are still calculated
+    by the task hosting the group. Groups held entirely by one task, or whose tasks have too few particles to build a grid, are
+    searched as usual. \n
+    Here pfof and mpi_foftask are indexed by the local particle index and largegroups is the list produced by \ref MPIBalanceLargeGroups.
+*/
+void MPISearchLargeGroups(Options &opt, const Int_t nbodies, Particle *Part, Int_t *pfof, vector<Int_t> &largegroups)
+{
+    mpi_largegroupsublabels.clear();
+    if (!opt.impilargegroupsearch || !opt.iSubSearch || largegroups.size()==0) return;
+    double time1=MyGetTime();
+    MPI_Comm comm;
+    int commsize, commrank, host;
+    Int_t nsearched=0, nsubtotal=0;
+    unordered_map<Int_t, vector<Int_t>> pglist;
+    vector<vector<Int_t>> sendlabels(NProcs);
+
+    for (auto &gid:largegroups) pglist[gid]=vector<Int_t>();
+    for (auto i=0;i<nbodies;i++) {
+        auto it=pglist.find(pfof[i]);
+        if (it!=pglist.end()) it->second.push_back(i);
+    }
+    for (auto &gid:largegroups) {
+        vector<Int_t> &plist=pglist[gid];
+        Int_t n=plist.size(), ntotal, ngrid, nout, numsub, *subpfof;
+        MPI_Comm_split(MPI_COMM_WORLD, (n>0)?1:MPI_UNDEFINED, ThisTask, &comm);
+        if (comm==MPI_COMM_NULL) continue;
+        MPI_Comm_size(comm, &commsize);
+        MPI_Comm_rank(comm, &commrank);
+        if (commsize==1) {MPI_Comm_free(&comm);continue;}
+        host=mpi_foftask[plist[0]];
+        Options opt2=opt;
+
+        Particle *gpart=new Particle[n];
+        for (auto j=0;j<n;j++) {
+            CopySubSearchParticle(gpart[j], Part[plist[j]]);
+            gpart[j].SetID(j);
+        }
+        //place particles in the periodic image closest to a common reference position
+        if (opt.p>0) {
+            Double_t xref[3], diff;
+            for (auto k=0;k<3;k++) xref[k]=gpart[0].GetPosition(k);
+            MPI_Bcast(xref, 3, MPI_Real_t, 0, comm);
+            for (auto j=0;j<n;j++) for (auto k=0;k<3;k++) {
+                diff=xref[k]-gpart[j].GetPosition(k);
+                if (diff<-0.5*opt.p) gpart[j].SetPosition(k, gpart[j].GetPosition(k)-opt.p);
+                else if (diff>0.5*opt.p) gpart[j].SetPosition(k, gpart[j].GetPosition(k)+opt.p);
+            }
+        }
+        //move to the phase-space centre of mass of the whole group
+        if (opt.icmrefadjust) {
+            GMatrix cmphase=CalcPhaseCM(n, gpart);
+            Double_t cmval[7]={0,0,0,0,0,0,0};
+            for (auto j=0;j<n;j++) cmval[6]+=gpart[j].GetMass();
+            for (auto k=0;k<6;k++) cmval[k]=cmphase(k,0)*cmval[6];
+            MPI_Allreduce(MPI_IN_PLACE, cmval, 7, MPI_Real_t, MPI_SUM, comm);
+            for (auto k=0;k<6;k++) cmphase(k,0)=cmval[k]/cmval[6];
+            AdjustSubPartToPhaseCM(n, gpart, cmphase);
+        }
+#if defined(STRUCDEN) || defined(HALOONLYDEN)
+        //density is calculated using group particles only and is stored with the particles for later sublevels
+        MPIGetVelocityDensityDistributed(opt2, n, gpart, comm);
+        for (auto j=0;j<n;j++) Part[plist[gpart[j].GetID()]].SetDensity(gpart[j].GetDensity());
+#endif
+
+        //build the grid of the background velocity distribution from the cells of all tasks, tasks with fewer particles than
+        //a cell only use the cells of other tasks
+        MPI_Allreduce(&n, &ntotal, 1, MPI_Int_t, MPI_SUM, comm);
+        opt2.Ncell=opt2.Ncellfac*ntotal;
+        while (opt2.Ncell<MINCELLSIZE && ntotal/4.0>opt2.Ncell) opt2.Ncell*=2;
+        GridCell *grid=NULL;
+        Coordinate *gvel=NULL;
+        Matrix *gveldisp=NULL;
+        ngrid=0;
+        if (n>=opt2.Ncell) {
+            KDTree *tree=InitializeTreeGrid(opt2, n, gpart);
+            ngrid=tree->GetNumLeafNodes();
+            grid=new GridCell[ngrid];
+            FillTreeGrid(opt2, n, ngrid, tree, gpart, grid);
+            gvel=GetCellVel(opt2, n, gpart, ngrid, grid);
+            gveldisp=GetCellVelDisp(opt2, n, gpart, ngrid, grid, gvel);
+        }
+        MPIGatherGridData(comm, ngrid, grid, gvel, gveldisp);
+        if (ngrid==0) {
+            delete[] grid;
+            delete[] gvel;
+            delete[] gveldisp;
+            delete[] gpart;
+            MPI_Comm_free(&comm);
+            continue;
+        }
+        GetDenVRatio(opt2, n, gpart, ngrid, grid, gvel, gveldisp);
+        MPIGetOutliersValues(opt2, n, gpart, 1, comm);
+
+        //search outliers, whose potential now stores their outlier value, and unbind candidates
+        vector<Int_t> outindex;
+        for (auto j=0;j<n;j++) if (gpart[j].GetPotential()>=opt2.ellthreshold) outindex.push_back(j);
+        nout=outindex.size();
+        Particle *opart=new Particle[nout];
+        for (auto j=0;j<nout;j++) {
+            CopySubSearchParticle(opart[j], gpart[outindex[j]]);
+            opart[j].SetID(j);
+            outindex[j]=gpart[outindex[j]].GetID();
+        }
+        delete[] gpart;
+        subpfof=MPISearchSubsetDistributed(opt2, nout, opart, numsub, comm);
+        if (opt.uinfo.unbindflag && numsub>0) numsub=MPIUnbindDistributed(opt2, nout, opart, numsub, subpfof, comm);
+        delete[] opart;
+
+        //queue the labels of all particles in the group for the host task
+        vector<Int_t> label(n,0);
+        for (auto j=0;j<nout;j++) label[outindex[j]]=subpfof[j];
+        delete[] subpfof;
+        for (auto j=0;j<n;j++) {
+            sendlabels[host].push_back(Part[plist[j]].GetPID());
+            sendlabels[host].push_back(label[j]);
+        }
+        MPI_Comm_free(&comm);
+        if (commrank==0) {nsearched++;nsubtotal+=numsub;}
+    }
+    pglist.clear();
+
+    //send labels to the tasks hosting the groups
+    vector<int> sendcount(NProcs), recvcount(NProcs), sendoffset(NProcs,0), recvoffset(NProcs,0);
+    for (auto j=0;j<NProcs;j++) sendcount[j]=sendlabels[j].size();
+    MPI_Alltoall(sendcount.data(), 1, MPI_INT, recvcount.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    for (auto j=1;j<NProcs;j++) {
+        sendoffset[j]=sendoffset[j-1]+sendcount[j-1];
+        recvoffset[j]=recvoffset[j-1]+recvcount[j-1];
+    }
+    vector<Int_t> sendbuf, recvbuf(recvoffset[NProcs-1]+recvcount[NProcs-1]);
+    for (auto &x:sendlabels) {sendbuf.insert(sendbuf.end(), x.begin(), x.end()); vector<Int_t>().swap(x);}
+    MPI_Alltoallv(sendbuf.data(), sendcount.data(), sendoffset.data(), MPI_Int_t,
+        recvbuf.data(), recvcount.data(), recvoffset.data(), MPI_Int_t, MPI_COMM_WORLD);
+    vector<Int_t>().swap(sendbuf);
+    mpi_largegroupsublabels.reserve(recvbuf.size()/2);
+    for (size_t i=0;i<recvbuf.size();i+=2) mpi_largegroupsublabels[recvbuf[i]]=recvbuf[i+1];
+
+    MPI_Allreduce(MPI_IN_PLACE, &nsearched, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &nsubtotal, 1, MPI_Int_t, MPI_SUM, MPI_COMM_WORLD);
+    if (ThisTask==0) cout<<"Searched "<<nsearched<<" large groups across mpi tasks finding "<<nsubtotal<<" substructures in "<<MyGetTime()-time1<<endl;
+}
+
+/*! If a group was searched across mpi tasks by \ref MPISearchLargeGroups, returns the group ids of its substructures
+    built from the labels stored in \ref mpi_largegroupsublabels, keeping labels with at least opt.MinSize particles in the group
+    ordered by size. Otherwise returns NULL and the group must be searched.
+*/
+Int_t *MPIGetLargeGroupSubstructure(Options &opt, const Int_t nsubset, Particle *Partsubset, Int_t &numgroups, Int_t *pnumcores)
+{
+    if (mpi_largegroupsublabels.size()==0 || nsubset==0) return NULL;
+    if (mpi_largegroupsublabels.find(Partsubset[0].GetPID())==mpi_largegroupsublabels.end()) return NULL;
+    Int_t *pfof=new Int_t[nsubset];
+    unordered_map<Int_t, Int_t> labelsize, groupid;
+    for (auto i=0;i<nsubset;i++) {
+        auto it=mpi_largegroupsublabels.find(Partsubset[i].GetPID());
+        pfof[i]=0;
+        if (it!=mpi_largegroupsublabels.end() && it->second>0) {
+            pfof[i]=it->second;
+            labelsize[pfof[i]]++;
+        }
+    }
+    vector<pair<Int_t,Int_t>> grouplist;
+    for (auto &x:labelsize) if (x.second>=opt.MinSize) grouplist.push_back(make_pair(x.second,x.first));
+    sort(grouplist.begin(), grouplist.end(), [](const pair<Int_t,Int_t> &a, const pair<Int_t,Int_t> &b){
+        if (a.first!=b.first) return a.first>b.first;
+        return a.second<b.second;
+    });
+    numgroups=0;
+    for (auto &x:grouplist) groupid[x.second]=++numgroups;
+    for (auto i=0;i<nsubset;i++) {
+        if (pfof[i]==0) continue;
+        auto it=groupid.find(pfof[i]);
+        pfof[i]=(it!=groupid.end())?it->second:0;
+    }
+    if (pnumcores!=NULL) *pnumcores=0;
+    return pfof;
+}
+//@}
+#endif
+
 /*!
     Given a initial ordered candidate list of substructures, find all substructures that are large enough to be searched.
     These substructures are used as a mean background velocity field and a new outlier list is found and searched.
@@ -3001,9 +3382,18 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
                 //this routine is within this file, also has internal parallelisation
                 AdjustSubPartToPhaseCM(subnumingroup[i], subPart, cmphase);
             }
+#ifdef USEMPI
+            //large groups may have already been searched across mpi tasks
+            subpfof = NULL;
+            if (sublevel==1) subpfof = MPIGetLargeGroupSubstructure(opt, subnumingroup[i], subPart, subngroup[i], &numcores[i]);
+            if (subpfof == NULL) {
+#endif
             PreCalcSearchSubSet(opt, subnumingroup[i], subPart, sublevel);
             subpfof = SearchSubset(opt, subnumingroup[i], subnumingroup[i], subPart,
                 subngroup[i], sublevel, &numcores[i]);
+#ifdef USEMPI
+            }
+#endif
             CleanAndUpdateGroupsFromSubSearch(opt, subnumingroup[i], subPart, subpfof,
                     subngroup[i], subsubnumingroup[i], subsubpglist[i], numcores[i],
                     subpglist[i], pfof, ngroup, ngroupidoffset_old[i]);
@@ -3048,9 +3438,17 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
                     //this routine is within this file, also has internal parallelisation
                     AdjustSubPartToPhaseCM(subnumingroup[i], subPart, cmphase);
                 }
+#ifdef USEMPI
+                subpfof = NULL;
+                if (sublevel==1) subpfof = MPIGetLargeGroupSubstructure(opt2, subnumingroup[i], subPart, subngroup[i], &numcores[i]);
+                if (subpfof == NULL) {
+#endif
                 PreCalcSearchSubSet(opt2, subnumingroup[i], subPart, sublevel);
                 subpfof = SearchSubset(opt2, subnumingroup[i], subnumingroup[i], subPart,
                     subngroup[i], sublevel, &numcores[i]);
+#ifdef USEMPI
+                }
+#endif
                 CleanAndUpdateGroupsFromSubSearch(opt2, subnumingroup[i], subPart, subpfof,
                         subngroup[i], subsubnumingroup[i], subsubpglist[i], numcores[i],
                         subpglist[i], pfof, ngroup, ngroupidoffset_old[i]);
@@ -3064,6 +3462,10 @@ void SearchSubSub(Options &opt, const Int_t nsubset, vector<Particle> &Partsubse
         UpdateGroupIDsFromSubstructure(oldnsubsearch, ngroup,
             pfof, subngroup, subnumingroup, subpglist,
             ns, ngroupidoffset, ngroupidoffset_old, ngroupidoffset_new);
+#ifdef USEMPI
+        //labels of large groups searched across mpi tasks are only used at the first sublevel
+        if (sublevel==1) unordered_map<Int_t, Int_t>().swap(mpi_largegroupsublabels);
+#endif
 
         //if objects have been found adjust the StrucLevelData
         //this stores the address of the parent particle and pfof along with child substructure particle and pfof
@@ -3683,10 +4085,9 @@ private(i,tid,p1,pindex,x1,D2,dval,rval,icheck,nnID,dist2,baryonfofold)
         //to store local mpi task
         mpi_foftask=MPISetTaskID(nbaryons);
         //then determine export particles, declare arrays used to export data
-        PartDataIn = new Particle[NExport+1];
-        PartDataGet = new Particle[NImport+1];
-        FoFDataIn = new fofdata_in[NExport+1];
-        FoFDataGet = new fofdata_in[NImport+1];
+        MPIAllocatePartCommBuffers(NExport, NImport);
+        MPIAllocateFoFCommBuffers(NExport, NImport);
+        MPIReportPlannedMemory(opt, npartingroups, "Baryon search");
         //exchange particles
 
         MPIBuildParticleExportBaryonSearchList(opt, npartingroups, Part.data(), pfofdark, ids, numingroup, sqrt(param[1]));
@@ -3702,10 +4103,7 @@ private(i,tid,p1,pindex,x1,D2,dval,rval,icheck,nnID,dist2,baryonfofold)
         delete[] ids;
 
         //reorder local particle array and delete memory associated with Head arrays, only need to keep Particles, pfof and some id and idexing information
-        delete[] FoFDataIn;
-        delete[] FoFDataGet;
-        delete[] PartDataIn;
-        delete[] PartDataGet;
+        MPIReleaseCommBuffers();
 
         Int_t newnbaryons=MPIBaryonGroupExchange(opt, nbaryons,Pbaryons,pfofbaryons);
         //once baryons are correctly associated to the appropriate mpi domain and are local (either in Pbaryons or in the \ref fofid_in structure, specifically FOFGroupData arrays) must then copy info correctly.
@@ -6,6 +6,7 @@
 #define STFINDER_H
 
 #include "allvars.h"
+#include "outputqueue.h"
 #include "proto.h"
 
 #define STFVERSION 1.30
@@ -4,6 +4,8 @@
 
 #include "stf.h"
 
+#include <cstring>
+
 
 ///\name Routines calculating numerous properties of groups
 //@{
@@ -25,6 +27,526 @@ inline bool CheckForSOInclCalc(Options &opt, PropData &pdata) {
         pdata.stype <= opt.SphericalOverdensitySeachMaxStructLevel);
 }
 
+/// \name Fused per particle type sums
+/// The counts, masses and bulk sums of each particle type are accumulated in a single pass over the
+/// particles of a group rather than separate count and sum passes for each type. Each type has an
+/// accumulator, \ref AddToTypeSums, specialised at compile time for the types enabled by GASON, STARON, BHON and EXTRADMON.
+//@{
+
+///Sums over the particles of each type gathered by \ref GetTypeSums. Members mirror the \ref PropData fields they are stored in.
+struct PropTypeSums
+{
+#ifdef EXTRADMON
+    Int_t n_dm=0;
+#endif
+#ifdef GASON
+    int n_gas=0;
+    Double_t M_gas=0, Temp_gas=0, Temp_mean_gas=0;
+    Coordinate cm_gas=Coordinate(0.), cmvel_gas=Coordinate(0.), L_gas=Coordinate(0.);
+    ///xx, yy, zz, xy, xz, yz components of the (unnormalised) velocity dispersion tensor
+    Double_t veldisp_gas[6]={0,0,0,0,0,0};
+#ifdef STARON
+    Double_t M_gas_sf=0, M_gas_nsf=0;
+    Double_t Z_gas=0, Z_mean_gas=0, SFR_gas=0, SFR_mean_gas=0;
+    Double_t Temp_gas_sf=0, Temp_mean_gas_sf=0, Z_gas_sf=0, Z_mean_gas_sf=0, sigV_gas_sf=0;
+    Double_t Temp_gas_nsf=0, Temp_mean_gas_nsf=0, Z_gas_nsf=0, Z_mean_gas_nsf=0, sigV_gas_nsf=0;
+    Coordinate L_gas_sf=Coordinate(0.), L_gas_nsf=Coordinate(0.);
+#endif
+#endif
+#ifdef STARON
+    int n_star=0;
+    Double_t M_star=0, t_star=0, t_mean_star=0, Z_star=0, Z_mean_star=0;
+    Coordinate cm_star=Coordinate(0.), cmvel_star=Coordinate(0.), L_star=Coordinate(0.);
+    Double_t veldisp_star[6]={0,0,0,0,0,0};
+#endif
+#ifdef BHON
+    int n_bh=0;
+    Double_t M_bh=0;
+#endif
+#ifdef HIGHRES
+    int n_interloper=0;
+    Double_t M_interloper=0;
+#endif
+
+    ///add the sums of another set of particles
+    void Merge(const PropTypeSums &s) {
+#ifdef EXTRADMON
+        n_dm+=s.n_dm;
+#endif
+#ifdef GASON
+        n_gas+=s.n_gas;
+        M_gas+=s.M_gas; Temp_gas+=s.Temp_gas; Temp_mean_gas+=s.Temp_mean_gas;
+        cm_gas=cm_gas+s.cm_gas; cmvel_gas=cmvel_gas+s.cmvel_gas; L_gas=L_gas+s.L_gas;
+        for (int k=0;k<6;k++) veldisp_gas[k]+=s.veldisp_gas[k];
+#ifdef STARON
+        M_gas_sf+=s.M_gas_sf; M_gas_nsf+=s.M_gas_nsf;
+        Z_gas+=s.Z_gas; Z_mean_gas+=s.Z_mean_gas; SFR_gas+=s.SFR_gas; SFR_mean_gas+=s.SFR_mean_gas;
+        Temp_gas_sf+=s.Temp_gas_sf; Temp_mean_gas_sf+=s.Temp_mean_gas_sf; Z_gas_sf+=s.Z_gas_sf; Z_mean_gas_sf+=s.Z_mean_gas_sf; sigV_gas_sf+=s.sigV_gas_sf;
+        Temp_gas_nsf+=s.Temp_gas_nsf; Temp_mean_gas_nsf+=s.Temp_mean_gas_nsf; Z_gas_nsf+=s.Z_gas_nsf; Z_mean_gas_nsf+=s.Z_mean_gas_nsf; sigV_gas_nsf+=s.sigV_gas_nsf;
+        L_gas_sf=L_gas_sf+s.L_gas_sf; L_gas_nsf=L_gas_nsf+s.L_gas_nsf;
+#endif
+#endif
+#ifdef STARON
+        n_star+=s.n_star;
+        M_star+=s.M_star; t_star+=s.t_star; t_mean_star+=s.t_mean_star; Z_star+=s.Z_star; Z_mean_star+=s.Z_mean_star;
+        cm_star=cm_star+s.cm_star; cmvel_star=cmvel_star+s.cmvel_star; L_star=L_star+s.L_star;
+        for (int k=0;k<6;k++) veldisp_star[k]+=s.veldisp_star[k];
+#endif
+#ifdef BHON
+        n_bh+=s.n_bh;
+        M_bh+=s.M_bh;
+#endif
+#ifdef HIGHRES
+        n_interloper+=s.n_interloper;
+        M_interloper+=s.M_interloper;
+#endif
+    }
+};
+
+///add the mass weighted second moments of the velocity to a dispersion tensor stored as xx, yy, zz, xy, xz, yz
+inline void AddToVelDisp(Double_t *veldisp, Double_t vx, Double_t vy, Double_t vz, Double_t mval)
+{
+    veldisp[0]+=vx*vx*mval;
+    veldisp[1]+=vy*vy*mval;
+    veldisp[2]+=vz*vz*mval;
+    veldisp[3]+=vx*vy*mval;
+    veldisp[4]+=vx*vz*mval;
+    veldisp[5]+=vy*vz*mval;
+}
+
+///store a symmetric dispersion tensor accumulated by \ref AddToVelDisp
+inline void StoreVelDisp(Matrix &m, const Double_t *veldisp)
+{
+    m(0,0)=veldisp[0];
+    m(1,1)=veldisp[1];
+    m(2,2)=veldisp[2];
+    m(0,1)=m(1,0)=veldisp[3];
+    m(0,2)=m(2,0)=veldisp[4];
+    m(1,2)=m(2,1)=veldisp[5];
+}
+
+///accumulate a particle of type ptype, types without an accumulator are ignored
+template<int ptype> inline void AddToTypeSums(Options &opt, PropTypeSums &s, Particle &p, Double_t mval, const Coordinate &gcmvel) {}
+
+#ifdef EXTRADMON
+template<> inline void AddToTypeSums<DARKTYPE>(Options &opt, PropTypeSums &s, Particle &p, Double_t mval, const Coordinate &gcmvel)
+{
+    s.n_dm++;
+}
+#endif
+
+#ifdef GASON
+template<> inline void AddToTypeSums<GASTYPE>(Options &opt, PropTypeSums &s, Particle &p, Double_t mval, const Coordinate &gcmvel)
+{
+    Double_t vx, vy, vz, u = p.GetU();
+    Coordinate J;
+    s.n_gas++;
+    s.M_gas+=mval;
+    //store temperature in units of internal energy
+    s.Temp_gas+=u;
+    s.Temp_mean_gas+=mval*u;
+    s.cm_gas[0]+=p.X()*mval;
+    s.cm_gas[1]+=p.Y()*mval;
+    s.cm_gas[2]+=p.Z()*mval;
+    vx = p.Vx()-gcmvel[0];
+    vy = p.Vy()-gcmvel[1];
+    vz = p.Vz()-gcmvel[2];
+    s.cmvel_gas[0]+=vx*mval;
+    s.cmvel_gas[1]+=vy*mval;
+    s.cmvel_gas[2]+=vz*mval;
+    J=Coordinate(p.GetPosition()).Cross(Coordinate(vx,vy,vz))*mval;
+    s.L_gas=s.L_gas+J;
+    AddToVelDisp(s.veldisp_gas, vx, vy, vz, mval);
+#ifdef STARON
+    Double_t SFR = p.GetSFR(), Z = p.GetZmet();
+    s.Z_gas+=Z;
+    s.Z_mean_gas+=mval*Z;
+    s.SFR_gas+=SFR;
+    s.SFR_mean_gas+=mval*SFR;
+    if (SFR>opt.gas_sfr_threshold) {
+        s.M_gas_sf+=mval;
+        s.Temp_gas_sf+=u;
+        s.Temp_mean_gas_sf+=mval*u;
+        s.Z_gas_sf+=Z;
+        s.Z_mean_gas_sf+=mval*Z;
+        s.L_gas_sf=s.L_gas_sf+J;
+        s.sigV_gas_sf+=(vx*vx+vy*vy+vz*vz)*mval;
+    }
+    else {
+        s.M_gas_nsf+=mval;
+        s.Temp_gas_nsf+=u;
+        s.Temp_mean_gas_nsf+=mval*u;
+        s.Z_gas_nsf+=Z;
+        s.Z_mean_gas_nsf+=mval*Z;
+        s.L_gas_nsf=s.L_gas_nsf+J;
+        s.sigV_gas_nsf+=(vx*vx+vy*vy+vz*vz)*mval;
+    }
+#endif
+}
+#endif
+
+#ifdef STARON
+template<> inline void AddToTypeSums<STARTYPE>(Options &opt, PropTypeSums &s, Particle &p, Double_t mval, const Coordinate &gcmvel)
+{
+    Double_t vx, vy, vz;
+    s.n_star++;
+    s.M_star+=mval;
+    s.t_star+=p.GetTage();
+    s.t_mean_star+=mval*p.GetTage();
+    s.Z_star+=p.GetZmet();
+    s.Z_mean_star+=mval*p.GetZmet();
+    s.cm_star[0]+=p.X()*mval;
+    s.cm_star[1]+=p.Y()*mval;
+    s.cm_star[2]+=p.Z()*mval;
+    vx = p.Vx()-gcmvel[0];
+    vy = p.Vy()-gcmvel[1];
+    vz = p.Vz()-gcmvel[2];
+    s.cmvel_star[0]+=vx*mval;
+    s.cmvel_star[1]+=vy*mval;
+    s.cmvel_star[2]+=vz*mval;
+    s.L_star=s.L_star+Coordinate(p.GetPosition()).Cross(Coordinate(vx,vy,vz))*mval;
+    AddToVelDisp(s.veldisp_star, vx, vy, vz, mval);
+}
+#endif
+
+#ifdef BHON
+template<> inline void AddToTypeSums<BHTYPE>(Options &opt, PropTypeSums &s, Particle &p, Double_t mval, const Coordinate &gcmvel)
+{
+    s.n_bh++;
+    s.M_bh+=mval;
+}
+#endif
+
+///accumulate the particles [jstart,jend) in a single pass, dispatching each to the accumulator of its type
+inline void AddToTypeSums(Options &opt, PropTypeSums &s, Int_t jstart, Int_t jend, Particle *Part, const Coordinate &gcmvel)
+{
+    Double_t mval;
+    for (Int_t j=jstart;j<jend;j++) {
+        Particle &p = Part[j];
+#ifndef NOMASS
+        mval = p.GetMass();
+#else
+        mval = opt.MassValue;
+#endif
+        switch (p.GetType()) {
+            case GASTYPE: AddToTypeSums<GASTYPE>(opt, s, p, mval, gcmvel); break;
+            case STARTYPE: AddToTypeSums<STARTYPE>(opt, s, p, mval, gcmvel); break;
+            case BHTYPE: AddToTypeSums<BHTYPE>(opt, s, p, mval, gcmvel); break;
+            case DARKTYPE: AddToTypeSums<DARKTYPE>(opt, s, p, mval, gcmvel); break;
+            default: break;
+        }
+#ifdef HIGHRES
+        if (p.GetType() == DARK2TYPE || p.GetType() == DARK3TYPE || (p.GetType()==DARKTYPE&&p.GetMass()>opt.zoomlowmassdm))
+        {
+            s.n_interloper++;
+            s.M_interloper+=mval;
+        }
+#endif
+    }
+}
+
+/*!
+    Gathers the per type counts, masses, temperatures, metallicities, centre of mass, angular momenta and velocity
+    dispersion sums of a group in one pass over its particles and stores them in pdata. These are the unnormalised
+    sums; velocity dispersion tensors are only stored if there are enough particles of that type (\ref PROPROTMINNUM).
+    Large groups are split into contiguous chunks, one per thread, whose sums are merged in a fixed order.
+ */
+void GetTypeSums(Options &opt, PropData &pdata, Int_t nbodies, Particle *Part)
+{
+    PropTypeSums s;
+    int nthreads = 1;
+#ifdef USEOPENMP
+    if (nbodies>=omppropnum) nthreads = omp_get_max_threads();
+#endif
+    if (nthreads == 1) AddToTypeSums(opt, s, 0, nbodies, Part, pdata.gcmvel);
+    else {
+        vector<PropTypeSums> threadsums(nthreads);
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) num_threads(nthreads)
+#endif
+        for (int t=0;t<nthreads;t++) {
+            AddToTypeSums(opt, threadsums[t], nbodies*t/nthreads, nbodies*(t+1)/nthreads, Part, pdata.gcmvel);
+        }
+        for (int t=0;t<nthreads;t++) s.Merge(threadsums[t]);
+    }
+
+#ifdef EXTRADMON
+    pdata.n_dm=s.n_dm;
+#endif
+#ifdef GASON
+    pdata.n_gas=s.n_gas;
+    pdata.M_gas=s.M_gas;
+    pdata.Temp_gas=s.Temp_gas;
+    pdata.Temp_mean_gas=s.Temp_mean_gas;
+    pdata.cm_gas=s.cm_gas;
+    pdata.cmvel_gas=s.cmvel_gas;
+    pdata.L_gas=s.L_gas;
+    if (pdata.n_gas>=PROPROTMINNUM) StoreVelDisp(pdata.veldisp_gas, s.veldisp_gas);
+#ifdef STARON
+    pdata.M_gas_sf=s.M_gas_sf;
+    pdata.M_gas_nsf=s.M_gas_nsf;
+    pdata.Z_gas=s.Z_gas;
+    pdata.Z_mean_gas=s.Z_mean_gas;
+    pdata.SFR_gas=s.SFR_gas;
+    pdata.SFR_mean_gas=s.SFR_mean_gas;
+    pdata.Temp_gas_sf=s.Temp_gas_sf;
+    pdata.Temp_mean_gas_sf=s.Temp_mean_gas_sf;
+    pdata.Z_gas_sf=s.Z_gas_sf;
+    pdata.Z_mean_gas_sf=s.Z_mean_gas_sf;
+    pdata.sigV_gas_sf=s.sigV_gas_sf;
+    pdata.L_gas_sf=s.L_gas_sf;
+    pdata.Temp_gas_nsf=s.Temp_gas_nsf;
+    pdata.Temp_mean_gas_nsf=s.Temp_mean_gas_nsf;
+    pdata.Z_gas_nsf=s.Z_gas_nsf;
+    pdata.Z_mean_gas_nsf=s.Z_mean_gas_nsf;
+    pdata.sigV_gas_nsf=s.sigV_gas_nsf;
+    pdata.L_gas_nsf=s.L_gas_nsf;
+#endif
+#endif
+#ifdef STARON
+    pdata.n_star=s.n_star;
+    pdata.M_star=s.M_star;
+    pdata.t_star=s.t_star;
+    pdata.t_mean_star=s.t_mean_star;
+    pdata.Z_star=s.Z_star;
+    pdata.Z_mean_star=s.Z_mean_star;
+    pdata.cm_star=s.cm_star;
+    pdata.cmvel_star=s.cmvel_star;
+    pdata.L_star=s.L_star;
+    if (pdata.n_star>=PROPROTMINNUM) StoreVelDisp(pdata.veldisp_star, s.veldisp_star);
+#endif
+#ifdef BHON
+    pdata.n_bh=s.n_bh;
+    pdata.M_bh=s.M_bh;
+#endif
+#ifdef HIGHRES
+    pdata.n_interloper=s.n_interloper;
+    pdata.M_interloper=s.M_interloper;
+#endif
+}
+//@}
+
+/*!
+    Shrinking sphere centre of mass and velocity of the nbodies particles in Part. On input cm is the
+    starting centre and ri the squared radius of the starting sphere. Each iteration reduces ri by
+    \ref PropInfo.cmadjustfac until fewer than \ref PropInfo.cmfrac of the particles (or \ref PROPCMMINNUM) lie inside.
+
+    Rather than checking all particles every iteration, particles are sorted once by distance from a
+    reference centre. A particle within r of the current centre is within r+d of the reference, where d
+    is how far the centre has moved since the reference was set, so only this prefix of the sorted list
+    is checked. The exact distance to the current centre is still used, so the particles in each sphere are
+    those of a full pass. The particles are re-sorted about the current centre once d exceeds
+    \ref PropInfo.cmresorttol of the current radius.
+    On output cm and cmvel are those of the last sphere and ri is its squared radius.
+ */
+void GetShrinkingSphereCM(Options &opt, const Int_t nbodies, Particle *Part, Coordinate &cm, Coordinate &cmvel, Double_t &ri)
+{
+    Int_t j, nsearch, Ninside;
+    int k;
+    Double_t x, y, z, massval, cmx, cmy, cmz, EncMass, d, rcmv=ri;
+    Coordinate cmref;
+    vector<pair<Double_t,Int_t>> rlist(nbodies);
+    //sort particles by distance from the current centre, which becomes the reference centre
+    auto sortlist = [&]() {
+        cmref = cm;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nbodies>=omppropnum)
+#endif
+        for (Int_t jj=0;jj<nbodies;jj++) {
+            Double_t xx = Part[jj].X() - cmref[0];
+            Double_t yy = Part[jj].Y() - cmref[1];
+            Double_t zz = Part[jj].Z() - cmref[2];
+            rlist[jj].first = xx*xx + yy*yy + zz*zz;
+            rlist[jj].second = jj;
+        }
+        sort(rlist.begin(), rlist.end());
+    };
+    //number of particles in the sorted list within a radius rs of the reference centre,
+    //slightly padded so that round off can not exclude a particle that passes the exact test
+    auto numwithin = [&](Double_t rs) {
+        rs *= (1.0+1e-6);
+        return (Int_t)(upper_bound(rlist.begin(), rlist.end(), make_pair(rs*rs, nbodies)) - rlist.begin());
+    };
+
+    sortlist();
+    while (true)
+    {
+        ri*=opt.pinfo.cmadjustfac;
+        d = 0;
+        for (k=0;k<3;k++) d += (cm[k]-cmref[k])*(cm[k]-cmref[k]);
+        d = sqrt(d);
+        if (d > opt.pinfo.cmresorttol*sqrt(ri)) {
+            sortlist();
+            d = 0;
+        }
+        nsearch = numwithin(sqrt(ri) + d);
+        // find c/m of all particles within ri
+        cmx=cmy=cmz=0.;
+        EncMass=0.;
+        Ninside=0;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(x,y,z,massval) schedule(static) \
+reduction(+:EncMass,Ninside,cmx,cmy,cmz) if (nsearch>=omppropnum)
+#endif
+        for (j=0;j<nsearch;j++)
+        {
+            Particle &p = Part[rlist[j].second];
+            x = p.X() - cm[0];
+            y = p.Y() - cm[1];
+            z = p.Z() - cm[2];
+            if ((x*x + y*y + z*z) <= ri)
+            {
+                massval = p.GetMass();
+#ifdef NOMASS
+                massval = opt.MassValue;
+#endif
+                cmx += massval*p.X();
+                cmy += massval*p.Y();
+                cmz += massval*p.Z();
+                EncMass += massval;
+                Ninside++;
+            }
+        }
+        if (Ninside >= opt.pinfo.cmfrac * nbodies && Ninside >= PROPCMMINNUM) {
+            cm[0]=cmx/EncMass;cm[1]=cmy/EncMass;cm[2]=cmz/EncMass;
+            rcmv=ri;
+        }
+        else break;
+    }
+    ri=rcmv;
+
+    //velocity of the particles in the last sphere
+    d = 0;
+    for (k=0;k<3;k++) d += (cm[k]-cmref[k])*(cm[k]-cmref[k]);
+    nsearch = numwithin(sqrt(ri) + sqrt(d));
+    cmx=cmy=cmz=EncMass=0.;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(x,y,z,massval) schedule(static) \
+reduction(+:EncMass,cmx,cmy,cmz) if (nsearch>=omppropnum)
+#endif
+    for (j=0;j<nsearch;j++)
+    {
+        Particle &p = Part[rlist[j].second];
+        x = p.X() - cm[0];
+        y = p.Y() - cm[1];
+        z = p.Z() - cm[2];
+        if ((x*x + y*y + z*z) <= ri)
+        {
+            massval = p.GetMass();
+#ifdef NOMASS
+            massval = opt.MassValue;
+#endif
+            cmx += massval*p.Vx();
+            cmy += massval*p.Vy();
+            cmz += massval*p.Vz();
+            EncMass += massval;
+        }
+    }
+    cmvel[0]=cmx/EncMass;cmvel[1]=cmy/EncMass;cmvel[2]=cmz/EncMass;
+}
+
+/*!
+    Orders the particles radially, as a sort with \ref RadCompare would, without repeatedly swapping whole particles.
+    Packed (radius squared, index) keys are sorted, with a parallel radix sort on the bits of the radius for large
+    groups, and the particles are then permuted in place following the cycles of the permutation so
+    that each particle is moved only once.
+ */
+void SortParticlesByRadius(const Int_t nbodies, Particle *Part)
+{
+    if (nbodies < 2) return;
+    vector<RadialKey> keys(nbodies);
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nbodies>=omppropnum)
+#endif
+    for (Int_t j=0;j<nbodies;j++) {
+        //radius squared is non-negative so ordering its bits as an unsigned integer orders the radii
+        double r2 = 0;
+        for (int k=0;k<3;k++) r2 += (double)Part[j].GetPosition(k)*(double)Part[j].GetPosition(k);
+        memcpy(&keys[j].key, &r2, sizeof(double));
+        keys[j].index = j;
+    }
+    if (nbodies < omppropnum) sort(keys.begin(), keys.end(), [](const RadialKey &a, const RadialKey &b) {return a.key < b.key;});
+    else RadixSortRadialKeys(keys);
+
+    //apply the permutation, position j takes the particle at keys[j].index
+    for (Int_t i=0;i<nbodies;i++) {
+        if (keys[i].index == i) continue;
+        Particle temp = std::move(Part[i]);
+        Int_t j = i, src;
+        while (true) {
+            src = keys[j].index;
+            keys[j].index = j;
+            if (src == i) {
+                Part[j] = std::move(temp);
+                break;
+            }
+            Part[j] = std::move(Part[src]);
+            j = src;
+        }
+    }
+}
+
+/*!
+    Least significant digit radix sort of the radial keys, one byte per pass. Each thread histograms a contiguous
+    chunk of the keys and scatters it to offsets determined from all the histograms, which keeps the sort stable.
+    Passes where all keys share the same byte, such as the high bytes of the exponent, are skipped.
+    May be called from within a parallel region, in which case the team is typically a single thread.
+ */
+void RadixSortRadialKeys(vector<RadialKey> &keys)
+{
+    const Int_t n = keys.size();
+    const int nbuckets = 256;
+    int nthreads = 1, nteam = 1;
+    bool iskip = false;
+#ifdef USEOPENMP
+    nthreads = omp_get_max_threads();
+#endif
+    vector<RadialKey> buffer(n);
+    RadialKey *in = keys.data(), *out = buffer.data();
+    vector<Int_t> counts(nthreads*nbuckets);
+
+    for (int shift=0; shift<64; shift+=8) {
+#ifdef USEOPENMP
+#pragma omp parallel default(shared) num_threads(nthreads)
+#endif
+        {
+            int tid = 0;
+#ifdef USEOPENMP
+            tid = omp_get_thread_num();
+            #pragma omp single
+            nteam = omp_get_num_threads();
+#endif
+            Int_t jstart = n*tid/nteam, jend = n*(tid+1)/nteam;
+            Int_t *c = &counts[tid*nbuckets];
+            for (int d=0; d<nbuckets; d++) c[d] = 0;
+            for (Int_t j=jstart; j<jend; j++) c[(in[j].key>>shift)&(nbuckets-1)]++;
+#ifdef USEOPENMP
+            #pragma omp barrier
+            #pragma omp single
+#endif
+            {
+                //turn counts into starting offsets for each thread and digit,
+                //noting if all keys share this byte in which case there is nothing to do
+                Int_t offset = 0, ctemp, ntotal;
+                iskip = false;
+                for (int d=0; d<nbuckets; d++) {
+                    ntotal = 0;
+                    for (int t=0; t<nteam; t++) {
+                        ctemp = counts[t*nbuckets+d];
+                        counts[t*nbuckets+d] = offset;
+                        offset += ctemp;
+                        ntotal += ctemp;
+                    }
+                    if (ntotal == n) iskip = true;
+                }
+            }
+            if (!iskip) for (Int_t j=jstart; j<jend; j++) out[c[(in[j].key>>shift)&(nbuckets-1)]++] = in[j];
+        }
+        if (!iskip) swap(in, out);
+    }
+    if (in != keys.data()) copy(in, in+n, keys.data());
+}
+
 /*!
     The routine is used to calculate CM of groups.
  */
@@ -39,17 +561,12 @@ void GetCM(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngroup, Int_
     double time1 = MyGetTime();
     Particle *Pval;
     Int_t i,j,k;
-    Coordinate cmold;
-    Double_t massval, ri,rcmv,r2,cmx,cmy,cmz,EncMass,Ninside;
-    Double_t cmvx,cmvy,cmvz;
-    Double_t vc,rc,x,y,z,vx,vy,vz,mval;
-    Double_t change=MAXVALUE,tol=1e-2;
-    Int_t ii,icmv;
+    Double_t massval,ri,r2,cmx,cmy,cmz,EncMass;
 
     //for small groups loop over groups
 #ifdef USEOPENMP
 #pragma omp parallel default(shared)  \
-private(i,j,k,Pval,ri,massval,rcmv,r2,cmx,cmy,cmz,EncMass,Ninside,cmold,change,tol,x,y,z,vx,vy,vz,vc,rc)
+private(i,j,k,Pval,ri,massval,r2)
 {
     #pragma omp for schedule(dynamic) nowait
 #endif
@@ -81,68 +598,10 @@ private(i,j,k,Pval,ri,massval,rcmv,r2,cmx,cmy,cmz,EncMass,Ninside,cmold,change,t
             if (sqrt(r2)>pdata[i].gsize)pdata[i].gsize=sqrt(r2);
         }
         //iterate for better cm if group large enough
-        cmold=pdata[i].gcm;
-        change=MAXVALUE;tol=1e-2;
-        if (numingroup[i]*opt.pinfo.cmadjustfac>=PROPCMMINNUM && opt.iIterateCM) {
+        if (numingroup[i]*opt.pinfo.cmadjustfac>=PROPCMMINNUM) {
             ri=pdata[i].gsize;
             ri=ri*ri;
-            cmold=pdata[i].gcm;
-            rcmv=ri;
-            while (true)
-            {
-                ri*=opt.pinfo.cmadjustfac;
-                // find c/m of all particles within ri
-                cmx=cmy=cmz=0.;
-                EncMass=0.;
-                Ninside=0;
-                for (j=0;j<numingroup[i];j++)
-                {
-                    Pval=&Part[j+noffset[i]];
-                    x = (*Pval).X() - cmold[0];
-                    y = (*Pval).Y() - cmold[1];
-                    z = (*Pval).Z() - cmold[2];
-                    if ((x*x + y*y + z*z) <= ri)
-                    {
-                        massval = (*Pval).GetMass();
-#ifdef NOMASS
-                        massval = opt.MassValue;
-#endif
-                        cmx += massval*(*Pval).X();
-                        cmy += massval*(*Pval).Y();
-                        cmz += massval*(*Pval).Z();
-                        EncMass += massval;
-                        Ninside++;
-                    }
-                }
-                if (Ninside >= opt.pinfo.cmfrac * numingroup[i] && Ninside >= PROPCMMINNUM) {
-                    pdata[i].gcm[0]=cmx;pdata[i].gcm[1]=cmy;pdata[i].gcm[2]=cmz;
-                    for (k=0;k<3;k++) pdata[i].gcm[k] /= EncMass;
-                    cmold=pdata[i].gcm;
-                    rcmv=ri;
-                }
-                else break;
-            }
-            cmx=cmy=cmz=EncMass=0.;
-            for (j=0;j<numingroup[i];j++)
-            {
-                Pval=&Part[j+noffset[i]];
-                x = (*Pval).X() - pdata[i].gcm[0];
-                y = (*Pval).Y() - pdata[i].gcm[1];
-                z = (*Pval).Z() - pdata[i].gcm[2];
-                if ((x*x + y*y + z*z) <= rcmv)
-                {
-                    massval = (*Pval).GetMass();
-                    #ifdef NOMASS
-                    massval = opt.MassValue;
-                    #endif
-                    cmx += massval*(*Pval).Vx();
-                    cmy += massval*(*Pval).Vy();
-                    cmz += massval*(*Pval).Vz();
-                    EncMass += massval;
-                }
-            }
-            pdata[i].gcmvel[0]=cmx;pdata[i].gcmvel[1]=cmy;pdata[i].gcmvel[2]=cmz;
-            for (k=0;k<3;k++) pdata[i].gcmvel[k] /= EncMass;
+            GetShrinkingSphereCM(opt, numingroup[i], &Part[noffset[i]], pdata[i].gcm, pdata[i].gcmvel, ri);
         }
     }
 #ifdef USEOPENMP
@@ -208,94 +667,38 @@ private(j,Pval,massval)
             for (k=0;k<3;k++) r2+=(pdata[i].gcm[k]-(*Pval).GetPosition(k))*(pdata[i].gcm[k]-(*Pval).GetPosition(k));
             if (sqrt(r2)>pdata[i].gsize)pdata[i].gsize=sqrt(r2);
         }
+        //iterate for better cm
         ri=pdata[i].gsize;
         ri=ri*ri;
-        //iterate for better cm if group large enough
-        cmold=pdata[i].gcm;
-        change=MAXVALUE;tol=1e-2;
-        rcmv=ri;
-        ii=numingroup[i];
-        while (opt.iIterateCM)
-        {
-            ri*=opt.pinfo.cmadjustfac;
-            // find c/m of all particles within ri
-            cmx=cmy=cmz=0.;
-            EncMass=0.;
-            Ninside=0;
-#ifdef USEOPENMP
-#pragma omp parallel default(shared) \
-private(j,Pval,x,y,z,massval)
-{
-#pragma omp for reduction(+:EncMass,Ninside,cmx,cmy,cmz)
-#endif
-            for (j=0;j<numingroup[i];j++)
-            {
-                Pval=&Part[j+noffset[i]];
-                x = (*Pval).X() - cmold[0];
-                y = (*Pval).Y() - cmold[1];
-                z = (*Pval).Z() - cmold[2];
-                if ((x*x + y*y + z*z) <= ri)
-                {
-                    massval = (*Pval).GetMass();
-#ifdef NOMASS
-                    massval = opt.MassValue;
-#endif
-                    cmx += massval*(*Pval).X();
-                    cmy += massval*(*Pval).Y();
-                    cmz += massval*(*Pval).Z();
-                    EncMass += massval;
-                    Ninside++;
-                }
-            }
-#ifdef USEOPENMP
-}
-#endif
-            x = Part[noffset[i]+ii-1].X() - cmold[0];
-            y = Part[noffset[i]+ii-1].Y() - cmold[1];
-            z = Part[noffset[i]+ii-1].Z() - cmold[2];
-            if (Ninside >= opt.pinfo.cmfrac * numingroup[i] && Ninside >= PROPCMMINNUM) {
-                cmold[0]=cmx;cmold[1]=cmy;cmold[2]=cmz;
-                for (k=0;k<3;k++) cmold[k] /= EncMass;
-                rcmv=ri;
-                icmv=ii;
-            }
-            else break;
-        }
-        pdata[i].gcm=cmold;
-        cmx=cmy=cmz=EncMass=0.;
-#ifdef USEOPENMP
-#pragma omp parallel default(shared) \
-private(j,Pval,x,y,z,massval)
-{
-    #pragma omp for reduction(+:EncMass,cmx,cmy,cmz)
-#endif
-        for (j=0;j<numingroup[i];j++)
-        {
-            Pval=&Part[j+noffset[i]];
-            x = (*Pval).X() - cmold[0];
-            y = (*Pval).Y() - cmold[1];
-            z = (*Pval).Z() - cmold[2];
-            if ((x*x + y*y + z*z) <= rcmv)
-            {
-                massval = (*Pval).GetMass();
-                #ifdef NOMASS
-                massval = opt.MassValue;
-                #endif
-                cmx += massval*(*Pval).Vx();
-                cmy += massval*(*Pval).Vy();
-                cmz += massval*(*Pval).Vz();
-                EncMass += massval;
-            }
-        }
-#ifdef USEOPENMP
-}
-#endif
-        pdata[i].gcmvel[0]=cmx;pdata[i].gcmvel[1]=cmy;pdata[i].gcmvel[2]=cmz;
-        for (k=0;k<3;k++) pdata[i].gcmvel[k] /= EncMass;
+        GetShrinkingSphereCM(opt, numingroup[i], &Part[noffset[i]], pdata[i].gcm, pdata[i].gcmvel, ri);
     }
     if (opt.iverbose) cout<<ThisTask<<" Done getting CM in "<<MyGetTime()-time1<<endl;
 }
 
+///Return the optional bulk property calculations, \ref PROPKERNELALL, needed to produce an output field,
+///including those it is derived from
+unsigned int GetPropertyKernels(const string &fieldname)
+{
+    unsigned int kernels = 0;
+    auto startswith = [&fieldname](const string &s) {return fieldname.compare(0, s.size(), s) == 0;};
+    auto contains = [&fieldname](const string &s) {return fieldname.find(s) != string::npos;};
+    //quantities within Rmax, which includes their shape
+    if (startswith("RVmax_")) {
+        kernels |= PROPKERNELRVMAX;
+        if (fieldname == "RVmax_q" || fieldname == "RVmax_s" || startswith("RVmax_eig_")) kernels |= PROPKERNELMORPHOLOGY;
+        return kernels;
+    }
+    if (fieldname == "q" || fieldname == "s" || startswith("q_") || startswith("s_") || startswith("eig_")) kernels |= PROPKERNELMORPHOLOGY;
+    if (fieldname == "Krot") kernels |= PROPKERNELROTATION;
+    //concentrations are derived from Vmax and the overdensity masses and radii
+    if (startswith("cNFW")) kernels |= PROPKERNELCONCENTRATION | PROPKERNELSO;
+    //virial and overdensity masses, radii and angular momenta and the spin parameter based on them
+    if (fieldname == "Mvir" || fieldname == "Rvir" || fieldname == "lambda_B" || startswith("SO_")
+        || contains("200crit") || contains("200mean") || contains("BN98") || contains("_200c") || contains("_200m") || contains("_500c"))
+        kernels |= PROPKERNELSO;
+    return kernels;
+}
+
 /*!
     The routine is used to calculate bulk object properties. It assumes that particles have been
     arranged in group order and the indexing offsets between groups is given by noffset
@@ -318,14 +721,9 @@ void GetProperties(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngro
     Coordinate cmold(0.),cmref;
     Double_t ri,rcmv,r2,cmx,cmy,cmz,EncMass,Ninside, SFR;
     Double_t EncMassSF,EncMassNSF;
-    Double_t cmvx,cmvy,cmvz;
     Double_t vc,rc,x,y,z,vx,vy,vz,jzval,Rdist,zdist,Ekin,Krot,mval;
     Double_t RV_Ekin,RV_Krot;
     Double_t Ekin_sf,Ekin_nsf,Krot_sf,Krot_nsf;
-    Double_t Tsum,Tmeansum,tsum,tmeansum,Zsum,Zmeansum,sfrsum,sfrmeansum;
-    Double_t Tsum_sf,Tmeansum_sf,Zsum_sf,Zmeansum_sf;
-    Double_t Tsum_nsf,Tmeansum_nsf,Zsum_nsf,Zmeansum_nsf;
-    Double_t sigV_gas_sf,sigV_gas_nsf;
     Coordinate jval;
     Double_t change=MAXVALUE,tol=1e-2;
     Int_t ii,icmv;
@@ -340,6 +738,10 @@ void GetProperties(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngro
     Double_t minlgrhoval = min({virval, m200val, mBN98val, m200mval})-(Double_t)log(2.0);
     vector<Double_t> SOlgrhovals;
     int iSOfound;
+    //optional calculations, skipped if none of their fields are output
+    const bool iSOcalc = (opt.propertykernels & PROPKERNELSO);
+    const bool imorphcalc = (opt.propertykernels & PROPKERNELMORPHOLOGY);
+    const bool iRVmorphcalc = imorphcalc && (opt.propertykernels & PROPKERNELRVMAX);
     if (opt.SOnum >0) {
         SOlgrhovals.resize(opt.SOnum);
         for (auto i=0;i<opt.SOnum;i++) {
@@ -375,8 +777,8 @@ private(i,j,k,Pval,cmref)
             Pval=&Part[j+noffset[i]];
             for (k=0;k<3;k++) Pval->SetPosition(k, Pval->GetPosition(k) - cmref[k]);
         }
-        //sort by radius (here use gsl_heapsort as no need to allocate more memory
-        gsl_heapsort(&Part[noffset[i]], numingroup[i], sizeof(Particle), RadCompare);
+        //sort by radius
+        SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
     }
 #ifdef USEOPENMP
 }
@@ -398,11 +800,11 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
         //determine overdensity mass and radii. AGAIN REMEMBER THAT THESE ARE NOT MEANINGFUL FOR TIDAL DEBRIS
         //HERE MASSES ARE EXCLUSIVE!
         EncMass=pdata[i].gmass;
-        if (CheckForSOSubCalc(opt,pdata[i])) {
+        if (iSOcalc && CheckForSOSubCalc(opt,pdata[i])) {
             CalculateSphericalOverdensitySubhalo(opt, pdata[i], numingroup[i], &Part[noffset[i]], m200val, m200mval, mBN98val, virval, m500val, SOlgrhovals);
             SetSphericalOverdensityMasstoTotalMass(opt, pdata[i]);
         }
-        if (CheckForSOExclCalc(opt,pdata[i])){
+        if (iSOcalc && CheckForSOExclCalc(opt,pdata[i])){
             CalculateSphericalOverdensityExclusive(opt, pdata[i], numingroup[i], &Part[noffset[i]], m200val, m200mval, mBN98val, virval, m500val, SOlgrhovals);
             SetSphericalOverdensityMasstoTotalMassExclusive(opt, pdata[i]);
         }
@@ -485,7 +887,7 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
         //calculate the rotational energy about the angular momentum axis
         //this is defined as the specific angular momentum about the angular momentum
         //axis (see sales et al 2010)
-        RV_Ekin=0;
+        if (opt.propertykernels & PROPKERNELROTATION) {
         for (j=0;j<numingroup[i];j++) {
             Pval=&Part[j+noffset[i]];
             #ifndef NOMASS
@@ -503,8 +905,11 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
             if (Rdist>0) pdata[i].Krot+=mval*(jzval*jzval/(Rdist*Rdist));
         }
         pdata[i].Krot*=0.5/Ekin;
+        }//end of rotational support calculation
 
         //now calculate stuff within RV knowing particle array sorted according to radius
+        if (opt.propertykernels & PROPKERNELRVMAX) {
+        RV_Ekin=0;
         for (j=0;j<RV_num;j++) {
             Pval=&Part[j+noffset[i]];
             rc=Pval->Radius();
@@ -553,102 +958,13 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
             if (Rdist>0) pdata[i].RV_Krot+=mval*(jzval*jzval/(Rdist*Rdist));
         }
         pdata[i].RV_Krot*=0.5/RV_Ekin;
+        }//end of calculations within Rmax
 
-#if defined(EXTRADMON)
-        for (j=0;j<numingroup[i];j++) {
-            if (Part[j+noffset[i]].GetType() != DARKTYPE) continue;
-            pdata[i].n_dm++;
-        }
-#endif
+        //counts, masses and bulk sums of each particle type in a single pass
+        GetTypeSums(opt, pdata[i], numingroup[i], &Part[noffset[i]]);
         //baryons
 #if defined(GASON)
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==GASTYPE) {
-                pdata[i].n_gas++;
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-                pdata[i].M_gas+=mval;
-                #ifdef STARON
-                SFR=Pval->GetSFR();
-                if (SFR>opt.gas_sfr_threshold) pdata[i].M_gas_sf+=mval;
-                else pdata[i].M_gas_nsf+=mval;
-                #endif
-            }
-        }
         Ekin=0;
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==GASTYPE) {
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-                //store temperature in units of internal energy
-                pdata[i].Temp_gas+=Pval->GetU();
-                pdata[i].Temp_mean_gas+=mval*Pval->GetU();
-                //pdata[i].sphden_gas+=Pval->GetMass()*Pval->GetSPHDen();
-#ifdef STARON
-                pdata[i].Z_gas+=Pval->GetZmet();
-                pdata[i].Z_mean_gas+=mval*Pval->GetZmet();
-                pdata[i].SFR_gas+=Pval->GetSFR();
-                pdata[i].SFR_mean_gas+=mval*Pval->GetSFR();
-                SFR=Pval->GetSFR();
-                if (SFR>opt.gas_sfr_threshold) {
-                    pdata[i].Temp_gas_sf+=Pval->GetU();
-                    pdata[i].Temp_mean_gas_sf+=mval*Pval->GetU();
-                    pdata[i].Z_gas_sf+=Pval->GetZmet();
-                    pdata[i].Z_mean_gas_sf+=mval*Pval->GetZmet();
-                }
-                else {
-                    pdata[i].Temp_gas_nsf+=Pval->GetU();
-                    pdata[i].Temp_mean_gas_nsf+=mval*Pval->GetU();
-                    pdata[i].Z_gas_nsf+=Pval->GetZmet();
-                    pdata[i].Z_mean_gas_nsf+=mval*Pval->GetZmet();
-                }
-#endif
-                x = (*Pval).X();
-                y = (*Pval).Y();
-                z = (*Pval).Z();
-                pdata[i].cm_gas[0]+=x*mval;
-                pdata[i].cm_gas[1]+=y*mval;
-                pdata[i].cm_gas[2]+=z*mval;
-
-                vx = (*Pval).Vx()-pdata[i].gcmvel[0];
-                vy = (*Pval).Vy()-pdata[i].gcmvel[1];
-                vz = (*Pval).Vz()-pdata[i].gcmvel[2];
-                pdata[i].cmvel_gas[0]+=vx*mval;
-                pdata[i].cmvel_gas[1]+=vy*mval;
-                pdata[i].cmvel_gas[2]+=vz*mval;
-                J=Coordinate(Pval->GetPosition()).Cross(Coordinate(vx,vy,vz))*mval;
-                pdata[i].L_gas=pdata[i].L_gas+J;
-                if (pdata[i].n_gas>=PROPROTMINNUM) {
-                    pdata[i].veldisp_gas(0,0)+=vx*vx*mval;
-                    pdata[i].veldisp_gas(1,1)+=vy*vy*mval;
-                    pdata[i].veldisp_gas(2,2)+=vz*vz*mval;
-                    pdata[i].veldisp_gas(0,1)+=vx*vy*mval;
-                    pdata[i].veldisp_gas(0,2)+=vx*vz*mval;
-                    pdata[i].veldisp_gas(1,2)+=vy*vz*mval;
-                    pdata[i].veldisp_gas(1,0)+=vx*vy*mval;
-                    pdata[i].veldisp_gas(2,0)+=vx*vz*mval;
-                    pdata[i].veldisp_gas(2,1)+=vy*vz*mval;
-                }
-                #ifdef STARON
-                if (SFR>opt.gas_sfr_threshold) {
-                    pdata[i].L_gas_sf=pdata[i].L_gas_sf+J;
-                    pdata[i].sigV_gas_sf+=(vx*vx+vy*vy+vz*vz)*mval;
-                }
-                else {
-                    pdata[i].L_gas_nsf=pdata[i].L_gas_nsf+J;
-                    pdata[i].sigV_gas_nsf+=(vx*vx+vy*vy+vz*vz)*mval;
-                }
-                #endif
-            }
-        }
 
         if (pdata[i].M_gas>0) {
             pdata[i].veldisp_gas=pdata[i].veldisp_gas*(1.0/pdata[i].M_gas);
@@ -847,62 +1163,10 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
             if (pdata[i].M_gas_nsf>0) pdata[i].Krot_gas_nsf/=Ekin_nsf;
 #endif
         }
-        if (pdata[i].n_gas>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_gas, pdata[i].s_gas, 1e-2, pdata[i].eigvec_gas,0,GASTYPE,0);
+        if (imorphcalc && pdata[i].n_gas>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_gas, pdata[i].s_gas, 1e-2, pdata[i].eigvec_gas,0,GASTYPE,0);
 #endif
 #ifdef STARON
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==STARTYPE) {
-                pdata[i].n_star++;
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-                pdata[i].M_star+=mval;
-            }
-        }
         Ekin=0;
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==STARTYPE) {
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-                pdata[i].t_star+=Pval->GetTage();
-                pdata[i].t_mean_star+=mval*Pval->GetTage();
-                pdata[i].Z_star+=Pval->GetZmet();
-                pdata[i].Z_mean_star+=mval*Pval->GetZmet();
-                x = (*Pval).X();
-                y = (*Pval).Y();
-                z = (*Pval).Z();
-                pdata[i].cm_star[0]+=x*mval;
-                pdata[i].cm_star[1]+=y*mval;
-                pdata[i].cm_star[2]+=z*mval;
-
-                vx = (*Pval).Vx()-pdata[i].gcmvel[0];
-                vy = (*Pval).Vy()-pdata[i].gcmvel[1];
-                vz = (*Pval).Vz()-pdata[i].gcmvel[2];
-                pdata[i].cmvel_star[0]+=vx*mval;
-                pdata[i].cmvel_star[1]+=vy*mval;
-                pdata[i].cmvel_star[2]+=vz*mval;
-
-                pdata[i].L_star=pdata[i].L_star+Coordinate(Pval->GetPosition()).Cross(Coordinate(vx,vy,vz))*mval;
-                if (pdata[i].n_star>=PROPROTMINNUM) {
-                    pdata[i].veldisp_star(0,0)+=vx*vx*mval;
-                    pdata[i].veldisp_star(1,1)+=vy*vy*mval;
-                    pdata[i].veldisp_star(2,2)+=vz*vz*mval;
-                    pdata[i].veldisp_star(0,1)+=vx*vy*mval;
-                    pdata[i].veldisp_star(0,2)+=vx*vz*mval;
-                    pdata[i].veldisp_star(1,2)+=vy*vz*mval;
-                    pdata[i].veldisp_star(1,0)+=vx*vy*mval;
-                    pdata[i].veldisp_star(2,0)+=vx*vz*mval;
-                    pdata[i].veldisp_star(2,1)+=vy*vz*mval;
-                }
-            }
-        }
         if (pdata[i].M_star>0) {
             pdata[i].veldisp_star=pdata[i].veldisp_star*(1.0/pdata[i].M_star);
             pdata[i].cm_star=pdata[i].cm_star*(1.0/pdata[i].M_star);
@@ -1029,23 +1293,9 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
             pdata[i].Krot_star /= Ekin;
             pdata[i].T_star = Ekin;
         }
-        if (pdata[i].n_star>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_star, pdata[i].s_star, 1e-2, pdata[i].eigvec_star,0,STARTYPE,0);
+        if (imorphcalc && pdata[i].n_star>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_star, pdata[i].s_star, 1e-2, pdata[i].eigvec_star,0,STARTYPE,0);
 #endif
 
-#ifdef BHON
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==BHTYPE) {
-                pdata[i].n_bh++;
-#ifndef NOMASS
-                mval = Pval->GetMass();
-#else
-                mval = opt.MassValue;
-#endif
-                pdata[i].M_bh+=mval;
-            }
-        }
-#endif
 #ifdef GASON
         GetExtraHydroProperties(opt, pdata[i], numingroup[i], &Part[noffset[i]]);
 #endif
@@ -1059,44 +1309,24 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
         GetExtraDMProperties(opt, pdata[i], numingroup[i], &Part[noffset[i]]);
 #endif
 
-#ifdef HIGHRES
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType() == DARK2TYPE || Pval->GetType() == DARK3TYPE || (Pval->GetType()==DARKTYPE&&Pval->GetMass()>opt.zoomlowmassdm))
-            {
-                pdata[i].n_interloper++;
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-                pdata[i].M_interloper+=mval;
-            }
-        }
-#endif
         //calculate aperture quantities
         CalculateApertureQuantities(opt, numingroup[i], &Part[noffset[i]], pdata[i]);
         //if calculating profiles
         if (opt.iprofilecalc) {
             double irnorm;
-            //as particles are radially sorted, init the radial bin at zero
-            int ibin=0;
             if (opt.iprofilenorm == PROFILERNORMR200CRIT) irnorm = 1.0/pdata[i].gR200c;
             else irnorm = 1.0;
-            for (j=0;j<numingroup[i];j++) {
-                Pval = &Part[noffset[i] + j];
-                AddParticleToRadialBin(opt,Pval,irnorm,ibin,pdata[i]);
-            }
+            AddParticlesToRadialBins(opt, numingroup[i], &Part[noffset[i]], irnorm, pdata[i]);
         }
 
         //morphology calcs
 #ifdef NOMASS
-        GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].gq, pdata[i].gs, 1e-2, pdata[i].geigvec,0);
+        if (imorphcalc) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].gq, pdata[i].gs, 1e-2, pdata[i].geigvec,0);
         //calculate morphology based on particles within RV, the radius of maximum circular velocity
-        if (RV_num>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(RV_num, &Part[noffset[i]], pdata[i].RV_q, pdata[i].RV_s, 1e-2, pdata[i].RV_eigvec,0);
+        if (iRVmorphcalc && RV_num>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(RV_num, &Part[noffset[i]], pdata[i].RV_q, pdata[i].RV_s, 1e-2, pdata[i].RV_eigvec,0);
 #else
-        GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].gq, pdata[i].gs, 1e-2, pdata[i].geigvec,1);
-        if (RV_num>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(RV_num, &Part[noffset[i]], pdata[i].RV_q, pdata[i].RV_s, 1e-2, pdata[i].RV_eigvec,1);
+        if (imorphcalc) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].gq, pdata[i].gs, 1e-2, pdata[i].geigvec,1);
+        if (iRVmorphcalc && RV_num>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(RV_num, &Part[noffset[i]], pdata[i].RV_q, pdata[i].RV_s, 1e-2, pdata[i].RV_eigvec,1);
 #endif
     }
 #ifdef USEOPENMP
@@ -1111,11 +1341,11 @@ private(EncMassSF,EncMassNSF,Krot_sf,Krot_nsf,Ekin_sf,Ekin_nsf)
         //determine overdensity mass and radii. AGAIN REMEMBER THAT THESE ARE NOT MEANINGFUL FOR TIDAL DEBRIS
         //HERE MASSES ARE EXCLUSIVE!
         EncMass=pdata[i].gmass;
-        if (CheckForSOSubCalc(opt,pdata[i])) {
+        if (iSOcalc && CheckForSOSubCalc(opt,pdata[i])) {
             CalculateSphericalOverdensitySubhalo(opt, pdata[i], numingroup[i], &Part[noffset[i]], m200val, m200mval, mBN98val, virval, m500val, SOlgrhovals);
             SetSphericalOverdensityMasstoTotalMass(opt, pdata[i]);
         }
-        if (CheckForSOExclCalc(opt,pdata[i])) {
+        if (iSOcalc && CheckForSOExclCalc(opt,pdata[i])) {
             CalculateSphericalOverdensityExclusive(opt, pdata[i], numingroup[i], &Part[noffset[i]], m200val, m200mval, mBN98val, virval, m500val, SOlgrhovals);
             SetSphericalOverdensityMasstoTotalMassExclusive(opt, pdata[i]);
         }
@@ -1225,6 +1455,7 @@ private(j,Pval,rc,x,y,z,vx,vy,vz,J,mval)
             pdata[i].glambda_B=pdata[i].gJ.Length()/(pdata[i].gM200c*sqrt(2.0*opt.G*pdata[i].gM200c*pdata[i].gR200c));
         }
         //rotational support calculation
+        if (opt.propertykernels & PROPKERNELROTATION) {
 #ifdef USEOPENMP
 #pragma omp parallel default(shared) \
 private(j,Pval,mval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist)
@@ -1254,6 +1485,7 @@ private(j,Pval,mval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist)
 }
 #endif
         pdata[i].Krot=0.5*Krot/Ekin;
+        }//end of rotational support calculation
         vc = 0;
         for (j=0;j<numingroup[i];j++) {
             Pval=&Part[j+noffset[i]];
@@ -1271,6 +1503,7 @@ private(j,Pval,mval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist)
         if (pdata[i].gRvir==0) {pdata[i].gMvir=pdata[i].gmass;pdata[i].gRvir=pdata[i].gsize;}
 
         //now that we have radius of maximum circular velocity, lets calculate properties internal to this radius
+        if (opt.propertykernels & PROPKERNELRVMAX) {
         Ekin=Jx=Jy=Jz=sxx=sxy=sxz=syy=syz=szz=Krot=0.;
 #ifdef USEOPENMP
 #pragma omp parallel default(shared) \
@@ -1346,147 +1579,14 @@ private(j,Pval,mval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist)
 }
 #endif
         pdata[i].RV_Krot=0.5*Krot/Ekin;
-#if defined(EXTRADMON)
-        for (j=0;j<numingroup[i];j++) {
-            if (Part[j+noffset[i]].GetType() != DARKTYPE) continue;
-            pdata[i].n_dm++;
-        }
-#endif
+        }//end of calculations within Rmax
+        //counts, masses and bulk sums of each particle type in a single pass
+        GetTypeSums(opt, pdata[i], numingroup[i], &Part[noffset[i]]);
     //baryons
 #if defined(GASON)
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==GASTYPE) {
-                pdata[i].n_gas++;
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-                pdata[i].M_gas+=mval;
-                #ifdef STARON
-                SFR = Pval->GetSFR();
-                if (SFR>opt.gas_sfr_threshold) pdata[i].M_gas_sf+=mval;
-                else pdata[i].M_gas_nsf+=mval;
-                #endif
-            }
-        }
         //calculate properties of there are gas particles
         if (pdata[i].n_gas>0) {
         Ekin=Krot=Jx=Jy=Jz=sxx=sxy=sxz=syy=syz=szz=0.;
-        Tsum=tsum=Zsum=sfrsum=0.;
-        Tmeansum=tmeansum=Zmeansum=sfrmeansum=0.;
-        Tsum_sf=tsum=Zsum_sf=0.;
-        Tmeansum_sf=Zmeansum_sf=0.;
-        Tsum_nsf=tsum=Zsum_nsf=0.;
-        Tmeansum_nsf=Zmeansum_nsf=0.;
-        cmx=cmy=cmz=cmvx=cmvy=cmvz=0.;
-        sigV_gas_sf=sigV_gas_nsf=0;
-#ifdef USEOPENMP
-#pragma omp parallel default(shared) \
-private(j,Pval,x,y,z,vx,vy,vz,J,mval,SFR)
-{
-    #pragma omp for reduction(+:Jx,Jy,Jz,sxx,sxy,sxz,syy,syz,szz,cmx,cmy,cmz,cmvx,cmvy,cmvz,Tsum,tsum,Zsum,sfrsum,Tmeansum,tmeansum,Zmeansum,sfrmeansum, Tsum_sf,Zsum_sf,Tmeansum_sf,Zmeansum_sf,Tsum_nsf,Zsum_nsf,Tmeansum_nsf,Zmeansum_nsf,sigV_gas_sf,sigV_gas_nsf)
-#endif
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==GASTYPE) {
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-                #ifdef STARON
-                SFR=Pval->GetSFR();
-                #endif
-
-                x = (*Pval).X();
-                y = (*Pval).Y();
-                z = (*Pval).Z();
-                vx = (*Pval).Vx()-pdata[i].gcmvel[0];
-                vy = (*Pval).Vy()-pdata[i].gcmvel[1];
-                vz = (*Pval).Vz()-pdata[i].gcmvel[2];
-
-                cmx+=x*mval;
-                cmy+=y*mval;
-                cmz+=z*mval;
-
-                cmvx+=vx*mval;
-                cmvy+=vy*mval;
-                cmvz+=vz*mval;
-
-                J=Coordinate(Pval->GetPosition()).Cross(Coordinate(vx,vy,vz))*mval;
-                Jx+=J[0];Jy+=J[1];Jz+=J[2];
-                sxx+=vx*vx*mval;
-                syy+=vy*vy*mval;
-                szz+=vz*vz*mval;
-                sxy+=vx*vy*mval;
-                sxz+=vx*vz*mval;
-                syz+=vy*vz*mval;
-
-                Tsum+=Pval->GetU();
-                Tmeansum+=mval*Pval->GetU();
-#ifdef STARON
-                Zsum+=Pval->GetZmet();
-                Zmeansum+=mval*Pval->GetZmet();
-                sfrsum+=Pval->GetSFR();
-                sfrmeansum+=mval*Pval->GetSFR();
-                if (SFR > opt.gas_sfr_threshold) {
-                    Tsum_sf+=Pval->GetU();
-                    Tmeansum_sf+=mval*Pval->GetU();
-                    Zsum_sf+=Pval->GetZmet();
-                    Zmeansum_sf+=mval*Pval->GetZmet();
-                    sigV_gas_sf+=(vx*vx+vy*vy*vz*vz)*mval;
-                }
-                else {
-                    Tsum_nsf+=Pval->GetU();
-                    Tmeansum_nsf+=mval*Pval->GetU();
-                    Zsum_nsf+=Pval->GetZmet();
-                    Zmeansum_nsf+=mval*Pval->GetZmet();
-                    sigV_gas_nsf+=(vx*vx+vy*vy*vz*vz)*mval;
-                }
-#endif
-            }
-        }
-#ifdef USEOPENMP
-}
-#endif
-        //store data
-        //store temperature in units of internal energy
-        pdata[i].Temp_gas=Tsum;
-        pdata[i].Temp_mean_gas=Tmeansum;
-        //pdata[i].sphden_gas+=Pval->GetMass()*Pval->GetSPHDen();
-#ifdef STARON
-        pdata[i].Z_gas=Zsum;
-        pdata[i].Z_mean_gas=Zmeansum;
-        pdata[i].SFR_gas=sfrsum;
-        pdata[i].SFR_mean_gas=sfrmeansum;
-
-        pdata[i].sigV_gas_sf=sigV_gas_sf;
-        pdata[i].Temp_gas_sf=Tsum_sf;
-        pdata[i].Temp_mean_gas_sf=Tmeansum_sf;
-        pdata[i].Z_gas_sf=Zsum_sf;
-        pdata[i].Z_mean_gas_sf=Zmeansum_sf;
-        pdata[i].sigV_gas_nsf=sigV_gas_nsf;
-        pdata[i].Temp_gas_nsf=Tsum_nsf;
-        pdata[i].Temp_mean_gas_nsf=Tmeansum_nsf;
-        pdata[i].Z_gas_nsf=Zsum_nsf;
-        pdata[i].Z_mean_gas_nsf=Zmeansum_nsf;
-#endif
-        pdata[i].cm_gas[0]=cmx;pdata[i].cm_gas[1]=cmy;pdata[i].cm_gas[2]=cmz;
-        pdata[i].cmvel_gas[0]=cmvx;pdata[i].cmvel_gas[1]=cmvy;pdata[i].cmvel_gas[2]=cmvz;
-        pdata[i].L_gas[0]=Jx;pdata[i].L_gas[1]=Jy;pdata[i].L_gas[2]=Jz;
-        if (pdata[i].n_gas>=PROPROTMINNUM) {
-            pdata[i].veldisp_gas(0,0)=sxx;
-            pdata[i].veldisp_gas(1,1)=syy;
-            pdata[i].veldisp_gas(2,2)=szz;
-            pdata[i].veldisp_gas(0,1)=sxy;
-            pdata[i].veldisp_gas(0,2)=sxz;
-            pdata[i].veldisp_gas(1,2)=syz;
-            pdata[i].veldisp_gas(1,0)=sxy;
-            pdata[i].veldisp_gas(2,0)=sxz;
-            pdata[i].veldisp_gas(2,1)=syz;
-        }
         if (pdata[i].M_gas>0) {
             pdata[i].veldisp_gas=pdata[i].veldisp_gas*(1.0/pdata[i].M_gas);
             pdata[i].cm_gas=pdata[i].cm_gas*(1.0/pdata[i].M_gas);
@@ -1675,99 +1775,19 @@ private(j,Pval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist,mval)
         if (pdata[i].M_gas_nsf>0) pdata[i].Krot_gas_nsf=Krot_nsf/Ekin_nsf;
         #endif
         }
-        if (pdata[i].n_gas>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_gas, pdata[i].s_gas, 1e-2, pdata[i].eigvec_gas,0,GASTYPE,0);
+        if (imorphcalc && pdata[i].n_gas>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_gas, pdata[i].s_gas, 1e-2, pdata[i].eigvec_gas,0,GASTYPE,0);
         }//end of if statement checking that there are gas particles
 #endif
 
 #ifdef STARON
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==STARTYPE) {
-                pdata[i].n_star++;
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-                pdata[i].M_star+=mval;
-            }
-        }
         if (pdata[i].n_star>0) {
         Ekin=Krot=Jx=Jy=Jz=sxx=sxy=sxz=syy=syz=szz=0.;
-        tsum=Zsum=0.;
-        tmeansum=Zmeansum=0.;
-        cmx=cmy=cmz=cmvx=cmvy=cmvz=0.;
-#ifdef USEOPENMP
-#pragma omp parallel default(shared) \
-private(j,Pval,x,y,z,vx,vy,vz,J,mval)
-{
-    #pragma omp for reduction(+:Jx,Jy,Jz,sxx,sxy,sxz,syy,syz,szz,cmx,cmy,cmz,cmvx,cmvy,cmvz,tsum,Zsum,tmeansum,Zmeansum)
-#endif
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==STARTYPE) {
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-
-                x = (*Pval).X();
-                y = (*Pval).Y();
-                z = (*Pval).Z();
-                vx = (*Pval).Vx()-pdata[i].gcmvel[0];
-                vy = (*Pval).Vy()-pdata[i].gcmvel[1];
-                vz = (*Pval).Vz()-pdata[i].gcmvel[2];
-
-                cmx+=x*mval;
-                cmy+=y*mval;
-                cmz+=z*mval;
-
-                cmvx+=vx*mval;
-                cmvy+=vy*mval;
-                cmvz+=vz*mval;
-
-                J=Coordinate(Pval->GetPosition()).Cross(Coordinate(vx,vy,vz))*mval;
-                Jx+=J[0];Jy+=J[1];Jz+=J[2];
-                sxx+=vx*vx*mval;
-                syy+=vy*vy*mval;
-                szz+=vz*vz*mval;
-                sxy+=vx*vy*mval;
-                sxz+=vx*vz*mval;
-                syz+=vy*vz*mval;
-
-                tsum+=Pval->GetTage();
-                Zsum+=Pval->GetZmet();
-                tmeansum+=mval*Pval->GetTage();
-                Zmeansum+=mval*Pval->GetZmet();
-            }
-        }
-#ifdef USEOPENMP
-}
-#endif
-        //store data
-        pdata[i].cm_star[0]=cmx;pdata[i].cm_star[1]=cmy;pdata[i].cm_star[2]=cmz;
-        pdata[i].cmvel_star[0]=cmvx;pdata[i].cmvel_star[1]=cmvy;pdata[i].cmvel_star[2]=cmvz;
-        pdata[i].L_star[0]=Jx;pdata[i].L_star[1]=Jy;pdata[i].L_star[2]=Jz;
-        if (pdata[i].n_star>=PROPROTMINNUM) {
-            pdata[i].veldisp_star(0,0)=sxx;
-            pdata[i].veldisp_star(1,1)=syy;
-            pdata[i].veldisp_star(2,2)=szz;
-            pdata[i].veldisp_star(0,1)=sxy;
-            pdata[i].veldisp_star(0,2)=sxz;
-            pdata[i].veldisp_star(1,2)=syz;
-            pdata[i].veldisp_star(1,0)=sxy;
-            pdata[i].veldisp_star(2,0)=sxz;
-            pdata[i].veldisp_star(2,1)=syz;
-        }
         if (pdata[i].M_star>0) {
             pdata[i].veldisp_star=pdata[i].veldisp_star*(1.0/pdata[i].M_star);
             pdata[i].cm_star=pdata[i].cm_star*(1.0/pdata[i].M_star);
             pdata[i].cmvel_star=pdata[i].cmvel_star*(1.0/pdata[i].M_star);
-            pdata[i].t_star=tsum;
-            pdata[i].Z_star=Zsum;
-            pdata[i].t_mean_star=tmeansum/pdata[i].M_star;
-            pdata[i].Z_mean_star=Zmeansum/pdata[i].M_star;
+            pdata[i].t_mean_star/=pdata[i].M_star;
+            pdata[i].Z_mean_star/=pdata[i].M_star;
         }
         //iterate for better cm if group large enough
         cmold=pdata[i].cm_star;
@@ -1898,25 +1918,10 @@ private(j,Pval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist)
         pdata[i].T_star=0.5*Ekin;
         }
 
-        if (pdata[i].n_star>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_star, pdata[i].s_star, 1e-2, pdata[i].eigvec_star,0,STARTYPE,0);
+        if (imorphcalc && pdata[i].n_star>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].q_star, pdata[i].s_star, 1e-2, pdata[i].eigvec_star,0,STARTYPE,0);
         }//end of calculations if stars are present
 #endif
 
-#ifdef BHON
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType()==BHTYPE) {
-                pdata[i].n_bh++;
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-                pdata[i].M_bh+=mval;
-            }
-        }
-#endif
-
 #ifdef GASON
         GetExtraHydroProperties(opt, pdata[i], numingroup[i], &Part[noffset[i]]);
 #endif
@@ -1930,28 +1935,12 @@ private(j,Pval,x,y,z,vx,vy,vz,jval,jzval,zdist,Rdist)
         GetExtraDMProperties(opt, pdata[i], numingroup[i], &Part[noffset[i]]);
 #endif
 
-#ifdef HIGHRES
-        for (j=0;j<numingroup[i];j++) {
-            Pval=&Part[j+noffset[i]];
-            if (Pval->GetType() == DARK2TYPE || Pval->GetType() == DARK3TYPE || (Pval->GetType()==DARKTYPE&&Pval->GetMass()>opt.zoomlowmassdm))
-            {
-                pdata[i].n_interloper++;
-                #ifndef NOMASS
-                mval = Pval->GetMass();
-                #else
-                mval = opt.MassValue;
-                #endif
-                pdata[i].M_interloper+=mval;
-            }
-        }
-#endif
-
 #ifdef NOMASS
-        GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].gq, pdata[i].gs, 1e-2, pdata[i].geigvec,0);
-        if (RV_num>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(RV_num, &Part[noffset[i]], pdata[i].RV_q, pdata[i].RV_s, 1e-2, pdata[i].RV_eigvec,0);
+        if (imorphcalc) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].gq, pdata[i].gs, 1e-2, pdata[i].geigvec,0);
+        if (iRVmorphcalc && RV_num>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(RV_num, &Part[noffset[i]], pdata[i].RV_q, pdata[i].RV_s, 1e-2, pdata[i].RV_eigvec,0);
 #else
-        GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].gq, pdata[i].gs, 1e-2, pdata[i].geigvec,1);
-        if (RV_num>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(RV_num, &Part[noffset[i]], pdata[i].RV_q, pdata[i].RV_s, 1e-2, pdata[i].RV_eigvec,1);
+        if (imorphcalc) GetGlobalSpatialMorphology(numingroup[i], &Part[noffset[i]], pdata[i].gq, pdata[i].gs, 1e-2, pdata[i].geigvec,1);
+        if (iRVmorphcalc && RV_num>=PROPMORPHMINNUM) GetGlobalSpatialMorphology(RV_num, &Part[noffset[i]], pdata[i].RV_q, pdata[i].RV_s, 1e-2, pdata[i].RV_eigvec,1);
 #endif
     }
 
@@ -1972,29 +1961,15 @@ private(i)
 #endif
     }
 
-    //if calculating profiles
+    //if calculating profiles, large groups are binned by all threads in turn
     if (opt.iprofilecalc) {
-#ifdef USEOPENMP
-#pragma omp parallel default(shared)  \
-private(i,j,k,Pval,x,y,z)
-{
-    #pragma omp for schedule(dynamic) nowait
-#endif
     for (i=1;i<=ngroup;i++) if (numingroup[i]>=omppropnum)
     {
         double irnorm;
-        //as particles are radially sorted, init the radial bin at zero
-        int ibin=0;
         if (opt.iprofilenorm == PROFILERNORMR200CRIT) irnorm = 1.0/pdata[i].gR200c;
         else irnorm = 1.0;
-        for (j=0;j<numingroup[i];j++) {
-            Pval = &Part[noffset[i] + j];
-            AddParticleToRadialBin(opt, Pval, irnorm, ibin, pdata[i]);
-        }
+        AddParticlesToRadialBins(opt, numingroup[i], &Part[noffset[i]], irnorm, pdata[i]);
     }
-#ifdef USEOPENMP
-}
-#endif
     }
 
     //loop over groups for black hole properties
@@ -2150,16 +2125,20 @@ private(i, Pval, rcm,rmbp,rminpot)
 
 }
 
-///Calculate concentration parameter based on assuming NFW profile
+///Calculate concentration parameter based on assuming NFW profile. Haloes large enough to fit are gathered
+///and their concentrations solved together as a batch
 void GetNFWConcentrations(Options &opt, Int_t ngroup, Int_t *&numingroup, PropData *&pdata)
 {
     if (ngroup == 0) return;
     Int_t i;
+    vector<char> icalc(ngroup+1,0);
+    vector<Int_t> ihalos;
+    vector<double> ratios, cvals;
 #ifdef USEOPENMP
 #pragma omp parallel default(shared)  \
 private(i)
 {
-    #pragma omp for schedule(dynamic) nowait
+    #pragma omp for schedule(static) nowait
 #endif
     for (i=1;i<=ngroup;i++)
     {
@@ -2169,21 +2148,44 @@ private(i)
         //where f(c)=ln(1+c)-c/(1+c) and M is some "virial" mass and associated radius
         pdata[i].VmaxVvir2=(pdata[i].gmaxvel*pdata[i].gmaxvel)/(opt.G*pdata[i].gM200c/pdata[i].gR200c);
         //always possible halo severly truncated before so correct if necessary and also for tidal debris, both vmax concentration pretty meaningless
-        if (pdata[i].VmaxVvir2<=1.05) {
+        if (pdata[i].VmaxVvir2<=1.05 || numingroup[i]<PROPNFWMINNUM) {
             if (pdata[i].gM200c==0) pdata[i].cNFW=pdata[i].gsize/pdata[i].gRmaxvel;
             else pdata[i].cNFW=pdata[i].gR200c/pdata[i].gRmaxvel;
         }
-        else {
-            if (numingroup[i]>=PROPNFWMINNUM) CalcConcentration(pdata[i]);
-            else {
-                if (pdata[i].gM200c==0) pdata[i].cNFW=pdata[i].gsize/pdata[i].gRmaxvel;
-                else pdata[i].cNFW=pdata[i].gR200c/pdata[i].gRmaxvel;
-            }
-        }
+        else icalc[i] = 1;
     }
 #ifdef USEOPENMP
 }
 #endif
+    for (i=1;i<=ngroup;i++) if (icalc[i]) ihalos.push_back(i);
+    Int_t nhalos = ihalos.size();
+    if (nhalos == 0) return;
+
+    //gather the Vmax and half mass radius ratios of all haloes, solve and scatter the results
+    ratios.resize(4*nhalos);
+    cvals.resize(4*nhalos);
+    for (i=0;i<nhalos;i++) {
+        PropData &p = pdata[ihalos[i]];
+        ratios[i] = p.VmaxVvir2;
+        ratios[nhalos+3*i] = p.gRhalf200c/p.gR200c;
+        ratios[nhalos+3*i+1] = p.gRhalf200m/p.gR200m;
+        ratios[nhalos+3*i+2] = p.gRhalfBN98/p.gRBN98;
+    }
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static) if (nhalos > ompsearchnum)
+#endif
+    for (i=0;i<nhalos;i++) cvals[i] = CalcConcentrationRootFindingVmax(ratios[i]);
+#ifdef USEOPENMP
+#pragma omp parallel for schedule(static) if (nhalos > ompsearchnum)
+#endif
+    for (i=nhalos;i<4*nhalos;i++) cvals[i] = CalcConcentrationRootFindingRhalf(ratios[i]);
+    for (i=0;i<nhalos;i++) {
+        PropData &p = pdata[ihalos[i]];
+        p.cNFW = cvals[i];
+        p.cNFW200c = cvals[nhalos+3*i];
+        p.cNFW200m = cvals[nhalos+3*i+1];
+        p.cNFWBN98 = cvals[nhalos+3*i+2];
+    }
 }
 
 ///Get inclusive halo FOF based masses. If requesting spherical overdensity masses then extra computation and search required
@@ -2318,7 +2320,7 @@ private(i,j,k,Pval,ri,rcmv,ri2,r2,cmx,cmy,cmz,EncMass,Ninside,icmv,cmold,x,y,z,v
             }
         }
         //sort by radius
-        gsl_heapsort(&Part[noffset[i]], numingroup[i], sizeof(Particle), RadCompare);
+        SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
         pdata[i].gsize=Part[noffset[i]+numingroup[i]-1].Radius();
         pdata[i].gRhalfmass=Part[noffset[i]+(numingroup[i]/2)].Radius();
         //then get cmvel if extra output is desired as will need angular momentum
@@ -2434,7 +2436,7 @@ private(j,Pval,x,y,z,massval)
                 Pval->SetPosition(k,(*Pval).GetPosition(k)-pdata[i].gcm[k]);
             }
         }
-        qsort(&Part[noffset[i]], numingroup[i], sizeof(Particle), RadCompare);
+        SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
         pdata[i].gsize=Part[noffset[i]+numingroup[i]-1].Radius();
         pdata[i].gRhalfmass=Part[noffset[i]+(numingroup[i]/2)].Radius();
         //then get cmvel if extra output is desired as will need angular momentum
@@ -2548,14 +2550,9 @@ private(massval,EncMass,Ninside,rc)
         for (i=1;i<=ngroup;i++)
         {
             double irnorm;
-            //as particles are radially sorted, init the radial bin at zero
-            int ibin =0;
             if (opt.iprofilenorm == PROFILERNORMR200CRIT) irnorm = 1.0/pdata[i].gR200c;
             else irnorm = 1.0;
-            for (j=0;j<numingroup[i];j++) {
-                Pval = &Part[noffset[i] + j];
-                AddParticleToRadialBin(opt,Pval,irnorm,ibin,pdata[i]);
-            }
+            AddParticlesToRadialBins(opt, numingroup[i], &Part[noffset[i]], irnorm, pdata[i]);
             pdata[i].CopyProfileToInclusive(opt);
         }
 #ifdef USEOPENMP
@@ -2674,14 +2671,13 @@ private(i,j,k,x,y,z,Pval)
         if (NProcs>1) {
         if (opt.impiusemesh) halooverlap = MPIGetHaloSearchExportNumUsingMesh(opt, ngroup, pdata, maxrdist);
         else halooverlap= MPIGetHaloSearchExportNum(ngroup, pdata, maxrdist);
-        NNDataIn = new nndata_in[NExport];
-        NNDataGet = new nndata_in[NImport];
+        MPIAllocateNNCommBuffers(NExport, NImport);
         //build the exported halo group list using NNData structures
         if (opt.impiusemesh) MPIBuildHaloSearchExportListUsingMesh(opt, ngroup, pdata, maxrdist,halooverlap);
         else MPIBuildHaloSearchExportList(ngroup, pdata, maxrdist,halooverlap);
         MPIGetHaloSearchImportNum(nbodies, tree, Part);
-        PartDataIn = new Particle[NExport+1];
-        PartDataGet = new Particle[NImport+1];
+        MPIAllocatePartCommBuffers(NExport, NImport);
+        MPIReportPlannedMemory(opt, nbodies, "Spherical overdensity");
         //run search on exported particles and determine which local particles need to be exported back (or imported)
         nimport=MPIBuildParticleNNImportList(opt, nbodies, tree, Part);
         if (nimport>0) treeimport=new KDTree(PartDataGet,nimport,opt.HaloMinSize,tree->TPHYS,tree->KEPAN,100,0,0,0,period);
@@ -2897,10 +2893,8 @@ private(i,j,k,taggedparts,radii,masses,indices,posparts,velparts,typeparts,n,dx,
         mpi_period=0;
         if (NProcs>1) {
             if (treeimport!=NULL) delete treeimport;
-            delete[] PartDataGet;
-            delete[] PartDataIn;
-            delete[] NNDataGet;
-            delete[] NNDataIn;
+            //hand the communication buffers filled by the import back to the arena
+            MPIReleaseCommBuffers();
         }
 #endif
     }
@@ -2979,6 +2973,86 @@ void GetFOFMass(Options &opt, Int_t ngroup, Int_t *&numingroup, PropData *&pdata
     if (opt.iverbose) cout<<"Done FOF masses "<<MyGetTime()-time1<<endl;
 }
 
+/// Order haloes along a Morton curve of their centres so that consecutive haloes in the list are
+/// spatial neighbours whose search volumes overlap
+void SortHalosBySpatialKey(vector<Int_t> &haloorder, PropData *pdata)
+{
+    Int_t nhalos = haloorder.size();
+    if (nhalos < 2) return;
+    Coordinate xmin, xmax;
+    xmin = xmax = pdata[haloorder[0]].gcm;
+    for (auto &i:haloorder) {
+        for (auto k=0;k<3;k++) {
+            xmin[k] = min(xmin[k], pdata[i].gcm[k]);
+            xmax[k] = max(xmax[k], pdata[i].gcm[k]);
+        }
+    }
+    //grid of 2^21 cells per dimension so that the interleaved key fits in 63 bits
+    const Double_t ncells = 2097152.0;
+    Double_t icellsize[3];
+    for (auto k=0;k<3;k++) icellsize[k] = (xmax[k] > xmin[k]) ? (ncells-1.0)/(xmax[k]-xmin[k]) : 0;
+    vector<pair<unsigned long long, Int_t>> keys(nhalos);
+    for (Int_t ii=0;ii<nhalos;ii++) {
+        Int_t i = haloorder[ii];
+        unsigned long long key = 0, icell[3];
+        for (auto k=0;k<3;k++) icell[k] = (unsigned long long)((pdata[i].gcm[k]-xmin[k])*icellsize[k]);
+        for (auto ibit=0;ibit<21;ibit++)
+            for (auto k=0;k<3;k++) key |= ((icell[k] >> ibit) & 1ULL) << (3*ibit+k);
+        keys[ii] = make_pair(key, i);
+    }
+    sort(keys.begin(), keys.end());
+    for (Int_t ii=0;ii<nhalos;ii++) haloorder[ii] = keys[ii].second;
+}
+
+/// Produce indices of the SO search candidates in radial order without a full sort.
+/// Candidates are binned into linear radial shells out to the search radius and only the inner shells are sorted.
+/// Within a shell starting at r_b the enclosed density is at most M(<r_{b+1})/r_b^3 so once this bound falls
+/// below the lowest overdensity of interest all thresholds are expected to be crossed, and only one more shell is sorted.
+/// Shells further out are ordered with respect to each other but not internally.
+/// \return the number of leading entries of indices that are in sorted radial order
+Int_t SortSphericalOverdensityShells(Options &opt, vector<Double_t> &radii, vector<Double_t> &masses, vector<Int_t> &indices,
+    Double_t maxrad, Double_t minlgrhoval)
+{
+    Int_t n = radii.size(), m = 0;
+    int nshells = min((Int_t)SOSHELLMAXNUM, n/SOSHELLPARTNUM);
+    auto comparator = [&radii](Int_t a, Int_t b){ return radii[a] < radii[b]; };
+    indices.resize(n);
+    if (nshells < 4 || maxrad <= 0) {
+        generate(indices.begin(), indices.end(), [&]{ return m++; });
+        sort(indices.begin(), indices.end(), comparator);
+        return n;
+    }
+    Double_t idr = nshells/maxrad, dr = maxrad/nshells, fac = -log(4.0*M_PI/3.0), EncMass;
+    vector<int> ishell(n);
+    vector<Int_t> shellstart(nshells+1, 0), shelloffset;
+    vector<Double_t> shellmass(nshells, 0);
+    for (Int_t j=0;j<n;j++) {
+        ishell[j] = min((int)(radii[j]*idr), nshells-1);
+        shellstart[ishell[j]+1]++;
+#ifndef NOMASS
+        shellmass[ishell[j]] += masses[j];
+#else
+        shellmass[ishell[j]] += opt.MassValue;
+#endif
+    }
+    for (auto b=0;b<nshells;b++) shellstart[b+1] += shellstart[b];
+    shelloffset.assign(shellstart.begin(), shellstart.end()-1);
+    for (Int_t j=0;j<n;j++) indices[shelloffset[ishell[j]]++] = j;
+
+    //find the first shell entirely below the lowest density threshold
+    int bcut = nshells-1;
+    EncMass = shellmass[0];
+    for (auto b=1;b<nshells;b++) {
+        EncMass += shellmass[b];
+        if (EncMass > 0 && log(EncMass)-3.0*log(b*dr)+fac < minlgrhoval) {
+            bcut = min(b+1, nshells-1);
+            break;
+        }
+    }
+    for (auto b=0;b<=bcut;b++) sort(indices.begin()+shellstart[b], indices.begin()+shellstart[b+1], comparator);
+    return shellstart[bcut+1];
+}
+
 /// of all host halos using there centre of masses
 void GetSOMasses(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngroup, Int_t *&numingroup, PropData *&pdata)
 {
@@ -2992,7 +3066,7 @@ void GetSOMasses(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngroup
     Particle *Pval;
     KDTree *tree;
     Double_t period[3];
-    Int_t i,j,k, nhalos = 0;
+    Int_t i,j,k,ii, nhalos = 0, nsorted;
     if (opt.iverbose) {
         cout<<"Get inclusive masses"<<endl;
         cout<<" with masses based on full SO search (slower) for halos only "<<endl;
@@ -3086,6 +3160,12 @@ void GetSOMasses(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngroup
         for (i=1;i<=ngroup;i++) if (maxsearchdist < maxrdist[i]) maxsearchdist = maxrdist[i];
         cout<<ThisTask<<" max search distance is "<<maxsearchdist<<" in period fraction "<<maxsearchdist/opt.p<<endl;
     }
+    //process haloes in spatial order so that the batch of haloes handed to a thread share
+    //much of the tree and particle data they search
+    vector<Int_t> haloorder;
+    haloorder.reserve(nhalos);
+    for (i=1;i<=ngroup;i++) if (CheckForSOInclCalc(opt,pdata[i])) haloorder.push_back(i);
+    SortHalosBySpatialKey(haloorder, pdata);
 #ifdef USEMPI
     //if using mpi then determine if halo's search radius overlaps another mpi domain
     vector<bool> halooverlap;
@@ -3094,14 +3174,13 @@ void GetSOMasses(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngroup
     if (NProcs>1) {
         if (opt.impiusemesh) halooverlap = MPIGetHaloSearchExportNumUsingMesh(opt, ngroup, pdata, maxrdist);
         else halooverlap= MPIGetHaloSearchExportNum(ngroup, pdata, maxrdist);
-        NNDataIn = new nndata_in[NExport];
-        NNDataGet = new nndata_in[NImport];
+        MPIAllocateNNCommBuffers(NExport, NImport);
         //build the exported halo group list using NNData structures
         if (opt.impiusemesh) MPIBuildHaloSearchExportListUsingMesh(opt, ngroup, pdata, maxrdist,halooverlap);
         else MPIBuildHaloSearchExportList(ngroup, pdata, maxrdist,halooverlap);
         MPIGetHaloSearchImportNum(nbodies, tree, Part);
-        PartDataIn = new Particle[NExport+1];
-        PartDataGet = new Particle[NImport+1];
+        MPIAllocatePartCommBuffers(NExport, NImport);
+        MPIReportPlannedMemory(opt, nbodies, "Spherical overdensity");
         //run search on exported particles and determine which local particles need to be exported back (or imported)
         nimport=MPIBuildParticleNNImportList(opt, nbodies, tree, Part, 1, opt.iSphericalOverdensityExtraFieldCalculations);
         if (nimport>0) treeimport=new KDTree(PartDataGet,nimport,opt.HaloMinSize,tree->TPHYS,tree->KEPAN,100,0,0,0,period);
@@ -3113,13 +3192,13 @@ void GetSOMasses(Options &opt, const Int_t nbodies, Particle *Part, Int_t ngroup
 
 #ifdef USEOPENMP
 #pragma omp parallel default(shared)  \
-private(i,j,k,taggedparts,radii,masses,indices,posref,posparts,velparts,typeparts,n,dx,EncMass,J,rc,rhoval,rhoval2,tid,SOpids,iSOfound)
+private(i,j,k,ii,taggedparts,radii,masses,indices,posref,posparts,velparts,typeparts,n,dx,EncMass,J,rc,rhoval,rhoval2,tid,SOpids,iSOfound,nsorted)
 {
-#pragma omp for schedule(dynamic) nowait
+#pragma omp for schedule(dynamic,SOHALOBATCHNUM) nowait
 #endif
-    for (i=1;i<=ngroup;i++)
+    for (ii=0;ii<nhalos;ii++)
     {
-        if (!CheckForSOInclCalc(opt,pdata[i])) continue;
+        i = haloorder[ii];
         if (opt.iPropertyReferencePosition == PROPREFCM) posref=pdata[i].gcm;
         else if (opt.iPropertyReferencePosition == PROPREFMBP) posref=pdata[i].gposmbp;
         else if (opt.iPropertyReferencePosition == PROPREFMINPOT) posref=pdata[i].gposminpot;
@@ -3211,13 +3290,17 @@ private(i,j,k,taggedparts,radii,masses,indices,posref,posparts,velparts,typepart
             }
         }
 #endif
-        //get incides
-        indices.resize(radii.size());
-        n=0;generate(indices.begin(), indices.end(), [&]{ return n++; });
-        //sort by radius
-        auto comparator = [&radii](int a, int b){ return radii[a] < radii[b]; };
-        sort(indices.begin(), indices.end(), comparator);
+        //get indices ordered by radius, only sorting the shells where thresholds are crossed
+        nsorted = SortSphericalOverdensityShells(opt, radii, masses, indices, maxrdist[i], minlgrhoval);
         Int_t llindex = CalculateSphericalOverdensity(opt, pdata[i], radii, masses, indices, m200val, m200mval, mBN98val, virval, m500val, SOlgrhovals);
+        //if not all thresholds were crossed within the sorted shells, sort the rest and recalculate
+        if (llindex >= nsorted && nsorted < (Int_t)radii.size()) {
+            auto comparator = [&radii](Int_t a, Int_t b){ return radii[a] < radii[b]; };
+            sort(indices.begin()+nsorted, indices.end(), comparator);
+            nsorted = radii.size();
+            ResetSphericalOverdensityMass(opt, pdata[i]);
+            llindex = CalculateSphericalOverdensity(opt, pdata[i], radii, masses, indices, m200val, m200mval, mBN98val, virval, m500val, SOlgrhovals);
+        }
         SetSphericalOverdensityMasstoFlagValue(opt, pdata[i]);
         //calculate other extra SO related properties
         CalculateExtraSphericalOverdensityProperties(opt, pdata[i], radii, masses, indices, posparts, velparts, typeparts);
@@ -3230,6 +3313,8 @@ private(i,j,k,taggedparts,radii,masses,indices,posref,posparts,velparts,typepart
             if (opt.iprofilenorm == PROFILERNORMR200CRIT) irnorm = 1.0/pdata[i].gR200c;
             else irnorm = 1.0;
             for (j=0;j<radii.size();j++) {
+                //beyond the sorted shells particles are not in radial order so search bins from the start
+                if (j>=nsorted) ibin = 0;
                 ///\todo need to update to allow for star forming/non-star forming profiles
                 ///by storing the star forming value.
                 double sfrval = 0;
@@ -3292,10 +3377,8 @@ private(i,j,k,taggedparts,radii,masses,indices,posref,posparts,velparts,typepart
     mpi_period=0;
     if (NProcs>1) {
         if (treeimport!=NULL) delete treeimport;
-        delete[] PartDataGet;
-        delete[] PartDataIn;
-        delete[] NNDataGet;
-        delete[] NNDataIn;
+        //hand the communication buffers filled by the import back to the arena
+        MPIReleaseCommBuffers();
     }
 #endif
     if (opt.iverbose) cout<<"Done SO masses for field objects in "<<MyGetTime()-time1<<endl;
@@ -3303,6 +3386,181 @@ private(i,j,k,taggedparts,radii,masses,indices,posref,posparts,velparts,typepart
 
 ///\name Routines to calculate specific property of a set of particles
 //@{
+///Analytic eigen decomposition of a real symmetric 3x3 matrix. Eigenvalues are returned in descending
+///order in e and the rows of eigenvec are the corresponding unit eigenvectors, matching the convention of
+///\ref Matrix::Eigenvalues and \ref Matrix::Eigenvectors. Eigenvalues follow from the trigonometric solution
+///of the characteristic cubic, the eigenvector of the best separated eigenvalue from the largest cross product
+///of the rows of \f$ A-\lambda I \f$ and the middle one from the 2x2 problem in the orthogonal plane
+///(see Eberly, A Robust Eigensolver for 3x3 Symmetric Matrices).
+void SymmetricEigen3x3(Matrix &A, Coordinate &e, Matrix &eigenvec)
+{
+    Double_t a00=A(0,0), a11=A(1,1), a22=A(2,2), a01=A(0,1), a02=A(0,2), a12=A(1,2);
+    Double_t scale, inv, p1, p2, p, trace3, b00, b11, b22, b01, b02, b12, halfdet, phi, eval[3];
+    Double_t evec[3][3];
+    eigenvec=Matrix(0.);
+    eigenvec(0,0)=eigenvec(1,1)=eigenvec(2,2)=1.0;
+    //scale the matrix to avoid over/underflow of the invariants
+    scale=max(max(max(fabs(a00),fabs(a11)),max(fabs(a22),fabs(a01))),max(fabs(a02),fabs(a12)));
+    if (scale==0) {
+        e[0]=e[1]=e[2]=0.;
+        return;
+    }
+    a00/=scale;a11/=scale;a22/=scale;a01/=scale;a02/=scale;a12/=scale;
+    p1=a01*a01+a02*a02+a12*a12;
+    trace3=(a00+a11+a22)/3.0;
+    b00=a00-trace3;b11=a11-trace3;b22=a22-trace3;
+    p2=b00*b00+b11*b11+b22*b22+2.0*p1;
+    //isotropic tensor, any frame is an eigen frame
+    if (p2==0) {
+        e[0]=e[1]=e[2]=trace3*scale;
+        return;
+    }
+    //eigenvalues from the determinant of (A-trace/3 I)/p
+    p=sqrt(p2/6.0);
+    inv=1.0/p;
+    b00*=inv;b11*=inv;b22*=inv;b01=a01*inv;b02=a02*inv;b12=a12*inv;
+    halfdet=0.5*(b00*(b11*b22-b12*b12)-b01*(b01*b22-b12*b02)+b02*(b01*b12-b11*b02));
+    halfdet=min(max(halfdet,(Double_t)-1.0),(Double_t)1.0);
+    phi=acos(halfdet)/3.0;
+    eval[0]=trace3+2.0*p*cos(phi);
+    eval[2]=trace3+2.0*p*cos(phi+2.0*M_PI/3.0);
+    eval[1]=3.0*trace3-eval[0]-eval[2];
+
+    //first eigenvector is that of the eigenvalue furthest from the other two
+    int ifirst=(halfdet>=0)?0:2;
+    Double_t r[3][3]={{a00-eval[ifirst],a01,a02},{a01,a11-eval[ifirst],a12},{a02,a12,a22-eval[ifirst]}};
+    Double_t c[3][3], d[3], dmax;
+    int imax=0;
+    for (int j=0;j<3;j++) {
+        int k0=(j==2)?1:0, k1=(j==0)?1:2;
+        c[j][0]=r[k0][1]*r[k1][2]-r[k0][2]*r[k1][1];
+        c[j][1]=r[k0][2]*r[k1][0]-r[k0][0]*r[k1][2];
+        c[j][2]=r[k0][0]*r[k1][1]-r[k0][1]*r[k1][0];
+        d[j]=c[j][0]*c[j][0]+c[j][1]*c[j][1]+c[j][2]*c[j][2];
+        if (d[j]>d[imax]) imax=j;
+    }
+    dmax=d[imax];
+    if (dmax>0) {
+        dmax=1.0/sqrt(dmax);
+        for (int k=0;k<3;k++) evec[ifirst][k]=c[imax][k]*dmax;
+    }
+    else {
+        for (int k=0;k<3;k++) evec[ifirst][k]=(k==ifirst);
+    }
+
+    //middle eigenvector from the 2x2 problem in the plane orthogonal to the first
+    Double_t *w=evec[ifirst], u[3], v[3], au[3], av[3], m00, m01, m11;
+    if (fabs(w[0])>fabs(w[1])) {
+        inv=1.0/sqrt(w[0]*w[0]+w[2]*w[2]);
+        u[0]=-w[2]*inv;u[1]=0.;u[2]=w[0]*inv;
+    }
+    else {
+        inv=1.0/sqrt(w[1]*w[1]+w[2]*w[2]);
+        u[0]=0.;u[1]=w[2]*inv;u[2]=-w[1]*inv;
+    }
+    v[0]=w[1]*u[2]-w[2]*u[1];
+    v[1]=w[2]*u[0]-w[0]*u[2];
+    v[2]=w[0]*u[1]-w[1]*u[0];
+    au[0]=a00*u[0]+a01*u[1]+a02*u[2];
+    au[1]=a01*u[0]+a11*u[1]+a12*u[2];
+    au[2]=a02*u[0]+a12*u[1]+a22*u[2];
+    av[0]=a00*v[0]+a01*v[1]+a02*v[2];
+    av[1]=a01*v[0]+a11*v[1]+a12*v[2];
+    av[2]=a02*v[0]+a12*v[1]+a22*v[2];
+    m00=u[0]*au[0]+u[1]*au[1]+u[2]*au[2]-eval[1];
+    m01=u[0]*av[0]+u[1]*av[1]+u[2]*av[2];
+    m11=v[0]*av[0]+v[1]*av[1]+v[2]*av[2]-eval[1];
+    Double_t cu=1.0, cv=0.;
+    if (fabs(m00)>=fabs(m11)) {
+        if (max(fabs(m00),fabs(m01))>0) {
+            if (fabs(m00)>=fabs(m01)) {m01/=m00;m00=1.0/sqrt(1.0+m01*m01);m01*=m00;}
+            else {m00/=m01;m01=1.0/sqrt(1.0+m00*m00);m00*=m01;}
+            cu=m01;cv=-m00;
+        }
+    }
+    else {
+        if (max(fabs(m11),fabs(m01))>0) {
+            if (fabs(m11)>=fabs(m01)) {m01/=m11;m11=1.0/sqrt(1.0+m01*m01);m01*=m11;}
+            else {m11/=m01;m01=1.0/sqrt(1.0+m11*m11);m11*=m01;}
+            cu=m11;cv=-m01;
+        }
+    }
+    for (int k=0;k<3;k++) evec[1][k]=cu*u[k]+cv*v[k];
+
+    //remaining eigenvector completes the right handed frame
+    int ilast=2-ifirst;
+    Double_t *x0=evec[(ilast+1)%3], *x1=evec[(ilast+2)%3];
+    evec[ilast][0]=x0[1]*x1[2]-x0[2]*x1[1];
+    evec[ilast][1]=x0[2]*x1[0]-x0[0]*x1[2];
+    evec[ilast][2]=x0[0]*x1[1]-x0[1]*x1[0];
+    //the trigonometric eigenvalues lose precision for (nearly) repeated roots so refine them
+    //with the Rayleigh quotients of the orthonormal eigenvectors, keeping descending order
+    for (int j=0;j<3;j++) {
+        Double_t *x=evec[j];
+        eval[j]=a00*x[0]*x[0]+a11*x[1]*x[1]+a22*x[2]*x[2]+2.0*(a01*x[0]*x[1]+a02*x[0]*x[2]+a12*x[1]*x[2]);
+    }
+    for (int j=0;j<2;j++) {
+        for (int k=0;k<2-j;k++) {
+            if (eval[k]<eval[k+1]) {
+                //swap rows and flip one to remain right handed
+                swap(eval[k],eval[k+1]);
+                for (int l=0;l<3;l++) {
+                    Double_t tmp=evec[k][l];
+                    evec[k][l]=evec[k+1][l];
+                    evec[k+1][l]=-tmp;
+                }
+            }
+        }
+    }
+    for (int j=0;j<3;j++) {
+        e[j]=eval[j]*scale;
+        for (int k=0;k<3;k++) eigenvec(j,k)=evec[j][k];
+    }
+}
+
+///Calculate the weighted reduced inertia tensor of particles stored in contiguous coordinate arrays.
+///The ellipsoidal distance is evaluated in the original frame using the principal axes (rows of eigenvec)
+///and axis ratios q, s, so particles need not be rotated. Weights are the masses if w is not NULL.
+inline void CalcMTensorInFrame(Matrix& M, const Double_t q, const Double_t s, Matrix &eigenvec,
+    const Int_t n, const Double_t *x, const Double_t *y, const Double_t *z, const Double_t *w)
+{
+    Int_t i;
+    Double_t a2,Mxx,Myy,Mzz,Mxy,Mxz,Myz;
+    //metric A=E^T diag(1,1/q^2,1/s^2) E so that a^2 = r^T A r
+    Double_t d[3]={1.0,1.0/(q*q),1.0/(s*s)};
+    Double_t Axx=0,Ayy=0,Azz=0,Axy=0,Axz=0,Ayz=0;
+    for (int k=0;k<3;k++) {
+        Axx+=d[k]*eigenvec(k,0)*eigenvec(k,0);
+        Ayy+=d[k]*eigenvec(k,1)*eigenvec(k,1);
+        Azz+=d[k]*eigenvec(k,2)*eigenvec(k,2);
+        Axy+=d[k]*eigenvec(k,0)*eigenvec(k,1);
+        Axz+=d[k]*eigenvec(k,0)*eigenvec(k,2);
+        Ayz+=d[k]*eigenvec(k,1)*eigenvec(k,2);
+    }
+    Mxx=Myy=Mzz=Mxy=Mxz=Myz=0.;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) private(i,a2) schedule(static) \
+reduction(+:Mxx,Myy,Mzz,Mxy,Mxz,Myz) if (n>=ompunbindnum)
+#endif
+    for (i = 0; i < n; i++)
+    {
+        a2 = Axx*x[i]*x[i]+Ayy*y[i]*y[i]+Azz*z[i]*z[i]+2.0*(Axy*x[i]*y[i]+Axz*x[i]*z[i]+Ayz*y[i]*z[i]);
+        if (a2!=0) {
+            a2=((w==NULL)?1.0:w[i])/a2;
+            Mxx+=x[i]*x[i]*a2;
+            Myy+=y[i]*y[i]*a2;
+            Mzz+=z[i]*z[i]*a2;
+            Mxy+=x[i]*y[i]*a2;
+            Mxz+=x[i]*z[i]*a2;
+            Myz+=y[i]*z[i]*a2;
+        }
+    }
+    M(0,0)=Mxx;M(1,1)=Myy;M(2,2)=Mzz;
+    M(0,1)=M(1,0)=Mxy;
+    M(0,2)=M(2,0)=Mxz;
+    M(1,2)=M(2,1)=Myz;
+}
+
 ///Get spatial morphology using iterative procedure
 void GetGlobalSpatialMorphology(const Int_t nbodies, Particle *p, Double_t& q, Double_t& s, Double_t Error, Matrix& eigenvec, int imflag, int itype, int iiterate)
 {
@@ -3310,39 +3568,33 @@ void GetGlobalSpatialMorphology(const Int_t nbodies, Particle *p, Double_t& q, D
     int MAXIT=10;
     Double_t oldq,olds;
     Coordinate e;
-    Matrix R(0.),M(0.0),eigenvecp(0.);
+    Matrix M(0.0);
+    Int_t i, nmorph=0;
     eigenvec=Matrix(0.);
     eigenvec(0,0)=eigenvec(1,1)=eigenvec(2,2)=1.0;
+    //gather the particles that contribute to the tensor once, these contiguous arrays are then
+    //reused by every iteration and the particles themselves are never rotated
+    vector<Double_t> x(nbodies), y(nbodies), z(nbodies), w;
+    if (imflag==1) w.resize(nbodies);
+    for (i=0;i<nbodies;i++) {
+        if (itype!=-1 && p[i].GetType()!=itype) continue;
+        x[nmorph]=p[i].X();
+        y[nmorph]=p[i].Y();
+        z[nmorph]=p[i].Z();
+        if (imflag==1) w[nmorph]=p[i].GetMass();
+        nmorph++;
+    }
     // Iterative procedure.  See Dubinski and Carlberg (1991).
-    int i=0;
-    if (iiterate) {
+    if (!iiterate) MAXIT=1;
+    i=0;
     do
     {
-        M = Matrix(0.0);
-        eigenvecp=Matrix(0.);
-        if (imflag==1)CalcMTensorWithMass(M, q, s, nbodies, p,itype);
-        else CalcMTensor(M, q, s, nbodies, p,itype);
-        e = M.Eigenvalues();
+        CalcMTensorInFrame(M, q, s, eigenvec, nmorph, x.data(), y.data(), z.data(), (imflag==1)?w.data():NULL);
+        SymmetricEigen3x3(M, e, eigenvec);
         oldq = q;olds = s;
         q = sqrt(e[1] / e[0]);s = sqrt(e[2] / e[0]);
-        eigenvecp=M.Eigenvectors(e);
-        eigenvec=eigenvecp*eigenvec;
-        RotParticles(nbodies, p, eigenvecp);
         i++;
     } while ((fabs(olds - s) > Error || fabs(oldq - q) > Error) && i<MAXIT);
-    //rotate system back to original coordinate frame
-    R=eigenvec.Transpose();
-    RotParticles(nbodies, p, R);
-    }
-    else {
-        if (imflag==1)CalcMTensorWithMass(M, q, s, nbodies, p,itype);
-        else CalcMTensor(M, q, s, nbodies, p,itype);
-        e = M.Eigenvalues();
-        oldq = q;olds = s;
-        q = sqrt(e[1] / e[0]);s = sqrt(e[2] / e[0]);
-        eigenvecp=M.Eigenvectors(e);
-        eigenvec=eigenvecp*eigenvec;
-    }
 }
 
 ///calculate the inertia tensor and return the dispersions (weight by 1/mtot)
@@ -3542,7 +3794,7 @@ void CalcPhaseSigmaTensor(const Int_t n, Particle *p, GMatrix &eigenvalues, GMat
 }
 
 void CalcPhaseSigmaTensor(const Int_t n, Particle *p, GMatrix &I, int itype) {
-    Double_t det,weight;
+    Double_t weight;
     Double_t Ixx,Iyy,Izz,Ixy,Ixz,Iyz;
     Double_t Ivxvx,Ivyvy,Ivzvz,Ivxvy,Ivxvz,Ivyvz;
     Double_t Ixvx,Iyvx,Izvx,Ixvy,Iyvy,Izvy,Ixvz,Iyvz,Izvz;
@@ -3552,43 +3804,45 @@ void CalcPhaseSigmaTensor(const Int_t n, Particle *p, GMatrix &I, int itype) {
     Ivxvx=Ivyvy=Ivzvz=Ivxvy=Ivxvz=Ivyvz=0.;
     Ixvx=Iyvx=Izvx=Ixvy=Iyvy=Izvy=Ixvz=Iyvz=Izvz=0;
     Double_t mtot=0;
+    //single pass over the particles accumulating the 21 unique terms of the symmetric tensor,
+    //threaded for large systems
 #ifdef USEOPENMP
-    if (n>=ompunbindnum) {
-#pragma omp parallel default(shared) \
-private(i,weight)
-{
-#pragma omp for schedule(dynamic) reduction(+:Ixx,Iyy,Izz,Ixy,Ixz,Iyz,Ivxvx,Ivyvy,Ivzvz,Ivxvy,Ivxvz,Ivyvz,Ixvx,Iyvx,Izvx,Ixvy,Iyvy,Izvy,Ixvz,Iyvz,Izvz,mtot)
+#pragma omp parallel for default(shared) private(i,weight) schedule(static) \
+reduction(+:Ixx,Iyy,Izz,Ixy,Ixz,Iyz,Ivxvx,Ivyvy,Ivzvz,Ivxvy,Ivxvz,Ivyvz,Ixvx,Iyvx,Izvx,Ixvy,Iyvy,Izvy,Ixvz,Iyvz,Izvz,mtot) \
+if (n>=ompunbindnum)
+#endif
     for (i = 0; i < n; i++)
     {
         if (itype==-1) weight=p[i].GetMass();
         else if (p[i].GetType()==itype) weight=p[i].GetMass();
-        else weight=0.;
-        Ixx+=(p[i].X()*p[i].X())*weight;
-        Iyy+=(p[i].Y()*p[i].Y())*weight;
-        Izz+=(p[i].Z()*p[i].Z())*weight;
-        Ixy+=(p[i].X()*p[i].Y())*weight;
-        Ixz+=(p[i].X()*p[i].Z())*weight;
-        Iyz+=(p[i].Y()*p[i].Z())*weight;
-        Ivxvx+=(p[i].Vx()*p[i].Vx())*weight;
-        Ivyvy+=(p[i].Vy()*p[i].Vy())*weight;
-        Ivzvz+=(p[i].Vz()*p[i].Vz())*weight;
-        Ivxvy+=(p[i].Vx()*p[i].Vy())*weight;
-        Ivxvz+=(p[i].Vx()*p[i].Vz())*weight;
-        Ivyvz+=(p[i].Vy()*p[i].Vz())*weight;
-
-        Ixvx+=(p[i].X()*p[i].Vx())*weight;
-        Iyvx+=(p[i].Y()*p[i].Vx())*weight;
-        Izvx+=(p[i].Z()*p[i].Vx())*weight;
-        Ixvy+=(p[i].X()*p[i].Vy())*weight;
-        Iyvy+=(p[i].Y()*p[i].Vy())*weight;
-        Izvy+=(p[i].Z()*p[i].Vy())*weight;
-        Ixvz+=(p[i].X()*p[i].Vz())*weight;
-        Iyvz+=(p[i].Y()*p[i].Vz())*weight;
-        Izvz+=(p[i].Z()*p[i].Vz())*weight;
+        else continue;
+        Double_t x=p[i].X(), y=p[i].Y(), z=p[i].Z();
+        Double_t vx=p[i].Vx(), vy=p[i].Vy(), vz=p[i].Vz();
+        Ixx+=(x*x)*weight;
+        Iyy+=(y*y)*weight;
+        Izz+=(z*z)*weight;
+        Ixy+=(x*y)*weight;
+        Ixz+=(x*z)*weight;
+        Iyz+=(y*z)*weight;
+        Ivxvx+=(vx*vx)*weight;
+        Ivyvy+=(vy*vy)*weight;
+        Ivzvz+=(vz*vz)*weight;
+        Ivxvy+=(vx*vy)*weight;
+        Ivxvz+=(vx*vz)*weight;
+        Ivyvz+=(vy*vz)*weight;
+
+        Ixvx+=(x*vx)*weight;
+        Iyvx+=(y*vx)*weight;
+        Izvx+=(z*vx)*weight;
+        Ixvy+=(x*vy)*weight;
+        Iyvy+=(y*vy)*weight;
+        Izvy+=(z*vy)*weight;
+        Ixvz+=(x*vz)*weight;
+        Iyvz+=(y*vz)*weight;
+        Izvz+=(z*vz)*weight;
 
         mtot+=weight;
     }
-}
     I(0,0)=Ixx;I(1,1)=Iyy;I(2,2)=Izz;
     I(0,1)=I(1,0)=Ixy;
     I(0,2)=I(2,0)=Ixz;
@@ -3609,182 +3863,9 @@ private(i,weight)
     I(1,5)=I(5,1)=Iyvz;
     I(2,5)=I(5,2)=Izvz;
 
-    }
-    else {
-#endif
-    for (i = 0; i < n; i++)
-    {
-        if (itype==-1) weight=p[i].GetMass();
-        else if (p[i].GetType()==itype) weight=p[i].GetMass();
-        else weight=0.;
-        for (int j = 0; j < 6; j++)
-        {
-            for (int k = 0; k < 6; k++)
-            {
-                I(j, k) += (p[i].GetPhase(j) *p[i].GetPhase(k))*weight;
-            }
-        }
-        mtot+=weight;
-    }
-#ifdef USEOPENMP
-    }
-#endif
     I=I*(1.0/mtot);
 }
 
-///calculate the weighted reduced inertia tensor assuming particles are the same mass
-void CalcMTensor(Matrix& M, const Double_t q, const Double_t s, const Int_t n, Particle *p, int itype)
-{
-    Int_t i;
-    int j,k;
-    Double_t a2,Mxx,Myy,Mzz,Mxy,Mxz,Myz,weight;
-    Mxx=Myy=Mzz=Mxy=Mxz=Myz=0.;
-#ifdef USEOPENMP
-    if (n>=ompunbindnum) {
-#pragma omp parallel default(shared) \
-private(i,a2,weight)
-{
-#pragma omp for schedule(dynamic) nowait reduction(+:Mxx,Myy,Mzz,Mxy,Mxz,Myz)
-    for (i = 0; i < n; i++)
-    {
-        a2 = (p[i].X()*p[i].X()+p[i].Y()*p[i].Y()/q/q+p[i].Z()*p[i].Z()/s/s);
-        if (a2!=0) {
-        if (itype==-1) weight=1.0;
-        else if (p[i].GetType()==itype) weight=1.0;
-        else weight=0.;
-        a2=1.0/a2*weight;
-        Mxx+=p[i].X()*p[i].X()*a2;
-        Myy+=p[i].Y()*p[i].Y()*a2;
-        Mzz+=p[i].Z()*p[i].Z()*a2;
-        Mxy+=p[i].X()*p[i].Y()*a2;
-        Mxz+=p[i].X()*p[i].Z()*a2;
-        Myz+=p[i].Y()*p[i].Z()*a2;
-        }
-    }
-}
-    M(0,0)=Mxx;M(1,1)=Myy;M(2,2)=Mzz;
-    M(0,1)=M(1,0)=Mxy;
-    M(0,2)=M(2,0)=Mxz;
-    M(1,2)=M(2,1)=Myz;
-    }
-    else {
-#endif
-    for (i = 0; i < n; i++)
-    {
-        a2 = (p[i].X()*p[i].X()+p[i].Y()*p[i].Y()/q/q+p[i].Z()*p[i].Z()/s/s);
-        if(a2!=0){
-            if (itype==-1) weight=1.0;
-            else if (p[i].GetType()==itype) weight=1.0;
-            else weight=0.;
-            a2=1.0/a2*weight;
-            for (j = 0; j < 3; j++)
-                for (k = 0; k < 3; k++)
-                M(j, k) += p[i].GetPosition(j)*p[i].GetPosition(k)*a2;
-        }
-    }
-#ifdef USEOPENMP
-    }
-#endif
-}
-
-///calculate the weighted reduced inertia tensor
-void CalcMTensorWithMass(Matrix& M, const Double_t q, const Double_t s, const Int_t n, Particle *p, int itype)
-{
-    Int_t i;
-    int j,k;
-    Double_t a2,Mxx,Myy,Mzz,Mxy,Mxz,Myz,weight;
-    Mxx=Myy=Mzz=Mxy=Mxz=Myz=0.;
-#ifdef USEOPENMP
-    if (n>=ompunbindnum) {
-#pragma omp parallel default(shared) \
-private(i,a2,weight)
-{
-#pragma omp for schedule(dynamic) nowait reduction(+:Mxx,Myy,Mzz,Mxy,Mxz,Myz)
-    for (i = 0; i < n; i++)
-    {
-        a2 = (p[i].X()*p[i].X()+p[i].Y()*p[i].Y()/q/q+p[i].Z()*p[i].Z()/s/s);
-        if (a2!=0) {
-        if (itype==-1) weight=1.0;
-        else if (p[i].GetType()==itype) weight=1.0;
-        else weight=0.;
-        a2=p[i].GetMass()/a2*weight;
-        Mxx+=p[i].X()*p[i].X()*a2;
-        Myy+=p[i].Y()*p[i].Y()*a2;
-        Mzz+=p[i].Z()*p[i].Z()*a2;
-        Mxy+=p[i].X()*p[i].Y()*a2;
-        Mxz+=p[i].X()*p[i].Z()*a2;
-        Myz+=p[i].Y()*p[i].Z()*a2;
-        }
-    }
-}
-    M(0,0)=Mxx;M(1,1)=Myy;M(2,2)=Mzz;
-    M(0,1)=M(1,0)=Mxy;
-    M(0,2)=M(2,0)=Mxz;
-    M(1,2)=M(2,1)=Myz;
-    }
-    else {
-#endif
-    for (i = 0; i < n; i++)
-    {
-        a2 = (p[i].X()*p[i].X()+p[i].Y()*p[i].Y()/q/q+p[i].Z()*p[i].Z()/s/s);
-        if(a2!=0){
-        if (itype==-1) weight=1.0;
-        else if (p[i].GetType()==itype) weight=1.0;
-        else weight=0.;
-            a2=p[i].GetMass()/a2*weight;
-            for (j = 0; j < 3; j++)
-                for (k = 0; k < 3; k++)
-                M(j, k) += p[i].GetPosition(j)*p[i].GetPosition(k)*a2;
-        }
-    }
-#ifdef USEOPENMP
-    }
-#endif
-}
-
-///rotate particles
-void RotParticles(const Int_t n, Particle *p, Matrix &R)
-{
-    Int_t i;
-    int j;
-    Coordinate temp;
-#ifdef USEOPENMP
-    if (n>=ompunbindnum) {
-#pragma omp parallel default(shared) \
-private(i,j,temp)
-{
-#pragma omp for schedule(dynamic) nowait
-    for (i=0; i<n; i++)
-    {
-        temp[0]=temp[1]=temp[2]=0.;
-        for (j=0; j<3; j++)
-        {
-            temp[0] += R(0, j) * (p[i].GetPosition(j));
-            temp[1] += R(1, j) * (p[i].GetPosition(j));
-            temp[2] += R(2, j) * (p[i].GetPosition(j));
-        }
-        p[i].SetPosition(temp[0], temp[1], temp[2]);
-    }
-}
-    }
-    else {
-#endif
-    for (i=0; i<n; i++)
-    {
-        temp[0]=temp[1]=temp[2]=0.;
-        for (j=0; j<3; j++)
-        {
-            temp[0] += R(0, j) * (p[i].GetPosition(j));
-            temp[1] += R(1, j) * (p[i].GetPosition(j));
-            temp[2] += R(2, j) * (p[i].GetPosition(j));
-        }
-        p[i].SetPosition(temp[0], temp[1], temp[2]);
-    }
-#ifdef USEOPENMP
-    }
-#endif
-}
-
 ///calculate the phase-space dispersion tensor
 GMatrix CalcPhaseCM(const Int_t n, Particle *p, int itype)
 {
@@ -3840,78 +3921,88 @@ private(i,weight)
 }
 
 ///calculate concentration. Note that we limit concentration to 1000 or so which means VmaxVvir2<=36
-void CalcConcentration(PropData &p)
-{
-    double tol = max(1.0/(double)p.num, 1e-3);
-    p.cNFW = CalcConcentrationRootFindingVmax(p.VmaxVvir2, tol);
-    p.cNFW200c = CalcConcentrationRootFindingRhalf(p.gRhalf200c/p.gR200c, tol);
-    p.cNFW200m = CalcConcentrationRootFindingRhalf(p.gRhalf200m/p.gR200m, tol);
-    p.cNFWBN98 = CalcConcentrationRootFindingRhalf(p.gRhalfBN98/p.gRBN98, tol);
-}
+///\name Tabulated NFW relations used to solve for concentrations
+//@{
+inline double NFWMassProfile(double x) {return log(1.0+x)-x/(1.0+x);}
+inline double NFWMassProfileDeriv(double x) {return x/((1.0+x)*(1.0+x));}
 
-double CalcConcentrationRootFindingRhalf(double rratio, double tol)
-{
-    if (rratio >= NFWMAXRHALFRATIO) return -1.0;
-    else if (rratio <= NFWMINRHALFRATIO) return -1.0;
-    int status;
-    int iter = 0, max_iter = 100;
-    const gsl_root_fsolver_type *T;
-    gsl_root_fsolver *s;
-    double cval = 2.3;
-    //start point for concentration
-    double x_lo = 0.6, x_hi = 10000.0;
-    gsl_function F;
-    F.function = &mycNFWRhalf;
-    F.params = &rratio;
-    T = gsl_root_fsolver_brent;
-    s = gsl_root_fsolver_alloc (T);
-    //gsl_invoke(gsl_root_fsolver_set, s, &F, x_lo, x_hi);
-    gsl_root_fsolver_set (s, &F, x_lo, x_hi);
-    do
-    {
-        iter++;
-        status = gsl_root_fsolver_iterate (s);
-        //gsl_invoke(gsl_root_fsolver_iterate, s);
-        cval = gsl_root_fsolver_root (s);
-        x_lo = gsl_root_fsolver_x_lower (s);
-        x_hi = gsl_root_fsolver_x_upper (s);
-        status = gsl_root_test_interval (x_lo, x_hi, tol, tol);
+/*! NFW relations between the concentration and the Vmax^2/Vvir^2 and Rhalf/Rvir ratios tabulated on grids evenly spaced
+    in log concentration. Both are monotonic over the tabulated range, so solving for a concentration only requires
+    locating the grid cell bracketing the ratio and a few Newton iterations kept within that cell.
+*/
+struct NFWConcentrationTable {
+    vector<double> cvmax, vmax, crhalf, rhalf;
+    NFWConcentrationTable() {
+        double lgcmin, dlgc, c, x_lo, x_hi, x, mhalf;
+        cvmax.resize(NFWTABLENUM);
+        vmax.resize(NFWTABLENUM);
+        lgcmin = log(NFWVMAXCMIN);
+        dlgc = (log(NFWVMAXCMAX)-lgcmin)/(double)(NFWTABLENUM-1);
+        for (auto i=0;i<NFWTABLENUM;i++) {
+            cvmax[i] = exp(lgcmin+i*dlgc);
+            vmax[i] = 0.216*cvmax[i]/NFWMassProfile(cvmax[i]);
+        }
+        crhalf.resize(NFWTABLENUM);
+        rhalf.resize(NFWTABLENUM);
+        lgcmin = log(NFWRHALFCMIN);
+        dlgc = (log(NFWRHALFCMAX)-lgcmin)/(double)(NFWTABLENUM-1);
+        for (auto i=0;i<NFWTABLENUM;i++) {
+            c = crhalf[i] = exp(lgcmin+i*dlgc);
+            mhalf = 0.5*NFWMassProfile(c);
+            x_lo = 0; x_hi = c;
+            for (auto iter=0;iter<100;iter++) {
+                x = 0.5*(x_lo+x_hi);
+                if (NFWMassProfile(x) < mhalf) x_lo = x;
+                else x_hi = x;
+            }
+            rhalf[i] = 0.5*(x_lo+x_hi)/c;
+        }
     }
-    while (status == GSL_CONTINUE && iter < max_iter);
-    gsl_root_fsolver_free (s);
-    return cval;
+};
+
+///Tables are built once, on first use
+const NFWConcentrationTable &GetNFWConcentrationTable()
+{
+    static const NFWConcentrationTable table;
+    return table;
 }
 
-double CalcConcentrationRootFindingVmax(double VmaxVvir2, double tol)
+///Solve m(c rratio) = 0.5 m(c), where m is the NFW mass profile, returning -1 if no solution in the expected range
+double CalcConcentrationRootFindingRhalf(double rratio)
 {
-    if (VmaxVvir2 >= NFWMINVMAXVVIRRATIO) return -1;
-    int status;
-    int iter = 0, max_iter = 100;
-    const gsl_root_fsolver_type *T;
-    gsl_root_fsolver *s;
-    double cval = 2.3;
-    //start point for concentration
-    double x_lo = 1.9, x_hi = 5000.0;
-    gsl_function F;
-    F.function = &mycNFW;
-    F.params = &VmaxVvir2;
-    T = gsl_root_fsolver_brent;
-    s = gsl_root_fsolver_alloc (T);
-    //gsl_invoke(gsl_root_fsolver_set, s, &F, x_lo, x_hi);
-    gsl_root_fsolver_set (s, &F, x_lo, x_hi);
-    do
-    {
-        iter++;
-        status = gsl_root_fsolver_iterate (s);
-        //gsl_invoke(gsl_root_fsolver_iterate, s);
-        cval = gsl_root_fsolver_root (s);
-        x_lo = gsl_root_fsolver_x_lower (s);
-        x_hi = gsl_root_fsolver_x_upper (s);
-        status = gsl_root_test_interval (x_lo, x_hi, tol, tol);
-    }
-    while (status == GSL_CONTINUE && iter < max_iter);
-    gsl_root_fsolver_free (s);
-    return cval;
+    if (!(rratio < NFWMAXRHALFRATIO && rratio > NFWMINRHALFRATIO)) return -1.0;
+    const NFWConcentrationTable &table = GetNFWConcentrationTable();
+    //ratio decreases with concentration, find first entry at or below the ratio
+    auto k = lower_bound(table.rhalf.begin(), table.rhalf.end(), rratio, greater<double>()) - table.rhalf.begin();
+    if (k == 0 || k == NFWTABLENUM) return -1.0;
+    double c_lo = table.crhalf[k-1], c_hi = table.crhalf[k];
+    double c = c_lo*pow(c_hi/c_lo, (table.rhalf[k-1]-rratio)/(table.rhalf[k-1]-table.rhalf[k]));
+    double f, df;
+    for (auto iter=0;iter<NFWNEWTONITER;iter++) {
+        f = NFWMassProfile(c*rratio)-0.5*NFWMassProfile(c);
+        df = rratio*NFWMassProfileDeriv(c*rratio)-0.5*NFWMassProfileDeriv(c);
+        c = min(max(c-f/df, c_lo), c_hi);
+    }
+    return c;
+}
+
+///Solve Vmax^2/Vvir^2 = 0.216 c/m(c), where m is the NFW mass profile, returning -1 if no solution in the expected range
+double CalcConcentrationRootFindingVmax(double VmaxVvir2)
+{
+    if (!(VmaxVvir2 < NFWMINVMAXVVIRRATIO)) return -1.0;
+    const NFWConcentrationTable &table = GetNFWConcentrationTable();
+    auto k = upper_bound(table.vmax.begin(), table.vmax.end(), VmaxVvir2) - table.vmax.begin();
+    if (k == 0 || k == NFWTABLENUM) return -1.0;
+    double c_lo = table.cvmax[k-1], c_hi = table.cvmax[k];
+    double c = c_lo*pow(c_hi/c_lo, (VmaxVvir2-table.vmax[k-1])/(table.vmax[k]-table.vmax[k-1]));
+    double m, f, df;
+    for (auto iter=0;iter<NFWNEWTONITER;iter++) {
+        m = NFWMassProfile(c);
+        f = 0.216*c/m-VmaxVvir2;
+        df = 0.216*(m-c*NFWMassProfileDeriv(c))/(m*m);
+        c = min(max(c-f/df, c_lo), c_hi);
+    }
+    return c;
 }
 
 //@}
@@ -4257,7 +4348,7 @@ private(i,j,k,r2,v2,poti,Ti,pot,Eval,npot,storepid,menc,potmin,ipotmin,cmpotmin)
             for (j=0;j<numingroup[i];j++) {
                 for (k=0;k<3;k++) Part[j+noffset[i]].SetPosition(k,Part[j+noffset[i]].GetPosition(k)-cmpotmin[k]);
             }
-            gsl_heapsort(&Part[noffset[i]],numingroup[i],sizeof(Particle),RadCompare);
+            SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
             //now determine kinetic frame
             pdata[i].gcmvel[0]=pdata[i].gcmvel[1]=pdata[i].gcmvel[2]=menc=0.;
             for (j=0;j<npot;j++) {
@@ -4333,7 +4424,7 @@ private(i,j,k,r2,v2,poti,Ti,pot,Eval,npot,storepid,menc,potmin,ipotmin,cmpotmin)
             for (j=0;j<numingroup[i];j++) {
                 for (k=0;k<3;k++) Part[j+noffset[i]].SetPosition(k,Part[j+noffset[i]].GetPosition(k)-cmpotmin[k]);
             }
-            gsl_heapsort(&Part[noffset[i]],numingroup[i],sizeof(Particle),RadCompare);
+            SortParticlesByRadius(numingroup[i], &Part[noffset[i]]);
             //now determine kinetic frame
             pdata[i].gcmvel[0]=pdata[i].gcmvel[1]=pdata[i].gcmvel[2]=menc=0.;
             for (j=0;j<npot;j++) {
@@ -4592,9 +4683,9 @@ private(i,j)
 
     GetMaximumSizes(opt, nbodies, Part, ngroup, numingroup, pdata, noffset);
     //calculate spherical masses after substructures identified if using InclusiveHalo = 3
-    if (opt.iInclusiveHalo == 3) GetSOMasses(opt, nbodies, Part, ngroup,  numingroup, pdata);
+    if (opt.iInclusiveHalo == 3 && (opt.propertykernels & PROPKERNELSO)) GetSOMasses(opt, nbodies, Part, ngroup,  numingroup, pdata);
     //and finally calculate concentrations
-    GetNFWConcentrations(opt, ngroup, numingroup, pdata);
+    if (opt.propertykernels & PROPKERNELCONCENTRATION) GetNFWConcentrations(opt, ngroup, numingroup, pdata);
     //AdjustHaloPositionRelativeToReferenceFrame(opt, ngroup, numingroup, pdata);
     AdjustHaloPositionForPeriod(opt, ngroup, numingroup, pdata);
 
@@ -4661,9 +4752,9 @@ void CalculateHaloProperties(Options &opt, const Int_t nbodies, Particle *Part,
     }
     GetMaximumSizes(opt, nbodies, Part, ngroup, numingroup, pdata, noffset);
     //calculate spherical masses after substructures identified if using InclusiveHalo = 3
-    if (opt.iInclusiveHalo == 3) GetSOMasses(opt, nbodies, Part, ngroup,  numingroup, pdata);
+    if (opt.iInclusiveHalo == 3 && (opt.propertykernels & PROPKERNELSO)) GetSOMasses(opt, nbodies, Part, ngroup,  numingroup, pdata);
     //and finally calculate concentrations
-    GetNFWConcentrations(opt, ngroup, numingroup, pdata);
+    if (opt.propertykernels & PROPKERNELCONCENTRATION) GetNFWConcentrations(opt, ngroup, numingroup, pdata);
     //AdjustHaloPositionRelativeToReferenceFrame(opt, ngroup, numingroup, pdata);
     AdjustHaloPositionForPeriod(opt, ngroup, numingroup, pdata);
 
@@ -4726,38 +4817,6 @@ Int_t *GetParentID(Int_t ngroups)
 //@}
 
 
-///\name functions used to find root of concentration
-//@{
-double mycNFW(double c, void *params)
-{
-  double *p = (double*) params;
-  Double_t VmaxVvir2=*p;
-  return (VmaxVvir2) -0.216*c/(log(1.0+c)-c/(1.0+c));
-}
-double mycNFW_deriv(double c, void *params)
-{
-  double *p = (double*) params;
-  Double_t VvirVmax2=*p;
-  return 0.216*c/pow((1.0+c),2.0);
-}
-double mycNFW_fdf(double c, void *params, double *y, double *dy)
-{
-  double *p = (double*) params;
-  Double_t VmaxVvir2=*p;
-  Double_t conec=c/(1.0+c);
-  *y=(VmaxVvir2)-0.216*c/(log(1.0+c)-conec);
-  *dy=0.216*conec*conec/c;
-}
-
-double mycNFWRhalf(double c, void *params)
-{
-  double *p = (double*) params;
-  Double_t RhalfRvir=*p;
-  Double_t a = c*RhalfRvir;
-  return (log(1.0+a)-a/(1.0+a))-0.5*(log(1.0+c)-c/(1.0+c));
-}
-//@}
-
 ///\name Simple cosmology related functions
 //@{
 void CalcOmegak(Options &opt) {
@@ -4835,103 +4894,48 @@ inline Double_t GetApertureRadiusInterpolation(const Double_t &oldrc, const Doub
     return (EncMass-refmass)*(rc-oldrc)/(mass)+oldrc;
 }
 
-template<typename T> inline void SetApertureExtraPropertiesInternalProp(
-    vector<string> &names, vector<int> &functions, vector<string> &outnames,
-    map<string, float> &data, Int_t norm,
-    T &aperture_properties
-)
-{
-    for (auto iextra=0;iextra<names.size();iextra++) {
-        auto field = names[iextra];
-        if (functions[iextra] == CALCQUANTITYAPERTUREAVERAGE && norm>0) data[field] /= float(norm);
-        aperture_properties.SetInternalProperties(outnames[iextra], data[field]);
-    }
-}
-template<typename T> inline void SetApertureExtraPropertiesChemistry(
-    vector<string> &names, vector<int> &functions, vector<string> &outnames,
-    map<string, float> &data, Int_t norm,
-    T &aperture_properties
-)
+///store the value of a slot of an extra property plan
+template<typename T> inline void SetExtraPropertiesSlot(const ExtraPropPlan &plan, int islot, double value, T &prop)
 {
-    for (auto iextra=0;iextra<names.size();iextra++) {
-        auto field = names[iextra];
-        if (functions[iextra] == CALCQUANTITYAPERTUREAVERAGE && norm>0) data[field] /= float(norm);
-        aperture_properties.SetChemistry(outnames[iextra], data[field]);
-    }
+    if (islot<plan.ninternal) prop.SetInternalProperties(plan.outnames[islot], value);
+    else if (islot<plan.ninternal+plan.nchem) prop.SetChemistry(plan.outnames[islot], value);
+    else prop.SetChemistryProduction(plan.outnames[islot], value);
 }
-template<typename T> inline void SetApertureExtraPropertiesChemistryProduction(
-    vector<string> &names, vector<int> &functions, vector<string> &outnames,
-    map<string, float> &data, Int_t norm,
-    T &aperture_properties
-)
+inline void SetExtraPropertiesSlot(const ExtraPropPlan &plan, int islot, double value, ExtraDMProperties &prop)
 {
-    for (auto iextra=0;iextra<names.size();iextra++) {
-        auto field = names[iextra];
-        if (functions[iextra] == CALCQUANTITYAPERTUREAVERAGE && norm>0) data[field] /= float(norm);
-        aperture_properties.SetChemistryProduction(outnames[iextra], data[field]);
-    }
+    prop.SetExtraProperties(plan.outnames[islot], value);
 }
+
+///store the running aperture sums of each slot, averaging where requested
 template<typename T> inline void SetApertureExtraProperties(bool &calc,
-    vector<string> &names1, vector<string> &names2, vector<string> &names3,
-    vector<int> &functions1, vector<int> &functions2, vector<int> &functions3,
-    vector<string> &outnames1, vector<string> &outnames2, vector<string> &outnames3,
-    map<string, float> &data, Int_t norm,
+    const ExtraPropPlan &plan, vector<float> &data, Int_t norm,
     T &aperture_properties
 )
 {
     if (!calc) return;
-    SetApertureExtraPropertiesInternalProp(names1, functions1, outnames1, data, norm, aperture_properties);
-    SetApertureExtraPropertiesChemistry(names2, functions2, outnames2, data, norm, aperture_properties);
-    SetApertureExtraPropertiesChemistryProduction(names3, functions3, outnames3, data, norm, aperture_properties);
-}
-
-inline void SetApertureExtraProperties(bool &calc,
-    vector<string> &names, vector<int> &functions, vector<string> &outnames,
-    map<string, float> &data, Int_t norm,
-    ExtraDMProperties &aperture_properties
-)
-{
-    if (!calc) return;
-    for (auto iextra=0;iextra<names.size();iextra++) {
-        auto field = names[iextra];
-        if (functions[iextra] == CALCQUANTITYAPERTUREAVERAGE && norm>0) data[field] /= float(norm);
-        aperture_properties.SetExtraProperties(outnames[iextra], data[field]);
-    }
-}
-
-template<typename T> inline void AddToApertureExtraProperties(vector<string> &names1,
-    vector<string> &names2, vector<string> &names3,
-    map<string, float> &data,
-    T &localprop, float w = 1.0
-)
-{
-    for (auto &field:names1) data[field] += localprop.GetInternalProperties(field);
-    for (auto &field:names2) data[field] += localprop.GetChemistry(field);
-    for (auto &field:names3) data[field] += localprop.GetChemistryProduction(field);
-}
-inline void AddToApertureExtraProperties(vector<string> &names1,
-    map<string, float> &data,
-    ExtraDMProperties &localprop, float w = 1.0
-)
-{
-    for (auto &field:names1) data[field] += localprop.GetExtraProperties(field);
+    float value;
+    for (auto islot=0;islot<plan.size();islot++) {
+        value = data[islot];
+        if (plan.functions[islot] == CALCQUANTITYAPERTUREAVERAGE && norm>0) value /= float(norm);
+        SetExtraPropertiesSlot(plan, islot, value, aperture_properties);
+    }
 }
 
-inline void InitApertureExtraProperties(bool &calc,
-    vector<string> &names1,vector<string> &names2,vector<string> &names3,
-    map<string, float> &data)
+///add the extra properties of a particle to the running aperture sums of each slot
+template<typename T> inline void AddToApertureExtraProperties(const ExtraPropPlan &plan,
+    vector<float> &data, T &localprop
+)
 {
-    if (!calc) return;
-    for (auto &s:names1) data[s]=0;
-    for (auto &s:names2) data[s]=0;
-    for (auto &s:names3) data[s]=0;
+    auto islot=0;
+    for (;islot<plan.ninternal;islot++) data[islot] += localprop.GetInternalProperties(plan.fields[islot]);
+    for (;islot<plan.ninternal+plan.nchem;islot++) data[islot] += localprop.GetChemistry(plan.fields[islot]);
+    for (;islot<plan.size();islot++) data[islot] += localprop.GetChemistryProduction(plan.fields[islot]);
 }
-inline void InitApertureExtraProperties(bool &calc,
-    vector<string> &names1,
-    map<string, float> &data)
+inline void AddToApertureExtraProperties(const ExtraPropPlan &plan,
+    vector<float> &data, ExtraDMProperties &localprop
+)
 {
-    if (!calc) return;
-    for (auto &s:names1) data[s]=0;
+    for (auto islot=0;islot<plan.size();islot++) data[islot] += localprop.GetExtraProperties(plan.fields[islot]);
 }
 
 
@@ -4951,42 +4955,16 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
     Coordinate x2;
 
 #ifdef GASON
-    HydroProperties gas;
-    map<string,float> gasdata;
-    InitApertureExtraProperties(opt.gas_extraprop_aperture_calc,
-        opt.gas_internalprop_names_aperture,
-        opt.gas_chem_names_aperture,
-        opt.gas_chemproduction_names_aperture,
-        gasdata
-    );
+    vector<float> gasdata(opt.gas_extraprop_aperture_plan.size(), 0);
 #endif
 #ifdef STARON
-    StarProperties star;
-    map<string,float> stardata;
-    InitApertureExtraProperties(opt.star_extraprop_aperture_calc,
-        opt.star_internalprop_names_aperture,
-        opt.star_chem_names_aperture,
-        opt.star_chemproduction_names_aperture,
-        stardata
-    );
+    vector<float> stardata(opt.star_extraprop_aperture_plan.size(), 0);
 #endif
 #ifdef BHON
-    BHProperties bh;
-    map<string,float> bhdata;
-    InitApertureExtraProperties(opt.bh_extraprop_aperture_calc,
-        opt.bh_internalprop_names_aperture,
-        opt.bh_chem_names_aperture,
-        opt.bh_chemproduction_names_aperture,
-        bhdata
-    );
+    vector<float> bhdata(opt.bh_extraprop_aperture_plan.size(), 0);
 #endif
 #ifdef EXTRADMON
-    ExtraDMProperties extradm;
-    map<string,float> extradmdata;
-    InitApertureExtraProperties(opt.extra_dm_extraprop_aperture_calc,
-        opt.extra_dm_internalprop_names_aperture,
-        extradmdata
-    );
+    vector<float> extradmdata(opt.extra_dm_extraprop_aperture_plan.size(), 0);
 #endif
 
     struct projectedmass {
@@ -5040,16 +5018,7 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
             if (EncMassGasNSF>0) pdata.aperture_vrdisp_gas_nsf[iaptindex]=EncVRDispGasNSF/EncMassGasNSF;
 #endif
             SetApertureExtraProperties(opt.gas_extraprop_aperture_calc,
-                opt.gas_internalprop_names_aperture,
-                opt.gas_chem_names_aperture,
-                opt.gas_chemproduction_names_aperture,
-                opt.gas_internalprop_function_aperture,
-                opt.gas_chem_function_aperture,
-                opt.gas_chemproduction_function_aperture,
-                opt.gas_internalprop_output_names_aperture,
-                opt.gas_chem_output_names_aperture,
-                opt.gas_chemproduction_output_names_aperture,
-                gasdata, NinsideGas, pdata.aperture_properties_gas[iaptindex]);
+                opt.gas_extraprop_aperture_plan, gasdata, NinsideGas, pdata.aperture_properties_gas[iaptindex]);
 #endif
 #ifdef STARON
             pdata.aperture_npart_star[iaptindex]=NinsideStar;
@@ -5058,31 +5027,13 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
             if (EncMassStar>0) pdata.aperture_veldisp_star[iaptindex]=EncVelDispStar/EncMassStar;
             if (EncMassStar>0) pdata.aperture_vrdisp_star[iaptindex]=EncVRDispStar/EncMassStar;
             SetApertureExtraProperties(opt.star_extraprop_aperture_calc,
-                opt.star_internalprop_names_aperture,
-                opt.star_chem_names_aperture,
-                opt.star_chemproduction_names_aperture,
-                opt.star_internalprop_function_aperture,
-                opt.star_chem_function_aperture,
-                opt.star_chemproduction_function_aperture,
-                opt.star_internalprop_output_names_aperture,
-                opt.star_chem_output_names_aperture,
-                opt.star_chemproduction_output_names_aperture,
-                stardata, NinsideStar, pdata.aperture_properties_star[iaptindex]);
+                opt.star_extraprop_aperture_plan, stardata, NinsideStar, pdata.aperture_properties_star[iaptindex]);
 #endif
 #ifdef BHON
             pdata.aperture_npart_bh[iaptindex]=NinsideBH;
             pdata.aperture_mass_bh[iaptindex]=EncMassBH;
             SetApertureExtraProperties(opt.bh_extraprop_aperture_calc,
-                opt.bh_internalprop_names_aperture,
-                opt.bh_chem_names_aperture,
-                opt.bh_chemproduction_names_aperture,
-                opt.bh_internalprop_function_aperture,
-                opt.bh_chem_function_aperture,
-                opt.bh_chemproduction_function_aperture,
-                opt.bh_internalprop_output_names_aperture,
-                opt.bh_chem_output_names_aperture,
-                opt.bh_chemproduction_output_names_aperture,
-                bhdata, NinsideBH, pdata.aperture_properties_bh[iaptindex]);
+                opt.bh_extraprop_aperture_plan, bhdata, NinsideBH, pdata.aperture_properties_bh[iaptindex]);
 #endif
 #ifdef HIGHRES
             pdata.aperture_npart_interloper[iaptindex]=NinsideInterloper;
@@ -5090,10 +5041,7 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
 #endif
 #ifdef EXTRADMON
             SetApertureExtraProperties(opt.extra_dm_extraprop_aperture_calc,
-                opt.extra_dm_internalprop_names_aperture,
-                opt.extra_dm_internalprop_function_aperture,
-                opt.extra_dm_internalprop_output_names_aperture,
-                extradmdata, NinsideDM, pdata.aperture_properties_extra_dm[iaptindex]);
+                opt.extra_dm_extraprop_aperture_plan, extradmdata, NinsideDM, pdata.aperture_properties_extra_dm[iaptindex]);
 #endif
             iaptindex++;
         }
@@ -5128,12 +5076,8 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
             }
 #endif
             if (opt.gas_extraprop_aperture_calc) {
-                gas = Pval->GetHydroProperties();
-                AddToApertureExtraProperties(
-                    opt.gas_internalprop_names_aperture,
-                    opt.gas_chem_names_aperture,
-                    opt.gas_chemproduction_names_aperture,
-                    gasdata, gas);
+                AddToApertureExtraProperties(opt.gas_extraprop_aperture_plan,
+                    gasdata, Pval->GetHydroProperties());
             }
         }
 #endif
@@ -5145,12 +5089,8 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
             EncVRDispStar += vrdisp;
             EncZmetStar += Zmet;
             if (opt.star_extraprop_aperture_calc) {
-                star = Pval->GetStarProperties();
-                AddToApertureExtraProperties(
-                    opt.star_internalprop_names_aperture,
-                    opt.star_chem_names_aperture,
-                    opt.star_chemproduction_names_aperture,
-                    stardata, star);
+                AddToApertureExtraProperties(opt.star_extraprop_aperture_plan,
+                    stardata, Pval->GetStarProperties());
             }
         }
 #endif
@@ -5168,20 +5108,15 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
             EncVelDispBH += veldisp;
             EncVRDispBH += vrdisp;
             if (opt.bh_extraprop_aperture_calc) {
-                bh = Pval->GetBHProperties();
-                AddToApertureExtraProperties(
-                    opt.bh_internalprop_names_aperture,
-                    opt.bh_chem_names_aperture,
-                    opt.bh_chemproduction_names_aperture,
-                    bhdata, bh);
+                AddToApertureExtraProperties(opt.bh_extraprop_aperture_plan,
+                    bhdata, Pval->GetBHProperties());
             }
         }
 #endif
 #ifdef EXTRADMON
         if (opt.extra_dm_extraprop_aperture_calc) {
-            extradm = Pval->GetExtraDMProperties();
-            AddToApertureExtraProperties(opt.extra_dm_internalprop_names_aperture,
-                extradmdata, extradm);
+            AddToApertureExtraProperties(opt.extra_dm_extraprop_aperture_plan,
+                extradmdata, Pval->GetExtraDMProperties());
         }
 #endif
     }
@@ -5214,16 +5149,7 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
         if (EncMassGasNSF>0) pdata.aperture_Z_gas_nsf[j]=EncZmetGasNSF/EncMassGasNSF;
 #endif
         SetApertureExtraProperties(opt.gas_extraprop_aperture_calc,
-            opt.gas_internalprop_names_aperture,
-            opt.gas_chem_names_aperture,
-            opt.gas_chemproduction_names_aperture,
-            opt.gas_internalprop_function_aperture,
-            opt.gas_chem_function_aperture,
-            opt.gas_chemproduction_function_aperture,
-            opt.gas_internalprop_output_names_aperture,
-            opt.gas_chem_output_names_aperture,
-            opt.gas_chemproduction_output_names_aperture,
-            gasdata, NinsideGas, pdata.aperture_properties_gas[j]);
+            opt.gas_extraprop_aperture_plan, gasdata, NinsideGas, pdata.aperture_properties_gas[j]);
 #endif
 #ifdef STARON
         pdata.aperture_npart_star[j]=NinsideStar;
@@ -5232,31 +5158,13 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
         if (EncMassStar>0) pdata.aperture_vrdisp_star[j]=EncVRDispStar/EncMassStar;
         if (EncMassStar>0) pdata.aperture_Z_star[j]=EncZmetStar/EncMassStar;
         SetApertureExtraProperties(opt.star_extraprop_aperture_calc,
-            opt.star_internalprop_names_aperture,
-            opt.star_chem_names_aperture,
-            opt.star_chemproduction_names_aperture,
-            opt.star_internalprop_function_aperture,
-            opt.star_chem_function_aperture,
-            opt.star_chemproduction_function_aperture,
-            opt.star_internalprop_output_names_aperture,
-            opt.star_chem_output_names_aperture,
-            opt.star_chemproduction_output_names_aperture,
-            stardata, NinsideStar, pdata.aperture_properties_star[j]);
+            opt.star_extraprop_aperture_plan, stardata, NinsideStar, pdata.aperture_properties_star[j]);
 #endif
 #ifdef BHON
         pdata.aperture_npart_bh[j]=NinsideBH;
         pdata.aperture_mass_bh[j]=EncMassBH;
         SetApertureExtraProperties(opt.bh_extraprop_aperture_calc,
-            opt.bh_internalprop_names_aperture,
-            opt.bh_chem_names_aperture,
-            opt.bh_chemproduction_names_aperture,
-            opt.bh_internalprop_function_aperture,
-            opt.bh_chem_function_aperture,
-            opt.bh_chemproduction_function_aperture,
-            opt.bh_internalprop_output_names_aperture,
-            opt.bh_chem_output_names_aperture,
-            opt.bh_chemproduction_output_names_aperture,
-            bhdata, NinsideBH, pdata.aperture_properties_bh[j]);
+            opt.bh_extraprop_aperture_plan, bhdata, NinsideBH, pdata.aperture_properties_bh[j]);
 #endif
 #ifdef HIGHRES
         pdata.aperture_npart_interloper[j]=NinsideInterloper;
@@ -5264,10 +5172,7 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
 #endif
 #ifdef EXTRADMON
         SetApertureExtraProperties(opt.extra_dm_extraprop_aperture_calc,
-            opt.extra_dm_internalprop_names_aperture,
-            opt.extra_dm_internalprop_function_aperture,
-            opt.extra_dm_internalprop_output_names_aperture,
-            extradmdata, NinsideDM, pdata.aperture_properties_extra_dm[j]);
+            opt.extra_dm_extraprop_aperture_plan, extradmdata, NinsideDM, pdata.aperture_properties_extra_dm[j]);
 #endif
     }
 
@@ -5380,8 +5285,57 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
     }
 
     //now move on to projected radii
-    //fill projectedmass structure, sort
+    //rather than sorting the particles along each projection, bin them into the annuli between
+    //projected apertures, which gives the enclosed quantities in one pass, and only sort the
+    //annuli in which half mass radii lie
     if (opt.apertureprojnum>0) {
+    //components for which projected aperture masses and half mass radii are calculated
+    enum {PROJALL, PROJGAS, PROJGASSF, PROJGASNSF, PROJSTAR, PROJNCOMP};
+    vector<Coordinate> *projmass[PROJNCOMP]={NULL}, *projrhalf[PROJNCOMP]={NULL}, *projZ[PROJNCOMP]={NULL};
+    projmass[PROJALL]=&pdata.aperture_mass_proj;
+    projrhalf[PROJALL]=&pdata.aperture_rhalfmass_proj;
+#ifdef GASON
+    projmass[PROJGAS]=&pdata.aperture_mass_proj_gas;
+    projrhalf[PROJGAS]=&pdata.aperture_rhalfmass_proj_gas;
+#ifdef STARON
+    projZ[PROJGAS]=&pdata.aperture_Z_proj_gas;
+    projmass[PROJGASSF]=&pdata.aperture_mass_proj_gas_sf;
+    projrhalf[PROJGASSF]=&pdata.aperture_rhalfmass_proj_gas_sf;
+    projZ[PROJGASSF]=&pdata.aperture_Z_proj_gas_sf;
+    projmass[PROJGASNSF]=&pdata.aperture_mass_proj_gas_nsf;
+    projrhalf[PROJGASNSF]=&pdata.aperture_rhalfmass_proj_gas_nsf;
+    projZ[PROJGASNSF]=&pdata.aperture_Z_proj_gas_nsf;
+#endif
+#endif
+#ifdef STARON
+    projmass[PROJSTAR]=&pdata.aperture_mass_proj_star;
+    projrhalf[PROJSTAR]=&pdata.aperture_rhalfmass_proj_star;
+    projZ[PROJSTAR]=&pdata.aperture_Z_proj_star;
+#endif
+    auto inprojcomp = [&opt](const projectedmass &p, int c) {
+        switch (c) {
+            case PROJALL: return true;
+#ifdef GASON
+            case PROJGAS: return (p.type==GASTYPE);
+#ifdef STARON
+            case PROJGASSF: return (p.type==GASTYPE && p.SFR>opt.gas_sfr_threshold);
+            case PROJGASNSF: return (p.type==GASTYPE && p.SFR<=opt.gas_sfr_threshold);
+#endif
+#endif
+#ifdef STARON
+            case PROJSTAR: return (p.type==STARTYPE);
+#endif
+        }
+        return false;
+    };
+    //annulus b holds particles with aperture radius b-1 <= rproj < aperture radius b, the last
+    //holding those outside all apertures
+    int napt=opt.apertureprojnum, nannuli=napt+1, b;
+    vector<int> iannulus(ning);
+    vector<Int_t> annulusstart(nannuli+1), annulusoffset, order(ning);
+    vector<Double_t> annulusmass(nannuli*PROJNCOMP), annulusrmax(nannuli*PROJNCOMP), annulusZ(nannuli*PROJNCOMP), annulusSFR(nannuli);
+    vector<bool> iannulussorted(nannuli);
+    Double_t target;
     for (auto j=0;j<ning;j++) {
         Pval=&Part[j];
 #ifndef NOMASS
@@ -5392,201 +5346,93 @@ void CalculateApertureQuantities(Options &opt, Int_t &ning, Particle *Part, Prop
         proj[j].type = Pval->GetType();
 #if defined(GASON) && defined(STARON)
         proj[j].SFR = Pval->GetSFR();
-        proj[j].Zmet = Pval->GetZmet()*mass;
+        proj[j].Zmet = Pval->GetZmet()*proj[j].mass;
 #endif
         for (auto k=0;k<3;k++) {x2[k]=Pval->GetPosition(k);x2[k]=x2[k]*x2[k];}
         proj[j].rproj[0]=sqrt(x2[0]+x2[1]);proj[j].rproj[1]=sqrt(x2[0]+x2[2]);proj[j].rproj[2]=sqrt(x2[1]+x2[2]);
     }
     //go through each projection
     for (auto k=0;k<3;k++) {
-        if (k==0) {
-            sort(proj.begin(), proj.end(), [](projectedmass &a, projectedmass &b){
-            return a.rproj[0] < b.rproj[0];
-            });
-
-        }
-        if (k==1) {
-            sort(proj.begin(), proj.end(), [](projectedmass &a, projectedmass &b){
-            return a.rproj[1] < b.rproj[1];
-            });
-        }
-        if (k==2) {
-            sort(proj.begin(), proj.end(), [](projectedmass &a, projectedmass &b){
-            return a.rproj[2] < b.rproj[2];
-            });
-        }
-        iaptindex=0;
-        EncMass=EncMassGas=EncMassGasSF=EncMassGasNSF=EncMassStar=EncMassBH=EncMassInterloper=0;
-        EncSFR=EncZmetGas=EncZmetGasSF=EncZmetGasNSF=EncZmetStar=0;
+        fill(annulusstart.begin(), annulusstart.end(), 0);
+        fill(annulusmass.begin(), annulusmass.end(), 0);
+        fill(annulusrmax.begin(), annulusrmax.end(), 0);
+        fill(annulusZ.begin(), annulusZ.end(), 0);
+        fill(annulusSFR.begin(), annulusSFR.end(), 0);
+        fill(iannulussorted.begin(), iannulussorted.end(), false);
         for (auto j=0;j<ning;j++) {
             rc=proj[j].rproj[k];
-            mass = proj[j].mass;
-            type = proj[j].type;
+            b=upper_bound(opt.aperture_proj_values_kpc.begin(), opt.aperture_proj_values_kpc.end(), rc)-opt.aperture_proj_values_kpc.begin();
+            iannulus[j]=b;
+            annulusstart[b+1]++;
+            for (auto c=0;c<PROJNCOMP;c++) {
+                if (projmass[c]==NULL || !inprojcomp(proj[j],c)) continue;
+                annulusmass[b*PROJNCOMP+c]+=proj[j].mass;
+                annulusrmax[b*PROJNCOMP+c]=max(annulusrmax[b*PROJNCOMP+c],rc);
 #if defined(GASON) && defined(STARON)
-            SFR = proj[j].SFR;
-            Zmet = proj[j].Zmet;
-#endif
-            if (rc>=opt.aperture_proj_values_kpc[iaptindex]) {
-                pdata.aperture_mass_proj[iaptindex][k]=EncMass;
-#ifdef GASON
-                pdata.aperture_mass_proj_gas[iaptindex][k]=EncMassGas;
-#ifdef STARON
-                pdata.aperture_SFR_proj_gas[iaptindex][k]=EncSFR;
-                pdata.aperture_Z_proj_gas[iaptindex][k]=EncZmetGas;
-                pdata.aperture_mass_proj_gas_sf[iaptindex][k]=EncMassGasSF;
-                pdata.aperture_mass_proj_gas_nsf[iaptindex][k]=EncMassGasNSF;
-                pdata.aperture_Z_proj_gas_sf[iaptindex][k]=EncZmetGasSF;
-                pdata.aperture_Z_proj_gas_nsf[iaptindex][k]=EncZmetGasNSF;
-#endif
-#endif
-#ifdef STARON
-                pdata.aperture_mass_proj_star[iaptindex][k]=EncMassStar;
-                pdata.aperture_Z_proj_star[iaptindex][k]=EncZmetStar;
-#endif
-                iaptindex++;
-            }
-            if (iaptindex==opt.apertureprojnum) break;
-            EncMass+=mass;
-#ifdef GASON
-            if (type==GASTYPE) {
-                EncMassGas+=mass;
-#ifdef STARON
-                EncSFR+=SFR;
-                EncZmetGas += Zmet;
-                if (SFR>opt.gas_sfr_threshold) {
-                    EncMassGasSF+=mass;
-                    EncZmetGasSF += Zmet;
-                }
-                else {
-                    EncMassGasNSF+=mass;
-                    EncZmetGasNSF += Zmet;
-                }
-#endif
-            }
+                annulusZ[b*PROJNCOMP+c]+=proj[j].Zmet;
 #endif
-#ifdef STARON
-            if (type==STARTYPE) {
-                EncMassStar+=mass;
-                EncZmetStar += Zmet;
             }
-#endif
-#ifdef BHON
-            if (type==BHTYPE) EncMassBH+=mass;
+#if defined(GASON) && defined(STARON)
+            if (proj[j].type==GASTYPE) annulusSFR[b]+=proj[j].SFR;
 #endif
         }
-        for (auto j=0;j<opt.apertureprojnum;j++)
-        {
-            if (pdata.aperture_mass_proj[j][k]==-1) pdata.aperture_mass_proj[j][k]=EncMass;
-#ifdef GASON
-            if (pdata.aperture_mass_proj_gas[j][k]==-1) {
-                pdata.aperture_mass_proj_gas[j][k]=EncMassGas;
-#ifdef STARON
-                pdata.aperture_SFR_proj_gas[j][k]=EncSFR;
-                pdata.aperture_Z_proj_gas[j][k]=EncZmetGas;
-#endif
-            }
-#ifdef STARON
-            if (pdata.aperture_mass_proj_gas_sf[j][k]==-1) {
-                pdata.aperture_mass_proj_gas_sf[j][k]=EncMassGasSF;
-                pdata.aperture_Z_proj_gas_sf[j][k]=EncZmetGasSF;
-            }
-            if (pdata.aperture_mass_proj_gas_nsf[j][k]==-1) {
-                pdata.aperture_mass_proj_gas_nsf[j][k]=EncMassGasNSF;
-                pdata.aperture_Z_proj_gas_nsf[j][k]=EncZmetGasNSF;
-            }
-#endif
-#endif
-#ifdef STARON
-            if (pdata.aperture_mass_proj_star[j][k]==-1) {
-                pdata.aperture_mass_proj_star[j][k]=EncMassStar;
-                pdata.aperture_Z_proj_star[j][k]=EncZmetStar;
+        //enclosed quantities are cumulative over annuli, as is the largest radius of each component
+        for (b=1;b<nannuli;b++) {
+            for (auto c=0;c<PROJNCOMP;c++) {
+                annulusmass[b*PROJNCOMP+c]+=annulusmass[(b-1)*PROJNCOMP+c];
+                annulusrmax[b*PROJNCOMP+c]=max(annulusrmax[b*PROJNCOMP+c],annulusrmax[(b-1)*PROJNCOMP+c]);
+                annulusZ[b*PROJNCOMP+c]+=annulusZ[(b-1)*PROJNCOMP+c];
             }
-#endif
+            annulusSFR[b]+=annulusSFR[b-1];
         }
-        //then determine half mass radii
-        EncMass=EncMassGas=EncMassGasSF=EncMassGasNSF=EncMassStar=EncMassBH=EncMassInterloper=0;
-        numapttotal=0;
-        numapttotal+=opt.apertureprojnum;
-#ifdef GASON
-        numapttotal+=opt.apertureprojnum;
-#ifdef STARON
-        numapttotal+=opt.apertureprojnum;
-        numapttotal+=opt.apertureprojnum;
-#endif
-#endif
-#ifdef STARON
-        numapttotal+=opt.aperturenum;
-#endif
-        iaptindex=0;
-        oldrc=oldrc_gas=oldrc_gas_sf=oldrc_gas_nsf=oldrc_star=oldrc_bh=0;
-        for (auto j=0;j<ning;j++) {
-            rc=proj[j].rproj[k];
-            mass = proj[j].mass;
-            type = proj[j].type;
-#if defined(GASON) && defined(STARON)
-            SFR = proj[j].SFR;
-#endif
-            EncMass+=mass;
-#ifdef GASON
-            if (type==GASTYPE) {
-                EncMassGas+=mass;
-#ifdef STARON
-                if (SFR>opt.gas_sfr_threshold) EncMassGasSF+=mass;
-                else EncMassGasNSF+=mass;
-#endif
+        for (auto i=0;i<napt;i++) {
+            for (auto c=0;c<PROJNCOMP;c++) {
+                if (projmass[c]!=NULL) (*projmass[c])[i][k]=annulusmass[i*PROJNCOMP+c];
+                if (projZ[c]!=NULL) (*projZ[c])[i][k]=annulusZ[i*PROJNCOMP+c];
             }
-#endif
-#ifdef STARON
-            if (type==STARTYPE) EncMassStar+=mass;
-#endif
-#ifdef BHON
-            if (type==BHTYPE) EncMassBH+=mass;
-#endif
-            for (auto i=0;i<opt.apertureprojnum;i++) {
-                if (EncMass>=0.5*pdata.aperture_mass_proj[i][k] && pdata.aperture_rhalfmass_proj[i][k]==-1) {
-                    pdata.aperture_rhalfmass_proj[i][k]=GetApertureRadiusInterpolation(oldrc, rc, EncMass, mass, 0.5*pdata.aperture_mass_proj[i][k]);//oldrc;
-                    iaptindex++;
-                }
-#ifdef GASON
-                if (EncMassGas>=0.5*pdata.aperture_mass_proj_gas[k][i] && pdata.aperture_rhalfmass_proj_gas[i][k]==-1) {
-                    pdata.aperture_rhalfmass_proj_gas[i][k]=GetApertureRadiusInterpolation(oldrc_gas, rc, EncMassGas, mass, 0.5*pdata.aperture_mass_proj_gas[i][k]);//oldrc_gas;
-                    iaptindex++;
-                }
-#ifdef STARON
-                if (EncMassGasSF>=0.5*pdata.aperture_mass_proj_gas_sf[i][k] && pdata.aperture_rhalfmass_proj_gas_sf[i][k]==-1) {
-                    pdata.aperture_rhalfmass_proj_gas_sf[i][k]=GetApertureRadiusInterpolation(oldrc_gas_sf, rc, EncMassGasSF, mass, 0.5*pdata.aperture_mass_proj_gas_sf[i][k]);//oldrc_gas_sf;
-                    iaptindex++;
+#if defined(GASON) && defined(STARON)
+            pdata.aperture_SFR_proj_gas[i][k]=annulusSFR[i];
+#endif
+        }
+
+        //then determine half mass radii, grouping particles by annulus and sorting
+        //only those annuli where half the mass of an aperture is reached
+        for (b=0;b<nannuli;b++) annulusstart[b+1]+=annulusstart[b];
+        annulusoffset.assign(annulusstart.begin(), annulusstart.end()-1);
+        for (auto j=0;j<ning;j++) order[annulusoffset[iannulus[j]]++]=j;
+        for (auto i=0;i<napt;i++) {
+            for (auto c=0;c<PROJNCOMP;c++) {
+                if (projrhalf[c]==NULL) continue;
+                target=0.5*(*projmass[c])[i][k];
+                if (target<=0) {
+                    (*projrhalf[c])[i][k]=0;
+                    continue;
                 }
-                if (EncMassGasNSF>=0.5*pdata.aperture_mass_proj_gas_nsf[i][k] && pdata.aperture_rhalfmass_proj_gas_nsf[i][k]==-1) {
-                    pdata.aperture_rhalfmass_proj_gas_nsf[i][k]=GetApertureRadiusInterpolation(oldrc_gas_nsf, rc, EncMassGasNSF, mass, 0.5*pdata.aperture_mass_proj_gas_nsf[i][k]);//oldrc_gas_nsf;
-                    iaptindex++;
+                b=0;
+                while (b<i && annulusmass[b*PROJNCOMP+c]<target) b++;
+                if (!iannulussorted[b]) {
+                    sort(order.begin()+annulusstart[b], order.begin()+annulusstart[b+1], [&proj,k](Int_t a1, Int_t a2){
+                        return proj[a1].rproj[k] < proj[a2].rproj[k];
+                    });
+                    iannulussorted[b]=true;
                 }
-#endif
-#endif
-#ifdef STARON
-                if (EncMassStar>=0.5*pdata.aperture_mass_proj_star[i][k] && pdata.aperture_rhalfmass_proj_star[i][k]==-1) {
-                    pdata.aperture_rhalfmass_proj_star[i][k]=GetApertureRadiusInterpolation(oldrc_star, rc, EncMassStar, mass, 0.5*pdata.aperture_mass_proj_star[i][k]);//oldrc_star;
-                    iaptindex++;
+                EncMass=(b>0)?annulusmass[(b-1)*PROJNCOMP+c]:0;
+                oldrc=(b>0)?annulusrmax[(b-1)*PROJNCOMP+c]:0;
+                (*projrhalf[c])[i][k]=-1;
+                for (auto jj=annulusstart[b];jj<annulusstart[b+1];jj++) {
+                    auto &p=proj[order[jj]];
+                    if (!inprojcomp(p,c)) continue;
+                    rc=p.rproj[k];
+                    EncMass+=p.mass;
+                    if (EncMass>=target) {
+                        (*projrhalf[c])[i][k]=GetApertureRadiusInterpolation(oldrc, rc, EncMass, p.mass, target);
+                        break;
+                    }
+                    oldrc=rc;
                 }
-#endif
-            }
-            if (iaptindex==numapttotal) break;
-            oldrc=rc;
-#ifdef GASON
-            if (type==GASTYPE) {
-                oldrc_gas=rc;
-#ifdef STARON
-                if (SFR>opt.gas_sfr_threshold) oldrc_gas_sf=rc;
-                else oldrc_gas_nsf=rc;
-#endif
+                //guard against round-off in the running sum never quite reaching the target
+                if ((*projrhalf[c])[i][k]==-1) (*projrhalf[c])[i][k]=oldrc;
             }
-#endif
-#ifdef STARON
-            if (type==STARTYPE) oldrc_star=rc;
-#endif
-#ifdef BHON
-            if (type==BHTYPE) oldrc_bh=rc;
-#endif
         }
     }
     }
@@ -5682,6 +5528,135 @@ void AddParticleToRadialBin(Options &opt, Particle *Pval, Double_t irnorm, int &
 #endif
 }
 
+///Get the radial bin of a normalised radius, -1 if outside the last bin edge. If log bin edges are
+///evenly spaced the bin is calculated directly and only corrected for round-off at the edges,
+///otherwise the edges are searched.
+inline int GetRadialBinOfRadius(Options &opt, Double_t rc)
+{
+    const Double_t *edges = opt.profile_bin_edges.data();
+    const int nbins = opt.profile_bin_edges.size();
+    if (rc > edges[nbins-1]) return -1;
+    if (!opt.iprofilelogbinuniform) return (int)(lower_bound(edges, edges+nbins, rc)-edges);
+    int ib = (rc > 0) ? max(0, (int)ceil((log10(rc)-opt.profilelogedgemin)*opt.profileilogbinwidth)) : 0;
+    ib = min(ib, nbins-1);
+    while (ib > 0 && rc <= edges[ib-1]) ib--;
+    while (rc > edges[ib]) ib++;
+    return ib;
+}
+
+///Get the radial bin of each particle, -1 if outside the last bin edge. If iparallel, must be called
+///by all threads of a parallel region, which share the particles.
+void GetRadialBins(Options &opt, const Int_t n, Particle *Part, Double_t irnorm, vector<int> &ibins, bool iparallel)
+{
+    if (!iparallel) {
+        ibins.resize(n);
+        for (Int_t j=0;j<n;j++) ibins[j] = GetRadialBinOfRadius(opt, Part[j].Radius()*irnorm);
+        return;
+    }
+#ifdef USEOPENMP
+    #pragma omp single
+    ibins.resize(n);
+    #pragma omp for schedule(static)
+    for (Int_t j=0;j<n;j++) ibins[j] = GetRadialBinOfRadius(opt, Part[j].Radius()*irnorm);
+#endif
+}
+
+///\name Radial profile histograms, one block of bins per profile
+//@{
+enum {PROFALL, PROFGAS, PROFGASSF, PROFGASNSF, PROFSTAR, PROFNUM};
+inline void AddParticleToRadialHist(Options &opt, Particle &p, int ib, int nbins,
+    vector<Double_t> &mass, vector<unsigned int> &npart)
+{
+#ifndef NOMASS
+    Double_t massval = p.GetMass();
+#else
+    Double_t massval = opt.MassValue;
+#endif
+    mass[PROFALL*nbins+ib] += massval;
+    npart[PROFALL*nbins+ib] += 1;
+#ifdef GASON
+    if (p.GetType()==GASTYPE) {
+        mass[PROFGAS*nbins+ib] += massval;
+        npart[PROFGAS*nbins+ib] += 1;
+#ifdef STARON
+        if (p.GetSFR()>opt.gas_sfr_threshold) {
+            mass[PROFGASSF*nbins+ib] += massval;
+            npart[PROFGASSF*nbins+ib] += 1;
+        }
+        else {
+            mass[PROFGASNSF*nbins+ib] += massval;
+            npart[PROFGASNSF*nbins+ib] += 1;
+        }
+#endif
+    }
+#endif
+#ifdef STARON
+    if (p.GetType()==STARTYPE) {
+        mass[PROFSTAR*nbins+ib] += massval;
+        npart[PROFSTAR*nbins+ib] += 1;
+    }
+#endif
+}
+inline void AddRadialHistToProfile(int nbins, vector<Double_t> &mass, vector<unsigned int> &npart, PropData &pdata)
+{
+    for (auto ib=0;ib<nbins;ib++) {
+        pdata.profile_mass[ib] += mass[PROFALL*nbins+ib];
+        pdata.profile_npart[ib] += npart[PROFALL*nbins+ib];
+#ifdef GASON
+        pdata.profile_mass_gas[ib] += mass[PROFGAS*nbins+ib];
+        pdata.profile_npart_gas[ib] += npart[PROFGAS*nbins+ib];
+#ifdef STARON
+        pdata.profile_mass_gas_sf[ib] += mass[PROFGASSF*nbins+ib];
+        pdata.profile_npart_gas_sf[ib] += npart[PROFGASSF*nbins+ib];
+        pdata.profile_mass_gas_nsf[ib] += mass[PROFGASNSF*nbins+ib];
+        pdata.profile_npart_gas_nsf[ib] += npart[PROFGASNSF*nbins+ib];
+#endif
+#endif
+#ifdef STARON
+        pdata.profile_mass_star[ib] += mass[PROFSTAR*nbins+ib];
+        pdata.profile_npart_star[ib] += npart[PROFSTAR*nbins+ib];
+#endif
+    }
+}
+//@}
+
+///Add the particles of a group to its radial profiles. Bins are calculated for all particles first and
+///then accumulated into local histograms, for large groups one per thread, which are added to the profiles.
+///For large groups both steps are done by the threads of a single parallel region.
+///Unlike \ref AddParticleToRadialBin, particles need not be radially sorted.
+void AddParticlesToRadialBins(Options &opt, const Int_t n, Particle *Part, Double_t irnorm, PropData &pdata)
+{
+    if (pdata.gNFOF < opt.profileminFOFsize || pdata.num < opt.profileminsize) return;
+    const int nbins = opt.profile_bin_edges.size();
+    vector<int> ibins;
+    bool iparallel = false;
+#ifdef USEOPENMP
+    iparallel = (n >= omppropnum && !omp_in_parallel());
+#endif
+    if (!iparallel) {
+        GetRadialBins(opt, n, Part, irnorm, ibins, false);
+        vector<Double_t> mass(PROFNUM*nbins, 0);
+        vector<unsigned int> npart(PROFNUM*nbins, 0);
+        for (Int_t j=0;j<n;j++) if (ibins[j] >= 0) AddParticleToRadialHist(opt, Part[j], ibins[j], nbins, mass, npart);
+        AddRadialHistToProfile(nbins, mass, npart, pdata);
+        return;
+    }
+#ifdef USEOPENMP
+#pragma omp parallel default(shared)
+{
+    GetRadialBins(opt, n, Part, irnorm, ibins, true);
+    vector<Double_t> mass(PROFNUM*nbins, 0);
+    vector<unsigned int> npart(PROFNUM*nbins, 0);
+    #pragma omp for schedule(static) nowait
+    for (Int_t j=0;j<n;j++) if (ibins[j] >= 0) AddParticleToRadialHist(opt, Part[j], ibins[j], nbins, mass, npart);
+    #pragma omp critical
+    {
+        AddRadialHistToProfile(nbins, mass, npart, pdata);
+    }
+}
+#endif
+}
+
 void AddDataToRadialBin(Options &opt, Double_t rval, Double_t massval,
 #if defined(GASON) || defined(STARON) || defined(BHON)
     Double_t sfrval, int typeval,
@@ -5802,25 +5777,32 @@ inline double ExtraPropGetWeight(unsigned int calctype, double weight){
 }
 inline double ExtraPropCalcAverage(double weight, double value, double &result){
     result += value * weight;
+    return result;
 }
 inline double ExtraPropCalcTotal(double weight, double value, double &result){
     result += value * weight;
+    return result;
 }
 inline double ExtraPropCalcSTD(double weight, double value, double &result){
     result += value * value * weight;
+    return result;
 }
 inline double ExtraPropCalcLogAverage(double weight, double value, double &result){
     result += log(value) * weight;
+    return result;
 }
 inline double ExtraPropCalcLogSTD(double weight, double value, double &result){
     value = log(value);
     result += value * value * weight;
+    return result;
 }
 inline double ExtraPropCalcMin(double weight, double value, double &result){
     if (value*weight < result) result = value * weight;
+    return result;
 }
 inline double ExtraPropCalcMax(double weight, double value, double &result){
     if (value*weight > result) result = value * weight;
+    return result;
 }
 inline double ExtraPropNormalizeValue(unsigned int calctype, double value, double norm){
     calctype = calctype % CALCQUANTITYMASSWEIGHT;
@@ -5891,148 +5873,158 @@ inline ExtraPropFunc ExtraPropSetCalc(unsigned int calctype){
     return f;
 }
 
-///Calculate the average mass weighted value of a chemical and how it was produced
-///based on gas particles of an object
-void GetExtraHydroProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pval)
+///append a list of extra property calculations to a plan, resolving paired calculations
+///and accumulation functions into slots
+inline void AddToExtraPropPlan(ExtraPropPlan &plan,
+    vector<string> &names, vector<string> &outnames, vector<int> &functions,
+    vector<int> *paired = NULL)
 {
-#ifdef GASON
-    if (opt.gas_internalprop_names.size() + opt.gas_chem_names.size() + opt.gas_chemproduction_names.size() == 0) return;
-    HydroProperties x;
-    map<string, double> value, weightsum;
-    string extrafield, outputfield, outputfield2;
-    double oldweight, weight, curvalue, result;
-    map<string, ExtraPropFunc> funcs;
-
-    //initialize map stored in the properties data
-    for (auto iextra=0;iextra<opt.gas_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.gas_internalprop_names[iextra];
-        outputfield = opt.gas_internalprop_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.gas_internalprop_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.gas_internalprop_function[iextra]);
-        pdata.hydroprop.SetInternalProperties(outputfield, 0);
-    }
-    for (auto iextra=0;iextra<opt.gas_chem_names.size();iextra++)
-    {
-        extrafield = opt.gas_chem_names[iextra];
-        outputfield = opt.gas_chem_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.gas_chem_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.gas_chem_function[iextra]);
-        pdata.hydroprop.SetChemistry(outputfield, 0);
-    }
-    for (auto iextra=0;iextra<opt.gas_chemproduction_names.size();iextra++)
-    {
-        extrafield = opt.gas_chemproduction_names[iextra];
-        outputfield = opt.gas_chemproduction_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.gas_chemproduction_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.gas_chemproduction_function[iextra]);
-        pdata.hydroprop.SetChemistryProduction(outputfield, 0);
-    }
-    if (pdata.n_gas == 0 ) return;
-    for (auto i=0;i<n;i++)
-    {
-        if (Pval[i].GetType()!=GASTYPE) continue;
-        x = Pval[i].GetHydroProperties();
-        oldweight = Pval[i].GetMass();
-        for (auto iextra=0;iextra<opt.gas_internalprop_names.size();iextra++)
-        {
-            extrafield = opt.gas_internalprop_names[iextra];
-            outputfield = opt.gas_internalprop_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.gas_internalprop_function[iextra], oldweight);
-            curvalue = x.GetInternalProperties(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-        for (auto iextra=0;iextra<opt.gas_chem_names.size();iextra++)
-        {
-            extrafield = opt.gas_chem_names[iextra];
-            outputfield = opt.gas_chem_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.gas_chem_function[iextra], oldweight);
-            curvalue = x.GetChemistry(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-        for (auto iextra=0;iextra<opt.gas_chemproduction_names.size();iextra++)
-        {
-            extrafield = opt.gas_chemproduction_names[iextra];
-            outputfield = opt.gas_chemproduction_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.gas_chemproduction_function[iextra], oldweight);
-            curvalue = x.GetChemistryProduction(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
+    int offset = plan.size();
+    for (auto iextra=0;iextra<names.size();iextra++) {
+        plan.fields.push_back(names[iextra]);
+        plan.outnames.push_back(outnames[iextra]);
+        plan.functions.push_back(functions[iextra]);
+        //aperture calculations are simple sums and are never paired
+        if (paired == NULL) {
+            plan.paired.push_back(offset+iextra);
+            plan.funcs.push_back(NULL);
+        }
+        else {
+            plan.paired.push_back(offset+(*paired)[iextra]);
+            plan.funcs.push_back(ExtraPropSetCalc(functions[iextra]));
         }
     }
+}
 
-    //normalize as necessary
-    for (auto iextra=0;iextra<opt.gas_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.gas_internalprop_names[iextra];
-        outputfield = opt.gas_internalprop_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.gas_internalprop_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.gas_chem_names.size();iextra++)
-    {
-        extrafield = opt.gas_chem_names[iextra];
-        outputfield = opt.gas_chem_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.gas_chem_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.gas_chemproduction_names.size();iextra++)
-    {
-        extrafield = opt.gas_chemproduction_names[iextra];
-        outputfield = opt.gas_chemproduction_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.gas_chemproduction_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
+///Resolve the extra property name lists of each particle type into plans so that accumulating
+///properties over particles does not require looking up functions or running values by name
+void SetExtraPropPlans(Options &opt)
+{
+    opt.gas_extraprop_plan = ExtraPropPlan();
+    AddToExtraPropPlan(opt.gas_extraprop_plan, opt.gas_internalprop_names, opt.gas_internalprop_output_names, opt.gas_internalprop_function, &opt.gas_internalprop_index_paired_calc);
+    opt.gas_extraprop_plan.ninternal = opt.gas_extraprop_plan.size();
+    AddToExtraPropPlan(opt.gas_extraprop_plan, opt.gas_chem_names, opt.gas_chem_output_names, opt.gas_chem_function, &opt.gas_chem_index_paired_calc);
+    opt.gas_extraprop_plan.nchem = opt.gas_extraprop_plan.size() - opt.gas_extraprop_plan.ninternal;
+    AddToExtraPropPlan(opt.gas_extraprop_plan, opt.gas_chemproduction_names, opt.gas_chemproduction_output_names, opt.gas_chemproduction_function, &opt.gas_chemproduction_index_paired_calc);
+
+    opt.star_extraprop_plan = ExtraPropPlan();
+    AddToExtraPropPlan(opt.star_extraprop_plan, opt.star_internalprop_names, opt.star_internalprop_output_names, opt.star_internalprop_function, &opt.star_internalprop_index_paired_calc);
+    opt.star_extraprop_plan.ninternal = opt.star_extraprop_plan.size();
+    AddToExtraPropPlan(opt.star_extraprop_plan, opt.star_chem_names, opt.star_chem_output_names, opt.star_chem_function, &opt.star_chem_index_paired_calc);
+    opt.star_extraprop_plan.nchem = opt.star_extraprop_plan.size() - opt.star_extraprop_plan.ninternal;
+    AddToExtraPropPlan(opt.star_extraprop_plan, opt.star_chemproduction_names, opt.star_chemproduction_output_names, opt.star_chemproduction_function, &opt.star_chemproduction_index_paired_calc);
+
+    opt.bh_extraprop_plan = ExtraPropPlan();
+    AddToExtraPropPlan(opt.bh_extraprop_plan, opt.bh_internalprop_names, opt.bh_internalprop_output_names, opt.bh_internalprop_function, &opt.bh_internalprop_index_paired_calc);
+    opt.bh_extraprop_plan.ninternal = opt.bh_extraprop_plan.size();
+    AddToExtraPropPlan(opt.bh_extraprop_plan, opt.bh_chem_names, opt.bh_chem_output_names, opt.bh_chem_function, &opt.bh_chem_index_paired_calc);
+    opt.bh_extraprop_plan.nchem = opt.bh_extraprop_plan.size() - opt.bh_extraprop_plan.ninternal;
+    AddToExtraPropPlan(opt.bh_extraprop_plan, opt.bh_chemproduction_names, opt.bh_chemproduction_output_names, opt.bh_chemproduction_function, &opt.bh_chemproduction_index_paired_calc);
+
+    opt.extra_dm_extraprop_plan = ExtraPropPlan();
+    AddToExtraPropPlan(opt.extra_dm_extraprop_plan, opt.extra_dm_internalprop_names, opt.extra_dm_internalprop_output_names, opt.extra_dm_internalprop_function, &opt.extra_dm_internalprop_index_paired_calc);
+    opt.extra_dm_extraprop_plan.ninternal = opt.extra_dm_extraprop_plan.size();
+
+    opt.gas_extraprop_aperture_plan = ExtraPropPlan();
+    AddToExtraPropPlan(opt.gas_extraprop_aperture_plan, opt.gas_internalprop_names_aperture, opt.gas_internalprop_output_names_aperture, opt.gas_internalprop_function_aperture);
+    opt.gas_extraprop_aperture_plan.ninternal = opt.gas_extraprop_aperture_plan.size();
+    AddToExtraPropPlan(opt.gas_extraprop_aperture_plan, opt.gas_chem_names_aperture, opt.gas_chem_output_names_aperture, opt.gas_chem_function_aperture);
+    opt.gas_extraprop_aperture_plan.nchem = opt.gas_extraprop_aperture_plan.size() - opt.gas_extraprop_aperture_plan.ninternal;
+    AddToExtraPropPlan(opt.gas_extraprop_aperture_plan, opt.gas_chemproduction_names_aperture, opt.gas_chemproduction_output_names_aperture, opt.gas_chemproduction_function_aperture);
+
+    opt.star_extraprop_aperture_plan = ExtraPropPlan();
+    AddToExtraPropPlan(opt.star_extraprop_aperture_plan, opt.star_internalprop_names_aperture, opt.star_internalprop_output_names_aperture, opt.star_internalprop_function_aperture);
+    opt.star_extraprop_aperture_plan.ninternal = opt.star_extraprop_aperture_plan.size();
+    AddToExtraPropPlan(opt.star_extraprop_aperture_plan, opt.star_chem_names_aperture, opt.star_chem_output_names_aperture, opt.star_chem_function_aperture);
+    opt.star_extraprop_aperture_plan.nchem = opt.star_extraprop_aperture_plan.size() - opt.star_extraprop_aperture_plan.ninternal;
+    AddToExtraPropPlan(opt.star_extraprop_aperture_plan, opt.star_chemproduction_names_aperture, opt.star_chemproduction_output_names_aperture, opt.star_chemproduction_function_aperture);
+
+    opt.bh_extraprop_aperture_plan = ExtraPropPlan();
+    AddToExtraPropPlan(opt.bh_extraprop_aperture_plan, opt.bh_internalprop_names_aperture, opt.bh_internalprop_output_names_aperture, opt.bh_internalprop_function_aperture);
+    opt.bh_extraprop_aperture_plan.ninternal = opt.bh_extraprop_aperture_plan.size();
+    AddToExtraPropPlan(opt.bh_extraprop_aperture_plan, opt.bh_chem_names_aperture, opt.bh_chem_output_names_aperture, opt.bh_chem_function_aperture);
+    opt.bh_extraprop_aperture_plan.nchem = opt.bh_extraprop_aperture_plan.size() - opt.bh_extraprop_aperture_plan.ninternal;
+    AddToExtraPropPlan(opt.bh_extraprop_aperture_plan, opt.bh_chemproduction_names_aperture, opt.bh_chemproduction_output_names_aperture, opt.bh_chemproduction_function_aperture);
+
+    opt.extra_dm_extraprop_aperture_plan = ExtraPropPlan();
+    AddToExtraPropPlan(opt.extra_dm_extraprop_aperture_plan, opt.extra_dm_internalprop_names_aperture, opt.extra_dm_internalprop_output_names_aperture, opt.extra_dm_internalprop_function_aperture);
+    opt.extra_dm_extraprop_aperture_plan.ninternal = opt.extra_dm_extraprop_aperture_plan.size();
+}
+
+///initialise the running value of each slot and zero the stored properties
+template<typename T> inline void InitExtraProperties(const ExtraPropPlan &plan,
+    vector<double> &value, vector<double> &weightsum, T &prop)
+{
+    value.resize(plan.size());
+    weightsum.assign(plan.size(), 0);
+    for (auto islot=0;islot<plan.size();islot++) {
+        value[islot] = ExtraPropInitValue(plan.functions[islot]);
+        SetExtraPropertiesSlot(plan, islot, 0, prop);
     }
+}
 
-    //for calculations that depend on other values
-    for (auto iextra=0;iextra<opt.gas_internalprop_names.size();iextra++)
-    {
-        if (opt.gas_internalprop_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.gas_internalprop_index_paired_calc[iextra];
-        outputfield = opt.gas_internalprop_output_names[iextra];
-        outputfield2 = opt.gas_internalprop_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.gas_internalprop_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.gas_chem_names.size();iextra++)
-    {
-        if (opt.gas_chem_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.gas_chem_index_paired_calc[iextra];
-        outputfield = opt.gas_chem_output_names[iextra];
-        outputfield2 = opt.gas_chem_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.gas_chem_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.gas_chemproduction_names.size();iextra++)
-    {
-        if (opt.gas_chemproduction_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.gas_chemproduction_index_paired_calc[iextra];
-        outputfield = opt.gas_chemproduction_output_names[iextra];
-        outputfield2 = opt.gas_chemproduction_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.gas_chemproduction_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
+///add the extra properties of a particle to the running value of each slot
+template<typename T> inline void AddToExtraProperties(const ExtraPropPlan &plan, T &x, double mass,
+    vector<double> &value, vector<double> &weightsum)
+{
+    double weight;
+    auto islot=0;
+    for (;islot<plan.ninternal;islot++) {
+        weight = ExtraPropGetWeight(plan.functions[islot], mass);
+        weightsum[islot] += weight;
+        plan.funcs[islot](weight, x.GetInternalProperties(plan.fields[islot]), value[islot]);
+    }
+    for (;islot<plan.ninternal+plan.nchem;islot++) {
+        weight = ExtraPropGetWeight(plan.functions[islot], mass);
+        weightsum[islot] += weight;
+        plan.funcs[islot](weight, x.GetChemistry(plan.fields[islot]), value[islot]);
+    }
+    for (;islot<plan.size();islot++) {
+        weight = ExtraPropGetWeight(plan.functions[islot], mass);
+        weightsum[islot] += weight;
+        plan.funcs[islot](weight, x.GetChemistryProduction(plan.fields[islot]), value[islot]);
+    }
+}
+inline void AddToExtraProperties(const ExtraPropPlan &plan, ExtraDMProperties &x, double mass,
+    vector<double> &value, vector<double> &weightsum)
+{
+    double weight;
+    for (auto islot=0;islot<plan.size();islot++) {
+        weight = ExtraPropGetWeight(plan.functions[islot], mass);
+        weightsum[islot] += weight;
+        plan.funcs[islot](weight, x.GetExtraProperties(plan.fields[islot]), value[islot]);
     }
+}
 
-    for (auto iextra=0;iextra<opt.gas_internalprop_names.size();iextra++)
-    {
-        outputfield = opt.gas_internalprop_output_names[iextra];
-        pdata.hydroprop.SetInternalProperties(outputfield, value[outputfield]);
-    }
-    for (auto iextra=0;iextra<opt.gas_chem_names.size();iextra++)
-    {
-        outputfield = opt.gas_chem_output_names[iextra];
-        pdata.hydroprop.SetChemistry(outputfield, value[outputfield]);
+///normalise the running values, adjust those paired with other calculations and store them
+template<typename T> inline void SetExtraProperties(const ExtraPropPlan &plan,
+    vector<double> &value, vector<double> &weightsum, T &prop)
+{
+    for (auto islot=0;islot<plan.size();islot++)
+        value[islot] = ExtraPropNormalizeValue(plan.functions[islot], value[islot], weightsum[islot]);
+    for (auto islot=0;islot<plan.size();islot++) {
+        if (plan.paired[islot] == islot) continue;
+        value[islot] = ExtraPropAdjustForPairedValue(plan.functions[islot], value[islot], value[plan.paired[islot]]);
     }
-    for (auto iextra=0;iextra<opt.gas_chemproduction_names.size();iextra++)
+    for (auto islot=0;islot<plan.size();islot++) SetExtraPropertiesSlot(plan, islot, value[islot], prop);
+}
+
+///Calculate the average mass weighted value of a chemical and how it was produced
+///based on gas particles of an object
+void GetExtraHydroProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pval)
+{
+#ifdef GASON
+    const ExtraPropPlan &plan = opt.gas_extraprop_plan;
+    if (plan.size() == 0) return;
+    vector<double> value, weightsum;
+    InitExtraProperties(plan, value, weightsum, pdata.hydroprop);
+    if (pdata.n_gas == 0) return;
+    for (auto i=0;i<n;i++)
     {
-        outputfield = opt.gas_chemproduction_output_names[iextra];
-        pdata.hydroprop.SetChemistryProduction(outputfield, value[outputfield]);
+        if (Pval[i].GetType()!=GASTYPE) continue;
+        AddToExtraProperties(plan, Pval[i].GetHydroProperties(), Pval[i].GetMass(), value, weightsum);
     }
+    SetExtraProperties(plan, value, weightsum, pdata.hydroprop);
 #endif
 }
 
@@ -6041,143 +6033,17 @@ void GetExtraHydroProperties(Options &opt, PropData &pdata, Int_t n, Particle *P
 void GetExtraStarProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pval)
 {
 #ifdef STARON
-    if (opt.star_internalprop_names.size() + opt.star_chem_names.size() + opt.star_chemproduction_names.size() == 0) return;
-    StarProperties x;
-    map<string, double> value, weightsum;
-    string extrafield, outputfield, outputfield2;
-    double oldweight, weight, curvalue, result;
-    map<string, ExtraPropFunc> funcs;
-
-    //initialize map stored in the properties data
-    for (auto iextra=0;iextra<opt.star_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.star_internalprop_names[iextra];
-        outputfield = opt.star_internalprop_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.star_internalprop_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.star_internalprop_function[iextra]);
-        pdata.starprop.SetInternalProperties(outputfield, 0);
-    }
-    for (auto iextra=0;iextra<opt.star_chem_names.size();iextra++)
-    {
-        extrafield = opt.star_chem_names[iextra];
-        outputfield = opt.star_chem_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.star_chem_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.star_chem_function[iextra]);
-        pdata.starprop.SetChemistry(outputfield, 0);
-    }
-    for (auto iextra=0;iextra<opt.star_chemproduction_names.size();iextra++)
-    {
-        extrafield = opt.star_chemproduction_names[iextra];
-        outputfield = opt.star_chemproduction_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.star_chemproduction_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.star_chemproduction_function[iextra]);
-        pdata.starprop.SetChemistryProduction(outputfield, 0);
-    }
-    if (pdata.n_star == 0 ) return;
+    const ExtraPropPlan &plan = opt.star_extraprop_plan;
+    if (plan.size() == 0) return;
+    vector<double> value, weightsum;
+    InitExtraProperties(plan, value, weightsum, pdata.starprop);
+    if (pdata.n_star == 0) return;
     for (auto i=0;i<n;i++)
     {
         if (Pval[i].GetType()!=STARTYPE) continue;
-        x = Pval[i].GetStarProperties();
-        oldweight = Pval[i].GetMass();
-        for (auto iextra=0;iextra<opt.star_internalprop_names.size();iextra++)
-        {
-            extrafield = opt.star_internalprop_names[iextra];
-            outputfield = opt.star_internalprop_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.star_internalprop_function[iextra], oldweight);
-            curvalue = x.GetInternalProperties(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-        for (auto iextra=0;iextra<opt.star_chem_names.size();iextra++)
-        {
-            extrafield = opt.star_chem_names[iextra];
-            outputfield = opt.star_chem_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.star_chem_function[iextra], oldweight);
-            curvalue = x.GetChemistry(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-        for (auto iextra=0;iextra<opt.star_chemproduction_names.size();iextra++)
-        {
-            extrafield = opt.star_chemproduction_names[iextra];
-            outputfield = opt.star_chemproduction_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.star_chemproduction_function[iextra], oldweight);
-            curvalue = x.GetChemistryProduction(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-    }
-
-    //normalize as necessary
-    for (auto iextra=0;iextra<opt.star_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.star_internalprop_names[iextra];
-        outputfield = opt.star_internalprop_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.star_internalprop_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.star_chem_names.size();iextra++)
-    {
-        extrafield = opt.star_chem_names[iextra];
-        outputfield = opt.star_chem_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.star_chem_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.star_chemproduction_names.size();iextra++)
-    {
-        extrafield = opt.star_chemproduction_names[iextra];
-        outputfield = opt.star_chemproduction_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.star_chemproduction_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-
-    //for calculations that depend on other values
-    for (auto iextra=0;iextra<opt.star_internalprop_names.size();iextra++)
-    {
-        if (opt.star_internalprop_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.star_internalprop_index_paired_calc[iextra];
-        outputfield = opt.star_internalprop_output_names[iextra];
-        outputfield2 = opt.star_internalprop_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.star_internalprop_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.star_chem_names.size();iextra++)
-    {
-        if (opt.star_chem_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.star_chem_index_paired_calc[iextra];
-        outputfield = opt.star_chem_output_names[iextra];
-        outputfield2 = opt.star_chem_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.star_chem_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.star_chemproduction_names.size();iextra++)
-    {
-        if (opt.star_chemproduction_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.star_chemproduction_index_paired_calc[iextra];
-        outputfield = opt.star_chemproduction_output_names[iextra];
-        outputfield2 = opt.star_chemproduction_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.star_chemproduction_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
-
-    for (auto iextra=0;iextra<opt.star_internalprop_names.size();iextra++)
-    {
-        outputfield = opt.star_internalprop_output_names[iextra];
-        pdata.starprop.SetInternalProperties(outputfield, value[outputfield]);
-    }
-    for (auto iextra=0;iextra<opt.star_chem_names.size();iextra++)
-    {
-        outputfield = opt.star_chem_output_names[iextra];
-        pdata.starprop.SetChemistry(outputfield, value[outputfield]);
-    }
-    for (auto iextra=0;iextra<opt.star_chemproduction_names.size();iextra++)
-    {
-        outputfield = opt.star_chemproduction_output_names[iextra];
-        pdata.starprop.SetChemistryProduction(outputfield, value[outputfield]);
+        AddToExtraProperties(plan, Pval[i].GetStarProperties(), Pval[i].GetMass(), value, weightsum);
     }
+    SetExtraProperties(plan, value, weightsum, pdata.starprop);
 #endif
 }
 
@@ -6186,166 +6052,27 @@ void GetExtraStarProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pv
 void GetExtraBHProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pval)
 {
 #ifdef BHON
-    if (opt.bh_internalprop_names.size() + opt.bh_chem_names.size() + opt.bh_chemproduction_names.size() == 0) return;
-    BHProperties x;
-    map<string, double> value, weightsum;
-    string extrafield, outputfield, outputfield2;
-    double oldweight, weight, curvalue, result;
-    map<string, ExtraPropFunc> funcs;
-
-    //initialize map stored in the properties data
-    for (auto iextra=0;iextra<opt.bh_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.bh_internalprop_names[iextra];
-        outputfield = opt.bh_internalprop_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.bh_internalprop_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.bh_internalprop_function[iextra]);
-        pdata.bhprop.SetInternalProperties(outputfield, 0);
-    }
-    for (auto iextra=0;iextra<opt.bh_chem_names.size();iextra++)
-    {
-        extrafield = opt.bh_chem_names[iextra];
-        outputfield = opt.bh_chem_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.bh_chem_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.bh_chem_function[iextra]);
-        pdata.bhprop.SetChemistry(outputfield, 0);
-    }
-    for (auto iextra=0;iextra<opt.bh_chemproduction_names.size();iextra++)
-    {
-        extrafield = opt.bh_chemproduction_names[iextra];
-        outputfield = opt.bh_chemproduction_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.bh_chemproduction_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.bh_chemproduction_function[iextra]);
-        pdata.bhprop.SetChemistryProduction(outputfield, 0);
-    }
-    if (pdata.n_bh == 0 ) return;
+    const ExtraPropPlan &plan = opt.bh_extraprop_plan;
+    if (plan.size() == 0) return;
+    vector<double> value, weightsum;
+    InitExtraProperties(plan, value, weightsum, pdata.bhprop);
+    if (pdata.n_bh == 0) return;
     for (auto i=0;i<n;i++)
     {
         if (Pval[i].GetType()!=BHTYPE) continue;
-        x = Pval[i].GetBHProperties();
-        oldweight = Pval[i].GetMass();
-        for (auto iextra=0;iextra<opt.bh_internalprop_names.size();iextra++)
-        {
-            extrafield = opt.bh_internalprop_names[iextra];
-            outputfield = opt.bh_internalprop_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.bh_internalprop_function[iextra], oldweight);
-            curvalue = x.GetInternalProperties(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-        for (auto iextra=0;iextra<opt.bh_chem_names.size();iextra++)
-        {
-            extrafield = opt.bh_chem_names[iextra];
-            outputfield = opt.bh_chem_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.bh_chem_function[iextra], oldweight);
-            curvalue = x.GetChemistry(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-        for (auto iextra=0;iextra<opt.bh_chemproduction_names.size();iextra++)
-        {
-            extrafield = opt.bh_chemproduction_names[iextra];
-            outputfield = opt.bh_chemproduction_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.bh_chemproduction_function[iextra], oldweight);
-            curvalue = x.GetChemistryProduction(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-    }
-
-    //normalize as necessary
-    for (auto iextra=0;iextra<opt.bh_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.bh_internalprop_names[iextra];
-        outputfield = opt.bh_internalprop_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.bh_internalprop_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.bh_chem_names.size();iextra++)
-    {
-        extrafield = opt.bh_chem_names[iextra];
-        outputfield = opt.bh_chem_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.bh_chem_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.bh_chemproduction_names.size();iextra++)
-    {
-        extrafield = opt.bh_chemproduction_names[iextra];
-        outputfield = opt.bh_chemproduction_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.bh_chemproduction_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-
-    //for calculations that depend on other values
-    for (auto iextra=0;iextra<opt.bh_internalprop_names.size();iextra++)
-    {
-        if (opt.bh_internalprop_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.bh_internalprop_index_paired_calc[iextra];
-        outputfield = opt.bh_internalprop_output_names[iextra];
-        outputfield2 = opt.bh_internalprop_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.bh_internalprop_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.bh_chem_names.size();iextra++)
-    {
-        if (opt.bh_chem_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.bh_chem_index_paired_calc[iextra];
-        outputfield = opt.bh_chem_output_names[iextra];
-        outputfield2 = opt.bh_chem_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.bh_chem_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.bh_chemproduction_names.size();iextra++)
-    {
-        if (opt.bh_chemproduction_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.bh_chemproduction_index_paired_calc[iextra];
-        outputfield = opt.bh_chemproduction_output_names[iextra];
-        outputfield2 = opt.bh_chemproduction_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.bh_chemproduction_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
-
-    for (auto iextra=0;iextra<opt.bh_internalprop_names.size();iextra++)
-    {
-        outputfield = opt.bh_internalprop_output_names[iextra];
-        pdata.bhprop.SetInternalProperties(outputfield, value[outputfield]);
-    }
-    for (auto iextra=0;iextra<opt.bh_chem_names.size();iextra++)
-    {
-        outputfield = opt.bh_chem_output_names[iextra];
-        pdata.bhprop.SetChemistry(outputfield, value[outputfield]);
-    }
-    for (auto iextra=0;iextra<opt.bh_chemproduction_names.size();iextra++)
-    {
-        outputfield = opt.bh_chemproduction_output_names[iextra];
-        pdata.bhprop.SetChemistryProduction(outputfield, value[outputfield]);
+        AddToExtraProperties(plan, Pval[i].GetBHProperties(), Pval[i].GetMass(), value, weightsum);
     }
+    SetExtraProperties(plan, value, weightsum, pdata.bhprop);
 #endif
 }
 
 void GetExtraDMProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pval)
 {
 #ifdef EXTRADMON
-    if (opt.extra_dm_internalprop_names.size() == 0) return;
-    ExtraDMProperties x;
-    map<string, double> value, weightsum;
-    string extrafield, outputfield, outputfield2;
-    double oldweight, weight, curvalue, result;
-    map<string, ExtraPropFunc> funcs;
-
-    //initialize map stored in the properties data
-    for (auto iextra=0;iextra<opt.extra_dm_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.extra_dm_internalprop_names[iextra];
-        outputfield = opt.extra_dm_internalprop_output_names[iextra];
-        value[outputfield] = ExtraPropInitValue(opt.extra_dm_internalprop_function[iextra]);
-        weightsum[outputfield] = 0;
-        funcs[outputfield] = ExtraPropSetCalc(opt.extra_dm_internalprop_function[iextra]);
-        pdata.extradmprop.SetExtraProperties(outputfield, 0);
-    }
+    const ExtraPropPlan &plan = opt.extra_dm_extraprop_plan;
+    if (plan.size() == 0) return;
+    vector<double> value, weightsum;
+    InitExtraProperties(plan, value, weightsum, pdata.extradmprop);
     if (pdata.n_dm == 0) return;
     for (auto i=0;i<n;i++)
     {
@@ -6353,41 +6080,9 @@ void GetExtraDMProperties(Options &opt, PropData &pdata, Int_t n, Particle *Pval
 #ifdef HIGHRES
         if (!Pval[i].HasExtraDMProperties()) continue;
 #endif
-        x = Pval[i].GetExtraDMProperties();
-        oldweight = Pval[i].GetMass();
-        for (auto iextra=0;iextra<opt.extra_dm_internalprop_names.size();iextra++)
-        {
-            extrafield = opt.extra_dm_internalprop_names[iextra];
-            outputfield = opt.extra_dm_internalprop_output_names[iextra];
-            weight = ExtraPropGetWeight(opt.extra_dm_internalprop_function[iextra], oldweight);
-            curvalue = x.GetExtraProperties(extrafield);
-            weightsum[outputfield] += weight;
-            funcs[outputfield](weight, curvalue, value[outputfield]);
-        }
-    }
-    //normalize as necessary
-    for (auto iextra=0;iextra<opt.extra_dm_internalprop_names.size();iextra++)
-    {
-        extrafield = opt.extra_dm_internalprop_names[iextra];
-        outputfield = opt.extra_dm_internalprop_output_names[iextra];
-        result = ExtraPropNormalizeValue(opt.extra_dm_internalprop_function[iextra], value[outputfield], weightsum[outputfield]);
-        value[outputfield] = result;
-    }
-    //for calculations that depend on other values
-    for (auto iextra=0;iextra<opt.extra_dm_internalprop_names.size();iextra++)
-    {
-        if (opt.extra_dm_internalprop_index_paired_calc[iextra] == iextra) continue;
-        int iextra2 = opt.extra_dm_internalprop_index_paired_calc[iextra];
-        outputfield = opt.extra_dm_internalprop_output_names[iextra];
-        outputfield2 = opt.extra_dm_internalprop_output_names[iextra2];
-        result = ExtraPropAdjustForPairedValue(opt.extra_dm_internalprop_function[iextra], value[outputfield], value[outputfield2]);
-        value[outputfield] = result;
-    }
-    for (auto iextra=0;iextra<opt.extra_dm_internalprop_names.size();iextra++)
-    {
-        outputfield = opt.extra_dm_internalprop_output_names[iextra];
-        pdata.extradmprop.SetExtraProperties(outputfield, value[outputfield]);
+        AddToExtraProperties(plan, Pval[i].GetExtraDMProperties(), Pval[i].GetMass(), value, weightsum);
     }
+    SetExtraProperties(plan, value, weightsum, pdata.extradmprop);
 #endif
 }
 //@}
@@ -6830,6 +6525,17 @@ void SetSphericalOverdensityMasstoFlagValue(Options &opt, PropData &pdata)
     }
 }
 
+void ResetSphericalOverdensityMass(Options &opt, PropData &pdata)
+{
+    pdata.gRvir=pdata.gMvir=0;
+    pdata.gR200c=pdata.gM200c=0;
+    pdata.gR200m=pdata.gM200m=0;
+    pdata.gR500c=pdata.gM500c=0;
+    pdata.gRBN98=pdata.gMBN98=0;
+    pdata.gRhalf200c=pdata.gRhalf200m=pdata.gRhalfBN98=0;
+    for (auto iso=0;iso<opt.SOnum;iso++) pdata.SO_radius[iso]=pdata.SO_mass[iso]=0;
+}
+
 void SetSphericalOverdensityMasstoTotalMass(Options &opt, PropData &pdata)
 {
     if (pdata.gRvir==0) {pdata.gMvir=pdata.gmass;pdata.gRvir=pdata.gsize;}
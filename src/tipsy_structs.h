@@ -83,6 +83,12 @@ struct tipsy_dump {
     
 } ;
 
+///convert a block of n tipsy particles, which only store 4 byte floats, from big endian in one go
+template<class T> inline void TipsyBlocktoBigEndian(T *p, size_t n)
+{
+    BigEndian4Array(p, n*sizeof(T)/sizeof(float));
+}
+
 //and simple particle 
 struct tipsy_simple_particle {
     float mass;
@@ -23,6 +23,10 @@ void ReadTipsy(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particl
     Double_t mscale,lscale,lvscale,LN=1.0;
     Double_t posfirst[3];
     fstream Ftip;
+    Int_t nblock, blocksize=opt.inputbufsize;
+    vector<tipsy_gas_particle> gasblock;
+    vector<tipsy_dark_particle> darkblock;
+    vector<tipsy_star_particle> starblock;
 #ifndef USEMPI
     int ThisTask=0,NProcs=1;
 #endif
@@ -138,33 +142,51 @@ void ReadTipsy(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particl
         Ftip.close();
     }
 
+    //particles are read in blocks, converted from big endian in one go and then stored
     oldcount=count=0;
     Ftip.open(opt.fname, ios::in | ios::binary);
     Ftip.read((char*)&tipsyheader,sizeof(tipsy_dump));
     tipsyheader.SwitchtoBigEndian();
-    for (Int_t i=0;i<ngas;i++)
+    for (Int_t i=0;i<ngas;i+=nblock)
     {
-        Ftip.read((char*)&gas,sizeof(tipsy_gas_particle));
-        gas.SwitchtoBigEndian();
+        nblock=min(blocksize,ngas-i);
+        gasblock.resize(nblock);
+        Ftip.read((char*)gasblock.data(),sizeof(tipsy_gas_particle)*nblock);
+        TipsyBlocktoBigEndian(gasblock.data(),nblock);
         //if particle is closer do to periodicity then alter position
         if (opt.p>0.0)
         {
-            for (int j=0;j<3;j++) {
-                if (gas.pos[j]-posfirst[j]>opt.p/2.0) gas.pos[j]-=opt.p;
-                else if (gas.pos[j]-posfirst[j]<-opt.p/2.0) gas.pos[j]+=opt.p;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nblock>ompreadnum)
+#endif
+            for (Int_t n=0;n<nblock;n++) {
+                for (int j=0;j<3;j++) {
+                    if (gasblock[n].pos[j]-posfirst[j]>opt.p/2.0) gasblock[n].pos[j]-=opt.p;
+                    else if (gasblock[n].pos[j]-posfirst[j]<-opt.p/2.0) gasblock[n].pos[j]+=opt.p;
+                }
             }
         }
-        if (opt.partsearchtype==PSTALL||opt.partsearchtype==PSTGAS) {
+        if (!(opt.partsearchtype==PSTALL||opt.partsearchtype==PSTGAS)) continue;
 #ifndef USEMPI
-            Part[count]=Particle(gas.mass*mscale,
+        //particles of a block are independent so store them in parallel
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nblock>ompreadnum)
+#endif
+        for (Int_t n=0;n<nblock;n++) {
+            tipsy_gas_particle &gas=gasblock[n];
+            Part[count+n]=Particle(gas.mass*mscale,
                 gas.pos[0]*lscale,gas.pos[1]*lscale,gas.pos[2]*lscale,
                 gas.vel[0]*opt.velocityinputconversion+Hubbleflow*gas.pos[0],
                 gas.vel[1]*opt.velocityinputconversion+Hubbleflow*gas.pos[1],
                 gas.vel[2]*opt.velocityinputconversion+Hubbleflow*gas.pos[2],
-                count,GASTYPE);
+                count+n,GASTYPE);
+        }
+        count+=nblock;
 #else
-            //if using MPI, determine ibuf, store particle in particle buffer and if buffer full, broadcast data
-            //unless ibuf is 0, then just store locally
+        //if using MPI, determine ibuf, store particle in particle buffer and if buffer full, broadcast data
+        //unless ibuf is 0, then just store locally
+        for (Int_t n=0;n<nblock;n++) {
+            tipsy_gas_particle &gas=gasblock[n];
             ibuf=MPIGetParticlesProcessor(opt, gas.pos[0],gas.pos[1],gas.pos[2]);
             Pbuf[ibuf*BufSize+Nbuf[ibuf]]=Particle(gas.mass*mscale,
                 gas.pos[0]*lscale,gas.pos[1]*lscale,gas.pos[2]*lscale,
@@ -184,27 +206,40 @@ void ReadTipsy(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particl
                     Nbuf[ibuf] = 0;
                 }
             }
-#endif
-        count++;
+            count++;
         }
+#endif
     }
     cout<<"Finished storing "<<count-oldcount<<" gas particles"<<endl;
     oldcount=count;
-    for (Int_t i=0;i<ndark;i++)
+    for (Int_t i=0;i<ndark;i+=nblock)
     {
-        Ftip.read((char*)&dark,sizeof(tipsy_dark_particle));
-        dark.SwitchtoBigEndian();
-        if (MP_DM>dark.mass) MP_DM=dark.mass;
-        //if particle is closer do to periodicity then alter position
-        if (opt.partsearchtype==PSTALL||opt.partsearchtype==PSTDARK) {
+        nblock=min(blocksize,ndark-i);
+        darkblock.resize(nblock);
+        Ftip.read((char*)darkblock.data(),sizeof(tipsy_dark_particle)*nblock);
+        TipsyBlocktoBigEndian(darkblock.data(),nblock);
+        for (Int_t n=0;n<nblock;n++) if (MP_DM>darkblock[n].mass) MP_DM=darkblock[n].mass;
+        if (!(opt.partsearchtype==PSTALL||opt.partsearchtype==PSTDARK)) continue;
 #ifndef USEMPI
-        Part[count]=Particle(dark.mass*mscale,
-            dark.pos[0]*lscale,dark.pos[1]*lscale,dark.pos[2]*lscale,
-            dark.vel[0]*opt.velocityinputconversion+Hubbleflow*dark.pos[0],
-            dark.vel[1]*opt.velocityinputconversion+Hubbleflow*dark.pos[1],
-            dark.vel[2]*opt.velocityinputconversion+Hubbleflow*dark.pos[2],
-            count,DARKTYPE);
+        //particles of a block are independent so store them in parallel
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nblock>ompreadnum)
+#endif
+        for (Int_t n=0;n<nblock;n++) {
+            tipsy_dark_particle &dark=darkblock[n];
+            Part[count+n]=Particle(dark.mass*mscale,
+                dark.pos[0]*lscale,dark.pos[1]*lscale,dark.pos[2]*lscale,
+                dark.vel[0]*opt.velocityinputconversion+Hubbleflow*dark.pos[0],
+                dark.vel[1]*opt.velocityinputconversion+Hubbleflow*dark.pos[1],
+                dark.vel[2]*opt.velocityinputconversion+Hubbleflow*dark.pos[2],
+                count+n,DARKTYPE);
+        }
+        count+=nblock;
 #else
+        //if using MPI, determine ibuf, store particle in particle buffer and if buffer full, broadcast data
+        //unless ibuf is 0, then just store locally
+        for (Int_t n=0;n<nblock;n++) {
+            tipsy_dark_particle &dark=darkblock[n];
             ibuf=MPIGetParticlesProcessor(opt, dark.pos[0],dark.pos[1],dark.pos[2]);
             Pbuf[ibuf*BufSize+Nbuf[ibuf]]=Particle(dark.mass*mscale,
                 dark.pos[0]*lscale,dark.pos[1]*lscale,dark.pos[2]*lscale,
@@ -224,33 +259,52 @@ void ReadTipsy(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particl
                     Nbuf[ibuf] = 0;
                 }
             }
-#endif
-        count++;
+            count++;
         }
+#endif
     }
     cout<<"Finished storing "<<count-oldcount<<" dark particles"<<endl;
     oldcount=count;
-    for (Int_t i=0;i<nstar;i++)
+    for (Int_t i=0;i<nstar;i+=nblock)
     {
-        Ftip.read((char*)&star,sizeof(tipsy_star_particle));
-        star.SwitchtoBigEndian();
+        nblock=min(blocksize,nstar-i);
+        starblock.resize(nblock);
+        Ftip.read((char*)starblock.data(),sizeof(tipsy_star_particle)*nblock);
+        TipsyBlocktoBigEndian(starblock.data(),nblock);
         //if particle is closer do to periodicity then alter position
         if (opt.p>0.0)
         {
-            for (int j=0;j<3;j++) {
-                if (star.pos[j]-posfirst[j]>opt.p/2.0) star.pos[j]-=opt.p;
-                else if (star.pos[j]-posfirst[j]<-opt.p/2.0) star.pos[j]+=opt.p;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nblock>ompreadnum)
+#endif
+            for (Int_t n=0;n<nblock;n++) {
+                for (int j=0;j<3;j++) {
+                    if (starblock[n].pos[j]-posfirst[j]>opt.p/2.0) starblock[n].pos[j]-=opt.p;
+                    else if (starblock[n].pos[j]-posfirst[j]<-opt.p/2.0) starblock[n].pos[j]+=opt.p;
+                }
             }
         }
-        if (opt.partsearchtype==PSTALL||opt.partsearchtype==PSTSTAR) {
+        if (!(opt.partsearchtype==PSTALL||opt.partsearchtype==PSTSTAR)) continue;
 #ifndef USEMPI
-        Part[count]=Particle(star.mass*mscale,
-            star.pos[0]*lscale,star.pos[1]*lscale,star.pos[2]*lscale,
-            star.vel[0]*opt.velocityinputconversion+Hubbleflow*star.pos[0],
-            star.vel[1]*opt.velocityinputconversion+Hubbleflow*star.pos[1],
-            star.vel[2]*opt.velocityinputconversion+Hubbleflow*star.pos[2],
-            count,STARTYPE);
+        //particles of a block are independent so store them in parallel
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (nblock>ompreadnum)
+#endif
+        for (Int_t n=0;n<nblock;n++) {
+            tipsy_star_particle &star=starblock[n];
+            Part[count+n]=Particle(star.mass*mscale,
+                star.pos[0]*lscale,star.pos[1]*lscale,star.pos[2]*lscale,
+                star.vel[0]*opt.velocityinputconversion+Hubbleflow*star.pos[0],
+                star.vel[1]*opt.velocityinputconversion+Hubbleflow*star.pos[1],
+                star.vel[2]*opt.velocityinputconversion+Hubbleflow*star.pos[2],
+                count+n,STARTYPE);
+        }
+        count+=nblock;
 #else
+        //if using MPI, determine ibuf, store particle in particle buffer and if buffer full, broadcast data
+        //unless ibuf is 0, then just store locally
+        for (Int_t n=0;n<nblock;n++) {
+            tipsy_star_particle &star=starblock[n];
             ibuf=MPIGetParticlesProcessor(opt, star.pos[0],star.pos[1],star.pos[2]);
             Pbuf[ibuf*BufSize+Nbuf[ibuf]]=Particle(star.mass*mscale,
                 star.pos[0]*lscale,star.pos[1]*lscale,star.pos[2]*lscale,
@@ -267,14 +321,13 @@ void ReadTipsy(Options &opt, vector<Particle> &Part, const Int_t nbodies,Particl
                 if(Nbuf[ibuf]==BufSize) {
                     MPI_Ssend(&Nbuf[ibuf], 1, MPI_Int_t, ibuf, ibuf+NProcs, MPI_COMM_WORLD);
                     MPI_Ssend(&Pbuf[ibuf*BufSize],sizeof(Particle)*Nbuf[ibuf],MPI_BYTE,ibuf,ibuf,MPI_COMM_WORLD);
-                    Nbuf[ibuf]=0;
+                    Nbuf[ibuf] = 0;
                 }
             }
-#endif
-        count++;
+            count++;
         }
+#endif
     }
-
     cout<<"Finished storing "<<count-oldcount<<" star particles"<<endl;
     //once finished reading the file if there are any particles left in the buffer broadcast them
 #ifdef USEMPI
@@ -94,7 +94,7 @@ void usage(void)
     cerr<<"-I <input format [Gadget (Default) "<<IOGADGET<<", HDF (if implemented) "<<IOHDF<<", TIPSY "<<IOTIPSY<<", RAMSES "<<IORAMSES<<", NCHILADA "<<IONCHILADA<<">"<<endl;
     cerr<<"-i <input file> "<<endl;
     cerr<<"-s <number of files per output for gadget input 1 [default]>"<<endl;
-    cerr<<"-Z <number of threads used in parallel read ("<<opt.nsnapread<<")>"<<endl;
+    cerr<<"-Z <number of threads used in parallel read ("<<opt.nsnapread<<"), <=0 lets all threads read>"<<endl;
     cerr<<"-o <output filename>"<<endl;
     cerr<<" ===== EXTRA OPTIONS FOR GADGET INPUT ====== "<<endl;
     cerr<<"-g <number of extra sph/gas blocks for gadget>"<<endl;
@@ -260,13 +260,21 @@ void usage(void)
     \arg <b> \e Extensive_halo_properties_output </b> 1/0 flag indicating whether to calculate/output even more halo properties. \ref Options.iextrahalooutput \n
     \arg <b> \e Extended_output </b> 1/0 flag indicating whether produce extended output for quick particle extraction from input catalog of particles in structures \ref Options.iextendedoutput \n
     \arg <b> \e Iterate_cm_flag </b> 1/0 flag indicating whether to use shrinking spheres to calculate the center of mass and velocity. \ref Options.iIterateCM \n
+    \arg <b> \e Iterate_cm_resort_tolerance </b> fraction of the current sphere radius the centre can move before particles are re-sorted by distance (0.1). \ref PropInfo.cmresorttol \n
     \arg <b> \e Sort_by_binding_energy </b> 1/0 flag indicating whether to sort by particle binding energy or by potential (if 0). \ref Options.iSortByBindingEnergy \n
 
     \section ioconfigs I/O options
     \arg <b> \e Cosmological_input </b> 1/0 indicating that input simulation is cosmological or not. With cosmological input, a variety of length/velocity scales are set to determine such things as the virial overdensity, linking length. \ref Options.icosmologicalin \n
     \arg <b> \e Input_chunk_size </b> Amount of information to read from input file in one go (100000). \ref Options.inputbufsize \n
+    \arg <b> \e Input_lazy_extra_fields </b> 1/0 flag indicating whether star formation rates, metallicities and extra gas/star/bh fields of HDF input are only read for particles in groups after the search. \ref Options.ilazyextrafields \n
+    \arg <b> \e Input_swift_cell_read </b> 1/0 flag indicating whether SWIFT HDF input is read using the top-level cell meta data so that mpi tasks only read the cells overlapping their domain. \ref Options.iswiftcellread \n
+    \arg <b> \e Input_swift_cell_buffer </b> fraction of a SWIFT top-level cell by which cells are expanded when checking overlaps (0.2). \ref Options.swiftcellbuffer \n
+    \arg <b> \e Input_region_of_interest </b> xmin,ymin,zmin,xmax,ymax,zmax, of region in input units, only SWIFT cells overlapping this region are read. \ref Options.inputregion \n
+    \arg <b> \e Input_snapshot_index </b> 1/0 flag indicating whether particle counts on the mpi mesh are stored in an index file next to the input and reused by later runs. \ref Options.isnapshotindex \n
     \arg <b> \e Write_group_array_file </b> 0/1 flag indicating whether write a single large tipsy style group assignment file is written. \ref Options.iwritefof \n
     \arg <b> \e Separate_output_files </b> 1/0 flag indicating whether separate files are written for field and subhalo groups. \ref Options.iseparatefiles \n
+    \arg <b> \e Async_output </b> 1/0 flag indicating whether group catalogues are written by a separate thread while subsequent groups are processed. Ignored with MPI. \ref Options.iasyncoutput \n
+    \arg <b> \e Async_output_max_queued </b> maximum number of group outputs buffered in memory waiting to be written, each holding a copy of the property catalogue of its groups (2). \ref Options.asyncoutputmaxqueued \n
     \arg <b> \e Binary_output </b> 3/2/1/0 flag indicating whether output is hdf, binary or ascii. \ref Options.ibinaryout, \ref OUTADIOS, \ref OUTHDF, \ref OUTBINARY, \ref OUTASCII \n
     \arg <b> \e Comoving_units </b> 1/0 flag indicating whether the properties output is in physical or comoving little h units. \ref Options.icomoveunit \n
 
@@ -894,6 +902,8 @@ void GetParamFile(Options &opt)
                         opt.ParticleTypeForRefenceFrame = atoi(vbuff);
                     else if (strcmp(tbuff, "Iterate_cm_flag")==0)
                         opt.iIterateCM = atoi(vbuff);
+                    else if (strcmp(tbuff, "Iterate_cm_resort_tolerance")==0)
+                        opt.pinfo.cmresorttol = atof(vbuff);
                     else if (strcmp(tbuff, "Inclusive_halo_masses")==0)
                         opt.iInclusiveHalo = atoi(vbuff);
                     else if (strcmp(tbuff, "Spherical_overdenisty_calculation_limited_to_structure_types")==0) {
@@ -909,6 +919,15 @@ void GetParamFile(Options &opt)
                         opt.iextrastaroutput = atoi(vbuff);
                     else if (strcmp(tbuff, "Extensive_interloper_properties_output")==0)
                         opt.iextrainterloperoutput = atoi(vbuff);
+                    else if (strcmp(tbuff, "Output_fields")==0) {
+                        pos=0;
+                        dataline=string(vbuff);
+                        while ((pos = dataline.find(delimiter)) != string::npos) {
+                            token = dataline.substr(0, pos);
+                            opt.output_field_names.push_back(token);
+                            dataline.erase(0, pos + delimiter.length());
+                        }
+                    }
                     else if (strcmp(tbuff, "Calculate_aperture_quantities")==0)
                         opt.iaperturecalc = atoi(vbuff);
                     else if (strcmp(tbuff, "Number_of_apertures")==0)
@@ -983,6 +1002,23 @@ void GetParamFile(Options &opt)
                     //input read related
                     else if (strcmp(tbuff, "Input_chunk_size")==0)
                         opt.inputbufsize = atol(vbuff);
+                    else if (strcmp(tbuff, "Input_lazy_extra_fields")==0)
+                        opt.ilazyextrafields = atoi(vbuff);
+                    else if (strcmp(tbuff, "Input_snapshot_index")==0)
+                        opt.isnapshotindex = atoi(vbuff);
+                    else if (strcmp(tbuff, "Input_swift_cell_read")==0)
+                        opt.iswiftcellread = atoi(vbuff);
+                    else if (strcmp(tbuff, "Input_swift_cell_buffer")==0)
+                        opt.swiftcellbuffer = atof(vbuff);
+                    else if (strcmp(tbuff, "Input_region_of_interest")==0) {
+                        pos=0;
+                        dataline=string(vbuff);
+                        while ((pos = dataline.find(delimiter)) != string::npos) {
+                            token = dataline.substr(0, pos);
+                            opt.inputregion.push_back(stof(token));
+                            dataline.erase(0, pos + delimiter.length());
+                        }
+                    }
                     else if (strcmp(tbuff, "MPI_particle_total_buf_size")==0)
                         opt.mpiparticletotbufsize = atol(vbuff);
                     //mpi memory related
@@ -994,6 +1030,20 @@ void GetParamFile(Options &opt)
                         opt.impiusemesh = (atoi(vbuff)>0);
                     else if (strcmp(tbuff, "MPI_zcurve_mesh_decomposition_min_num_cells_per_dim")==0)
                         opt.minnumcellperdim = atoi(vbuff);
+                    else if (strcmp(tbuff, "MPI_mesh_decomposition_num_cells_per_dim")==0)
+                        opt.mpimeshnumcellsperdim = atoi(vbuff);
+                    else if (strcmp(tbuff, "MPI_mesh_decomposition_curve_type")==0)
+                        opt.mpimeshcurvetype = atoi(vbuff);
+                    else if (strcmp(tbuff, "MPI_large_group_balance_min_size")==0)
+                        opt.mpilargegroupsize = atol(vbuff);
+                    else if (strcmp(tbuff, "MPI_large_group_distributed_search")==0)
+                        opt.impilargegroupsearch = atoi(vbuff);
+                    else if (strcmp(tbuff, "MPI_single_pass_read")==0)
+                        opt.impisinglepassread = atoi(vbuff);
+                    else if (strcmp(tbuff, "MPI_single_pass_read_sample_stride")==0)
+                        opt.mpisinglepasssamplestride = atoi(vbuff);
+                    else if (strcmp(tbuff, "MPI_num_read_tasks_per_file")==0)
+                        opt.mpinumreadtasksperfile = atoi(vbuff);
                     ///OpenMP related
                     else if (strcmp(tbuff, "OMP_run_fof")==0)
                         opt.iopenmpfof = atoi(vbuff);
@@ -1663,6 +1713,10 @@ void GetParamFile(Options &opt)
                     //output related
                     else if (strcmp(tbuff, "Separate_output_files")==0)
                         opt.iseparatefiles = atoi(vbuff);
+                    else if (strcmp(tbuff, "Async_output")==0)
+                        opt.iasyncoutput = atoi(vbuff);
+                    else if (strcmp(tbuff, "Async_output_max_queued")==0)
+                        opt.asyncoutputmaxqueued = atoi(vbuff);
                     else if (strcmp(tbuff, "Binary_output")==0)
                         opt.ibinaryout = atoi(vbuff);
                     else if (strcmp(tbuff, "Comoving_units")==0)
@@ -1748,6 +1802,20 @@ void ConfigCheck(Options &opt)
         errormessage("Invalid read buf size (<1)");
         ConfigExit();
     }
+    if (opt.pinfo.cmresorttol<0){
+        errormessage("Invalid cm resort tolerance (<0), resetting to 0.1.");
+        opt.pinfo.cmresorttol=0.1;
+    }
+    if (opt.iasyncoutput && opt.asyncoutputmaxqueued<1){
+        errormessage("Invalid number of queued outputs (<1)");
+        ConfigExit();
+    }
+#ifdef USEMPI
+    if (opt.iasyncoutput) {
+        errormessage("Asynchronous output is not compatible with MPI as output uses collective communication, writing synchronously.");
+        opt.iasyncoutput=0;
+    }
+#endif
     }
 
     if (opt.iBaryonSearch && !(opt.partsearchtype==PSTALL || opt.partsearchtype==PSTDARK))
@@ -1818,11 +1886,83 @@ void ConfigCheck(Options &opt)
         }
     }
 
+#ifndef EXTRAINPUTINFO
+    if (opt.ilazyextrafields){
+        errormessage("Lazy loading of extra input fields requires particles to store their location in the input files, compile with VR_USE_EXTRA_INPUT_INFO. Reading all fields with the input.");
+        opt.ilazyextrafields = 0;
+    }
+#endif
+
+    if (opt.iswiftcellread) {
+#ifndef USEMPI
+        errormessage("Reading SWIFT input by cell only reduces input volume with MPI domains. Reading the whole volume.");
+        opt.iswiftcellread = 0;
+#else
+        if (opt.inputtype != IOHDF) {
+            errormessage("Reading input by cell requires SWIFT HDF input. Reading the whole volume.");
+            opt.iswiftcellread = 0;
+        }
+        else if (!opt.impiusemesh) {
+            errormessage("Reading SWIFT input by cell requires the z-curve mesh decomposition, MPI_use_zcurve_mesh_decomposition = 1. Reading the whole volume.");
+            opt.iswiftcellread = 0;
+        }
+#endif
+    }
+    if (opt.isnapshotindex) {
+#ifndef USEMPI
+        errormessage("Snapshot index is only used to decompose MPI domains. Ignoring.");
+        opt.isnapshotindex = 0;
+#else
+        if (opt.inputtype != IOHDF || !opt.impiusemesh) {
+            errormessage("Snapshot index requires HDF input and the z-curve mesh decomposition. Ignoring.");
+            opt.isnapshotindex = 0;
+        }
+#endif
+    }
+    if (opt.iswiftcellread && opt.swiftcellbuffer < 0) {
+        errormessage("Invalid SWIFT cell buffer (<0), resetting to 0.2.");
+        opt.swiftcellbuffer = 0.2;
+    }
+    if (opt.inputregion.size() > 0 && opt.inputregion.size() != 6) {
+        errormessage("Region of interest must be given as xmin,ymin,zmin,xmax,ymax,zmax. Ignoring region.");
+        opt.inputregion.clear();
+    }
+    if (opt.inputregion.size() > 0 && !opt.iswiftcellread) {
+        errormessage("Region of interest is only used when reading SWIFT input by cell. Ignoring region.");
+        opt.inputregion.clear();
+    }
+
 #ifdef USEMPI
+    if (opt.impilargegroupsearch) {
+        if (opt.mpilargegroupsize<=0) {
+            errormessage("Distributed search of large groups requires MPI_large_group_balance_min_size > 0. Disabling.");
+            opt.impilargegroupsearch = 0;
+        }
+        else if (opt.foftype!=FOFSTPROB || opt.iSingleHalo) {
+            errormessage("Distributed search of large groups is only implemented for the FoF_search_type = 1 substructure search of field haloes. Disabling.");
+            opt.impilargegroupsearch = 0;
+        }
+        else if (opt.iBaryonSearch>=1 && opt.partsearchtype==PSTALL) {
+            errormessage("Distributed search of large groups is not implemented when all particle types are searched together. Disabling.");
+            opt.impilargegroupsearch = 0;
+        }
+    }
     if (opt.minnumcellperdim<8){
         errormessage("MPI mesh too coarse, minimum number of cells per dimension from which to produce z-curve decomposition is 8. Resetting to 8.");
         opt.minnumcellperdim = 8;
     }
+    if (opt.mpimeshcurvetype != MPIMESHCURVEZ && opt.mpimeshcurvetype != MPIMESHCURVEHILBERT){
+        errormessage("Invalid MPI mesh curve type, must be 0 (z-curve) or 1 (Peano-Hilbert curve).");
+        ConfigExit();
+    }
+    if (opt.impisinglepassread && opt.mpisinglepasssamplestride<1){
+        errormessage("Invalid MPI single pass read sample stride, must be >= 1.");
+        ConfigExit();
+    }
+    //a non-positive number of read tasks means all tasks may read, limited later by the number of files
+    if (opt.nsnapread<=0) opt.nsnapread=NProcs;
+    //reading SWIFT input by cell, every task reads the cells of its own domain
+    if (opt.iswiftcellread) opt.nsnapread=NProcs;
     if (opt.mpiparticletotbufsize<(long int)(sizeof(Particle)*NProcs) && opt.mpiparticletotbufsize!=-1){
         errormessage("Invalid input particle buffer send size, mininmum input buffer size given paritcle byte size "+to_string(sizeof(Particle))+" and have "+to_string(NProcs)+" mpi processes is "+to_string(sizeof(Particle)*NProcs));
         ConfigExit();
@@ -1922,6 +2062,18 @@ void ConfigCheck(Options &opt)
             ConfigExit();
         }
         if (opt.iprofilebintype == PROFILERBINTYPELOG) {
+            //check if log edges are evenly spaced so that bins can be calculated directly
+            opt.iprofilelogbinuniform = (opt.profilenbins > 1);
+            if (opt.iprofilelogbinuniform) {
+                Double_t dlog = (opt.profile_bin_edges[opt.profilenbins-1]-opt.profile_bin_edges[0])/(Double_t)(opt.profilenbins-1);
+                if (dlog <= 0) opt.iprofilelogbinuniform = 0;
+                for (auto i=1;i<opt.profilenbins;i++)
+                    if (fabs(opt.profile_bin_edges[i]-opt.profile_bin_edges[i-1]-dlog) > 1e-3*dlog) opt.iprofilelogbinuniform = 0;
+                if (opt.iprofilelogbinuniform) {
+                    opt.profilelogedgemin = opt.profile_bin_edges[0];
+                    opt.profileilogbinwidth = 1.0/dlog;
+                }
+            }
             for (auto i=0;i<opt.profilenbins;i++) opt.profile_bin_edges[i]=pow(10.0,opt.profile_bin_edges[i]);
         }
         if (opt.iprofilenorm == PROFILERNORMR200CRIT) opt.profileradnormstring = "R_200crit";
@@ -2153,6 +2305,7 @@ void ConfigCheck(Options &opt)
         opt.extra_dm_internalprop_input_output_unit_conversion_factors_aperture, opt.extra_dm_internalprop_output_units_aperture
     );
     opt.extra_dm_extraprop_aperture_calc = (opt.extra_dm_internalprop_names_aperture.size() >0);
+    SetExtraPropPlans(opt);
 
     if (opt.gas_extraprop_aperture_calc && opt.iaperturecalc == 0){
         errormessage("Requesting extra gas properties to be calculated in apertures but apertures not set");
@@ -2175,6 +2328,27 @@ void ConfigCheck(Options &opt)
         ConfigExit();
     }
 
+    //if only some fields are output, only run the bulk property calculations they depend on
+    if (opt.output_field_names.size() > 0) {
+        PropDataHeader head(opt);
+        set<string> headerfields(head.headerdatainfo.begin(), head.headerdatainfo.end());
+        opt.propertykernels = 0;
+        for (auto &x:opt.output_field_names) {
+            if (headerfields.count(x) == 0) {
+                errormessage("Requested output field "+x+" is not a property produced with this configuration. Check config.");
+                ConfigExit();
+            }
+            opt.propertykernels |= GetPropertyKernels(x);
+        }
+        //profiles normalised by R200crit and particle lists of spherical overdensities require the overdensity radii,
+        //and inclusive profiles of field haloes are built by the spherical overdensity calculation when iInclusiveHalo==3
+        if (opt.iprofilecalc && opt.iprofilenorm == PROFILERNORMR200CRIT) opt.propertykernels |= PROPKERNELSO;
+        if (opt.iprofilecalc && opt.iInclusiveHalo == 3) opt.propertykernels |= PROPKERNELSO;
+        if (opt.iSphericalOverdensityPartList) opt.propertykernels |= PROPKERNELSO;
+        if (ThisTask==0 && opt.propertykernels != PROPKERNELALL)
+            cout<<"Skipping bulk property calculations not needed by the "<<opt.output_field_names.size()<<" requested output fields"<<endl;
+    }
+
 
     //set halo 3d fof linking length if necessary
     if (opt.ellhalo3dxfac == -1) {
@@ -2400,7 +2574,9 @@ ConfigInfo::ConfigInfo(Options &opt){
     AddEntry("Extensive_gas_properties_output", opt.iextragasoutput);
     AddEntry("Extensive_star_properties_output", opt.iextrastaroutput);
     AddEntry("Extensive_interloper_properties_output", opt.iextrainterloperoutput);
+    AddEntry("Output_fields", opt.output_field_names);
     AddEntry("Iterate_cm_flag", opt.iIterateCM);
+    AddEntry("Iterate_cm_resort_tolerance", opt.pinfo.cmresorttol);
     AddEntry("Sort_by_binding_energy", opt.iSortByBindingEnergy);
     AddEntry("Reference_frame_for_properties", opt.iPropertyReferencePosition);
 
@@ -2543,8 +2719,15 @@ ConfigInfo::ConfigInfo(Options &opt){
     //io related
     AddEntry("Cosmological_input",opt.icosmologicalin);
     AddEntry("Input_chunk_size",opt.inputbufsize);
+    AddEntry("Input_lazy_extra_fields",opt.ilazyextrafields);
+    AddEntry("Input_swift_cell_read",opt.iswiftcellread);
+    AddEntry("Input_swift_cell_buffer",opt.swiftcellbuffer);
+    AddEntry("Input_region_of_interest",opt.inputregion);
+    AddEntry("Input_snapshot_index",opt.isnapshotindex);
     AddEntry("MPI_particle_total_buf_size",opt.mpiparticletotbufsize);
     AddEntry("Separate_output_files", opt.iseparatefiles);
+    AddEntry("Async_output", opt.iasyncoutput);
+    AddEntry("Async_output_max_queued", opt.asyncoutputmaxqueued);
     AddEntry("Binary_output", opt.ibinaryout);
     AddEntry("Comoving_units", opt.icomoveunit);
     AddEntry("Extended_output", opt.iextendedoutput);
@@ -2566,6 +2749,15 @@ ConfigInfo::ConfigInfo(Options &opt){
 
     //mpi related configuration
     AddEntry("MPI_part_allocation_fac", opt.mpipartfac);
+    AddEntry("MPI_use_zcurve_mesh_decomposition", opt.impiusemesh);
+    AddEntry("MPI_zcurve_mesh_decomposition_min_num_cells_per_dim", opt.minnumcellperdim);
+    AddEntry("MPI_mesh_decomposition_num_cells_per_dim", opt.mpimeshnumcellsperdim);
+    AddEntry("MPI_mesh_decomposition_curve_type", opt.mpimeshcurvetype);
+    AddEntry("MPI_large_group_balance_min_size", opt.mpilargegroupsize);
+    AddEntry("MPI_large_group_distributed_search", opt.impilargegroupsearch);
+    AddEntry("MPI_single_pass_read", opt.impisinglepassread);
+    AddEntry("MPI_single_pass_read_sample_stride", opt.mpisinglepasssamplestride);
+    AddEntry("MPI_num_read_tasks_per_file", opt.mpinumreadtasksperfile);
 #endif
     AddEntry("#Compilation Info");
 #ifdef USEMPI
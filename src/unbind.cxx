@@ -1338,3 +1338,175 @@ void PotentialPP(Options &opt, Int_t nbodies, Particle *Part)
     for (auto j=0;j<nbodies;j++) Part[j].SetPotential(Part[j].GetPotential()*mv2);
     #endif
 }
+
+#ifdef USEMPI
+///\name Unbinding of groups spread over several mpi tasks
+//@{
+/*! Unbinding of candidate groups whose particles are spread over the tasks of comm, where the group ids in pfof run
+    from 1 to numgroups on every task. \n
+    Each iteration calculates the potential of the local particles of a group using the tree potential and adds the
+    contribution of the group's particles held by other tasks, using the leaf cells of those tasks' trees as monopoles.
+    Energies are in the centre-of-mass velocity frame of the whole group, summed over comm. All particles with positive energy
+    are removed at once, as are the least bound particles when the bound fraction is below opt.uinfo.minEfrac, and groups
+    that fall below the minimum size are removed. Iterates till no particles are removed. Returns the number of groups left.
+*/
+Int_t MPIUnbindDistributed(Options &opt, const Int_t nbodies, Particle *Part, Int_t numgroups, Int_t *pfof, MPI_Comm comm)
+{
+    const int ncelldata=5, ngroupdata=6;
+    int commsize, commrank, bsize=opt.uinfo.BucketSize;
+    Int_t nremoved, nremovedtotal, ngroupsleft=numgroups;
+    Double_t eps2=opt.uinfo.eps*opt.uinfo.eps, mv2=opt.MassValue*opt.MassValue;
+    vector<vector<Int_t>> pglist(numgroups+1);
+    vector<Double_t> groupdata(ngroupdata*(numgroups+1)), E(nbodies);
+    vector<Double_t> celldata, allcelldata;
+    vector<int> recvcount, recvoffset;
+    MPI_Comm_size(comm, &commsize);
+    MPI_Comm_rank(comm, &commrank);
+    recvcount.resize(commsize);
+    recvoffset.resize(commsize);
+
+    do {
+        for (auto &x:pglist) x.clear();
+        for (auto i=0;i<nbodies;i++) if (pfof[i]>0) pglist[pfof[i]].push_back(i);
+
+        //number, mass and momentum of each group, summed over comm
+        for (auto &x:groupdata) x=0;
+        for (auto g=1;g<=numgroups;g++) {
+            for (auto &i:pglist[g]) {
+                groupdata[ngroupdata*g]+=1;
+                groupdata[ngroupdata*g+1]+=Part[i].GetMass();
+                for (auto k=0;k<3;k++) groupdata[ngroupdata*g+2+k]+=Part[i].GetMass()*Part[i].GetVelocity(k);
+            }
+        }
+        MPI_Allreduce(MPI_IN_PLACE, groupdata.data(), groupdata.size(), MPI_Real_t, MPI_SUM, comm);
+
+        //potential of the local particles of each group and the leaf cells of the local tree
+        celldata.clear();
+        if (opt.uinfo.icalculatepotential) {
+            for (auto g=1;g<=numgroups;g++) {
+                Int_t ning=pglist[g].size();
+                if (ning==0) continue;
+                Particle *gPart=new Particle[ning];
+                for (auto j=0;j<ning;j++) {
+                    gPart[j]=Particle(Part[pglist[g][j]].GetMass(),
+                        Part[pglist[g][j]].GetPosition(0),Part[pglist[g][j]].GetPosition(1),Part[pglist[g][j]].GetPosition(2),
+                        0.,0.,0.,j);
+                }
+                if (ning<=POTPPCALCNUM) PotentialPP(opt, ning, gPart);
+                else Potential(opt, ning, gPart);
+                for (auto j=0;j<ning;j++) Part[pglist[g][gPart[j].GetID()]].SetPotential(gPart[j].GetPotential());
+                //leaf cells as monopoles for the other tasks
+                KDTree *tree=new KDTree(gPart,ning,bsize,tree->TPHYS,tree->KEPAN,100,0,0,0);
+                Int_t ncell=tree->GetNumNodes();
+                Node **nodelist=new Node*[ncell];
+                ncell=0;
+                GetNodeList(tree->GetRoot(),ncell,nodelist,bsize);
+                ncell++;
+                for (auto c=0;c<ncell;c++) {
+                    if (nodelist[c]->GetCount()>bsize) continue;
+                    Double_t mc=0, xc[3]={0,0,0};
+                    for (auto k=nodelist[c]->GetStart();k<nodelist[c]->GetEnd();k++) {
+                        mc+=gPart[k].GetMass();
+                        for (auto n=0;n<3;n++) xc[n]+=gPart[k].GetMass()*gPart[k].GetPosition(n);
+                    }
+                    celldata.push_back(g);
+                    celldata.push_back(mc);
+                    for (auto n=0;n<3;n++) celldata.push_back(xc[n]/mc);
+                }
+                delete[] nodelist;
+                delete tree;
+                delete[] gPart;
+            }
+            int nlocalcell=celldata.size();
+            MPI_Allgather(&nlocalcell, 1, MPI_INT, recvcount.data(), 1, MPI_INT, comm);
+            recvoffset[0]=0;
+            for (auto j=1;j<commsize;j++) recvoffset[j]=recvoffset[j-1]+recvcount[j-1];
+            allcelldata.resize(recvoffset[commsize-1]+recvcount[commsize-1]);
+            MPI_Allgatherv(celldata.data(), nlocalcell, MPI_Real_t, allcelldata.data(), recvcount.data(), recvoffset.data(), MPI_Real_t, comm);
+            celldata.clear();
+            //group the cells of other tasks by group
+            vector<vector<Int_t>> remotecells(numgroups+1);
+            for (auto j=0;j<commsize;j++) {
+                if (j==commrank) continue;
+                for (auto c=recvoffset[j];c<recvoffset[j]+recvcount[j];c+=ncelldata) remotecells[(Int_t)allcelldata[c]].push_back(c);
+            }
+            for (auto g=1;g<=numgroups;g++) {
+                if (remotecells[g].size()==0) continue;
+#ifdef USEOPENMP
+#pragma omp parallel for default(shared) schedule(static) if (pglist[g].size() > ompunbindnum)
+#endif
+                for (auto j=0;j<pglist[g].size();j++) {
+                    Int_t i=pglist[g][j];
+                    Double_t r2, pot=0;
+                    for (auto &c:remotecells[g]) {
+                        r2=eps2;
+                        for (auto n=0;n<3;n++) r2+=pow(Part[i].GetPosition(n)-allcelldata[c+2+n],2.0);
+                        pot-=allcelldata[c+1]/sqrt(r2);
+                    }
+                    pot*=Part[i].GetMass()*opt.G;
+#ifdef NOMASS
+                    pot*=mv2;
+#endif
+                    Part[i].SetPotential(Part[i].GetPotential()+pot);
+                }
+            }
+            allcelldata.clear();
+        }
+
+        //energies in the frame of the whole group and the number of unbound particles
+        vector<Double_t> boundcount(2*(numgroups+1),0.);
+        for (auto g=1;g<=numgroups;g++) {
+            if (groupdata[ngroupdata*g]==0) continue;
+            Double_t mass, v2, Ti;
+            Coordinate cmvel;
+            for (auto k=0;k<3;k++) cmvel[k]=groupdata[ngroupdata*g+2+k]/groupdata[ngroupdata*g+1];
+            for (auto &i:pglist[g]) {
+                mass=Part[i].GetMass();
+#ifdef NOMASS
+                mass=opt.MassValue;
+#endif
+                v2=0;for (auto k=0;k<3;k++) v2+=pow(Part[i].GetVelocity(k)-cmvel[k],2.0);
+                Ti=0.5*mass*v2;
+#ifdef GASON
+                Ti+=mass*Part[i].GetU();
+#endif
+                E[i]=opt.uinfo.Eratio*Ti+Part[i].GetPotential();
+                boundcount[2*g]+=(Ti+Part[i].GetPotential()<0);
+                boundcount[2*g+1]+=(E[i]>0);
+            }
+        }
+        MPI_Allreduce(MPI_IN_PLACE, boundcount.data(), boundcount.size(), MPI_Real_t, MPI_SUM, comm);
+
+        //remove unbound particles, and the least bound if the bound fraction is too low, and groups that are too small
+        nremoved=0;
+        for (auto g=1;g<=numgroups;g++) {
+            Double_t ning=groupdata[ngroupdata*g];
+            if (ning==0) continue;
+            Double_t Efrac=boundcount[2*g]/ning, nunbound=boundcount[2*g+1];
+            Int_t nEfrac=0;
+            if (opt.uinfo.unbindtype==USYSANDPART && Efrac<opt.uinfo.minEfrac) nEfrac=ceil((opt.uinfo.minEfrac-Efrac)*pglist[g].size());
+            if (nunbound<opt.uinfo.maxallowedunboundfrac*ning && nEfrac==0) nunbound=0;
+            if (nunbound>0 || nEfrac>0) {
+                sort(pglist[g].begin(), pglist[g].end(), [&E](const Int_t &a, const Int_t &b) {return E[a]>E[b];});
+                for (auto j=0;j<pglist[g].size();j++) {
+                    Int_t i=pglist[g][j];
+                    if (!((nunbound>0 && E[i]>0) || j<nEfrac)) break;
+                    pfof[i]=0;
+                    nremoved++;
+                }
+            }
+        }
+        MPI_Allreduce(&nremoved, &nremovedtotal, 1, MPI_Int_t, MPI_SUM, comm);
+
+        //remove groups that are now too small
+        vector<Int_t> ning(numgroups+1,0);
+        for (auto i=0;i<nbodies;i++) if (pfof[i]>0) ning[pfof[i]]++;
+        MPI_Allreduce(MPI_IN_PLACE, ning.data(), numgroups+1, MPI_Int_t, MPI_SUM, comm);
+        ngroupsleft=0;
+        for (auto g=1;g<=numgroups;g++) ngroupsleft+=(ning[g]>=opt.MinSize);
+        for (auto i=0;i<nbodies;i++) if (pfof[i]>0 && ning[pfof[i]]<opt.MinSize) pfof[i]=0;
+    } while (nremovedtotal>0);
+    return ngroupsleft;
+}
+//@}
+#endif